@@ -24,152 +24,330 @@
 #include "collectd.h"
 
 #include "plugin.h"
+#include "utils/avltree/avltree.h"
+#include "utils/cmds/putmetric.h"
 #include "utils/common/common.h"
+#include "utils/strbuf/strbuf.h"
 #include "utils_cache.h"
 
+/*
+ * Private data types
+ */
+/* An open CSV file with the lines which were not written yet. Files are kept
+ * in a list, most recently used first, to close the least recently used file
+ * when MaxOpenFiles is reached. */
+typedef struct csv_file_s csv_file_t;
+struct csv_file_s {
+  char *filename;
+  int fd;
+  /* Identify the file `fd' refers to, to notice when it was rotated or
+   * deleted. */
+  dev_t dev;
+  ino_t ino;
+  char *buffer;
+  size_t buffer_len;
+
+  csv_file_t *prev;
+  csv_file_t *next;
+};
+
 /*
  * Private variables
  */
-static const char *config_keys[] = {"DataDir", "StoreRates"};
+static const char *config_keys[] = {"DataDir", "StoreRates", "MaxOpenFiles",
+                                    "WriteBufferSize", "FlushInterval"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static char *datadir;
 static int store_rates;
 static int use_stdio;
+static int max_open_files = 128;
+static size_t write_buffer_size = 4096;
+static cdtime_t flush_interval = TIME_T_TO_CDTIME_T_STATIC(10);
+
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_avl_tree_t *files;
+static csv_file_t *files_head;
+static csv_file_t *files_tail;
+/* The date is part of the file names, so all files are closed when it
+ * changes. The formatted date is cached for the second it was computed in. */
+static time_t files_time;
+static char files_date[16];
+
+/* Formats the time and value of `m' as a CSV line, without the newline. */
+static int metric_to_string(strbuf_t *buf, metric_t const *m) {
+  strbuf_printf(buf, "%.3f,", CDTIME_T_TO_DOUBLE(m->time));
+
+  if (store_rates && (m->family->type == METRIC_TYPE_COUNTER)) {
+    gauge_t rate = NAN;
+    if (uc_get_rate(m, &rate) != 0) {
+      WARNING("csv plugin: uc_get_rate failed.");
+      return -1;
+    }
+    return value_marshal_text(buf, (value_t){.gauge = rate},
+                              METRIC_TYPE_GAUGE);
+  }
 
-static int value_list_to_string(char *buffer, int buffer_len,
-                                const data_set_t *ds, const value_list_t *vl) {
-  int offset;
-  int status;
-  gauge_t *rates = NULL;
+  return value_marshal_text(buf, m->value, m->family->type);
+} /* int metric_to_string */
 
-  assert(0 == strcmp(ds->type, vl->type));
+/* Builds the file name of `m' from its identity, e.g.
+ * "<DataDir>/cpu_seconds_total{cpu=\"0\",state=\"idle\"}-2013-07-12". */
+static int metric_to_filename(strbuf_t *buf, metric_t const *m,
+                              char const *date) {
+  if (datadir != NULL)
+    strbuf_printf(buf, "%s/", datadir);
+  size_t offset = buf->pos;
 
-  memset(buffer, '\0', buffer_len);
+  int status = metric_identity(buf, m);
+  if (status != 0)
+    return status;
 
-  status = snprintf(buffer, buffer_len, "%.3f", CDTIME_T_TO_DOUBLE(vl->time));
-  if ((status < 1) || (status >= buffer_len))
+  /* Labels may contain slashes. */
+  for (size_t i = offset; i < buf->pos; i++)
+    if (buf->ptr[i] == '/')
+      buf->ptr[i] = '_';
+
+  return strbuf_print(buf, date);
+} /* int metric_to_filename */
+
+static int csv_create_file(const char *filename) {
+  FILE *csv;
+
+  if (check_create_dir(filename))
     return -1;
-  offset = status;
 
-  for (size_t i = 0; i < ds->ds_num; i++) {
-    if ((ds->ds[i].type != DS_TYPE_COUNTER) &&
-        (ds->ds[i].type != DS_TYPE_GAUGE) &&
-        (ds->ds[i].type != DS_TYPE_DERIVE)) {
-      sfree(rates);
-      return -1;
-    }
+  csv = fopen(filename, "w");
+  if (csv == NULL) {
+    ERROR("csv plugin: fopen (%s) failed: %s", filename, STRERRNO);
+    return -1;
+  }
 
-    if (ds->ds[i].type == DS_TYPE_GAUGE) {
-      status = snprintf(buffer + offset, buffer_len - offset, ",%lf",
-                        vl->values[i].gauge);
-    } else if (store_rates != 0) {
-      if (rates == NULL)
-        rates = uc_get_rate_vl(ds, vl);
-      if (rates == NULL) {
-        WARNING("csv plugin: "
-                "uc_get_rate_vl failed.");
-        return -1;
-      }
-      status = snprintf(buffer + offset, buffer_len - offset, ",%lf", rates[i]);
-    } else if (ds->ds[i].type == DS_TYPE_COUNTER) {
-      status = snprintf(buffer + offset, buffer_len - offset, ",%" PRIu64,
-                        (uint64_t)vl->values[i].counter);
-    } else if (ds->ds[i].type == DS_TYPE_DERIVE) {
-      status = snprintf(buffer + offset, buffer_len - offset, ",%" PRIi64,
-                        vl->values[i].derive);
-    }
+  fprintf(csv, "epoch,value\n");
+  fclose(csv);
 
-    if ((status < 1) || (status >= (buffer_len - offset))) {
-      sfree(rates);
-      return -1;
+  return 0;
+} /* int csv_create_file */
+
+/* Writes `data' while holding a lock on the file, so that readers never see
+ * partial lines. Waits for readers holding a lock. */
+static int csv_file_write(csv_file_t *file, char const *data, size_t len) {
+  struct flock fl = {
+      .l_pid = getpid(),
+      .l_type = F_WRLCK,
+      .l_whence = SEEK_SET,
+  };
+
+  while (fcntl(file->fd, F_SETLKW, &fl) != 0) {
+    if (errno == EINTR)
+      continue;
+    ERROR("csv plugin: flock (%s) failed: %s", file->filename, STRERRNO);
+    return -1;
+  }
+
+  int status = 0;
+  while (len > 0) {
+    ssize_t n = write(file->fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("csv plugin: write (%s) failed: %s", file->filename, STRERRNO);
+      status = -1;
+      break;
     }
+    data += n;
+    len -= (size_t)n;
+  }
 
-    offset += status;
-  } /* for ds->ds_num */
+  fl.l_type = F_UNLCK;
+  fcntl(file->fd, F_SETLK, &fl);
 
-  sfree(rates);
-  return 0;
-} /* int value_list_to_string */
+  return status;
+} /* int csv_file_write */
 
-static int value_list_to_filename(char *buffer, size_t buffer_size,
-                                  value_list_t const *vl) {
-  int status;
+static int csv_file_flush(csv_file_t *file) {
+  if (file->buffer_len == 0)
+    return 0;
 
-  char *ptr = buffer;
-  size_t ptr_size = buffer_size;
-  time_t now;
-  struct tm struct_tm;
+  /* Lines which can't be written are dropped, so the buffer doesn't grow
+   * while the file system is full. */
+  int status = csv_file_write(file, file->buffer, file->buffer_len);
+  file->buffer_len = 0;
+  return status;
+} /* int csv_file_flush */
+
+static void csv_file_unlink(csv_file_t *file) {
+  if (file->prev != NULL)
+    file->prev->next = file->next;
+  else
+    files_head = file->next;
+
+  if (file->next != NULL)
+    file->next->prev = file->prev;
+  else
+    files_tail = file->prev;
+
+  file->prev = NULL;
+  file->next = NULL;
+} /* void csv_file_unlink */
+
+static void csv_file_push(csv_file_t *file) {
+  file->next = files_head;
+  if (files_head != NULL)
+    files_head->prev = file;
+  files_head = file;
+  if (files_tail == NULL)
+    files_tail = file;
+} /* void csv_file_push */
+
+static void csv_file_close(csv_file_t *file) {
+  csv_file_flush(file);
+
+  csv_file_unlink(file);
+  c_avl_remove(files, file->filename, NULL, NULL);
+
+  close(file->fd);
+  sfree(file->filename);
+  sfree(file->buffer);
+  sfree(file);
+} /* void csv_file_close */
+
+static void csv_close_all(void) {
+  while (files_head != NULL)
+    csv_file_close(files_head);
+} /* void csv_close_all */
+
+static void csv_flush_all(void) {
+  for (csv_file_t *file = files_head; file != NULL; file = file->next)
+    csv_file_flush(file);
+} /* void csv_flush_all */
+
+/* Returns the open file `filename', which is created if it doesn't exist. A
+ * cached file is opened again if it was rotated or deleted since. */
+static csv_file_t *csv_file_get(char const *filename) {
+  csv_file_t *file = NULL;
+  struct stat statbuf;
 
-  if (datadir != NULL) {
-    size_t len = strlen(datadir) + 1;
+  if (files == NULL) {
+    files = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if (files == NULL) {
+      ERROR("csv plugin: c_avl_create failed.");
+      return NULL;
+    }
+  }
 
-    if (len >= ptr_size)
-      return ENOBUFS;
+  int status = stat(filename, &statbuf);
 
-    memcpy(ptr, datadir, len);
-    ptr[len - 1] = '/';
-    ptr_size -= len;
-    ptr += len;
+  if (c_avl_get(files, filename, (void *)&file) == 0) {
+    if ((status == 0) && (statbuf.st_dev == file->dev) &&
+        (statbuf.st_ino == file->ino)) {
+      csv_file_unlink(file);
+      csv_file_push(file);
+      return file;
+    }
+    /* Buffered lines still go to the old file. */
+    csv_file_close(file);
+    file = NULL;
   }
 
-  status = FORMAT_VL(ptr, ptr_size, vl);
-  if (status != 0)
-    return status;
+  if (status == -1) {
+    if (errno == ENOENT) {
+      if (csv_create_file(filename))
+        return NULL;
+    } else {
+      ERROR("stat(%s) failed: %s", filename, STRERRNO);
+      return NULL;
+    }
+  } else if (!S_ISREG(statbuf.st_mode)) {
+    ERROR("stat(%s): Not a regular file!", filename);
+    return NULL;
+  }
 
-  /* Skip all the time formatting stuff when printing to STDOUT or
-   * STDERR. */
-  if (use_stdio)
-    return 0;
+  while ((files_tail != NULL) && (c_avl_size(files) >= max_open_files))
+    csv_file_close(files_tail);
 
-  ptr_size -= strlen(ptr);
-  ptr += strlen(ptr);
+  file = calloc(1, sizeof(*file));
+  if (file == NULL) {
+    ERROR("csv plugin: calloc failed.");
+    return NULL;
+  }
 
-  /* "-2013-07-12" => 11 bytes */
-  if (ptr_size < 12) {
-    ERROR("csv plugin: Buffer too small.");
-    return ENOMEM;
+  file->fd = open(filename, O_WRONLY | O_APPEND);
+  if ((file->fd < 0) || (fstat(file->fd, &statbuf) != 0)) {
+    ERROR("csv plugin: open (%s) failed: %s", filename, STRERRNO);
+    if (file->fd >= 0)
+      close(file->fd);
+    sfree(file);
+    return NULL;
+  }
+  file->dev = statbuf.st_dev;
+  file->ino = statbuf.st_ino;
+
+  file->filename = strdup(filename);
+  if (write_buffer_size > 0)
+    file->buffer = malloc(write_buffer_size);
+  if ((file->filename == NULL) ||
+      ((write_buffer_size > 0) && (file->buffer == NULL))) {
+    ERROR("csv plugin: strdup or malloc failed.");
+    close(file->fd);
+    sfree(file->filename);
+    sfree(file);
+    return NULL;
   }
 
-  /* TODO: Find a way to minimize the calls to `localtime_r',
-   * since they are pretty expensive.. */
-  now = time(NULL);
-  if (localtime_r(&now, &struct_tm) == NULL) {
-    ERROR("csv plugin: localtime_r failed");
-    return -1;
+  if (c_avl_insert(files, file->filename, file) != 0) {
+    ERROR("csv plugin: c_avl_insert (%s) failed.", filename);
+    close(file->fd);
+    sfree(file->filename);
+    sfree(file->buffer);
+    sfree(file);
+    return NULL;
   }
+  csv_file_push(file);
 
-  status = strftime(ptr, ptr_size, "-%Y-%m-%d", &struct_tm);
-  if (status == 0) /* yep, it returns zero on error. */
-  {
-    ERROR("csv plugin: strftime failed");
-    return -1;
+  return file;
+} /* csv_file_t *csv_file_get */
+
+static int csv_file_append(csv_file_t *file, char const *line, size_t len) {
+  if ((file->buffer_len + len) > write_buffer_size) {
+    int status = csv_file_flush(file);
+    if (status != 0)
+      return status;
   }
 
+  if (len > write_buffer_size)
+    return csv_file_write(file, line, len);
+
+  memcpy(file->buffer + file->buffer_len, line, len);
+  file->buffer_len += len;
   return 0;
-} /* int value_list_to_filename */
+} /* int csv_file_append */
 
-static int csv_create_file(const char *filename, const data_set_t *ds) {
-  FILE *csv;
+static int csv_update_date(void) {
+  time_t now = time(NULL);
+  if (now == files_time)
+    return 0;
 
-  if (check_create_dir(filename))
+  struct tm struct_tm;
+  if (localtime_r(&now, &struct_tm) == NULL) {
+    ERROR("csv plugin: localtime_r failed");
     return -1;
+  }
 
-  csv = fopen(filename, "w");
-  if (csv == NULL) {
-    ERROR("csv plugin: fopen (%s) failed: %s", filename, STRERRNO);
+  char date[sizeof(files_date)];
+  if (strftime(date, sizeof(date), "-%Y-%m-%d", &struct_tm) == 0) {
+    ERROR("csv plugin: strftime failed");
     return -1;
   }
 
-  fprintf(csv, "epoch");
-  for (size_t i = 0; i < ds->ds_num; i++)
-    fprintf(csv, ",%s", ds->ds[i].name);
-
-  fprintf(csv, "\n");
-  fclose(csv);
+  if (strcmp(date, files_date) != 0) {
+    csv_close_all();
+    sstrncpy(files_date, date, sizeof(files_date));
+  }
+  files_time = now;
 
   return 0;
-} /* int csv_create_file */
+} /* int csv_update_date */
 
 static int csv_config(const char *key, const char *value) {
   if (strcasecmp("DataDir", key) == 0) {
@@ -201,93 +379,131 @@ static int csv_config(const char *key, const char *value) {
       store_rates = 1;
     else
       store_rates = 0;
+  } else if (strcasecmp("MaxOpenFiles", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 1) {
+      ERROR("csv plugin: MaxOpenFiles must be at least 1.");
+      return -1;
+    }
+    max_open_files = tmp;
+  } else if (strcasecmp("WriteBufferSize", key) == 0) {
+    int tmp = atoi(value);
+    if (tmp < 0) {
+      ERROR("csv plugin: WriteBufferSize must not be negative.");
+      return -1;
+    }
+    write_buffer_size = (size_t)tmp;
+  } else if (strcasecmp("FlushInterval", key) == 0) {
+    double tmp = atof(value);
+    if (tmp <= 0) {
+      ERROR("csv plugin: FlushInterval must be positive.");
+      return -1;
+    }
+    flush_interval = DOUBLE_TO_CDTIME_T(tmp);
   } else {
     return -1;
   }
   return 0;
 } /* int csv_config */
 
-static int csv_write(const data_set_t *ds, const value_list_t *vl,
-                     user_data_t __attribute__((unused)) * user_data) {
-  struct stat statbuf;
-  char filename[512];
-  char values[4096];
-  FILE *csv;
-  int csv_fd;
-  struct flock fl = {0};
-  int status;
+static int csv_write_metric(metric_t const *m, strbuf_t *filename,
+                            strbuf_t *line) {
+  if (use_stdio) {
+    int status = cmd_format_putmetric(line, m);
+    if (status != 0)
+      return status;
 
-  if (0 != strcmp(ds->type, vl->type)) {
-    ERROR("csv plugin: DS type does not match value list type");
-    return -1;
+    fprintf(use_stdio == 1 ? stdout : stderr, "%s\n", line->ptr);
+    return 0;
   }
 
-  status = value_list_to_filename(filename, sizeof(filename), vl);
-  if (status != 0)
+  if (metric_to_string(line, m) != 0)
     return -1;
+  strbuf_print(line, "\n");
 
-  DEBUG("csv plugin: csv_write: filename = %s;", filename);
+  int status = metric_to_filename(filename, m, files_date);
+  if (status != 0)
+    return status;
 
-  if (value_list_to_string(values, sizeof(values), ds, vl) != 0)
+  DEBUG("csv plugin: csv_write: filename = %s;", filename->ptr);
+
+  csv_file_t *file = csv_file_get(filename->ptr);
+  if (file == NULL)
     return -1;
 
-  if (use_stdio) {
-    escape_string(filename, sizeof(filename));
-
-    /* Replace commas by colons for PUTVAL compatible output. */
-    for (size_t i = 0; i < sizeof(values); i++) {
-      if (values[i] == 0)
-        break;
-      else if (values[i] == ',')
-        values[i] = ':';
-    }
+  return csv_file_append(file, line->ptr, line->pos);
+} /* int csv_write_metric */
 
-    fprintf(use_stdio == 1 ? stdout : stderr, "PUTVAL %s interval=%.3f %s\n",
-            filename, CDTIME_T_TO_DOUBLE(vl->interval), values);
+static int csv_write(metric_family_t const *fam,
+                     user_data_t __attribute__((unused)) * user_data) {
+  /* Distributions have no single value to write into a column. */
+  if (fam->type == METRIC_TYPE_DISTRIBUTION)
     return 0;
-  }
 
-  if (stat(filename, &statbuf) == -1) {
-    if (errno == ENOENT) {
-      if (csv_create_file(filename, ds))
-        return -1;
-    } else {
-      ERROR("stat(%s) failed: %s", filename, STRERRNO);
-      return -1;
-    }
-  } else if (!S_ISREG(statbuf.st_mode)) {
-    ERROR("stat(%s): Not a regular file!", filename);
-    return -1;
-  }
+  strbuf_t filename = STRBUF_CREATE;
+  strbuf_t line = STRBUF_CREATE;
+  int ret = 0;
 
-  csv = fopen(filename, "a");
-  if (csv == NULL) {
-    ERROR("csv plugin: fopen (%s) failed: %s", filename, STRERRNO);
-    return -1;
-  }
-  csv_fd = fileno(csv);
+  pthread_mutex_lock(&files_lock);
 
-  fl.l_pid = getpid();
-  fl.l_type = F_WRLCK;
-  fl.l_whence = SEEK_SET;
+  if (!use_stdio && (csv_update_date() != 0))
+    ret = -1;
 
-  status = fcntl(csv_fd, F_SETLK, &fl);
-  if (status != 0) {
-    ERROR("csv plugin: flock (%s) failed: %s", filename, STRERRNO);
-    fclose(csv);
-    return -1;
+  for (size_t i = 0; (ret == 0) && (i < fam->metric.num); i++) {
+    strbuf_reset(&filename);
+    strbuf_reset(&line);
+    if (csv_write_metric(fam->metric.ptr + i, &filename, &line) != 0)
+      ret = -1;
   }
 
-  fprintf(csv, "%s\n", values);
+  pthread_mutex_unlock(&files_lock);
 
-  /* The lock is implicitely released. I we don't release it explicitely
-   * because the `FILE *' may need to flush a cache first */
-  fclose(csv);
+  STRBUF_DESTROY(filename);
+  STRBUF_DESTROY(line);
+  return ret;
+} /* int csv_write */
+
+static int csv_flush(cdtime_t __attribute__((unused)) timeout,
+                     const char __attribute__((unused)) * identifier,
+                     user_data_t __attribute__((unused)) * user_data) {
+  pthread_mutex_lock(&files_lock);
+  csv_flush_all();
+  pthread_mutex_unlock(&files_lock);
 
   return 0;
-} /* int csv_write */
+} /* int csv_flush */
+
+/* Lines of files which aren't written to often enough to fill their buffer
+ * are flushed every FlushInterval. */
+static int csv_flush_read(user_data_t __attribute__((unused)) * user_data) {
+  return csv_flush(/* timeout = */ 0, /* identifier = */ NULL, NULL);
+} /* int csv_flush_read */
+
+static int csv_init(void) {
+  if (use_stdio || (write_buffer_size == 0))
+    return 0;
+
+  return plugin_register_complex_read(/* group = */ NULL, "csv",
+                                      csv_flush_read, flush_interval,
+                                      /* user_data = */ NULL);
+} /* int csv_init */
+
+static int csv_shutdown(void) {
+  pthread_mutex_lock(&files_lock);
+  csv_close_all();
+  c_avl_destroy(files);
+  files = NULL;
+  pthread_mutex_unlock(&files_lock);
+
+  sfree(datadir);
+
+  return 0;
+} /* int csv_shutdown */
 
 void module_register(void) {
   plugin_register_config("csv", csv_config, config_keys, config_keys_num);
+  plugin_register_init("csv", csv_init);
   plugin_register_write("csv", csv_write, /* user_data = */ NULL);
+  plugin_register_flush("csv", csv_flush, /* user_data = */ NULL);
+  plugin_register_shutdown("csv", csv_shutdown);
 } /* void module_register */
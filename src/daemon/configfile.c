@@ -110,6 +110,10 @@ static cf_global_option_t cf_global_options[] = {
     {"WriteThreads", NULL, 0, "5"},
     {"WriteQueueLimitHigh", NULL, 0, NULL},
     {"WriteQueueLimitLow", NULL, 0, NULL},
+    {"WriteSpoolDir", NULL, 0, NULL},
+    {"WriteSpoolMaxSize", NULL, 0, "128"},
+    {"WriteSpoolReplayRate", NULL, 0, "1000"},
+    {"WriteSpoolMaxAttempts", NULL, 0, "10"},
     {"Timeout", NULL, 0, "2"},
     {"AutoLoadPlugin", NULL, 0, "false"},
     {"CollectInternalStats", NULL, 0, "false"},
@@ -220,6 +220,29 @@ distribution_t *distribution_new_custom(size_t array_size,
   return build_distribution_from_bucket_array(num_buckets, bucket_array);
 }
 
+distribution_t *distribution_new_buckets(buckets_array_t buckets,
+                                         double total_sum, double squares_sum) {
+  if (buckets.num_buckets == 0 || buckets.buckets == NULL ||
+      buckets.buckets[buckets.num_buckets - 1].maximum != INFINITY) {
+    errno = EINVAL;
+    return NULL;
+  }
+  for (size_t i = 1; i < buckets.num_buckets; i++) {
+    if (!(buckets.buckets[i].maximum > buckets.buckets[i - 1].maximum)) {
+      errno = EINVAL;
+      return NULL;
+    }
+  }
+
+  distribution_t *new_distribution = build_distribution_from_bucket_array(
+      buckets.num_buckets, buckets.buckets);
+  if (new_distribution == NULL)
+    return NULL;
+  new_distribution->total_sum = total_sum;
+  new_distribution->total_square_sum = squares_sum;
+  return new_distribution;
+}
+
 void distribution_destroy(distribution_t *d) {
   if (d == NULL)
     return;
@@ -506,3 +529,30 @@ int distribution_sub(distribution_t *d1, distribution_t *d2) {
   distribution_unlock(d1, d2);
   return 0;
 }
+
+/* distribution_add adds all values in d2 to d1. Both distributions must have
+ * the same bucket boundaries. */
+int distribution_add(distribution_t *d1, distribution_t *d2) {
+  if (distribution_lock(d1, d2) != 0)
+    return EINVAL;
+
+  if (d1->num_buckets != d2->num_buckets) {
+    distribution_unlock(d1, d2);
+    return EINVAL;
+  }
+  for (size_t i = 0; i < tree_size(d1->num_buckets); i++) {
+    if (d1->tree[i].maximum != d2->tree[i].maximum) {
+      distribution_unlock(d1, d2);
+      return EINVAL;
+    }
+  }
+
+  d1->total_sum += d2->total_sum;
+  d1->total_square_sum += d2->total_square_sum;
+  for (size_t i = 0; i < tree_size(d1->num_buckets); i++) {
+    d1->tree[i].bucket_counter += d2->tree[i].bucket_counter;
+  }
+
+  distribution_unlock(d1, d2);
+  return 0;
+}
@@ -81,6 +81,18 @@ distribution_t *distribution_new_exponential(size_t num_buckets, double base,
 distribution_t *distribution_new_custom(size_t array_size,
                                         double *custom_buckets_boundaries);
 
+/**
+ * function creates a distribution from the buckets returned by get_buckets()
+ * and the sums of the values and their squares, e.g. to restore a serialized
+ * distribution
+ * @param buckets - buckets with increasing maxima, the last one must be
+ * infinity
+ * @return - pointer to a new distribution or null pointer if parameters are
+ * wrong or memory allocation fails
+ */
+distribution_t *distribution_new_buckets(buckets_array_t buckets,
+                                         double total_sum, double squares_sum);
+
 /** add new value to a distribution **/
 int distribution_update(distribution_t *dist, double gauge);
 
@@ -140,6 +152,13 @@ int distribution_reset(distribution_t *dist);
  * function with the same order of arguments everytime **/
 int distribution_sub(distribution_t *d1, distribution_t *d2);
 
+/** This function adds all values of d2 to d1. If arguments are NULL pointers
+ * or the distributions have a different structure EINVAL is returned, in case
+ * of success returns 0.
+ *  This function holds both mutexes for d1 and d2. Be sure that you call the
+ * function with the same order of arguments everytime **/
+int distribution_add(distribution_t *d1, distribution_t *d2);
+
 #define DISTRIBUTION_DEFAULT_TIME distribution_new_custom(7, (double[]){0.05, 0.1, 0.2, 0.5, 1, 10, 100})
 
 #endif // COLLECTD_DISTRIBUTION_H
@@ -480,6 +480,43 @@ DEF_TEST(clone) {
   return 0;
 }
 
+DEF_TEST(new_buckets) {
+  distribution_t *dist = distribution_new_exponential(6, 2, 1);
+  distribution_update(dist, 0.5);
+  distribution_update(dist, 3);
+  distribution_update(dist, 3.5);
+  distribution_update(dist, 100);
+
+  buckets_array_t buckets = get_buckets(dist);
+  distribution_t *copy =
+      distribution_new_buckets(buckets, distribution_total_sum(dist),
+                               distribution_squares_sum(dist));
+  CHECK_NOT_NULL(copy);
+  buckets_array_t got = get_buckets(copy);
+  EXPECT_EQ_INT(buckets.num_buckets, got.num_buckets);
+  for (size_t i = 0; i < got.num_buckets; i++) {
+    EXPECT_EQ_UINT64(buckets.buckets[i].bucket_counter,
+                     got.buckets[i].bucket_counter);
+    EXPECT_EQ_DOUBLE(buckets.buckets[i].maximum, got.buckets[i].maximum);
+  }
+  destroy_buckets_array(got);
+  EXPECT_EQ_INT(distribution_total_counter(copy), 4);
+  EXPECT_EQ_DOUBLE(distribution_total_sum(copy), 107);
+  EXPECT_EQ_DOUBLE(distribution_stddev(copy), distribution_stddev(dist));
+
+  /* The maxima must be increasing and end with infinity. */
+  buckets.buckets[buckets.num_buckets - 1].maximum = 1000;
+  EXPECT_EQ_PTR(NULL, distribution_new_buckets(buckets, 0, 0));
+  buckets.buckets[buckets.num_buckets - 1].maximum = INFINITY;
+  buckets.buckets[1].maximum = buckets.buckets[0].maximum;
+  EXPECT_EQ_PTR(NULL, distribution_new_buckets(buckets, 0, 0));
+
+  destroy_buckets_array(buckets);
+  distribution_destroy(copy);
+  distribution_destroy(dist);
+  return 0;
+}
+
 DEF_TEST(getters) {
   struct {
     distribution_t *dist;
@@ -544,6 +581,27 @@ DEF_TEST(getters) {
   }
   return 0;
 }
+
+DEF_TEST(add) {
+  distribution_t *d1 = distribution_new_linear(5, 10);
+  distribution_t *d2 = distribution_new_linear(5, 10);
+  distribution_t *d3 = distribution_new_linear(4, 10);
+  distribution_update(d1, 5);
+  distribution_update(d2, 15);
+  distribution_update(d2, 100);
+  EXPECT_EQ_INT(distribution_add(d1, d2), 0);
+  EXPECT_EQ_INT(distribution_total_counter(d1), 3);
+  EXPECT_EQ_DOUBLE(distribution_total_sum(d1), 120);
+  EXPECT_EQ_DOUBLE(distribution_percentile(d1, 60), 20);
+  EXPECT_EQ_INT(distribution_total_counter(d2), 2);
+  EXPECT_EQ_INT(distribution_add(d1, d3), EINVAL);
+  EXPECT_EQ_INT(distribution_add(d1, NULL), EINVAL);
+  distribution_destroy(d1);
+  distribution_destroy(d2);
+  distribution_destroy(d3);
+  return 0;
+}
+
 int main() {
   RUN_TEST(distribution_new_linear);
   RUN_TEST(distribution_new_exponential);
@@ -552,6 +610,8 @@ int main() {
   RUN_TEST(average);
   RUN_TEST(percentile);
   RUN_TEST(clone);
+  RUN_TEST(new_buckets);
   RUN_TEST(getters);
+  RUN_TEST(add);
   END_TEST;
 }
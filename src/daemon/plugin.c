@@ -42,6 +42,7 @@
 #include "utils_llist.h"
 #include "utils_random.h"
 #include "utils_time.h"
+#include "write_spool.h"
 
 #include <time.h>
 
@@ -96,6 +97,14 @@ struct write_queue_s {
   write_queue_t *next;
 };
 
+struct write_spool_entry_s {
+  write_spool_t *spool;
+  /* Used by the spool thread only. */
+  cdtime_t retry_time;
+  cdtime_t retry_interval;
+};
+typedef struct write_spool_entry_s write_spool_entry_t;
+
 struct flush_callback_s {
   char *name;
   cdtime_t timeout;
@@ -111,6 +120,7 @@ static llist_t *list_init;
 static llist_t *list_write;
 static llist_t *list_flush;
 static llist_t *list_missing;
+static llist_t *list_query;
 static llist_t *list_shutdown;
 static llist_t *list_log;
 static llist_t *list_notification;
@@ -146,6 +156,16 @@ static pthread_cond_t write_cond = PTHREAD_COND_INITIALIZER;
 static pthread_t *write_threads;
 static size_t write_threads_num;
 
+#define WRITE_SPOOL_MAX_RETRY_INTERVAL TIME_T_TO_CDTIME_T_STATIC(64)
+static c_avl_tree_t *write_spools;
+static uint64_t write_spool_replay_rate;
+static unsigned int write_spool_max_attempts;
+static bool write_spool_loop = true;
+static pthread_mutex_t write_spool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t write_spool_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t write_spool_thread;
+static bool write_spool_thread_running;
+
 static pthread_key_t plugin_ctx_key;
 static bool plugin_ctx_key_initialized;
 
@@ -176,6 +196,9 @@ static int plugin_update_internal_statistics(void)
     FAM_NCOLLECTD_WRITE_QUEUE_LENGTH,
     FAM_NCOLLECTD_WRITE_QUEUE_DROPPED,
     FAM_NCOLLECTD_CACHE_SIZE,
+    FAM_NCOLLECTD_WRITE_SPOOL_BYTES,
+    FAM_NCOLLECTD_WRITE_SPOOL_FAMILIES,
+    FAM_NCOLLECTD_WRITE_SPOOL_DROPPED,
     FAM_NCOLLECTD_MAX,
   };
   metric_family_t fams[FAM_NCOLLECTD_MAX] = {
@@ -195,6 +218,18 @@ static int plugin_update_internal_statistics(void)
       .name = "ncollectd_cache_size",
       .type = METRIC_TYPE_GAUGE,
     },
+    [FAM_NCOLLECTD_WRITE_SPOOL_BYTES] = {
+      .name = "ncollectd_write_spool_bytes",
+      .type = METRIC_TYPE_GAUGE,
+    },
+    [FAM_NCOLLECTD_WRITE_SPOOL_FAMILIES] = {
+      .name = "ncollectd_write_spool_families",
+      .type = METRIC_TYPE_GAUGE,
+    },
+    [FAM_NCOLLECTD_WRITE_SPOOL_DROPPED] = {
+      .name = "ncollectd_write_spool_dropped",
+      .type = METRIC_TYPE_COUNTER,
+    },
   };
   static time_t ncollectd_uptime = 0;
 
@@ -215,7 +250,27 @@ static int plugin_update_internal_statistics(void)
   m.value.gauge = (gauge_t)uc_get_size();
   metric_family_metric_append(&fams[FAM_NCOLLECTD_CACHE_SIZE], m);
 
+  if (write_spools != NULL) {
+    c_avl_iterator_t *iter = c_avl_get_iterator(write_spools);
+    char *name;
+    write_spool_entry_t *e;
+    while (c_avl_iterator_next(iter, (void *)&name, (void *)&e) == 0) {
+      write_spool_stats_t stats = write_spool_stats(e->spool);
+      metric_family_append(&fams[FAM_NCOLLECTD_WRITE_SPOOL_BYTES], "plugin",
+                           name, (value_t){.gauge = (gauge_t)stats.bytes},
+                           NULL);
+      metric_family_append(&fams[FAM_NCOLLECTD_WRITE_SPOOL_FAMILIES], "plugin",
+                           name, (value_t){.gauge = (gauge_t)stats.families},
+                           NULL);
+      metric_family_append(&fams[FAM_NCOLLECTD_WRITE_SPOOL_DROPPED], "plugin",
+                           name, (value_t){.counter = stats.dropped}, NULL);
+    }
+    c_avl_iterator_destroy(iter);
+  }
+
   for (size_t i = 0; i < FAM_NCOLLECTD_MAX ; i++) {
+    if (fams[i].metric.num == 0)
+      continue;
     int status = plugin_dispatch_metric_family(&fams[i]);
     if (status != 0) {
       ERROR("info plugin: plugin_dispatch_metric_family failed: %s", STRERROR(status));
@@ -937,6 +992,221 @@ static void stop_write_threads(void)
   }
 }
 
+static write_spool_entry_t *plugin_write_spool_get(char const *name)
+{
+  write_spool_entry_t *e = NULL;
+
+  if (write_spools != NULL)
+    c_avl_get(write_spools, name, (void *)&e);
+
+  return e;
+}
+
+static int plugin_write_spool_write(metric_family_t const *fam, void *arg)
+{
+  callback_func_t *cf = arg;
+
+  if (!write_spool_loop)
+    return ECANCELED;
+
+  plugin_write_cb callback = (void *)cf->cf_callback;
+  return (*callback)(fam, &cf->cf_udata);
+}
+
+/* plugin_write_spool_replay passes the families in the write spool to the
+ * write callback of plugin "name", until the spool is empty, "max" families
+ * (if non-zero) were written or the callback fails. Families the callback
+ * rejects or fails to write `write_spool_max_attempts' times are dropped, see
+ * write_spool_replay. */
+static int plugin_write_spool_replay(char const *name, write_spool_entry_t *e,
+                                     uint64_t max)
+{
+  llentry_t *le = llist_search(list_write, name);
+  if (le == NULL)
+    return ENOENT;
+
+  callback_func_t *cf = le->value;
+  plugin_ctx_t old_ctx = plugin_set_ctx(cf->cf_ctx);
+  int status = write_spool_replay(e->spool, max, write_spool_max_attempts,
+                                  plugin_write_spool_write, cf);
+  plugin_set_ctx(old_ctx);
+
+  return status;
+}
+
+/* plugin_write_spool_thread replays the write spools at most
+ * `write_spool_replay_rate' families per second and spool. If a plugin fails,
+ * the next attempt is delayed with exponential backoff. */
+static void *plugin_write_spool_thread(void __attribute__((unused)) * args)
+{
+  pthread_mutex_lock(&write_spool_lock);
+  while (write_spool_loop) {
+    pthread_mutex_unlock(&write_spool_lock);
+
+    cdtime_t now = cdtime();
+    c_avl_iterator_t *iter = c_avl_get_iterator(write_spools);
+    char *name;
+    write_spool_entry_t *e;
+    while (c_avl_iterator_next(iter, (void *)&name, (void *)&e) == 0) {
+      if ((now < e->retry_time) || write_spool_empty(e->spool))
+        continue;
+
+      int status = plugin_write_spool_replay(name, e, write_spool_replay_rate);
+      if (status == 0) {
+        e->retry_interval = 0;
+        continue;
+      }
+
+      if (e->retry_interval == 0)
+        e->retry_interval = TIME_T_TO_CDTIME_T(1);
+      else if (e->retry_interval < WRITE_SPOOL_MAX_RETRY_INTERVAL)
+        e->retry_interval *= 2;
+      e->retry_time = now + e->retry_interval;
+      DEBUG("plugin: Replaying the write spool of %s failed, retrying in "
+            "%.0f s.",
+            name, CDTIME_T_TO_DOUBLE(e->retry_interval));
+    }
+    c_avl_iterator_destroy(iter);
+
+    pthread_mutex_lock(&write_spool_lock);
+    if (write_spool_loop) {
+      struct timespec ts =
+          CDTIME_T_TO_TIMESPEC(cdtime() + TIME_T_TO_CDTIME_T(1));
+      pthread_cond_timedwait(&write_spool_cond, &write_spool_lock, &ts);
+    }
+  }
+  pthread_mutex_unlock(&write_spool_lock);
+
+  pthread_exit(NULL);
+  return (void *)0;
+}
+
+/* start_write_spools opens a write spool for every write plugin if
+ * WriteSpoolDir is set. Families left by a previous run are replayed. */
+static void start_write_spools(void)
+{
+  char const *dir = global_option_get("WriteSpoolDir");
+  if ((dir == NULL) || (list_write == NULL) || (write_spools != NULL))
+    return;
+
+  long max_size = global_option_get_long("WriteSpoolMaxSize",
+                                         /* default = */ 128);
+  if (max_size < 1) {
+    ERROR("WriteSpoolMaxSize must be positive.");
+    max_size = 128;
+  }
+
+  long replay_rate = global_option_get_long("WriteSpoolReplayRate",
+                                            /* default = */ 1000);
+  if (replay_rate < 0) {
+    ERROR("WriteSpoolReplayRate must be positive or zero.");
+    replay_rate = 1000;
+  }
+  write_spool_replay_rate = (uint64_t)replay_rate;
+
+  long max_attempts = global_option_get_long("WriteSpoolMaxAttempts",
+                                             /* default = */ 10);
+  if ((max_attempts < 0) || (max_attempts > UINT_MAX)) {
+    ERROR("WriteSpoolMaxAttempts must be positive or zero.");
+    max_attempts = 10;
+  }
+  write_spool_max_attempts = (unsigned int)max_attempts;
+
+  write_spools = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (write_spools == NULL) {
+    ERROR("plugin: start_write_spools: c_avl_create failed.");
+    return;
+  }
+
+  uint64_t max_bytes = (uint64_t)max_size * 1024 * 1024;
+  for (llentry_t *le = llist_head(list_write); le != NULL; le = le->next) {
+    char path[PATH_MAX];
+    ssnprintf(path, sizeof(path), "%s/%s", dir, le->key);
+
+    write_spool_entry_t *e = calloc(1, sizeof(*e));
+    char *key = strdup(le->key);
+    if ((e == NULL) || (key == NULL)) {
+      ERROR("plugin: start_write_spools: calloc failed.");
+      sfree(e);
+      sfree(key);
+      continue;
+    }
+
+    e->spool = write_spool_open(path, max_bytes, max_bytes / 16);
+    if (e->spool == NULL) {
+      ERROR("plugin: Opening the write spool of %s in %s failed.", le->key,
+            path);
+      sfree(e);
+      sfree(key);
+      continue;
+    }
+
+    c_avl_insert(write_spools, key, e);
+  }
+
+  write_spool_loop = true;
+  int status = pthread_create(&write_spool_thread, /* attr = */ NULL,
+                              plugin_write_spool_thread, /* arg = */ NULL);
+  if (status != 0) {
+    ERROR("plugin: start_write_spools: pthread_create failed with status %i "
+          "(%s).",
+          status, STRERROR(status));
+    return;
+  }
+  set_thread_name(write_spool_thread, "writer#spool");
+  write_spool_thread_running = true;
+}
+
+/* stop_write_spools stops the replay and closes the write spools. Families
+ * not written yet stay on disk. */
+static void stop_write_spools(void)
+{
+  if (write_spools == NULL)
+    return;
+
+  if (write_spool_thread_running) {
+    pthread_mutex_lock(&write_spool_lock);
+    write_spool_loop = false;
+    pthread_cond_broadcast(&write_spool_cond);
+    pthread_mutex_unlock(&write_spool_lock);
+
+    if (pthread_join(write_spool_thread, NULL) != 0)
+      ERROR("plugin: stop_write_spools: pthread_join failed.");
+    write_spool_thread_running = false;
+  }
+
+  char *name;
+  write_spool_entry_t *e;
+  while (c_avl_pick(write_spools, (void *)&name, (void *)&e) == 0) {
+    write_spool_close(e->spool);
+    sfree(e);
+    sfree(name);
+  }
+  c_avl_destroy(write_spools);
+  write_spools = NULL;
+}
+
+/* plugin_write_family passes "fam" to the write callback "cf" of plugin
+ * "name". If the plugin has a write spool, "fam" is appended to the spool
+ * instead while the spool is not empty, so that families are written in
+ * order, or when the callback fails. Families the callback rejects (see
+ * write_spool_rejected) are not spooled. */
+static int plugin_write_family(char const *name, callback_func_t *cf,
+                               metric_family_t const *fam)
+{
+  write_spool_entry_t *e = plugin_write_spool_get(name);
+  if ((e != NULL) && !write_spool_empty(e->spool))
+    return write_spool_append(e->spool, fam);
+
+  plugin_write_cb callback = (void *)cf->cf_callback;
+  int status = (*callback)(fam, &cf->cf_udata);
+  if ((status == 0) || (e == NULL) || write_spool_rejected(status))
+    return status;
+
+  DEBUG("plugin: Writing via %s failed, spooling %s.", name, fam->name);
+  return write_spool_append(e->spool, fam);
+}
+
 /*
  * Public functions
  */
@@ -1369,6 +1639,12 @@ int plugin_register_missing(const char *name, plugin_missing_cb callback,
   return create_register_callback(&list_missing, name, (void *)callback, ud);
 }
 
+int plugin_register_query(const char *name, plugin_query_cb callback,
+                          user_data_t const *ud)
+{
+  return create_register_callback(&list_query, name, (void *)callback, ud);
+}
+
 int plugin_register_cache_event(const char *name,
                                        plugin_cache_event_cb callback,
                                        user_data_t const *ud)
@@ -1638,6 +1914,11 @@ int plugin_unregister_missing(const char *name)
   return plugin_unregister(list_missing, name);
 }
 
+int plugin_unregister_query(const char *name)
+{
+  return plugin_unregister(list_query, name);
+}
+
 int plugin_unregister_cache_event(const char *name)
 {
   for (size_t i = 0; i < list_cache_event_num; i++) {
@@ -1774,6 +2055,7 @@ int plugin_init_all(void)
     le = le->next;
   }
 
+  start_write_spools();
   start_write_threads((size_t)write_threads_num);
 
   max_read_interval =
@@ -1870,8 +2152,7 @@ int plugin_write(const char *plugin, metric_family_t const *fam)
       plugin_set_ctx(ctx);
 
       DEBUG("plugin: plugin_write: Writing values via %s.", le->key);
-      plugin_write_cb callback = (void *)cf->cf_callback;
-      status = (*callback)(fam, &cf->cf_udata);
+      status = plugin_write_family(le->key, cf, fam);
       if (status != 0)
         failure++;
       else
@@ -1904,8 +2185,7 @@ int plugin_write(const char *plugin, metric_family_t const *fam)
      * information of the calling read plugin */
 
     DEBUG("plugin: plugin_write: Writing values via %s.", le->key);
-    plugin_write_cb callback = (void *)cf->cf_callback;
-    status = (*callback)(fam, &cf->cf_udata);
+    status = plugin_write_family(le->key, cf, fam);
   }
 
   return status;
@@ -1939,6 +2219,35 @@ int plugin_flush(const char *plugin, cdtime_t timeout,
   return 0;
 }
 
+int plugin_query(const char *plugin, metric_t const *m, cdtime_t start,
+                 cdtime_t end, plugin_query_emit_cb emit, void *arg)
+{
+  if ((m == NULL) || (emit == NULL))
+    return EINVAL;
+
+  if (list_query == NULL)
+    return ENOENT;
+
+  for (llentry_t *le = llist_head(list_query); le != NULL; le = le->next) {
+    if ((plugin != NULL) && (strcmp(plugin, le->key) != 0))
+      continue;
+
+    callback_func_t *cf = le->value;
+    plugin_ctx_t old_ctx = plugin_set_ctx(cf->cf_ctx);
+    plugin_query_cb callback = (void *)cf->cf_callback;
+
+    int status = (*callback)(m, start, end, emit, arg, &cf->cf_udata);
+
+    plugin_set_ctx(old_ctx);
+
+    /* The first plugin that knows the series answers the query. */
+    if (status != ENOENT)
+      return status;
+  }
+
+  return ENOENT;
+}
+
 int plugin_shutdown_all(void)
 {
   llentry_t *le;
@@ -1957,6 +2266,7 @@ int plugin_shutdown_all(void)
 
   /* blocks until all write threads have shut down. */
   stop_write_threads();
+  stop_write_spools();
 
   /* ask all plugins to write out the state they kept. */
   plugin_flush(/* plugin = */ NULL,
@@ -1991,6 +2301,7 @@ int plugin_shutdown_all(void)
    * the data isn't freed twice. */
   destroy_all_callbacks(&list_flush);
   destroy_all_callbacks(&list_missing);
+  destroy_all_callbacks(&list_query);
   destroy_cache_event_callbacks();
   destroy_all_callbacks(&list_write);
 
@@ -144,6 +144,13 @@ typedef int (*plugin_read_cb)(user_data_t *);
 typedef int (*plugin_write_cb)(metric_family_t const *, user_data_t *);
 typedef int (*plugin_flush_cb)(cdtime_t timeout, const char *identifier,
                                user_data_t *);
+/* "query" callback. Passes the stored samples of the series identified by
+ * "m" within [start, end] to "emit", in chronological order. Returns ENOENT
+ * if the series is unknown. */
+typedef int (*plugin_query_emit_cb)(cdtime_t time, double value, void *arg);
+typedef int (*plugin_query_cb)(metric_t const *m, cdtime_t start, cdtime_t end,
+                               plugin_query_emit_cb emit, void *arg,
+                               user_data_t *);
 /* "missing" callback. Returns less than zero on failure, zero if other
  * callbacks should be called, greater than zero if no more callbacks should be
  * called. */
@@ -230,6 +237,26 @@ int plugin_write(const char *plugin, metric_family_t const *fam);
 
 int plugin_flush(const char *plugin, cdtime_t timeout, const char *identifier);
 
+/*
+ * NAME
+ *  plugin_query
+ *
+ * DESCRIPTION
+ *  Reads the samples of a series between "start" and "end" from a plugin
+ *  storing them, e.g. for the GETRANGE command.
+ *
+ * ARGUMENTS
+ *  `plugin'     Name of the plugin to query. If NULL, the first plugin that
+ *               knows the series is used.
+ *  `m'          Identity (name and labels) of the series.
+ *  `emit'       Called for every sample.
+ *
+ * RETURN VALUE
+ *  Zero on success, ENOENT if no plugin knows the series.
+ */
+int plugin_query(const char *plugin, metric_t const *m, cdtime_t start,
+                 cdtime_t end, plugin_query_emit_cb emit, void *arg);
+
 /*
  * The `plugin_register_*' functions are used to make `config', `init',
  * `read', `write' and `shutdown' functions known to the plugin
@@ -253,6 +280,8 @@ int plugin_register_flush(const char *name, plugin_flush_cb callback,
                           user_data_t const *user_data);
 int plugin_register_missing(const char *name, plugin_missing_cb callback,
                             user_data_t const *user_data);
+int plugin_register_query(const char *name, plugin_query_cb callback,
+                          user_data_t const *user_data);
 int plugin_register_cache_event(const char *name,
                                 plugin_cache_event_cb callback,
                                 user_data_t const *ud);
@@ -272,6 +301,7 @@ int plugin_unregister_read_group(const char *group);
 int plugin_unregister_write(const char *name);
 int plugin_unregister_flush(const char *name);
 int plugin_unregister_missing(const char *name);
+int plugin_unregister_query(const char *name);
 int plugin_unregister_cache_event(const char *name);
 int plugin_unregister_shutdown(const char *name);
 int plugin_unregister_data_set(const char *name);
@@ -81,6 +81,12 @@ int plugin_register_missing(const char *name, plugin_missing_cb callback,
   return ENOTSUP;
 }
 
+int plugin_register_query(__attribute__((unused)) const char *name,
+                          __attribute__((unused)) plugin_query_cb callback,
+                          __attribute__((unused)) user_data_t const *ud) {
+  return ENOTSUP;
+}
+
 int plugin_register_complex_read(const char *group, const char *name,
                                  int (*callback)(user_data_t *),
                                  cdtime_t interval,
@@ -188,6 +194,15 @@ int plugin_flush(const char *plugin, cdtime_t timeout, const char *identifier) {
   return ENOTSUP;
 }
 
+int plugin_query(__attribute__((unused)) const char *plugin,
+                 __attribute__((unused)) metric_t const *m,
+                 __attribute__((unused)) cdtime_t start,
+                 __attribute__((unused)) cdtime_t end,
+                 __attribute__((unused)) plugin_query_emit_cb emit,
+                 __attribute__((unused)) void *arg) {
+  return ENOENT;
+}
+
 static data_source_t magic_ds[] = {{"value", DS_TYPE_DERIVE, 0.0, NAN}};
 static data_set_t magic = {"MAGIC", 1, magic_ds};
 const data_set_t *plugin_get_ds(const char *name) {
@@ -79,6 +79,11 @@ typedef struct cache_entry_s {
   meta_data_t *meta;
 
   unsigned long callbacks_mask;
+
+  /* Set when the entry expired while an open cursor could still return it.
+   * The missing callbacks have been called already; the entry is removed by a
+   * later uc_check_timeout() unless it is updated in the meantime. */
+  bool expired;
 } cache_entry_t;
 
 struct uc_iter_s {
@@ -88,8 +93,33 @@ struct uc_iter_s {
   cache_entry_t *entry;
 };
 
+/* Maximum number of entries a cursor visits while holding the cache lock. */
+#define UC_CURSOR_SCAN_MAX 4096
+
+struct uc_cursor_s {
+  char *prefix;
+  size_t prefix_len;
+  /* `name="value"' strings of the labels an entry must have. */
+  char **labels;
+  size_t labels_num;
+
+  /* Name of the last entry visited. The next scan starts after it. */
+  char *last;
+  bool done;
+
+  uc_cursor_entry_t *entries;
+  size_t entries_num;
+  size_t chunk_size;
+
+  struct uc_cursor_s *next;
+};
+
 static c_avl_tree_t *cache_tree;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+/* List of open cursors. Protected by cache_lock. */
+static uc_cursor_t *cache_cursors;
+
+static bool uc_cursors_pending(char const *key);
 
 static int cache_compare(const cache_entry_t *a, const cache_entry_t *b) {
 #if COLLECT_DEBUG
@@ -231,6 +261,8 @@ int uc_check_timeout(void) {
     cdtime_t time;
     cdtime_t interval;
     unsigned long callbacks_mask;
+    /* False for entries which expired before, see cache_entry_t.expired. */
+    bool dispatch;
   } *expired = NULL;
   size_t expired_num = 0;
 
@@ -245,6 +277,10 @@ int uc_check_timeout(void) {
     /* If the entry is fresh enough, continue. */
     if ((now - ce->last_update) < (ce->interval * timeout_g))
       continue;
+    /* Entries which expired before are only removed once no open cursor can
+     * return them anymore. */
+    if (ce->expired && uc_cursors_pending(key))
+      continue;
 
     void *tmp = realloc(expired, (expired_num + 1) * sizeof(*expired));
     if (tmp == NULL) {
@@ -257,6 +293,7 @@ int uc_check_timeout(void) {
     expired[expired_num].time = ce->last_time;
     expired[expired_num].interval = ce->interval;
     expired[expired_num].callbacks_mask = ce->callbacks_mask;
+    expired[expired_num].dispatch = !ce->expired;
 
     if (expired[expired_num].key == NULL) {
       ERROR("uc_check_timeout: strdup failed.");
@@ -280,6 +317,9 @@ int uc_check_timeout(void) {
    * without holding the lock, otherwise we will run into a deadlock if a
    * plugin calls the cache interface. */
   for (size_t i = 0; i < expired_num; i++) {
+    if (!expired[i].dispatch)
+      continue;
+
     metric_t *m = metric_parse_identity(expired[i].key);
     if (m == NULL) {
       ERROR("uc_check_timeout: metric_parse_identity(\"%s\") failed: %s",
@@ -303,12 +343,21 @@ int uc_check_timeout(void) {
 
   /* Now actually remove all the values from the cache. We don't re-evaluate
    * the timestamp again, so in theory it is possible we remove a value after
-   * it is updated here. */
+   * it is updated here. Open cursors rely on entries not disappearing, e.g. to
+   * print the number of values before the values themselves, so entries which
+   * a cursor may still return are kept until a later call. */
   pthread_mutex_lock(&cache_lock);
   for (size_t i = 0; i < expired_num; i++) {
     char *key = NULL;
     cache_entry_t *value = NULL;
 
+    if (uc_cursors_pending(expired[i].key)) {
+      if (c_avl_get(cache_tree, expired[i].key, (void *)&value) == 0)
+        value->expired = true;
+      sfree(expired[i].key);
+      continue;
+    }
+
     if (c_avl_remove(cache_tree, expired[i].key, (void *)&key,
                      (void *)&value) != 0) {
       ERROR("uc_check_timeout: c_avl_remove (\"%s\") failed.", expired[i].key);
@@ -438,6 +487,7 @@ static int uc_update_metric(metric_t const *m) {
   ce->last_time = m->time;
   ce->last_update = cdtime();
   ce->interval = m->interval;
+  ce->expired = false;
 
   /* Check if cache entry has registered callbacks */
   unsigned long callbacks_mask = ce->callbacks_mask;
@@ -1182,6 +1232,259 @@ int uc_iterator_get_meta(uc_iter_t *iter, meta_data_t **ret_meta) {
   return 0;
 } /* int uc_iterator_get_meta */
 
+/*
+ * Cursor interface
+ */
+static void uc_cursor_reset_entries(uc_cursor_t *c) {
+  for (size_t i = 0; i < c->entries_num; i++)
+    sfree(c->entries[i].name);
+  c->entries_num = 0;
+} /* void uc_cursor_reset_entries */
+
+static void uc_cursor_free(uc_cursor_t *c) {
+  if (c == NULL)
+    return;
+
+  if (c->entries != NULL)
+    uc_cursor_reset_entries(c);
+  sfree(c->entries);
+  for (size_t i = 0; i < c->labels_num; i++)
+    sfree(c->labels[i]);
+  sfree(c->labels);
+  sfree(c->prefix);
+  sfree(c->last);
+  sfree(c);
+} /* void uc_cursor_free */
+
+uc_cursor_t *uc_cursor_create(char const *prefix, label_set_t labels,
+                              size_t chunk_size) {
+  if (chunk_size == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  uc_cursor_t *c = calloc(1, sizeof(*c));
+  if (c == NULL)
+    return NULL;
+
+  c->chunk_size = chunk_size;
+  c->entries = calloc(chunk_size, sizeof(*c->entries));
+  c->labels = calloc(labels.num + 1, sizeof(*c->labels));
+  if ((c->entries == NULL) || (c->labels == NULL)) {
+    uc_cursor_free(c);
+    return NULL;
+  }
+
+  if ((prefix != NULL) && (prefix[0] != 0)) {
+    c->prefix = strdup(prefix);
+    if (c->prefix == NULL) {
+      uc_cursor_free(c);
+      return NULL;
+    }
+    c->prefix_len = strlen(prefix);
+  }
+
+  /* Format the labels the way label_set_marshal() does, so they can be
+   * matched against the cache key directly. */
+  for (size_t i = 0; i < labels.num; i++) {
+    strbuf_t buf = STRBUF_CREATE;
+    int status = strbuf_print(&buf, labels.ptr[i].name);
+    status = status || strbuf_print(&buf, "=\"");
+    status = status || strbuf_print_escaped(&buf, labels.ptr[i].value,
+                                            "\\\"\n\r\t", '\\');
+    status = status || strbuf_print(&buf, "\"");
+    if (status == 0)
+      c->labels[c->labels_num] = strdup(buf.ptr);
+    STRBUF_DESTROY(buf);
+
+    if (c->labels[c->labels_num] == NULL) {
+      uc_cursor_free(c);
+      return NULL;
+    }
+    c->labels_num++;
+  }
+
+  pthread_mutex_lock(&cache_lock);
+  c->next = cache_cursors;
+  cache_cursors = c;
+  pthread_mutex_unlock(&cache_lock);
+
+  return c;
+} /* uc_cursor_t *uc_cursor_create */
+
+/* uc_cursor_match returns true if the cache key "name" has all labels of the
+ * cursor. Label values are escaped in the key, so a `name="value"' string can
+ * only be found at a label boundary if the key has that label. */
+static bool uc_cursor_match(uc_cursor_t const *c, char const *name) {
+  if (c->labels_num == 0)
+    return true;
+
+  char const *labels = strchr(name, '{');
+  if (labels == NULL)
+    return false;
+
+  for (size_t i = 0; i < c->labels_num; i++) {
+    size_t len = strlen(c->labels[i]);
+    bool found = false;
+    for (char const *pos = strstr(labels, c->labels[i]); pos != NULL;
+         pos = strstr(pos + 1, c->labels[i])) {
+      if (((pos[-1] == '{') || (pos[-1] == ',')) &&
+          ((pos[len] == ',') || (pos[len] == '}'))) {
+        found = true;
+        break;
+      }
+    }
+    if (!found)
+      return false;
+  }
+
+  return true;
+} /* bool uc_cursor_match */
+
+/* uc_cursors_pending returns true if any open cursor may still return the
+ * entry "key", i.e. if the entry matches and has not been visited yet.
+ * Must hold cache_lock when calling this function. */
+static bool uc_cursors_pending(char const *key) {
+  for (uc_cursor_t *c = cache_cursors; c != NULL; c = c->next) {
+    if (c->done)
+      continue;
+    if ((c->last != NULL) && (strcmp(key, c->last) <= 0))
+      continue;
+    if ((c->prefix != NULL) && (strncmp(key, c->prefix, c->prefix_len) != 0))
+      continue;
+    if (uc_cursor_match(c, key))
+      return true;
+  }
+  return false;
+} /* bool uc_cursors_pending */
+
+/* uc_cursor_scan visits at most UC_CURSOR_SCAN_MAX cache entries after
+ * "*last" while holding the cache lock. Matching entries are appended to the
+ * cursor's chunk or, if "count" is not NULL, only counted. */
+static int uc_cursor_scan(uc_cursor_t *c, char **last, bool *done,
+                          size_t *count) {
+  pthread_mutex_lock(&cache_lock);
+
+  c_avl_iterator_t *iter =
+      c_avl_get_iterator_from(cache_tree, (*last != NULL) ? *last : c->prefix);
+  if (iter == NULL) {
+    pthread_mutex_unlock(&cache_lock);
+    return ENOMEM;
+  }
+
+  char *key = NULL;
+  cache_entry_t *ce = NULL;
+  char const *visited = NULL;
+  int status = 0;
+  for (size_t i = 0; i < UC_CURSOR_SCAN_MAX; i++) {
+    if ((count == NULL) && (c->entries_num >= c->chunk_size))
+      break;
+
+    if (c_avl_iterator_next(iter, (void *)&key, (void *)&ce) != 0) {
+      *done = true;
+      break;
+    }
+    if ((*last != NULL) && (strcmp(key, *last) == 0))
+      continue;
+    if ((c->prefix != NULL) && (strncmp(key, c->prefix, c->prefix_len) != 0)) {
+      /* Keys sharing the prefix are adjacent in the tree. */
+      *done = true;
+      break;
+    }
+    visited = key;
+
+    if ((ce->state == STATE_MISSING) || !uc_cursor_match(c, key))
+      continue;
+
+    if (count != NULL) {
+      (*count)++;
+      continue;
+    }
+
+    uc_cursor_entry_t *e = c->entries + c->entries_num;
+    e->name = strdup(key);
+    if (e->name == NULL) {
+      status = ENOMEM;
+      break;
+    }
+    e->time = ce->last_time;
+    if (ce->values_raw.type == METRIC_TYPE_DISTRIBUTION)
+      e->rate = distribution_percentile(ce->distribution_increase, 50.0);
+    else
+      e->rate = ce->values_gauge;
+    c->entries_num++;
+  }
+
+  if ((status == 0) && !*done && (visited != NULL)) {
+    char *tmp = strdup(visited);
+    if (tmp == NULL) {
+      status = ENOMEM;
+    } else {
+      sfree(*last);
+      *last = tmp;
+    }
+  }
+
+  c_avl_iterator_destroy(iter);
+  pthread_mutex_unlock(&cache_lock);
+  return status;
+} /* int uc_cursor_scan */
+
+int uc_cursor_next(uc_cursor_t *c, uc_cursor_entry_t **ret_entries,
+                   size_t *ret_entries_num) {
+  if ((c == NULL) || (ret_entries == NULL) || (ret_entries_num == NULL))
+    return EINVAL;
+
+  uc_cursor_reset_entries(c);
+  while (!c->done && (c->entries_num < c->chunk_size)) {
+    int status = uc_cursor_scan(c, &c->last, &c->done, NULL);
+    if (status != 0) {
+      uc_cursor_reset_entries(c);
+      return status;
+    }
+  }
+
+  *ret_entries = c->entries;
+  *ret_entries_num = c->entries_num;
+  return 0;
+} /* int uc_cursor_next */
+
+int uc_cursor_count(uc_cursor_t *c, size_t *ret_count) {
+  if ((c == NULL) || (ret_count == NULL))
+    return EINVAL;
+
+  char *last = NULL;
+  bool done = false;
+  size_t count = 0;
+  while (!done) {
+    int status = uc_cursor_scan(c, &last, &done, &count);
+    if (status != 0) {
+      sfree(last);
+      return status;
+    }
+  }
+
+  sfree(last);
+  *ret_count = count;
+  return 0;
+} /* int uc_cursor_count */
+
+void uc_cursor_destroy(uc_cursor_t *c) {
+  if (c == NULL)
+    return;
+
+  pthread_mutex_lock(&cache_lock);
+  for (uc_cursor_t **ptr = &cache_cursors; *ptr != NULL; ptr = &(*ptr)->next) {
+    if (*ptr == c) {
+      *ptr = c->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&cache_lock);
+
+  uc_cursor_free(c);
+} /* void uc_cursor_destroy */
+
 /*
  * Meta data interface
  */
@@ -136,6 +136,64 @@ int uc_iterator_get_interval(uc_iter_t *iter, cdtime_t *ret_interval);
 /* Return the metadata for the value at the current position. */
 int uc_iterator_get_meta(uc_iter_t *iter, meta_data_t **ret_meta);
 
+/*
+ * Cursor interface
+ *
+ * Unlike the iterator, a cursor does not hold the cache lock while it is
+ * open. Each call to uc_cursor_next() takes the lock, copies at most
+ * `chunk_size' matching entries and releases the lock again, so the cache can
+ * be walked in bounded steps even if it holds millions of entries. Entries are
+ * returned in the cache's (lexicographic) order; entries added or removed
+ * while the cursor is open may or may not be returned. Entries which expire
+ * while a cursor is open are reported as missing to the plugins, but are not
+ * removed from the cache while the cursor may still return them. The cursor
+ * returns such entries with their last time and rate, so it returns at least
+ * as many entries as uc_cursor_count() reported.
+ */
+struct uc_cursor_s;
+typedef struct uc_cursor_s uc_cursor_t;
+
+typedef struct {
+  char *name;
+  cdtime_t time;
+  gauge_t rate;
+} uc_cursor_entry_t;
+
+/*
+ * NAME
+ *   uc_cursor_create
+ *
+ * DESCRIPTION
+ *   Create a cursor over all cache entries whose name starts with `prefix'
+ *   (if not NULL) and which have all labels in `labels'.
+ *
+ * RETURN VALUE
+ *   A cursor object on success or NULL else.
+ */
+uc_cursor_t *uc_cursor_create(char const *prefix, label_set_t labels,
+                              size_t chunk_size);
+
+/*
+ * NAME
+ *   uc_cursor_next
+ *
+ * DESCRIPTION
+ *   Fetch the next chunk of matching entries. The entries are owned by the
+ *   cursor and remain valid until the next call to uc_cursor_next() or
+ *   uc_cursor_destroy().
+ *
+ * RETURN VALUE
+ *   Zero upon success, even if no further entries are available, in which case
+ *   `ret_entries_num' is set to zero. Non-zero on error.
+ */
+int uc_cursor_next(uc_cursor_t *cursor, uc_cursor_entry_t **ret_entries,
+                   size_t *ret_entries_num);
+/* uc_cursor_count returns the number of entries matching the cursor's filter,
+ * regardless of the cursor's position. Like uc_cursor_next(), it releases the
+ * cache lock periodically. */
+int uc_cursor_count(uc_cursor_t *cursor, size_t *ret_count);
+void uc_cursor_destroy(uc_cursor_t *cursor);
+
 /*
  * Meta data interface
  */
@@ -48,6 +48,26 @@ int uc_get_names(char ***ret_names, cdtime_t **ret_times, size_t *ret_number) {
   return ENOTSUP;
 }
 
+uc_cursor_t *uc_cursor_create(__attribute__((unused)) char const *prefix,
+                              __attribute__((unused)) label_set_t labels,
+                              __attribute__((unused)) size_t chunk_size) {
+  errno = ENOTSUP;
+  return NULL;
+}
+
+int uc_cursor_next(__attribute__((unused)) uc_cursor_t *cursor,
+                   __attribute__((unused)) uc_cursor_entry_t **ret_entries,
+                   __attribute__((unused)) size_t *ret_entries_num) {
+  return ENOTSUP;
+}
+
+int uc_cursor_count(__attribute__((unused)) uc_cursor_t *cursor,
+                    __attribute__((unused)) size_t *ret_count) {
+  return ENOTSUP;
+}
+
+void uc_cursor_destroy(__attribute__((unused)) uc_cursor_t *cursor) {}
+
 int uc_get_value_by_name_vl(const char *name, value_t **ret_values,
                             size_t *ret_values_num) {
   return ENOTSUP;
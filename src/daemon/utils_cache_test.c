@@ -1261,12 +1261,171 @@ DEF_TEST(uc_get_rate) {
   return 0;
 }
 
+DEF_TEST(uc_cursor) {
+  metric_family_t fam = {
+      .name = "test_cursor",
+      .type = METRIC_TYPE_GAUGE,
+  };
+  for (int i = 0; i < 2500; i++) {
+    char instance[16];
+    snprintf(instance, sizeof(instance), "%04d", i);
+
+    metric_t m = {
+        .value.gauge = (gauge_t)i,
+        .time = cdtime_mock,
+    };
+    CHECK_ZERO(metric_label_set(&m, "instance", instance));
+    CHECK_ZERO(metric_label_set(&m, "parity", (i % 2) ? "odd" : "even"));
+    CHECK_ZERO(metric_family_metric_append(&fam, m));
+    metric_reset(&m);
+  }
+
+  metric_family_t other = {
+      .name = "test_cursor_other",
+      .type = METRIC_TYPE_GAUGE,
+  };
+  CHECK_ZERO(metric_family_metric_append(&other, (metric_t){
+                                                     .value.gauge = 1,
+                                                     .time = cdtime_mock,
+                                                 }));
+
+  uc_init();
+  CHECK_ZERO(uc_update(&fam));
+  CHECK_ZERO(uc_update(&other));
+
+  struct {
+    char const *prefix;
+    char const *label_name;
+    char const *label_value;
+    size_t want_count;
+  } cases[] = {
+      {NULL, NULL, NULL, 2501},
+      {"test_cursor{", NULL, NULL, 2500},
+      {"test_cursor_other", NULL, NULL, 1},
+      {"test_cursor{", "parity", "odd", 1250},
+      {NULL, "instance", "0042", 1},
+      {NULL, "instance", "004", 0},
+      {"does_not_exist", NULL, NULL, 0},
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    printf("## Case %zu:\n", i);
+
+    label_set_t labels = {0};
+    if (cases[i].label_name != NULL)
+      CHECK_ZERO(label_set_add(&labels, cases[i].label_name,
+                               cases[i].label_value));
+
+    uc_cursor_t *cursor;
+    CHECK_NOT_NULL(cursor = uc_cursor_create(cases[i].prefix, labels, 100));
+
+    size_t count = 0;
+    CHECK_ZERO(uc_cursor_count(cursor, &count));
+    EXPECT_EQ_UINT64(cases[i].want_count, count);
+
+    char last[256] = "";
+    gauge_t last_rate = NAN;
+    size_t total = 0;
+    uc_cursor_entry_t *entries = NULL;
+    size_t entries_num = 0;
+    while (uc_cursor_next(cursor, &entries, &entries_num) == 0 &&
+           entries_num > 0) {
+      OK(entries_num <= 100);
+      for (size_t j = 0; j < entries_num; j++) {
+        OK(strcmp(last, entries[j].name) < 0);
+        sstrncpy(last, entries[j].name, sizeof(last));
+        last_rate = entries[j].rate;
+        if (cases[i].label_value != NULL)
+          OK(strstr(entries[j].name, cases[i].label_value) != NULL);
+      }
+      total += entries_num;
+    }
+    EXPECT_EQ_UINT64(cases[i].want_count, total);
+
+    if ((cases[i].label_name != NULL) && (total == 1)) {
+      EXPECT_EQ_DOUBLE(42, last_rate);
+    }
+
+    uc_cursor_destroy(cursor);
+    label_set_reset(&labels);
+  }
+
+  metric_family_metric_reset(&fam);
+  metric_family_metric_reset(&other);
+  uc_destroy();
+  return 0;
+}
+
+DEF_TEST(uc_cursor_expire) {
+  metric_family_t fam = {
+      .name = "test_expire",
+      .type = METRIC_TYPE_GAUGE,
+  };
+  for (int i = 0; i < 10; i++) {
+    char instance[16];
+    snprintf(instance, sizeof(instance), "%02d", i);
+
+    metric_t m = {
+        .value.gauge = (gauge_t)i,
+        .time = cdtime_mock,
+        .interval = TIME_T_TO_CDTIME_T(10),
+    };
+    CHECK_ZERO(metric_label_set(&m, "instance", instance));
+    CHECK_ZERO(metric_family_metric_append(&fam, m));
+    metric_reset(&m);
+  }
+
+  int timeout = timeout_g;
+  timeout_g = 2;
+  uc_init();
+  CHECK_ZERO(uc_update(&fam));
+
+  uc_cursor_t *cursor;
+  CHECK_NOT_NULL(cursor = uc_cursor_create("test_expire{", (label_set_t){0}, 4));
+  size_t count = 0;
+  CHECK_ZERO(uc_cursor_count(cursor, &count));
+  EXPECT_EQ_UINT64(10, count);
+
+  uc_cursor_entry_t *entries = NULL;
+  size_t entries_num = 0;
+  CHECK_ZERO(uc_cursor_next(cursor, &entries, &entries_num));
+  EXPECT_EQ_UINT64(4, entries_num);
+
+  /* All entries expire. Those the cursor has returned already are removed,
+   * the others are kept until the cursor has returned them. */
+  cdtime_mock += TIME_T_TO_CDTIME_T(100);
+  CHECK_ZERO(uc_check_timeout());
+
+  gauge_t rate = NAN;
+  OK(uc_get_rate(fam.metric.ptr + 0, &rate) != 0);
+  CHECK_ZERO(uc_get_rate(fam.metric.ptr + 9, &rate));
+  EXPECT_EQ_DOUBLE(9, rate);
+
+  size_t total = entries_num;
+  while ((uc_cursor_next(cursor, &entries, &entries_num) == 0) &&
+         (entries_num > 0))
+    total += entries_num;
+  EXPECT_EQ_UINT64(count, total);
+  uc_cursor_destroy(cursor);
+
+  /* Without open cursors, the remaining entries are removed. */
+  CHECK_ZERO(uc_check_timeout());
+  OK(uc_get_rate(fam.metric.ptr + 9, &rate) != 0);
+
+  timeout_g = timeout;
+  metric_family_metric_reset(&fam);
+  uc_destroy();
+  return 0;
+}
+
 int main() {
   RUN_TEST(uc_update);
   RUN_TEST(uc_get_percentile_by_name);
   RUN_TEST(uc_get_percentile);
   RUN_TEST(uc_get_rate_by_name);
   RUN_TEST(uc_get_rate);
+  RUN_TEST(uc_cursor);
+  RUN_TEST(uc_cursor_expire);
 
   END_TEST;
 }
@@ -0,0 +1,668 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "plugin.h"
+#include "utils/common/common.h"
+#include "utils/crc32/crc32.h"
+#include "utils/format_binary/format_binary.h"
+#include "utils_complain.h"
+#include "write_spool.h"
+
+#include <dirent.h>
+
+/* Segments are named after their sequence number, in hexadecimal. Each record
+ * is the length and CRC-32 of the encoded family, both little endian, followed
+ * by the family in the format of utils/format_binary. */
+#define SPOOL_RECORD_HEADER_SIZE 8
+/* Records larger than this are considered corrupt. */
+#define SPOOL_RECORD_MAX_SIZE (64 * 1024 * 1024)
+/* Holds the sequence number, offset and record number of the read position. */
+#define SPOOL_OFFSET_FILE "offset"
+
+typedef struct {
+  uint64_t seq;
+  uint64_t size;
+  uint64_t records;
+} spool_segment_t;
+
+struct write_spool_s {
+  char *dir;
+  uint64_t max_size;
+  uint64_t segment_size;
+
+  pthread_mutex_t lock;
+  /* Oldest first. Families are read from the first and appended to the last
+   * segment. */
+  spool_segment_t *segments;
+  size_t segments_num;
+  uint64_t next_seq;
+
+  int write_fd;
+  int read_fd;
+  uint64_t read_offset;
+  uint64_t read_records;
+
+  /* Position after the family returned by write_spool_peek. */
+  bool pending;
+  uint64_t pending_seq;
+  uint64_t pending_offset;
+
+  /* Number of failed attempts to write the record at
+   * (failed_seq, failed_offset). */
+  uint64_t failed_seq;
+  uint64_t failed_offset;
+  unsigned int failed_attempts;
+
+  uint64_t dropped;
+  c_complain_t drop_complaint;
+};
+
+/*
+ * Encoding of metric families
+ */
+static void put_u32(uint8_t *p, uint32_t v) {
+  for (size_t i = 0; i < 4; i++)
+    p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get_u32(uint8_t const *p) {
+  uint32_t v = 0;
+  for (size_t i = 0; i < 4; i++)
+    v |= ((uint32_t)p[i]) << (8 * i);
+  return v;
+}
+
+static int encode_family(strbuf_t *buf, metric_family_t const *fam) {
+  metric_family_t const *fams[] = {fam};
+  return format_binary_encode(buf, fams, STATIC_ARRAY_SIZE(fams));
+}
+
+static metric_family_t *decode_family(uint8_t const *data, size_t len) {
+  metric_family_t **fams = NULL;
+  size_t fams_num = 0;
+  size_t size = 0;
+  if (format_binary_decode(data, len, &fams, &fams_num, &size) != 0)
+    return NULL;
+
+  if ((fams_num != 1) || (size != len)) {
+    format_binary_families_free(fams, fams_num);
+    return NULL;
+  }
+
+  metric_family_t *fam = fams[0];
+  free(fams);
+  return fam;
+}
+
+/*
+ * Segments
+ */
+static void spool_segment_path(write_spool_t *s, uint64_t seq, char *buf,
+                               size_t size) {
+  ssnprintf(buf, size, "%s/%016" PRIx64, s->dir, seq);
+}
+
+static int spool_segment_filter(const struct dirent *d) {
+  return (strlen(d->d_name) == 16) &&
+         (strspn(d->d_name, "0123456789abcdef") == 16);
+}
+
+/* spool_segment_scan counts the records of a segment found on disk. A
+ * truncated record at the end, e.g. after a crash, is removed. */
+static int spool_segment_scan(write_spool_t *s, spool_segment_t *seg) {
+  char path[PATH_MAX];
+  spool_segment_path(s, seg->seq, path, sizeof(path));
+
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    ERROR("write_spool: open (%s) failed: %s", path, STRERRNO);
+    return errno;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int status = errno;
+    ERROR("write_spool: fstat (%s) failed: %s", path, STRERRNO);
+    close(fd);
+    return status;
+  }
+
+  uint64_t offset = 0;
+  while (offset < (uint64_t)st.st_size) {
+    uint8_t hdr[SPOOL_RECORD_HEADER_SIZE];
+    if (pread(fd, hdr, sizeof(hdr), (off_t)offset) != (ssize_t)sizeof(hdr))
+      break;
+
+    uint64_t next = offset + sizeof(hdr) + get_u32(hdr);
+    if (next > (uint64_t)st.st_size)
+      break;
+
+    offset = next;
+    seg->records++;
+  }
+
+  if (offset < (uint64_t)st.st_size) {
+    WARNING("write_spool: Removing a truncated record at the end of %s.",
+            path);
+    if (ftruncate(fd, (off_t)offset) != 0)
+      ERROR("write_spool: ftruncate (%s) failed: %s", path, STRERRNO);
+  }
+
+  close(fd);
+  seg->size = offset;
+  return 0;
+}
+
+static void spool_remove_first(write_spool_t *s) {
+  if (s->segments_num == 0)
+    return;
+
+  if (s->read_fd >= 0) {
+    close(s->read_fd);
+    s->read_fd = -1;
+  }
+  if ((s->segments_num == 1) && (s->write_fd >= 0)) {
+    close(s->write_fd);
+    s->write_fd = -1;
+  }
+
+  char path[PATH_MAX];
+  spool_segment_path(s, s->segments[0].seq, path, sizeof(path));
+  if ((unlink(path) != 0) && (errno != ENOENT))
+    ERROR("write_spool: unlink (%s) failed: %s", path, STRERRNO);
+
+  memmove(s->segments, s->segments + 1,
+          (s->segments_num - 1) * sizeof(*s->segments));
+  s->segments_num--;
+
+  s->read_offset = 0;
+  s->read_records = 0;
+  s->pending = false;
+}
+
+static int spool_segment_new(write_spool_t *s) {
+  if (s->write_fd >= 0) {
+    close(s->write_fd);
+    s->write_fd = -1;
+  }
+
+  spool_segment_t *tmp =
+      realloc(s->segments, (s->segments_num + 1) * sizeof(*s->segments));
+  if (tmp == NULL)
+    return ENOMEM;
+  s->segments = tmp;
+
+  s->segments[s->segments_num] = (spool_segment_t){.seq = s->next_seq};
+  s->segments_num++;
+  s->next_seq++;
+  return 0;
+}
+
+static int spool_write_fd(write_spool_t *s) {
+  if (s->write_fd >= 0)
+    return s->write_fd;
+
+  char path[PATH_MAX];
+  spool_segment_path(s, s->segments[s->segments_num - 1].seq, path,
+                     sizeof(path));
+
+  s->write_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (s->write_fd < 0)
+    ERROR("write_spool: open (%s) failed: %s", path, STRERRNO);
+  return s->write_fd;
+}
+
+static uint64_t spool_size(write_spool_t *s) {
+  uint64_t size = 0;
+  for (size_t i = 0; i < s->segments_num; i++)
+    size += s->segments[i].size;
+  return size;
+}
+
+/* Drops the oldest segments while the spool is larger than its limit. The
+ * segment appended to is kept. */
+static void spool_enforce_limit(write_spool_t *s) {
+  while ((s->segments_num > 1) && (spool_size(s) > s->max_size)) {
+    s->dropped += s->segments[0].records - s->read_records;
+    spool_remove_first(s);
+    c_complain(LOG_WARNING, &s->drop_complaint,
+               "write_spool: %s exceeds its maximum size, %" PRIu64
+               " families were dropped so far.",
+               s->dir, s->dropped);
+  }
+}
+
+/*
+ * Read position
+ */
+static void spool_offset_load(write_spool_t *s) {
+  char path[PATH_MAX];
+  ssnprintf(path, sizeof(path), "%s/" SPOOL_OFFSET_FILE, s->dir);
+
+  FILE *fh = fopen(path, "r");
+  if (fh == NULL)
+    return;
+
+  uint64_t seq, offset, records;
+  int n = fscanf(fh, "%" SCNu64 " %" SCNu64 " %" SCNu64, &seq, &offset,
+                 &records);
+  fclose(fh);
+
+  /* The read position is only valid as long as its segment exists. */
+  if ((n != 3) || (s->segments_num == 0) || (s->segments[0].seq != seq) ||
+      (offset > s->segments[0].size) || (records > s->segments[0].records))
+    return;
+
+  s->read_offset = offset;
+  s->read_records = records;
+}
+
+static void spool_offset_save(write_spool_t *s) {
+  char path[PATH_MAX];
+  ssnprintf(path, sizeof(path), "%s/" SPOOL_OFFSET_FILE, s->dir);
+
+  if ((s->segments_num == 0) || (s->read_offset == 0)) {
+    unlink(path);
+    return;
+  }
+
+  char tmp[PATH_MAX];
+  ssnprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+  FILE *fh = fopen(tmp, "w");
+  if (fh == NULL) {
+    ERROR("write_spool: fopen (%s) failed: %s", tmp, STRERRNO);
+    return;
+  }
+  fprintf(fh, "%" PRIu64 " %" PRIu64 " %" PRIu64 "\n", s->segments[0].seq,
+          s->read_offset, s->read_records);
+  if (fclose(fh) != 0) {
+    ERROR("write_spool: Writing %s failed: %s", tmp, STRERRNO);
+    unlink(tmp);
+    return;
+  }
+
+  if (rename(tmp, path) != 0)
+    ERROR("write_spool: rename (%s) failed: %s", path, STRERRNO);
+}
+
+/*
+ * Public functions
+ */
+write_spool_t *write_spool_open(char const *dir, uint64_t max_size,
+                                uint64_t segment_size) {
+  if ((dir == NULL) || (max_size == 0) || (segment_size == 0)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  char path[PATH_MAX];
+  ssnprintf(path, sizeof(path), "%s/" SPOOL_OFFSET_FILE, dir);
+  if (check_create_dir(path) != 0) {
+    ERROR("write_spool: Creating %s failed.", dir);
+    return NULL;
+  }
+
+  write_spool_t *s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+
+  s->dir = strdup(dir);
+  if (s->dir == NULL) {
+    free(s);
+    return NULL;
+  }
+  s->max_size = max_size;
+  s->segment_size = segment_size;
+  s->next_seq = 1;
+  s->write_fd = -1;
+  s->read_fd = -1;
+  C_COMPLAIN_INIT(&s->drop_complaint);
+  pthread_mutex_init(&s->lock, NULL);
+
+  struct dirent **list = NULL;
+  int n = scandir(dir, &list, spool_segment_filter, alphasort);
+  if (n < 0) {
+    ERROR("write_spool: scandir (%s) failed: %s", dir, STRERRNO);
+    write_spool_close(s);
+    return NULL;
+  }
+
+  for (int i = 0; i < n; i++) {
+    uint64_t seq = (uint64_t)strtoull(list[i]->d_name, NULL, 16);
+    if (spool_segment_new(s) == 0) {
+      spool_segment_t *seg = s->segments + s->segments_num - 1;
+      seg->seq = seq;
+      if ((spool_segment_scan(s, seg) != 0) || (seg->records == 0)) {
+        /* Empty segments are removed. */
+        spool_segment_path(s, seq, path, sizeof(path));
+        unlink(path);
+        s->segments_num--;
+      }
+    }
+    s->next_seq = seq + 1;
+    free(list[i]);
+  }
+  free(list);
+
+  spool_offset_load(s);
+
+  write_spool_stats_t stats = write_spool_stats(s);
+  if (stats.families > 0)
+    INFO("write_spool: %s holds %" PRIu64 " families (%" PRIu64 " bytes).",
+         dir, stats.families, stats.bytes);
+
+  return s;
+}
+
+void write_spool_close(write_spool_t *s) {
+  if (s == NULL)
+    return;
+
+  spool_offset_save(s);
+
+  if (s->write_fd >= 0)
+    close(s->write_fd);
+  if (s->read_fd >= 0)
+    close(s->read_fd);
+
+  pthread_mutex_destroy(&s->lock);
+  free(s->segments);
+  free(s->dir);
+  free(s);
+}
+
+int write_spool_append(write_spool_t *s, metric_family_t const *fam) {
+  if ((s == NULL) || (fam == NULL))
+    return EINVAL;
+
+  strbuf_t buf = STRBUF_CREATE;
+  uint8_t hdr[SPOOL_RECORD_HEADER_SIZE] = {0};
+  int status = strbuf_putn(&buf, hdr, sizeof(hdr));
+  status = status || encode_family(&buf, fam);
+  if (status != 0) {
+    STRBUF_DESTROY(buf);
+    return ENOMEM;
+  }
+
+  size_t payload_len = buf.pos - sizeof(hdr);
+  if (payload_len > SPOOL_RECORD_MAX_SIZE) {
+    ERROR("write_spool: Family %s is too large to be spooled.", fam->name);
+    STRBUF_DESTROY(buf);
+    return EINVAL;
+  }
+  put_u32((uint8_t *)buf.ptr, (uint32_t)payload_len);
+  put_u32((uint8_t *)buf.ptr + 4,
+          crc32_buffer((unsigned char *)buf.ptr + sizeof(hdr), payload_len));
+
+  pthread_mutex_lock(&s->lock);
+
+  if ((s->segments_num == 0) ||
+      (s->segments[s->segments_num - 1].size >= s->segment_size)) {
+    status = spool_segment_new(s);
+    if (status != 0) {
+      pthread_mutex_unlock(&s->lock);
+      STRBUF_DESTROY(buf);
+      return status;
+    }
+  }
+
+  spool_segment_t *seg = s->segments + s->segments_num - 1;
+  int fd = spool_write_fd(s);
+  if (fd < 0)
+    status = errno;
+
+  size_t written = 0;
+  while ((status == 0) && (written < buf.pos)) {
+    ssize_t n = write(fd, buf.ptr + written, buf.pos - written);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      status = errno;
+      ERROR("write_spool: Writing to %s failed: %s", s->dir, STRERRNO);
+      break;
+    }
+    written += (size_t)n;
+  }
+
+  if (status == 0) {
+    seg->size += buf.pos;
+    seg->records++;
+    spool_enforce_limit(s);
+  } else if (fd >= 0) {
+    /* Remove the partially written record. */
+    if (ftruncate(fd, (off_t)seg->size) != 0)
+      ERROR("write_spool: ftruncate failed: %s", STRERRNO);
+  }
+  if ((status != 0) && (seg->records == 0)) {
+    s->segments_num--;
+    if (s->write_fd >= 0) {
+      close(s->write_fd);
+      s->write_fd = -1;
+    }
+  }
+
+  pthread_mutex_unlock(&s->lock);
+  STRBUF_DESTROY(buf);
+  return status;
+}
+
+bool write_spool_empty(write_spool_t *s) {
+  if (s == NULL)
+    return true;
+
+  pthread_mutex_lock(&s->lock);
+  bool empty = (s->segments_num == 0) ||
+               ((s->segments_num == 1) &&
+                (s->read_offset >= s->segments[0].size));
+  pthread_mutex_unlock(&s->lock);
+
+  return empty;
+}
+
+/* spool_read_record reads the record at the read position. Returns EINVAL if
+ * the record is corrupt. */
+static int spool_read_record(write_spool_t *s, metric_family_t **ret_fam,
+                             uint64_t *ret_next) {
+  spool_segment_t *seg = s->segments;
+
+  if (s->read_fd < 0) {
+    char path[PATH_MAX];
+    spool_segment_path(s, seg->seq, path, sizeof(path));
+    s->read_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (s->read_fd < 0) {
+      ERROR("write_spool: open (%s) failed: %s", path, STRERRNO);
+      return EINVAL;
+    }
+  }
+
+  uint8_t hdr[SPOOL_RECORD_HEADER_SIZE];
+  if (pread(s->read_fd, hdr, sizeof(hdr), (off_t)s->read_offset) !=
+      (ssize_t)sizeof(hdr))
+    return EINVAL;
+
+  uint32_t len = get_u32(hdr);
+  uint64_t next = s->read_offset + sizeof(hdr) + len;
+  if ((len > SPOOL_RECORD_MAX_SIZE) || (next > seg->size))
+    return EINVAL;
+
+  uint8_t *payload = malloc(len > 0 ? len : 1);
+  if (payload == NULL)
+    return ENOMEM;
+
+  int status = 0;
+  if ((pread(s->read_fd, payload, len,
+             (off_t)(s->read_offset + sizeof(hdr))) != (ssize_t)len) ||
+      (crc32_buffer(payload, len) != get_u32(hdr + 4))) {
+    status = EINVAL;
+  } else {
+    *ret_fam = decode_family(payload, len);
+    if (*ret_fam == NULL)
+      status = EINVAL;
+  }
+  free(payload);
+
+  *ret_next = next;
+  return status;
+}
+
+int write_spool_peek(write_spool_t *s, metric_family_t **ret_fam) {
+  if ((s == NULL) || (ret_fam == NULL))
+    return EINVAL;
+
+  pthread_mutex_lock(&s->lock);
+
+  while (s->segments_num > 0) {
+    spool_segment_t *seg = s->segments;
+    if (s->read_offset >= seg->size) {
+      spool_remove_first(s);
+      continue;
+    }
+
+    uint64_t next = 0;
+    int status = spool_read_record(s, ret_fam, &next);
+    if (status == ENOMEM) {
+      pthread_mutex_unlock(&s->lock);
+      return status;
+    }
+    if (status != 0) {
+      /* Skip a corrupt record if its length is plausible, otherwise the rest
+       * of the segment. */
+      if ((next == 0) || (next > seg->size)) {
+        ERROR("write_spool: Skipping the corrupt remainder of segment %" PRIu64
+              " in %s.",
+              seg->seq, s->dir);
+        s->dropped += seg->records - s->read_records;
+        s->read_offset = seg->size;
+        s->read_records = seg->records;
+      } else {
+        ERROR("write_spool: Skipping a corrupt record in %s.", s->dir);
+        s->dropped++;
+        s->read_offset = next;
+        s->read_records++;
+      }
+      continue;
+    }
+
+    s->pending = true;
+    s->pending_seq = seg->seq;
+    s->pending_offset = next;
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+  }
+
+  pthread_mutex_unlock(&s->lock);
+  return ENOENT;
+}
+
+static void spool_consume(write_spool_t *s, bool drop) {
+  if (s == NULL)
+    return;
+
+  pthread_mutex_lock(&s->lock);
+
+  /* The segment may have been dropped in the meantime. */
+  if (s->pending && (s->segments_num > 0) &&
+      (s->segments[0].seq == s->pending_seq)) {
+    s->read_offset = s->pending_offset;
+    s->read_records++;
+    if (drop)
+      s->dropped++;
+    if (s->read_offset >= s->segments[0].size)
+      spool_remove_first(s);
+  }
+  s->pending = false;
+
+  pthread_mutex_unlock(&s->lock);
+}
+
+void write_spool_consume(write_spool_t *s) { spool_consume(s, false); }
+
+void write_spool_drop(write_spool_t *s) { spool_consume(s, true); }
+
+bool write_spool_rejected(int status) {
+  return (status == EINVAL) || (status == ENOTSUP) || (status == EMSGSIZE);
+}
+
+/* spool_failed counts a failed attempt to write the family returned by the last
+ * call of write_spool_peek and returns the number of consecutive failed
+ * attempts for it. */
+static unsigned int spool_failed(write_spool_t *s) {
+  pthread_mutex_lock(&s->lock);
+  uint64_t seq = (s->segments_num > 0) ? s->segments[0].seq : 0;
+  if (!s->pending || (s->failed_attempts == 0) || (s->failed_seq != seq) ||
+      (s->failed_offset != s->read_offset)) {
+    s->failed_seq = seq;
+    s->failed_offset = s->read_offset;
+    s->failed_attempts = 0;
+  }
+  unsigned int attempts = ++s->failed_attempts;
+  pthread_mutex_unlock(&s->lock);
+
+  return attempts;
+}
+
+int write_spool_replay(write_spool_t *s, uint64_t max,
+                       unsigned int max_attempts, write_spool_write_cb write,
+                       void *arg) {
+  if ((s == NULL) || (write == NULL))
+    return EINVAL;
+
+  for (uint64_t i = 0; (max == 0) || (i < max); i++) {
+    metric_family_t *fam = NULL;
+    int status = write_spool_peek(s, &fam);
+    if (status != 0)
+      return (status == ENOENT) ? 0 : status;
+
+    status = (*write)(fam, arg);
+    if (status == 0) {
+      write_spool_consume(s);
+    } else if (write_spool_rejected(status)) {
+      /* Retrying would block the spool forever. */
+      pthread_mutex_lock(&s->lock);
+      c_complain(LOG_ERR, &s->drop_complaint,
+                 "write_spool: Dropping %s from %s, it was rejected: %s",
+                 fam->name, s->dir, STRERROR(status));
+      pthread_mutex_unlock(&s->lock);
+      write_spool_drop(s);
+    } else if ((status != ECANCELED) && (max_attempts > 0) &&
+               (spool_failed(s) >= max_attempts)) {
+      /* Most write callbacks do not tell permanent from temporary failures.
+       * A family that never succeeds would block the spool forever. */
+      pthread_mutex_lock(&s->lock);
+      c_complain(LOG_ERR, &s->drop_complaint,
+                 "write_spool: Dropping %s from %s after %u failed attempts: "
+                 "%s",
+                 fam->name, s->dir, max_attempts, STRERROR(status));
+      s->failed_attempts = 0;
+      pthread_mutex_unlock(&s->lock);
+      write_spool_drop(s);
+    } else {
+      metric_family_free(fam);
+      return status;
+    }
+    metric_family_free(fam);
+  }
+
+  return 0;
+}
+
+write_spool_stats_t write_spool_stats(write_spool_t *s) {
+  write_spool_stats_t stats = {0};
+  if (s == NULL)
+    return stats;
+
+  pthread_mutex_lock(&s->lock);
+  for (size_t i = 0; i < s->segments_num; i++) {
+    stats.bytes += s->segments[i].size;
+    stats.families += s->segments[i].records;
+  }
+  if (s->segments_num > 0) {
+    stats.bytes -= s->read_offset;
+    stats.families -= s->read_records;
+  }
+  stats.dropped = s->dropped;
+  pthread_mutex_unlock(&s->lock);
+
+  return stats;
+}
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef WRITE_SPOOL_H
+#define WRITE_SPOOL_H 1
+
+#include "metric.h"
+
+/* A write spool is an on-disk queue of metric families for one write plugin.
+ * Families are appended to segment files in a directory; segments are removed
+ * once all their families were consumed. If the spool grows beyond its maximum
+ * size, the oldest segments are dropped.
+ *
+ * The read position is persisted when a spool is closed, so families consumed
+ * before a crash may be returned again after a restart. */
+struct write_spool_s;
+typedef struct write_spool_s write_spool_t;
+
+typedef struct {
+  uint64_t bytes;    /* size of the families not consumed yet */
+  uint64_t families; /* number of families not consumed yet */
+  uint64_t dropped;  /* number of families dropped due to the size limit,
+                        rejected by the plugin or failing too often */
+} write_spool_stats_t;
+
+/* write_spool_open opens the spool in directory "dir", creating it if
+ * necessary. Families stored by a previous instance are kept. "max_size" and
+ * "segment_size" are in bytes. */
+write_spool_t *write_spool_open(char const *dir, uint64_t max_size,
+                                uint64_t segment_size);
+
+/* write_spool_close persists the read position and frees the spool. The
+ * families not consumed yet stay on disk. */
+void write_spool_close(write_spool_t *s);
+
+/* write_spool_append adds "fam" to the end of the spool. */
+int write_spool_append(write_spool_t *s, metric_family_t const *fam);
+
+/* write_spool_empty returns true if all families were consumed. */
+bool write_spool_empty(write_spool_t *s);
+
+/* write_spool_peek returns a copy of the oldest family in "ret_fam", which
+ * must be freed with metric_family_free. ENOENT is returned if the spool is
+ * empty. Calling write_spool_peek again without write_spool_consume returns the
+ * same family. */
+int write_spool_peek(write_spool_t *s, metric_family_t **ret_fam);
+
+/* write_spool_consume removes the family returned by the last call of
+ * write_spool_peek. */
+void write_spool_consume(write_spool_t *s);
+
+/* write_spool_drop removes the family returned by the last call of
+ * write_spool_peek and counts it as dropped. */
+void write_spool_drop(write_spool_t *s);
+
+/* write_spool_rejected returns true if "status", returned by a write callback,
+ * means that the family will never be accepted, e.g. EINVAL for a metric type
+ * the output format does not support. Such families are not spooled. */
+bool write_spool_rejected(int status);
+
+typedef int (*write_spool_write_cb)(metric_family_t const *fam, void *arg);
+
+/* write_spool_replay passes the families in the spool to "write", oldest
+ * first, until the spool is empty, "max" families (if non-zero) were passed or
+ * "write" fails. Families rejected by "write" (see write_spool_rejected) are
+ * dropped; on other errors the replay stops and the family is passed again by
+ * the next call. A family which failed "max_attempts" (if non-zero) times in a
+ * row is dropped as well. ECANCELED does not count as an attempt. */
+int write_spool_replay(write_spool_t *s, uint64_t max,
+                       unsigned int max_attempts, write_spool_write_cb write,
+                       void *arg);
+
+write_spool_stats_t write_spool_stats(write_spool_t *s);
+
+#endif /* WRITE_SPOOL_H */
@@ -0,0 +1,327 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/common/common.h"
+#include "write_spool.h"
+
+static char spool_dir[] = "/tmp/write_spool_test.XXXXXX";
+
+static metric_family_t *make_family(int i) {
+  metric_family_t *fam = calloc(1, sizeof(*fam));
+  char name[64];
+  ssnprintf(name, sizeof(name), "test_family_%d", i);
+  fam->name = strdup(name);
+  fam->type = (i % 2) ? METRIC_TYPE_COUNTER : METRIC_TYPE_GAUGE;
+  if (i % 3 == 0)
+    fam->help = strdup("Help text");
+
+  for (int j = 0; j < 3; j++) {
+    metric_t m = {
+        .time = TIME_T_TO_CDTIME_T(1700000000 + i),
+        .interval = TIME_T_TO_CDTIME_T(10),
+    };
+    if (fam->type == METRIC_TYPE_COUNTER)
+      m.value.counter = (counter_t)(i * 1000 + j);
+    else
+      m.value.gauge = (gauge_t)i + (gauge_t)j / 4.0;
+
+    char value[16];
+    ssnprintf(value, sizeof(value), "%d", j);
+    metric_label_set(&m, "instance", value);
+    metric_label_set(&m, "host", "example.com");
+    metric_family_metric_append(fam, m);
+    metric_reset(&m);
+  }
+
+  return fam;
+}
+
+static int expect_family(metric_family_t const *want,
+                         metric_family_t const *got) {
+  EXPECT_EQ_STR(want->name, got->name);
+  EXPECT_EQ_STR(want->help, got->help);
+  EXPECT_EQ_INT(want->type, got->type);
+  EXPECT_EQ_INT(want->metric.num, got->metric.num);
+
+  for (size_t i = 0; i < want->metric.num; i++) {
+    metric_t const *w = want->metric.ptr + i;
+    metric_t const *g = got->metric.ptr + i;
+
+    EXPECT_EQ_INT(w->label.num, g->label.num);
+    for (size_t j = 0; j < w->label.num; j++) {
+      EXPECT_EQ_STR(w->label.ptr[j].name, g->label.ptr[j].name);
+      EXPECT_EQ_STR(w->label.ptr[j].value, g->label.ptr[j].value);
+    }
+    EXPECT_EQ_UINT64(w->time, g->time);
+    EXPECT_EQ_UINT64(w->interval, g->interval);
+    if (want->type == METRIC_TYPE_COUNTER)
+      EXPECT_EQ_UINT64(w->value.counter, g->value.counter);
+    else if (want->type == METRIC_TYPE_DISTRIBUTION)
+      EXPECT_EQ_DOUBLE(distribution_total_sum(w->value.distribution),
+                       distribution_total_sum(g->value.distribution));
+    else
+      EXPECT_EQ_DOUBLE(w->value.gauge, g->value.gauge);
+  }
+
+  return 0;
+}
+
+/* Reads the next family from the spool and compares it with the family "i"
+ * created by make_family. */
+static int expect_next(write_spool_t *s, int i) {
+  metric_family_t *want = make_family(i);
+  metric_family_t *got = NULL;
+
+  CHECK_ZERO(write_spool_peek(s, &got));
+  int status = expect_family(want, got);
+  metric_family_free(got);
+  metric_family_free(want);
+  if (status != 0)
+    return status;
+
+  write_spool_consume(s);
+  return 0;
+}
+
+static void remove_spool_dir(void) {
+  char cmd[PATH_MAX + 16];
+  ssnprintf(cmd, sizeof(cmd), "rm -rf %s", spool_dir);
+  if (system(cmd) != 0)
+    printf("# removing %s failed\n", spool_dir);
+}
+
+DEF_TEST(append_peek) {
+  write_spool_t *s = write_spool_open(spool_dir, 1024 * 1024, 1024);
+  CHECK_NOT_NULL(s);
+  OK(write_spool_empty(s));
+
+  metric_family_t *got = NULL;
+  EXPECT_EQ_INT(ENOENT, write_spool_peek(s, &got));
+
+  for (int i = 0; i < 100; i++) {
+    metric_family_t *fam = make_family(i);
+    CHECK_ZERO(write_spool_append(s, fam));
+    metric_family_free(fam);
+  }
+  OK(!write_spool_empty(s));
+
+  write_spool_stats_t stats = write_spool_stats(s);
+  EXPECT_EQ_UINT64(100, stats.families);
+  EXPECT_EQ_UINT64(0, stats.dropped);
+  OK(stats.bytes > 0);
+
+  /* Peeking without consuming returns the same family. */
+  CHECK_ZERO(write_spool_peek(s, &got));
+  EXPECT_EQ_STR("test_family_0", got->name);
+  metric_family_free(got);
+
+  for (int i = 0; i < 40; i++)
+    CHECK_ZERO(expect_next(s, i));
+
+  /* Reopening continues at the read position. */
+  write_spool_close(s);
+  s = write_spool_open(spool_dir, 1024 * 1024, 1024);
+  CHECK_NOT_NULL(s);
+  EXPECT_EQ_UINT64(60, write_spool_stats(s).families);
+
+  for (int i = 40; i < 100; i++)
+    CHECK_ZERO(expect_next(s, i));
+  OK(write_spool_empty(s));
+  EXPECT_EQ_INT(ENOENT, write_spool_peek(s, &got));
+  EXPECT_EQ_UINT64(0, write_spool_stats(s).bytes);
+
+  write_spool_close(s);
+  return 0;
+}
+
+DEF_TEST(distribution) {
+  write_spool_t *s = write_spool_open(spool_dir, 1024 * 1024, 1024);
+  CHECK_NOT_NULL(s);
+
+  metric_family_t fam = {
+      .name = "test_distribution",
+      .type = METRIC_TYPE_DISTRIBUTION,
+  };
+  metric_t m = {.time = TIME_T_TO_CDTIME_T(1700000000)};
+  m.value.distribution = distribution_new_linear(10, 5);
+  distribution_update(m.value.distribution, 3);
+  distribution_update(m.value.distribution, 17);
+  metric_family_metric_append(&fam, m);
+  distribution_destroy(m.value.distribution);
+
+  CHECK_ZERO(write_spool_append(s, &fam));
+
+  metric_family_t *got = NULL;
+  CHECK_ZERO(write_spool_peek(s, &got));
+  CHECK_ZERO(expect_family(&fam, got));
+  EXPECT_EQ_INT(10, distribution_num_buckets(got->metric.ptr[0].value.distribution));
+  EXPECT_EQ_DOUBLE(
+      distribution_percentile(fam.metric.ptr[0].value.distribution, 90),
+      distribution_percentile(got->metric.ptr[0].value.distribution, 90));
+  metric_family_free(got);
+  write_spool_consume(s);
+
+  metric_family_metric_reset(&fam);
+  write_spool_close(s);
+  return 0;
+}
+
+DEF_TEST(max_size) {
+  /* Every segment holds a few families, the limit a few segments. */
+  write_spool_t *s = write_spool_open(spool_dir, 4096, 512);
+  CHECK_NOT_NULL(s);
+
+  for (int i = 0; i < 200; i++) {
+    metric_family_t *fam = make_family(i);
+    CHECK_ZERO(write_spool_append(s, fam));
+    metric_family_free(fam);
+  }
+
+  write_spool_stats_t stats = write_spool_stats(s);
+  OK(stats.bytes <= 4096 + 512 + 256);
+  OK(stats.dropped > 0);
+  EXPECT_EQ_UINT64(200, stats.families + stats.dropped);
+
+  /* The newest families are kept, in order. */
+  for (int i = (int)stats.dropped; i < 200; i++)
+    CHECK_ZERO(expect_next(s, i));
+  OK(write_spool_empty(s));
+
+  write_spool_close(s);
+  return 0;
+}
+
+DEF_TEST(truncated) {
+  write_spool_t *s = write_spool_open(spool_dir, 1024 * 1024, 1024 * 1024);
+  CHECK_NOT_NULL(s);
+  for (int i = 0; i < 3; i++) {
+    metric_family_t *fam = make_family(i);
+    CHECK_ZERO(write_spool_append(s, fam));
+    metric_family_free(fam);
+  }
+  write_spool_close(s);
+
+  /* Simulate a crash while writing the last record. */
+  char path[PATH_MAX];
+  ssnprintf(path, sizeof(path), "%s/%016x", spool_dir, 1);
+  struct stat st;
+  CHECK_ZERO(stat(path, &st));
+  CHECK_ZERO(truncate(path, st.st_size - 5));
+
+  s = write_spool_open(spool_dir, 1024 * 1024, 1024 * 1024);
+  CHECK_NOT_NULL(s);
+  EXPECT_EQ_UINT64(2, write_spool_stats(s).families);
+  CHECK_ZERO(expect_next(s, 0));
+  CHECK_ZERO(expect_next(s, 1));
+  OK(write_spool_empty(s));
+
+  write_spool_close(s);
+  return 0;
+}
+
+typedef struct {
+  char const *reject;
+  int fail;
+  int written[8];
+  size_t written_num;
+} replay_test_t;
+
+/* Rejects the family named "reject" with EINVAL, fails the next "fail" calls
+ * with EAGAIN and records the other families. */
+static int replay_test_write(metric_family_t const *fam, void *arg) {
+  replay_test_t *t = arg;
+
+  if (strcmp(fam->name, t->reject) == 0)
+    return EINVAL;
+  if (t->fail > 0) {
+    t->fail--;
+    return EAGAIN;
+  }
+  if (t->written_num >= STATIC_ARRAY_SIZE(t->written))
+    return ENOBUFS;
+
+  int i = -1;
+  sscanf(fam->name, "test_family_%d", &i);
+  t->written[t->written_num++] = i;
+  return 0;
+}
+
+DEF_TEST(replay) {
+  write_spool_t *s = write_spool_open(spool_dir, 1024 * 1024, 1024);
+  CHECK_NOT_NULL(s);
+  for (int i = 0; i < 5; i++) {
+    metric_family_t *fam = make_family(i);
+    CHECK_ZERO(write_spool_append(s, fam));
+    metric_family_free(fam);
+  }
+
+  OK(write_spool_rejected(EINVAL));
+  OK(!write_spool_rejected(EAGAIN));
+  OK(!write_spool_rejected(-1));
+
+  /* A family that is always rejected does not block the families after it. */
+  replay_test_t t = {.reject = "test_family_1"};
+  EXPECT_EQ_INT(0, write_spool_replay(s, 2, 0, replay_test_write, &t));
+  EXPECT_EQ_INT(1, t.written_num);
+  EXPECT_EQ_INT(0, t.written[0]);
+  EXPECT_EQ_UINT64(1, write_spool_stats(s).dropped);
+  EXPECT_EQ_UINT64(3, write_spool_stats(s).families);
+
+  /* Other errors stop the replay and the family is retried. */
+  t.fail = 1;
+  EXPECT_EQ_INT(EAGAIN, write_spool_replay(s, 0, 0, replay_test_write, &t));
+  EXPECT_EQ_INT(1, t.written_num);
+  EXPECT_EQ_UINT64(3, write_spool_stats(s).families);
+
+  EXPECT_EQ_INT(0, write_spool_replay(s, 0, 0, replay_test_write, &t));
+  EXPECT_EQ_INT(4, t.written_num);
+  for (size_t i = 1; i < t.written_num; i++)
+    EXPECT_EQ_INT((int)i + 1, t.written[i]);
+  OK(write_spool_empty(s));
+  EXPECT_EQ_UINT64(1, write_spool_stats(s).dropped);
+
+  write_spool_close(s);
+  return 0;
+}
+
+DEF_TEST(max_attempts) {
+  write_spool_t *s = write_spool_open(spool_dir, 1024 * 1024, 1024);
+  CHECK_NOT_NULL(s);
+  for (int i = 0; i < 2; i++) {
+    metric_family_t *fam = make_family(i);
+    CHECK_ZERO(write_spool_append(s, fam));
+    metric_family_free(fam);
+  }
+
+  /* A family that fails "max_attempts" times in a row is dropped. */
+  replay_test_t t = {.reject = "", .fail = 3};
+  EXPECT_EQ_INT(EAGAIN, write_spool_replay(s, 0, 3, replay_test_write, &t));
+  EXPECT_EQ_INT(EAGAIN, write_spool_replay(s, 0, 3, replay_test_write, &t));
+  EXPECT_EQ_UINT64(0, write_spool_stats(s).dropped);
+  EXPECT_EQ_INT(0, write_spool_replay(s, 0, 3, replay_test_write, &t));
+  EXPECT_EQ_UINT64(1, write_spool_stats(s).dropped);
+  EXPECT_EQ_INT(1, t.written_num);
+  EXPECT_EQ_INT(1, t.written[0]);
+  OK(write_spool_empty(s));
+
+  write_spool_close(s);
+  return 0;
+}
+
+int main(void) {
+  if (mkdtemp(spool_dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  RUN_TEST(append_peek);
+  RUN_TEST(distribution);
+  RUN_TEST(max_size);
+  RUN_TEST(truncated);
+  RUN_TEST(replay);
+  RUN_TEST(max_attempts);
+
+  remove_spool_dir();
+  END_TEST;
+}
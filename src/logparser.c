@@ -43,6 +43,7 @@
 #define LOGPARSER_SEVERITY_STR "Severity"
 
 #define MAX_STR_LEN 128
+#define LOGPARSER_BATCH_LINES 4096
 #define MAX_FIELDS 4 /* PluginInstance, Type, TypeInstance, Severity */
 
 #define START_IDX 0
@@ -79,6 +80,9 @@ typedef struct log_parser_s {
   size_t patterns_len;
   bool first_read;
   char *filename;
+  char *state_file;
+  int workers;
+  int batch_lines;
   char *def_plugin_inst;
   char *def_type;
   char *def_type_inst;
@@ -272,11 +276,18 @@ static int logparser_config_message(const oconfig_item_t *ci, char *filename,
   parser->first_read = first_read;
   parser->filename = filename;
   parser->def_severity = NOTIF_OKAY;
+  parser->batch_lines = LOGPARSER_BATCH_LINES;
 
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp("Match", child->key) == 0)
       ret = logparser_config_match(child, parser);
+    else if (strcasecmp("StateFile", child->key) == 0)
+      ret = cf_util_get_string(child, &parser->state_file);
+    else if (strcasecmp("Workers", child->key) == 0)
+      ret = cf_util_get_int(child, &parser->workers);
+    else if (strcasecmp("BatchLines", child->key) == 0)
+      ret = cf_util_get_int(child, &parser->batch_lines);
     else if (strcasecmp("DefaultPluginInstance", child->key) == 0)
       ret = cf_util_get_string(child, &parser->def_plugin_inst);
     else if (strcasecmp("DefaultType", child->key) == 0)
@@ -306,6 +317,10 @@ static int logparser_config_message(const oconfig_item_t *ci, char *filename,
       goto error;
     }
   }
+  if ((parser->workers < 0) || (parser->batch_lines < 1)) {
+    ERROR(PLUGIN_NAME ": Invalid Workers or BatchLines in %s.", msg_name);
+    goto error;
+  }
   logparser_ctx.parsers_len++;
 
   return 0;
@@ -534,6 +549,24 @@ static int logparser_init(void) {
       logparser_shutdown();
       return -1;
     }
+
+    if ((parser->state_file != NULL) &&
+        (message_parser_set_state_file(parser->job, parser->state_file) !=
+         0)) {
+      ERROR(PLUGIN_NAME ": Failed to set the state file of %s parser.",
+            parser->name);
+      logparser_shutdown();
+      return -1;
+    }
+
+    if ((parser->workers > 0) &&
+        (message_parser_set_workers(parser->job, (size_t)parser->workers,
+                                    (size_t)parser->batch_lines) != 0)) {
+      ERROR(PLUGIN_NAME ": Failed to start the workers of %s parser.",
+            parser->name);
+      logparser_shutdown();
+      return -1;
+    }
   }
 
   return 0;
@@ -681,6 +714,7 @@ static int logparser_shutdown(void) {
 
     sfree(parser->patterns);
     sfree(parser->filename);
+    sfree(parser->state_file);
     sfree(parser->def_plugin_inst);
     sfree(parser->def_type);
     sfree(parser->def_type_inst);
@@ -41,6 +41,9 @@
 #if HAVE_NETINET_IN_H
 #include <netinet/in.h>
 #endif
+#if HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
 #if HAVE_ARPA_INET_H
 #include <arpa/inet.h>
 #endif
@@ -74,6 +77,11 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 #endif
 #endif
 
+#if HAVE_LIBSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#endif
+
 #ifndef IPV6_ADD_MEMBERSHIP
 #ifdef IPV6_JOIN_GROUP
 #define IPV6_ADD_MEMBERSHIP IPV6_JOIN_GROUP
@@ -100,6 +108,55 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 #define SECURITY_LEVEL_SIGN 1
 #define SECURITY_LEVEL_ENCRYPT 2
 #endif
+
+#define PROTOCOL_UDP 0
+#define PROTOCOL_TCP 1
+
+/* Encoding of the metrics sent to a server: the metric family parts, or the
+ * value list parts understood by older versions. */
+#define FORMAT_METRIC_FAMILY 0
+#define FORMAT_VALUE_LIST 1
+#define FORMAT_NUM 2
+#define FORMAT_ANY -1
+
+/* Packets sent with the TCP protocol are kept in a queue of frames until the
+ * server has acknowledged them. The frame data starts with space for the frame
+ * header, which is filled in when the frame is sent. */
+typedef struct stream_frame_s {
+  struct stream_frame_s *next;
+  uint64_t seq;
+  size_t size;
+  char data[];
+} stream_frame_t;
+
+struct stream_client {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  /* Frames which have not been sent yet. */
+  stream_frame_t *head;
+  stream_frame_t *tail;
+  /* Size of all frames which have not been acknowledged yet. */
+  size_t queue_size;
+  size_t max_queue_size;
+  size_t max_pending;
+  size_t connections_num;
+  cdtime_t timeout;
+  pthread_t *threads;
+  size_t threads_num;
+  bool shutdown;
+};
+
+#if HAVE_LIBSSL
+struct sockent_tls {
+  bool enabled;
+  bool verify_peer;
+  char *ca_file;
+  char *cert_file;
+  char *key_file;
+  SSL_CTX *ctx;
+};
+#endif
+
 struct sockent_client {
   int fd;
   struct sockaddr_storage *addr;
@@ -114,6 +171,8 @@ struct sockent_client {
   cdtime_t next_resolve_reconnect;
   cdtime_t resolve_interval;
   struct sockaddr_storage *bind_addr;
+  int format;
+  struct stream_client stream;
 };
 
 struct sockent_server {
@@ -135,6 +194,10 @@ typedef struct sockent {
   char *node;
   char *service;
   int interface;
+  int protocol;
+#if HAVE_LIBSSL
+  struct sockent_tls tls;
+#endif
 
   union {
     struct sockent_client client;
@@ -207,6 +270,40 @@ struct part_values_s {
 };
 typedef struct part_values_s part_values_t;
 
+/*                      1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-------------------------------+-------------------------------+
+ * ! Type                          ! Length                        !
+ * +-------------------------------+-------------------------------+
+ * : Name0 \0 Value0 \0 Name1 \0 Value1 \0 ...                     :
+ * +---------------------------------------------------------------+
+ *
+ * The labels part holds zero or more pairs of null terminated strings.
+ */
+
+/*                      1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-------------------------------+-------------------------------+
+ * ! Type                          ! Length                        !
+ * +-------------------------------+-------------------------------+
+ * ! Num of buckets                !                               :
+ * +-------------------------------+                               :
+ * : Maximum0 (double), Counter0 (64 bit), Maximum1, Counter1, ... :
+ * +---------------------------------------------------------------+
+ * ! Sum (double)                                                  !
+ * !                                                               !
+ * +---------------------------------------------------------------+
+ * ! Sum of squares (double)                                       !
+ * !                                                               !
+ * +---------------------------------------------------------------+
+ *
+ * The metric part holds a single 64 bit value, a counter or a gauge depending
+ * on the type of the current family, encoded like in the values part.
+ */
+#define PART_DISTRIBUTION_SIZE(num_buckets)                                    \
+  (sizeof(part_header_t) + sizeof(uint16_t) +                                  \
+   (num_buckets) * (sizeof(double) + sizeof(uint64_t)) + 2 * sizeof(double))
+
 /*                      1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3
  *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
  * +-------------------------------+-------------------------------+
@@ -252,6 +349,44 @@ struct part_encryption_aes256_s {
 };
 typedef struct part_encryption_aes256_s part_encryption_aes256_t;
 
+/*                      1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +---------------------------------------------------------------+
+ * ! Packet length                                                 !
+ * +---------------------------------------------------------------+
+ * ! Sequence number                                               !
+ * !                                                               !
+ * +---------------------------------------------------------------+
+ * : Packet                                                        :
+ * +---------------------------------------------------------------+
+ *
+ * With the TCP protocol, each packet is sent as a frame. The server answers
+ * with the 64 bit sequence number of the last frame it has dispatched, which
+ * acknowledges that frame and all frames before it. Sequence numbers start at
+ * one for each connection.
+ */
+#define STREAM_HEADER_SIZE 12
+#define STREAM_ACK_SIZE 8
+#define STREAM_MAX_PACKET_SIZE (65535 + BUFF_SIG_SIZE)
+#define STREAM_BUFFER_SIZE (2 * (STREAM_HEADER_SIZE + STREAM_MAX_PACKET_SIZE))
+
+typedef struct {
+  int fd;
+#if HAVE_LIBSSL
+  SSL *ssl;
+#endif
+} stream_conn_t;
+
+/* A connection accepted on a TCP "Listen" socket. */
+typedef struct stream_connection_s {
+  sockent_t *se;
+  stream_conn_t conn;
+  struct sockaddr_storage peer;
+  pthread_t thread;
+  bool done;
+  struct stream_connection_s *next;
+} stream_connection_t;
+
 struct receive_list_entry_s {
   char *data;
   int data_len;
@@ -290,20 +425,45 @@ static pthread_t receive_thread_id;
 static int dispatch_thread_running;
 static pthread_t dispatch_thread_id;
 
-/* Buffer in which to-be-sent network packets are constructed. */
-static char *send_buffer;
-static char *send_buffer_ptr;
-static int send_buffer_fill;
-static cdtime_t send_buffer_last_update;
-static value_list_t send_buffer_vl = VALUE_LIST_INIT;
+/* TCP listen sockets and the connections accepted on them. Connections are
+ * handled by one thread each. */
+static sockent_t *stream_listen_sockets;
+static stream_connection_t *stream_connections;
+static pthread_mutex_t stream_connections_lock = PTHREAD_MUTEX_INITIALIZER;
+static int stream_thread_running;
+static pthread_t stream_thread_id;
+
+/* parse_packet is called by the dispatch thread and by the threads handling
+ * TCP connections. It uses the cypher of the socket entry and updates the
+ * statistics, so calls are serialized: received packets are parsed and
+ * dispatched one at a time, no matter how many connections are open. */
+static pthread_mutex_t parse_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Buffers in which to-be-sent network packets are constructed, one for each
+ * format used by a server. */
+typedef struct {
+  char *buffer;
+  char *ptr;
+  int fill;
+  cdtime_t last_update;
+  /* Family and metric written last to the buffer. Parts which are equal to
+   * those of the previous metric are not repeated. The pointers are only valid
+   * during a call of network_write. */
+  metric_family_t const *fam;
+  metric_t const *metric;
+  cdtime_t time;
+  cdtime_t interval;
+  /* Identifier written last in the value list format. */
+  value_list_t vl;
+} send_buffer_t;
+static send_buffer_t send_buffers[FORMAT_NUM];
 static pthread_mutex_t send_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* XXX: These counters are incremented from one place only. The spot in which
  * the values are incremented is either only reachable by one thread (the
- * dispatch thread, for example) or locked by some lock (send_buffer_lock for
- * example). Only if neither is true, the stats_lock is acquired. The counters
- * are always read without holding a lock in the hope that writing 8 bytes to
- * memory is an atomic operation. */
+ * dispatch thread, for example) or locked by some lock (send_buffer_lock or
+ * parse_lock, for example). The counters are always read without holding a
+ * lock in the hope that writing 8 bytes to memory is an atomic operation. */
 static derive_t stats_octets_rx;
 static derive_t stats_octets_tx;
 static derive_t stats_packets_rx;
@@ -312,27 +472,26 @@ static derive_t stats_values_dispatched;
 static derive_t stats_values_not_dispatched;
 static derive_t stats_values_sent;
 static derive_t stats_values_not_sent;
-static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /*
  * Private functions
  */
-static bool check_receive_okay(const value_list_t *vl) /* {{{ */
+static bool check_receive_okay(metric_t const *m) /* {{{ */
 {
   uint64_t time_sent = 0;
   int status;
 
-  status = uc_meta_data_get_unsigned_int(vl, "network:time_sent", &time_sent);
+  status = uc_meta_data_get_unsigned_int(m, "network:time_sent", &time_sent);
 
   /* This is a value we already sent. Don't allow it to be received again in
    * order to avoid looping. */
-  if ((status == 0) && (time_sent >= ((uint64_t)vl->time)))
+  if ((status == 0) && (time_sent >= ((uint64_t)m->time)))
     return 0;
 
   return 1;
 } /* }}} bool check_receive_okay */
 
-static bool check_send_okay(const value_list_t *vl) /* {{{ */
+static bool check_send_okay(metric_t const *m) /* {{{ */
 {
   bool received = 0;
   int status;
@@ -340,10 +499,10 @@ static bool check_send_okay(const value_list_t *vl) /* {{{ */
   if (network_config_forward)
     return 1;
 
-  if (vl->meta == NULL)
+  if (m->meta == NULL)
     return 1;
 
-  status = meta_data_get_boolean(vl->meta, "network:received", &received);
+  status = meta_data_get_boolean(m->meta, "network:received", &received);
   if (status == -ENOENT)
     return 1;
   else if (status != 0) {
@@ -393,51 +552,31 @@ static bool check_send_notify_okay(const notification_t *n) /* {{{ */
   return !received;
 } /* }}} bool check_send_notify_okay */
 
-static int network_dispatch_values(value_list_t *vl, /* {{{ */
-                                   const char *username,
-                                   struct sockaddr_storage *address) {
+/* network_received_meta returns the meta data added to received values and
+ * metrics. */
+static meta_data_t *network_received_meta(const char *username, /* {{{ */
+                                          struct sockaddr_storage *address) {
   int status;
 
-  if ((vl->time == 0) || (strlen(vl->host) == 0) || (strlen(vl->plugin) == 0) ||
-      (strlen(vl->type) == 0))
-    return -EINVAL;
-
-  if (!check_receive_okay(vl)) {
-#if COLLECT_DEBUG
-    char name[6 * DATA_MAX_NAME_LEN];
-    FORMAT_VL(name, sizeof(name), vl);
-    name[sizeof(name) - 1] = '\0';
-    DEBUG("network plugin: network_dispatch_values: "
-          "NOT dispatching %s.",
-          name);
-#endif
-    stats_values_not_dispatched++;
-    return 0;
-  }
-
-  assert(vl->meta == NULL);
-
-  vl->meta = meta_data_create();
-  if (vl->meta == NULL) {
+  meta_data_t *meta = meta_data_create();
+  if (meta == NULL) {
     ERROR("network plugin: meta_data_create failed.");
-    return -ENOMEM;
+    return NULL;
   }
 
-  status = meta_data_add_boolean(vl->meta, "network:received", 1);
+  status = meta_data_add_boolean(meta, "network:received", 1);
   if (status != 0) {
     ERROR("network plugin: meta_data_add_boolean failed.");
-    meta_data_destroy(vl->meta);
-    vl->meta = NULL;
-    return status;
+    meta_data_destroy(meta);
+    return NULL;
   }
 
   if (username != NULL) {
-    status = meta_data_add_string(vl->meta, "network:username", username);
+    status = meta_data_add_string(meta, "network:username", username);
     if (status != 0) {
       ERROR("network plugin: meta_data_add_string failed.");
-      meta_data_destroy(vl->meta);
-      vl->meta = NULL;
-      return status;
+      meta_data_destroy(meta);
+      return NULL;
     }
   }
 
@@ -448,20 +587,37 @@ static int network_dispatch_values(value_list_t *vl, /* {{{ */
                          NULL, 0, NI_NUMERICHOST | NI_NUMERICSERV);
     if (status != 0) {
       ERROR("network plugin: getnameinfo failed: %s", gai_strerror(status));
-      meta_data_destroy(vl->meta);
-      vl->meta = NULL;
-      return status;
+      meta_data_destroy(meta);
+      return NULL;
     }
 
-    status = meta_data_add_string(vl->meta, "network:ip_address", host);
+    status = meta_data_add_string(meta, "network:ip_address", host);
     if (status != 0) {
       ERROR("network plugin: meta_data_add_string failed.");
-      meta_data_destroy(vl->meta);
-      vl->meta = NULL;
-      return status;
+      meta_data_destroy(meta);
+      return NULL;
     }
   }
 
+  return meta;
+} /* }}} meta_data_t *network_received_meta */
+
+/* network_dispatch_values dispatches values received in the format of
+ * collectd. Values sent by this plugin use the metric family parts, so these
+ * values cannot loop back and are not checked with check_receive_okay. */
+static int network_dispatch_values(value_list_t *vl, /* {{{ */
+                                   const char *username,
+                                   struct sockaddr_storage *address) {
+  if ((vl->time == 0) || (strlen(vl->host) == 0) || (strlen(vl->plugin) == 0) ||
+      (strlen(vl->type) == 0))
+    return -EINVAL;
+
+  assert(vl->meta == NULL);
+
+  vl->meta = network_received_meta(username, address);
+  if (vl->meta == NULL)
+    return -ENOMEM;
+
   plugin_dispatch_values(vl);
   stats_values_dispatched++;
 
@@ -471,6 +627,34 @@ static int network_dispatch_values(value_list_t *vl, /* {{{ */
   return 0;
 } /* }}} int network_dispatch_values */
 
+/* network_dispatch_family dispatches the metrics received for "fam" and
+ * removes them from the family. */
+static int network_dispatch_family(metric_family_t *fam, /* {{{ */
+                                   const char *username,
+                                   struct sockaddr_storage *address) {
+  if (fam->metric.num == 0)
+    return 0;
+
+  meta_data_t *meta = network_received_meta(username, address);
+  if (meta == NULL) {
+    metric_family_metric_reset(fam);
+    return -ENOMEM;
+  }
+
+  for (size_t i = 0; i < fam->metric.num; i++) {
+    metric_t *m = fam->metric.ptr + i;
+    meta_data_destroy(m->meta);
+    m->meta = meta_data_clone(meta);
+  }
+  meta_data_destroy(meta);
+
+  plugin_dispatch_metric_family(fam);
+  stats_values_dispatched += (derive_t)fam->metric.num;
+
+  metric_family_metric_reset(fam);
+  return 0;
+} /* }}} int network_dispatch_family */
+
 static int network_dispatch_notification(notification_t *n) /* {{{ */
 {
   int status;
@@ -597,93 +781,68 @@ static gcry_cipher_hd_t network_get_aes256_cypher(sockent_t *se, /* {{{ */
 } /* }}} int network_get_aes256_cypher */
 #endif /* HAVE_GCRYPT_H */
 
+/* write_part_values writes a values part holding the single value "value" of
+ * type "ds_type". */
 static int write_part_values(char **ret_buffer, size_t *ret_buffer_len,
-                             const data_set_t *ds, const value_list_t *vl) {
-  char *packet_ptr;
-  size_t packet_len;
-  int num_values;
-
+                             int ds_type, value_t value) {
   part_header_t pkg_ph;
   uint16_t pkg_num_values;
-  uint8_t *pkg_values_types;
-  value_t *pkg_values;
-
-  size_t offset;
+  uint8_t pkg_values_type;
+  value_t pkg_value;
 
-  num_values = vl->values_len;
-  packet_len = sizeof(part_header_t) + sizeof(uint16_t) +
-               (num_values * sizeof(uint8_t)) + (num_values * sizeof(value_t));
+  size_t packet_len = sizeof(pkg_ph) + sizeof(pkg_num_values) +
+                      sizeof(pkg_values_type) + sizeof(pkg_value);
 
   if (*ret_buffer_len < packet_len)
     return -1;
 
-  pkg_values_types = malloc(num_values * sizeof(*pkg_values_types));
-  if (pkg_values_types == NULL) {
-    ERROR("network plugin: write_part_values: malloc failed.");
-    return -1;
-  }
-
-  pkg_values = malloc(num_values * sizeof(*pkg_values));
-  if (pkg_values == NULL) {
-    free(pkg_values_types);
-    ERROR("network plugin: write_part_values: malloc failed.");
-    return -1;
-  }
-
   pkg_ph.type = htons(TYPE_VALUES);
   pkg_ph.length = htons(packet_len);
 
-  pkg_num_values = htons((uint16_t)vl->values_len);
+  pkg_num_values = htons(1);
+  pkg_values_type = (uint8_t)ds_type;
 
-  for (int i = 0; i < num_values; i++) {
-    pkg_values_types[i] = (uint8_t)ds->ds[i].type;
-    switch (ds->ds[i].type) {
-    case DS_TYPE_COUNTER:
-      pkg_values[i].counter = htonll(vl->values[i].counter);
-      break;
+  switch (ds_type) {
+  case DS_TYPE_COUNTER:
+    pkg_value.counter = htonll(value.counter);
+    break;
 
-    case DS_TYPE_GAUGE:
-      pkg_values[i].gauge = htond(vl->values[i].gauge);
-      break;
+  case DS_TYPE_GAUGE:
+    pkg_value.gauge = htond(value.gauge);
+    break;
 
-    case DS_TYPE_DERIVE:
-      pkg_values[i].derive = htonll(vl->values[i].derive);
-      break;
+  case DS_TYPE_DERIVE:
+    pkg_value.derive = htonll(value.derive);
+    break;
 
-    default:
-      free(pkg_values_types);
-      free(pkg_values);
-      ERROR("network plugin: write_part_values: "
-            "Unknown data source type: %i",
-            ds->ds[i].type);
-      return -1;
-    } /* switch (ds->ds[i].type) */
-  }   /* for (num_values) */
+  default:
+    ERROR("network plugin: write_part_values: "
+          "Unknown data source type: %i",
+          ds_type);
+    return -1;
+  }
 
   /*
    * Use `memcpy' to write everything to the buffer, because the pointer
    * may be unaligned and some architectures, such as SPARC, can't handle
    * that.
    */
-  packet_ptr = *ret_buffer;
-  offset = 0;
+  char *packet_ptr = *ret_buffer;
+  size_t offset = 0;
   memcpy(packet_ptr + offset, &pkg_ph, sizeof(pkg_ph));
   offset += sizeof(pkg_ph);
   memcpy(packet_ptr + offset, &pkg_num_values, sizeof(pkg_num_values));
   offset += sizeof(pkg_num_values);
-  memcpy(packet_ptr + offset, pkg_values_types, num_values * sizeof(uint8_t));
-  offset += num_values * sizeof(uint8_t);
-  memcpy(packet_ptr + offset, pkg_values, num_values * sizeof(value_t));
-  offset += num_values * sizeof(value_t);
+  memcpy(packet_ptr + offset, &pkg_values_type, sizeof(pkg_values_type));
+  offset += sizeof(pkg_values_type);
+  memcpy(packet_ptr + offset, &pkg_value, sizeof(pkg_value));
+  offset += sizeof(pkg_value);
 
   assert(offset == packet_len);
 
   *ret_buffer = packet_ptr + packet_len;
   *ret_buffer_len -= packet_len;
 
-  free(pkg_values_types);
-  free(pkg_values);
-
   return 0;
 } /* int write_part_values */
 
@@ -757,6 +916,132 @@ static int write_part_string(char **ret_buffer, size_t *ret_buffer_len,
   return 0;
 } /* int write_part_string */
 
+static int write_part_labels(char **ret_buffer, size_t *ret_buffer_len,
+                             label_set_t labels) {
+  part_header_t pkg_head;
+  size_t buffer_len = sizeof(pkg_head);
+
+  for (size_t i = 0; i < labels.num; i++)
+    buffer_len += strlen(labels.ptr[i].name) + strlen(labels.ptr[i].value) + 2;
+
+  if ((*ret_buffer_len < buffer_len) || (buffer_len > UINT16_MAX))
+    return -1;
+
+  pkg_head.type = htons(TYPE_LABELS);
+  pkg_head.length = htons((uint16_t)buffer_len);
+
+  char *buffer = *ret_buffer;
+  size_t offset = 0;
+  memcpy(buffer + offset, &pkg_head, sizeof(pkg_head));
+  offset += sizeof(pkg_head);
+  for (size_t i = 0; i < labels.num; i++) {
+    size_t len = strlen(labels.ptr[i].name) + 1;
+    memcpy(buffer + offset, labels.ptr[i].name, len);
+    offset += len;
+
+    len = strlen(labels.ptr[i].value) + 1;
+    memcpy(buffer + offset, labels.ptr[i].value, len);
+    offset += len;
+  }
+
+  assert(offset == buffer_len);
+
+  *ret_buffer = buffer + buffer_len;
+  *ret_buffer_len -= buffer_len;
+
+  return 0;
+} /* int write_part_labels */
+
+static int write_part_metric(char **ret_buffer, size_t *ret_buffer_len,
+                             metric_type_t type, value_t value) {
+  switch (type) {
+  case METRIC_TYPE_COUNTER:
+    return write_part_number(ret_buffer, ret_buffer_len, TYPE_METRIC,
+                             (uint64_t)value.counter);
+  case METRIC_TYPE_GAUGE:
+  case METRIC_TYPE_UNTYPED: {
+    /* Gauges are stored in x86 byte order, like in the values part. */
+    part_header_t pkg_head;
+    gauge_t pkg_value = htond(value.gauge);
+    size_t packet_len = sizeof(pkg_head) + sizeof(pkg_value);
+
+    if (*ret_buffer_len < packet_len)
+      return -1;
+
+    pkg_head.type = htons(TYPE_METRIC);
+    pkg_head.length = htons(packet_len);
+
+    memcpy(*ret_buffer, &pkg_head, sizeof(pkg_head));
+    memcpy(*ret_buffer + sizeof(pkg_head), &pkg_value, sizeof(pkg_value));
+
+    *ret_buffer += packet_len;
+    *ret_buffer_len -= packet_len;
+    return 0;
+  }
+  case METRIC_TYPE_DISTRIBUTION:
+    break;
+  }
+
+  ERROR("network plugin: write_part_metric: Unknown metric type: %d",
+        (int)type);
+  return -1;
+} /* int write_part_metric */
+
+static int write_part_distribution(char **ret_buffer, size_t *ret_buffer_len,
+                                   distribution_t *dist) {
+  if (dist == NULL)
+    return -1;
+
+  buckets_array_t buckets = get_buckets(dist);
+  if (buckets.buckets == NULL) {
+    ERROR("network plugin: write_part_distribution: get_buckets failed.");
+    return -1;
+  }
+
+  size_t packet_len = PART_DISTRIBUTION_SIZE(buckets.num_buckets);
+  if ((*ret_buffer_len < packet_len) || (packet_len > UINT16_MAX)) {
+    destroy_buckets_array(buckets);
+    return -1;
+  }
+
+  part_header_t pkg_head = {
+      .type = htons(TYPE_METRIC_DISTRIBUTION),
+      .length = htons((uint16_t)packet_len),
+  };
+  uint16_t pkg_num_buckets = htons((uint16_t)buckets.num_buckets);
+
+  char *buffer = *ret_buffer;
+  size_t offset = 0;
+  memcpy(buffer + offset, &pkg_head, sizeof(pkg_head));
+  offset += sizeof(pkg_head);
+  memcpy(buffer + offset, &pkg_num_buckets, sizeof(pkg_num_buckets));
+  offset += sizeof(pkg_num_buckets);
+
+  for (size_t i = 0; i < buckets.num_buckets; i++) {
+    double maximum = htond(buckets.buckets[i].maximum);
+    uint64_t counter = htonll(buckets.buckets[i].bucket_counter);
+    memcpy(buffer + offset, &maximum, sizeof(maximum));
+    offset += sizeof(maximum);
+    memcpy(buffer + offset, &counter, sizeof(counter));
+    offset += sizeof(counter);
+  }
+  destroy_buckets_array(buckets);
+
+  double sum = htond(distribution_total_sum(dist));
+  double squares_sum = htond(distribution_squares_sum(dist));
+  memcpy(buffer + offset, &sum, sizeof(sum));
+  offset += sizeof(sum);
+  memcpy(buffer + offset, &squares_sum, sizeof(squares_sum));
+  offset += sizeof(squares_sum);
+
+  assert(offset == packet_len);
+
+  *ret_buffer = buffer + packet_len;
+  *ret_buffer_len -= packet_len;
+
+  return 0;
+} /* int write_part_distribution */
+
 static int parse_part_values(void **ret_buffer, size_t *ret_buffer_len,
                              value_t **ret_values, size_t *ret_num_values) {
   char *buffer = *ret_buffer;
@@ -888,6 +1173,13 @@ static int parse_part_number(void **ret_buffer, size_t *ret_buffer_len,
   buffer += sizeof(tmp16);
   pkg_length = ntohs(tmp16);
 
+  if (pkg_length != exp_size) {
+    WARNING("network plugin: parse_part_number: "
+            "Invalid part length %" PRIu16 ".",
+            pkg_length);
+    return -1;
+  }
+
   memcpy((void *)&tmp64, buffer, sizeof(tmp64));
   buffer += sizeof(tmp64);
   *value = ntohll(tmp64);
@@ -982,6 +1274,216 @@ static int parse_part_string(void **ret_buffer, size_t *ret_buffer_len,
   return 0;
 } /* int parse_part_string */
 
+/* parse_part_payload returns the payload of the part at the start of the
+ * buffer and advances the buffer to the next part. */
+static int parse_part_payload(void **ret_buffer, size_t *ret_buffer_len,
+                              char **ret_payload, size_t *ret_payload_size) {
+  char *buffer = *ret_buffer;
+  size_t buffer_len = *ret_buffer_len;
+
+  uint16_t tmp16;
+  uint16_t pkg_length;
+
+  if (buffer_len < sizeof(part_header_t)) {
+    WARNING("network plugin: parse_part_payload: "
+            "Packet too short: "
+            "Chunk of at least size %" PRIsz " expected, "
+            "but buffer has only %" PRIsz " bytes left.",
+            sizeof(part_header_t), buffer_len);
+    return -1;
+  }
+
+  memcpy((void *)&tmp16, buffer + sizeof(tmp16), sizeof(tmp16));
+  pkg_length = ntohs(tmp16);
+
+  if ((pkg_length > buffer_len) || (pkg_length < sizeof(part_header_t))) {
+    WARNING("network plugin: parse_part_payload: "
+            "Invalid part length %" PRIu16 ", "
+            "buffer has %" PRIsz " bytes left.",
+            pkg_length, buffer_len);
+    return -1;
+  }
+
+  *ret_payload = buffer + sizeof(part_header_t);
+  *ret_payload_size = (size_t)pkg_length - sizeof(part_header_t);
+
+  *ret_buffer = buffer + pkg_length;
+  *ret_buffer_len = buffer_len - pkg_length;
+
+  return 0;
+} /* int parse_part_payload */
+
+/* parse_part_string_dup is like parse_part_string for strings of any length.
+ * The returned string must be freed by the caller. */
+static int parse_part_string_dup(void **ret_buffer, size_t *ret_buffer_len,
+                                 char **ret_string) {
+  char *payload;
+  size_t payload_size;
+
+  int status =
+      parse_part_payload(ret_buffer, ret_buffer_len, &payload, &payload_size);
+  if (status != 0)
+    return status;
+
+  if ((payload_size == 0) || (payload[payload_size - 1] != 0) ||
+      (strlen(payload) != payload_size - 1)) {
+    WARNING("network plugin: parse_part_string_dup: "
+            "Received string is not null terminated.");
+    return -1;
+  }
+
+  *ret_string = strdup(payload);
+  if (*ret_string == NULL) {
+    ERROR("network plugin: parse_part_string_dup: strdup failed.");
+    return -1;
+  }
+
+  return 0;
+} /* int parse_part_string_dup */
+
+static int parse_part_labels(void **ret_buffer, size_t *ret_buffer_len,
+                             label_set_t *labels) {
+  char *payload;
+  size_t payload_size;
+
+  int status =
+      parse_part_payload(ret_buffer, ret_buffer_len, &payload, &payload_size);
+  if (status != 0)
+    return status;
+
+  label_set_reset(labels);
+
+  char *end = payload + payload_size;
+  while (payload < end) {
+    char *name = payload;
+    char *name_end = memchr(name, 0, (size_t)(end - name));
+    if ((name_end == NULL) || (name_end == name))
+      break;
+
+    char *value = name_end + 1;
+    char *value_end = memchr(value, 0, (size_t)(end - value));
+    if ((value_end == NULL) || (value_end == value))
+      break;
+
+    if (label_set_add(labels, name, value) != 0)
+      break;
+
+    payload = value_end + 1;
+  }
+
+  if (payload != end) {
+    WARNING("network plugin: parse_part_labels: Received invalid labels.");
+    label_set_reset(labels);
+    return -1;
+  }
+
+  return 0;
+} /* int parse_part_labels */
+
+static int parse_part_metric(void **ret_buffer, size_t *ret_buffer_len,
+                             metric_type_t type, value_t *ret_value) {
+  char *payload;
+  size_t payload_size;
+
+  int status =
+      parse_part_payload(ret_buffer, ret_buffer_len, &payload, &payload_size);
+  if (status != 0)
+    return status;
+
+  if (payload_size != sizeof(uint64_t)) {
+    WARNING("network plugin: parse_part_metric: "
+            "Received value of %" PRIsz " bytes.",
+            payload_size);
+    return -1;
+  }
+
+  switch (type) {
+  case METRIC_TYPE_COUNTER: {
+    uint64_t tmp64;
+    memcpy(&tmp64, payload, sizeof(tmp64));
+    ret_value->counter = (counter_t)ntohll(tmp64);
+    return 0;
+  }
+  case METRIC_TYPE_GAUGE:
+  case METRIC_TYPE_UNTYPED: {
+    gauge_t tmp;
+    memcpy(&tmp, payload, sizeof(tmp));
+    ret_value->gauge = (gauge_t)ntohd(tmp);
+    return 0;
+  }
+  case METRIC_TYPE_DISTRIBUTION:
+    break;
+  }
+
+  WARNING("network plugin: parse_part_metric: "
+          "Received a value for a family of type %d.",
+          (int)type);
+  return -1;
+} /* int parse_part_metric */
+
+static int parse_part_distribution(void **ret_buffer, size_t *ret_buffer_len,
+                                   distribution_t **ret_dist) {
+  char *payload;
+  size_t payload_size;
+
+  int status =
+      parse_part_payload(ret_buffer, ret_buffer_len, &payload, &payload_size);
+  if (status != 0)
+    return status;
+
+  uint16_t tmp16 = 0;
+  if (payload_size >= sizeof(tmp16))
+    memcpy(&tmp16, payload, sizeof(tmp16));
+  size_t num_buckets = (size_t)ntohs(tmp16);
+
+  if ((num_buckets == 0) ||
+      (payload_size + sizeof(part_header_t) !=
+       PART_DISTRIBUTION_SIZE(num_buckets))) {
+    WARNING("network plugin: parse_part_distribution: "
+            "Length and number of buckets in the packet don't match.");
+    return -1;
+  }
+  payload += sizeof(tmp16);
+
+  buckets_array_t buckets = {
+      .num_buckets = num_buckets,
+      .buckets = calloc(num_buckets, sizeof(*buckets.buckets)),
+  };
+  if (buckets.buckets == NULL) {
+    ERROR("network plugin: parse_part_distribution: calloc failed.");
+    return -1;
+  }
+
+  for (size_t i = 0; i < num_buckets; i++) {
+    double maximum;
+    uint64_t counter;
+    memcpy(&maximum, payload, sizeof(maximum));
+    payload += sizeof(maximum);
+    memcpy(&counter, payload, sizeof(counter));
+    payload += sizeof(counter);
+
+    buckets.buckets[i].maximum = ntohd(maximum);
+    buckets.buckets[i].bucket_counter = ntohll(counter);
+  }
+
+  double sum;
+  double squares_sum;
+  memcpy(&sum, payload, sizeof(sum));
+  payload += sizeof(sum);
+  memcpy(&squares_sum, payload, sizeof(squares_sum));
+
+  *ret_dist =
+      distribution_new_buckets(buckets, ntohd(sum), ntohd(squares_sum));
+  destroy_buckets_array(buckets);
+  if (*ret_dist == NULL) {
+    WARNING("network plugin: parse_part_distribution: "
+            "Received invalid buckets.");
+    return -1;
+  }
+
+  return 0;
+} /* int parse_part_distribution */
+
 /* Forward declaration: parse_part_sign_sha256 and parse_part_encr_aes256 call
  * parse_packet and vice versa. */
 #define PP_SIGNED 0x01
@@ -1326,7 +1828,38 @@ static int parse_part_encr_aes256(sockent_t *se, /* {{{ */
 } /* }}} int parse_part_encr_aes256 */
 #endif /* !HAVE_GCRYPT_H */
 
-#undef BUFFER_READ
+#undef BUFFER_READ
+
+/* network_receive_metric adds a metric received with the metric family parts
+ * to "fam". */
+static void network_receive_metric(metric_family_t *fam, /* {{{ */
+                                   label_set_t labels, cdtime_t time,
+                                   cdtime_t interval, value_t value) {
+  metric_t m = {
+      .family = fam,
+      .label = labels,
+      .time = time,
+      .interval = interval,
+      .value = value,
+  };
+
+  if ((fam->name == NULL) || (time == 0)) {
+    INFO("network plugin: Ignoring metric without family or time.");
+    stats_values_not_dispatched++;
+    return;
+  }
+
+  if (!check_receive_okay(&m)) {
+    DEBUG("network plugin: network_receive_metric: "
+          "NOT dispatching a metric of %s.",
+          fam->name);
+    stats_values_not_dispatched++;
+    return;
+  }
+
+  if (metric_family_metric_append(fam, m) != 0)
+    ERROR("network plugin: metric_family_metric_append failed.");
+} /* }}} void network_receive_metric */
 
 static int parse_packet(sockent_t *se, /* {{{ */
                         void *buffer, size_t buffer_size, int flags,
@@ -1337,6 +1870,11 @@ static int parse_packet(sockent_t *se, /* {{{ */
   value_list_t vl = VALUE_LIST_INIT;
   notification_t n = {0};
 
+  /* Metrics are collected until the family changes or the end of the packet
+   * and dispatched together. */
+  metric_family_t fam = {.type = METRIC_TYPE_UNTYPED};
+  label_set_t labels = {0};
+
 #if HAVE_GCRYPT_H
   int packet_was_signed = (flags & PP_SIGNED);
   int packet_was_encrypted = (flags & PP_ENCRYPTED);
@@ -1421,6 +1959,57 @@ static int parse_packet(sockent_t *se, /* {{{ */
       network_dispatch_values(&vl, username, address);
 
       sfree(vl.values);
+    } else if (pkg_type == TYPE_FAMILY) {
+      char *name = NULL;
+      status = parse_part_string_dup(&buffer, &buffer_size, &name);
+      if (status == 0) {
+        network_dispatch_family(&fam, username, address);
+        sfree(fam.name);
+        sfree(fam.help);
+        fam.name = name;
+        fam.type = METRIC_TYPE_UNTYPED;
+        label_set_reset(&labels);
+      }
+    } else if (pkg_type == TYPE_FAMILY_HELP) {
+      char *help = NULL;
+      status = parse_part_string_dup(&buffer, &buffer_size, &help);
+      if (status == 0) {
+        network_dispatch_family(&fam, username, address);
+        sfree(fam.help);
+        fam.help = help;
+      }
+    } else if (pkg_type == TYPE_FAMILY_TYPE) {
+      uint64_t tmp = 0;
+      status = parse_part_number(&buffer, &buffer_size, &tmp);
+      if ((status == 0) && (tmp > METRIC_TYPE_DISTRIBUTION)) {
+        WARNING("network plugin: Received unknown metric type %" PRIu64 ".",
+                tmp);
+        status = -1;
+      }
+      if (status == 0) {
+        network_dispatch_family(&fam, username, address);
+        fam.type = (metric_type_t)tmp;
+      }
+    } else if (pkg_type == TYPE_LABELS) {
+      status = parse_part_labels(&buffer, &buffer_size, &labels);
+    } else if (pkg_type == TYPE_METRIC) {
+      value_t value = {0};
+      status = parse_part_metric(&buffer, &buffer_size, fam.type, &value);
+      if (status == 0)
+        network_receive_metric(&fam, labels, vl.time, vl.interval, value);
+    } else if (pkg_type == TYPE_METRIC_DISTRIBUTION) {
+      distribution_t *dist = NULL;
+      status = parse_part_distribution(&buffer, &buffer_size, &dist);
+      if ((status == 0) && (fam.type != METRIC_TYPE_DISTRIBUTION)) {
+        WARNING("network plugin: Received a distribution for a family of "
+                "type %d.",
+                (int)fam.type);
+        status = -1;
+      }
+      if (status == 0)
+        network_receive_metric(&fam, labels, vl.time, vl.interval,
+                               (value_t){.distribution = dist});
+      distribution_destroy(dist);
     } else if (pkg_type == TYPE_TIME) {
       uint64_t tmp = 0;
       status = parse_part_number(&buffer, &buffer_size, &tmp);
@@ -1508,6 +2097,11 @@ static int parse_packet(sockent_t *se, /* {{{ */
     }
   } /* while (buffer_size > sizeof (part_header_t)) */
 
+  network_dispatch_family(&fam, username, address);
+  sfree(fam.name);
+  sfree(fam.help);
+  label_set_reset(&labels);
+
   if (status == 0 && buffer_size > 0)
     WARNING("network plugin: parse_packet: Received truncated "
             "packet, try increasing `MaxPacketSize'");
@@ -1523,6 +2117,15 @@ static void free_sockent_client(struct sockent_client *sec) /* {{{ */
   }
   sfree(sec->addr);
   sfree(sec->bind_addr);
+
+  while (sec->stream.head != NULL) {
+    stream_frame_t *next = sec->stream.head->next;
+    sfree(sec->stream.head);
+    sec->stream.head = next;
+  }
+  sfree(sec->stream.threads);
+  pthread_cond_destroy(&sec->stream.cond);
+  pthread_mutex_destroy(&sec->stream.lock);
 #if HAVE_GCRYPT_H
   sfree(sec->username);
   sfree(sec->password);
@@ -1561,6 +2164,13 @@ static void sockent_destroy(sockent_t *se) /* {{{ */
     sfree(se->node);
     sfree(se->service);
     pthread_mutex_destroy(&se->lock);
+#if HAVE_LIBSSL
+    sfree(se->tls.ca_file);
+    sfree(se->tls.cert_file);
+    sfree(se->tls.key_file);
+    if (se->tls.ctx != NULL)
+      SSL_CTX_free(se->tls.ctx);
+#endif
 
     if (se->type == SOCKENT_TYPE_CLIENT)
       free_sockent_client(&se->data.client);
@@ -1581,7 +2191,8 @@ static void sockent_destroy(sockent_t *se) /* {{{ */
  * The `struct addrinfo' is used to destinguish between unicast and multicast
  * sockets.
  */
-static int network_set_ttl(const sockent_t *se, const struct addrinfo *ai) {
+static int network_set_ttl(const sockent_t *se, int fd,
+                           const struct addrinfo *ai) {
   DEBUG("network plugin: network_set_ttl: network_config_ttl = %i;",
         network_config_ttl);
 
@@ -1599,7 +2210,7 @@ static int network_set_ttl(const sockent_t *se, const struct addrinfo *ai) {
     else
       optname = IP_TTL;
 
-    if (setsockopt(se->data.client.fd, IPPROTO_IP, optname, &network_config_ttl,
+    if (setsockopt(fd, IPPROTO_IP, optname, &network_config_ttl,
                    sizeof(network_config_ttl)) != 0) {
       ERROR("network plugin: setsockopt (ipv4-ttl): %s", STRERRNO);
       return -1;
@@ -1615,7 +2226,7 @@ static int network_set_ttl(const sockent_t *se, const struct addrinfo *ai) {
     else
       optname = IPV6_UNICAST_HOPS;
 
-    if (setsockopt(se->data.client.fd, IPPROTO_IPV6, optname,
+    if (setsockopt(fd, IPPROTO_IPV6, optname,
                    &network_config_ttl, sizeof(network_config_ttl)) != 0) {
       ERROR("network plugin: setsockopt(ipv6-ttl): %s", STRERRNO);
       return -1;
@@ -1625,7 +2236,7 @@ static int network_set_ttl(const sockent_t *se, const struct addrinfo *ai) {
   return 0;
 } /* int network_set_ttl */
 
-static int network_set_interface(const sockent_t *se,
+static int network_set_interface(const sockent_t *se, int fd,
                                  const struct addrinfo *ai) /* {{{ */
 {
   DEBUG("network plugin: network_set_interface: interface index = %i;",
@@ -1651,7 +2262,7 @@ static int network_set_interface(const sockent_t *se,
                              .imr_interface.s_addr = ntohl(INADDR_ANY)};
 #endif
 
-      if (setsockopt(se->data.client.fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq,
+      if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq,
                      sizeof(mreq)) != 0) {
         ERROR("network plugin: setsockopt (ipv4-multicast-if): %s", STRERRNO);
         return -1;
@@ -1663,7 +2274,7 @@ static int network_set_interface(const sockent_t *se,
     struct sockaddr_in6 *addr = (struct sockaddr_in6 *)ai->ai_addr;
 
     if (IN6_IS_ADDR_MULTICAST(&addr->sin6_addr)) {
-      if (setsockopt(se->data.client.fd, IPPROTO_IPV6, IPV6_MULTICAST_IF,
+      if (setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF,
                      &se->interface, sizeof(se->interface)) != 0) {
         ERROR("network plugin: setsockopt (ipv6-multicast-if): %s", STRERRNO);
         return -1;
@@ -1684,7 +2295,7 @@ static int network_set_interface(const sockent_t *se,
 
     DEBUG("network plugin: Binding socket to interface %s", interface_name);
 
-    if (setsockopt(se->data.client.fd, SOL_SOCKET, SO_BINDTODEVICE,
+    if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE,
                    interface_name, sizeof(interface_name)) == -1) {
       ERROR("network plugin: setsockopt (bind-if): %s", STRERRNO);
       return -1;
@@ -1706,13 +2317,13 @@ static int network_set_interface(const sockent_t *se,
   return 0;
 } /* }}} network_set_interface */
 
-static int network_bind_socket_to_addr(sockent_t *se,
+static int network_bind_socket_to_addr(sockent_t *se, int fd,
                                        const struct addrinfo *ai) {
 
   if (se->data.client.bind_addr == NULL)
     return 0;
 
-  DEBUG("network_plugin: fd %i: bind socket to address", se->data.client.fd);
+  DEBUG("network_plugin: fd %i: bind socket to address", fd);
   char pbuffer[64];
 
   if (ai->ai_family == AF_INET) {
@@ -1720,7 +2331,7 @@ static int network_bind_socket_to_addr(sockent_t *se,
         (struct sockaddr_in *)(se->data.client.bind_addr);
     inet_ntop(AF_INET, &(addr->sin_addr), pbuffer, 64);
     DEBUG("network_plugin: binding client socket to ipv4 address: %s", pbuffer);
-    if (bind(se->data.client.fd, (struct sockaddr *)addr, sizeof(*addr)) ==
+    if (bind(fd, (struct sockaddr *)addr, sizeof(*addr)) ==
         -1) {
       ERROR("network plugin: failed to bind client socket (ipv4) to %s: %s",
             pbuffer, STRERRNO);
@@ -1731,7 +2342,7 @@ static int network_bind_socket_to_addr(sockent_t *se,
         (struct sockaddr_in6 *)(se->data.client.bind_addr);
     inet_ntop(AF_INET6, &(addr->sin6_addr), pbuffer, 64);
     DEBUG("network_plugin: binding client socket to ipv6 address: %s", pbuffer);
-    if (bind(se->data.client.fd, (struct sockaddr *)addr, sizeof(*addr)) ==
+    if (bind(fd, (struct sockaddr *)addr, sizeof(*addr)) ==
         -1) {
       ERROR("network plugin: failed to bind client socket (ipv6) to %s: %s",
             pbuffer, STRERRNO);
@@ -1878,8 +2489,12 @@ static sockent_t *sockent_create(int type) /* {{{ */
   se->node = NULL;
   se->service = NULL;
   se->interface = 0;
+  se->protocol = PROTOCOL_UDP;
   se->next = NULL;
   pthread_mutex_init(&se->lock, NULL);
+#if HAVE_LIBSSL
+  se->tls.verify_peer = true;
+#endif
 
   if (type == SOCKENT_TYPE_SERVER) {
     se->data.server.fd = NULL;
@@ -1896,6 +2511,12 @@ static sockent_t *sockent_create(int type) /* {{{ */
     se->data.client.bind_addr = NULL;
     se->data.client.resolve_interval = 0;
     se->data.client.next_resolve_reconnect = 0;
+    pthread_mutex_init(&se->data.client.stream.lock, NULL);
+    pthread_cond_init(&se->data.client.stream.cond, NULL);
+    se->data.client.stream.max_queue_size = 1048576;
+    se->data.client.stream.max_pending = 64;
+    se->data.client.stream.connections_num = 1;
+    se->data.client.stream.timeout = TIME_T_TO_CDTIME_T(10);
 #if HAVE_GCRYPT_H
     se->data.client.security_level = SECURITY_LEVEL_NONE;
     se->data.client.username = NULL;
@@ -1957,6 +2578,84 @@ static int sockent_init_crypto(sockent_t *se) /* {{{ */
   return 0;
 } /* }}} int sockent_init_crypto */
 
+#if HAVE_LIBSSL
+static char const *stream_tls_error(char *buffer, size_t buffer_size) {
+  unsigned long err = ERR_get_error();
+
+  ERR_clear_error();
+  if (err == 0)
+    return "unknown error";
+
+  ERR_error_string_n(err, buffer, buffer_size);
+  return buffer;
+} /* char const *stream_tls_error */
+
+static int sockent_init_tls(sockent_t *se) /* {{{ */
+{
+  struct sockent_tls *tls = &se->tls;
+  bool is_client = (se->type == SOCKENT_TYPE_CLIENT);
+  char errbuf[256];
+
+  if (!tls->enabled)
+    return 0;
+
+  if (se->protocol != PROTOCOL_TCP) {
+    ERROR("network plugin: TLS requires `Protocol \"TCP\"'.");
+    return -1;
+  }
+  if (!is_client && (tls->cert_file == NULL)) {
+    ERROR("network plugin: TLS on a `Listen' socket requires the "
+          "`TLSCertFile' option.");
+    return -1;
+  }
+
+  tls->ctx = SSL_CTX_new(is_client ? TLS_client_method() : TLS_server_method());
+  if (tls->ctx == NULL) {
+    ERROR("network plugin: SSL_CTX_new failed: %s",
+          stream_tls_error(errbuf, sizeof(errbuf)));
+    return -1;
+  }
+  SSL_CTX_set_min_proto_version(tls->ctx, TLS1_2_VERSION);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+  SSL_CTX_set_options(tls->ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+
+  if (tls->cert_file != NULL) {
+    char const *key_file =
+        (tls->key_file != NULL) ? tls->key_file : tls->cert_file;
+    if ((SSL_CTX_use_certificate_chain_file(tls->ctx, tls->cert_file) != 1) ||
+        (SSL_CTX_use_PrivateKey_file(tls->ctx, key_file, SSL_FILETYPE_PEM) !=
+         1) ||
+        (SSL_CTX_check_private_key(tls->ctx) != 1)) {
+      ERROR("network plugin: Loading the certificate \"%s\" failed: %s",
+            tls->cert_file, stream_tls_error(errbuf, sizeof(errbuf)));
+      return -1;
+    }
+  }
+
+  /* Clients verify the server unless disabled. Servers require a client
+   * certificate if a CA file is configured. */
+  if (is_client ? tls->verify_peer : (tls->ca_file != NULL)) {
+    int status = (tls->ca_file != NULL)
+                     ? SSL_CTX_load_verify_locations(tls->ctx, tls->ca_file,
+                                                     /* CApath = */ NULL)
+                     : SSL_CTX_set_default_verify_paths(tls->ctx);
+    if (status != 1) {
+      ERROR("network plugin: Loading the CA certificates failed: %s",
+            stream_tls_error(errbuf, sizeof(errbuf)));
+      return -1;
+    }
+    SSL_CTX_set_verify(tls->ctx,
+                       is_client ? SSL_VERIFY_PEER
+                                 : (SSL_VERIFY_PEER |
+                                    SSL_VERIFY_FAIL_IF_NO_PEER_CERT),
+                       /* callback = */ NULL);
+  }
+
+  return 0;
+} /* }}} int sockent_init_tls */
+#endif /* HAVE_LIBSSL */
+
 static int sockent_client_disconnect(sockent_t *se) /* {{{ */
 {
   struct sockent_client *client;
@@ -2051,9 +2750,9 @@ static int sockent_client_connect(sockent_t *se) /* {{{ */
     memcpy(client->addr, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
     client->addrlen = ai_ptr->ai_addrlen;
 
-    network_set_ttl(se, ai_ptr);
-    network_set_interface(se, ai_ptr);
-    network_bind_socket_to_addr(se, ai_ptr);
+    network_set_ttl(se, client->fd, ai_ptr);
+    network_set_interface(se, client->fd, ai_ptr);
+    network_bind_socket_to_addr(se, client->fd, ai_ptr);
 
     /* We don't open more than one write-socket per
      * node/service pair.. */
@@ -2097,6 +2796,10 @@ static int sockent_server_listen(sockent_t *se) /* {{{ */
                               .ai_flags = AI_ADDRCONFIG | AI_PASSIVE,
                               .ai_protocol = IPPROTO_UDP,
                               .ai_socktype = SOCK_DGRAM};
+  if (se->protocol == PROTOCOL_TCP) {
+    ai_hints.ai_protocol = IPPROTO_TCP;
+    ai_hints.ai_socktype = SOCK_STREAM;
+  }
 
   status = getaddrinfo(node, service, &ai_hints, &ai_list);
   if (status != 0) {
@@ -2126,6 +2829,11 @@ static int sockent_server_listen(sockent_t *se) /* {{{ */
     }
 
     status = network_bind_socket(*tmp, ai_ptr, se->interface);
+    if ((status == 0) && (se->protocol == PROTOCOL_TCP) &&
+        (listen(*tmp, SOMAXCONN) != 0)) {
+      ERROR("network plugin: listen(2) failed: %s", STRERRNO);
+      status = -1;
+    }
     if (status != 0) {
       close(*tmp);
       *tmp = -1;
@@ -2151,7 +2859,14 @@ static int sockent_add(sockent_t *se) /* {{{ */
   if (se == NULL)
     return -1;
 
-  if (se->type == SOCKENT_TYPE_SERVER) {
+  if ((se->type == SOCKENT_TYPE_SERVER) && (se->protocol == PROTOCOL_TCP)) {
+    /* TCP sockets are polled by the stream thread, not the receive thread. */
+    if (stream_listen_sockets == NULL) {
+      stream_listen_sockets = se;
+      return 0;
+    }
+    last_ptr = stream_listen_sockets;
+  } else if (se->type == SOCKENT_TYPE_SERVER) {
     struct pollfd *tmp;
 
     tmp = realloc(listen_sockets_pollfd,
@@ -2240,8 +2955,12 @@ static void *dispatch_thread(void __attribute__((unused)) * arg) /* {{{ */
       continue;
     }
 
+    pthread_mutex_lock(&parse_lock);
+    stats_octets_rx += ((uint64_t)ent->data_len);
+    stats_packets_rx++;
     parse_packet(se, ent->data, ent->data_len, /* flags = */ 0,
                  /* username = */ NULL, &ent->sender);
+    pthread_mutex_unlock(&parse_lock);
     sfree(ent->data);
     sfree(ent);
   } /* while (42) */
@@ -2294,9 +3013,6 @@ static int network_receive(void) /* {{{ */
         break;
       }
 
-      stats_octets_rx += ((uint64_t)buffer_len);
-      stats_packets_rx++;
-
       /* TODO: Possible performance enhancement: Do not free
        * these entries in the dispatch thread but put them in
        * another list, so we don't have to allocate more and
@@ -2335,63 +3051,773 @@ static int network_receive(void) /* {{{ */
         assert(((receive_list_head == NULL) && (receive_list_length == 0)) ||
                ((receive_list_head != NULL) && (receive_list_length != 0)));
 
-        if (receive_list_head == NULL)
-          receive_list_head = private_list_head;
-        else
-          receive_list_tail->next = private_list_head;
-        receive_list_tail = private_list_tail;
-        receive_list_length += private_list_length;
+        if (receive_list_head == NULL)
+          receive_list_head = private_list_head;
+        else
+          receive_list_tail->next = private_list_head;
+        receive_list_tail = private_list_tail;
+        receive_list_length += private_list_length;
+
+        pthread_cond_signal(&receive_list_cond);
+        pthread_mutex_unlock(&receive_list_lock);
+
+        private_list_head = NULL;
+        private_list_tail = NULL;
+        private_list_length = 0;
+      }
+
+      status = 0;
+    } /* for (listen_sockets_pollfd) */
+
+    if (status != 0)
+      break;
+  } /* while (listen_loop == 0) */
+
+  /* Make sure everything is dispatched before exiting. */
+  if (private_list_head != NULL) {
+    pthread_mutex_lock(&receive_list_lock);
+
+    if (receive_list_head == NULL)
+      receive_list_head = private_list_head;
+    else
+      receive_list_tail->next = private_list_head;
+    receive_list_tail = private_list_tail;
+    receive_list_length += private_list_length;
+
+    pthread_cond_signal(&receive_list_cond);
+    pthread_mutex_unlock(&receive_list_lock);
+  }
+
+  return status;
+} /* }}} int network_receive */
+
+static void *receive_thread(void __attribute__((unused)) * arg) {
+  return network_receive() ? (void *)1 : (void *)0;
+} /* void *receive_thread */
+
+/*
+ * Stream transport
+ */
+static void stream_put_uint64(char *buffer, uint64_t value) {
+  for (size_t i = 0; i < sizeof(value); i++)
+    buffer[i] = (char)(value >> (56 - 8 * i));
+} /* void stream_put_uint64 */
+
+static uint64_t stream_get_uint64(char const *buffer) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < sizeof(value); i++)
+    value = (value << 8) | (uint8_t)buffer[i];
+  return value;
+} /* uint64_t stream_get_uint64 */
+
+/* Timeouts make sure that no thread blocks forever on a dead peer. */
+static void stream_set_options(int fd, cdtime_t timeout) {
+  struct timeval tv = CDTIME_T_TO_TIMEVAL(timeout);
+
+  if ((setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) ||
+      (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0))
+    WARNING("network plugin: setsockopt (timeout): %s", STRERRNO);
+  if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &(int){1}, sizeof(int)) != 0)
+    WARNING("network plugin: setsockopt (keepalive): %s", STRERRNO);
+#ifdef TCP_NODELAY
+  /* Frames are written as a whole, acknowledgements must not be delayed. */
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int)) != 0)
+    WARNING("network plugin: setsockopt (nodelay): %s", STRERRNO);
+#endif
+} /* void stream_set_options */
+
+static ssize_t stream_conn_read(stream_conn_t *conn, void *buffer,
+                                size_t buffer_size) {
+#if HAVE_LIBSSL
+  if (conn->ssl != NULL) {
+    errno = 0;
+    int status = SSL_read(conn->ssl, buffer, (int)buffer_size);
+    if (status > 0)
+      return (ssize_t)status;
+
+    switch (SSL_get_error(conn->ssl, status)) {
+    case SSL_ERROR_ZERO_RETURN:
+      return 0;
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+      errno = EAGAIN;
+      return -1;
+    case SSL_ERROR_SYSCALL:
+      if (errno == 0) /* end of file */
+        return 0;
+      return -1;
+    default:
+      errno = EPROTO;
+      return -1;
+    }
+  }
+#endif
+
+  return read(conn->fd, buffer, buffer_size);
+} /* ssize_t stream_conn_read */
+
+static int stream_conn_write(stream_conn_t *conn, void const *buffer,
+                             size_t buffer_size) {
+  char const *ptr = buffer;
+
+  while (buffer_size > 0) {
+    ssize_t status;
+
+    errno = 0;
+#if HAVE_LIBSSL
+    if (conn->ssl != NULL) {
+      status = (ssize_t)SSL_write(conn->ssl, ptr, (int)buffer_size);
+      if (status <= 0)
+        return (errno != 0) ? errno : EPROTO;
+    } else
+#endif
+      status = write(conn->fd, ptr, buffer_size);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      return (errno == EAGAIN) ? ETIMEDOUT : errno;
+    }
+
+    ptr += status;
+    buffer_size -= (size_t)status;
+  }
+
+  return 0;
+} /* int stream_conn_write */
+
+static void stream_conn_close(stream_conn_t *conn) {
+#if HAVE_LIBSSL
+  if (conn->ssl != NULL) {
+    SSL_shutdown(conn->ssl);
+    SSL_free(conn->ssl);
+    conn->ssl = NULL;
+  }
+#endif
+  if (conn->fd >= 0) {
+    close(conn->fd);
+    conn->fd = -1;
+  }
+} /* void stream_conn_close */
+
+#if HAVE_LIBSSL
+static int stream_tls_connect(sockent_t *se, stream_conn_t *conn) /* {{{ */
+{
+  conn->ssl = SSL_new(se->tls.ctx);
+  if ((conn->ssl == NULL) || (SSL_set_fd(conn->ssl, conn->fd) != 1))
+    return -1;
+
+  /* Servers which are configured by address need a certificate for that
+   * address, others one for their host name. */
+  struct in6_addr addr;
+  bool is_address = (inet_pton(AF_INET, se->node, &addr) == 1) ||
+                    (inet_pton(AF_INET6, se->node, &addr) == 1);
+  if (!is_address && (SSL_set_tlsext_host_name(conn->ssl, se->node) != 1))
+    return -1;
+
+  if (se->tls.verify_peer) {
+    int status;
+    if (is_address)
+      status = X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(conn->ssl),
+                                             se->node);
+    else
+      status = SSL_set1_host(conn->ssl, se->node);
+    if (status != 1)
+      return -1;
+  }
+
+  if (SSL_connect(conn->ssl) != 1)
+    return -1;
+
+  return 0;
+} /* }}} int stream_tls_connect */
+#endif
+
+static int stream_client_connect(sockent_t *se, stream_conn_t *conn, /* {{{ */
+                                 c_complain_t *complaint) {
+  char const *service = (se->service != NULL) ? se->service : NET_DEFAULT_PORT;
+  struct addrinfo *ai_list;
+  int status;
+
+  conn->fd = -1;
+#if HAVE_LIBSSL
+  conn->ssl = NULL;
+#endif
+
+  struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
+                              .ai_flags = AI_ADDRCONFIG,
+                              .ai_protocol = IPPROTO_TCP,
+                              .ai_socktype = SOCK_STREAM};
+
+  status = getaddrinfo(se->node, service, &ai_hints, &ai_list);
+  if (status != 0) {
+    c_complain(LOG_ERR, complaint,
+               "network plugin: getaddrinfo (%s, %s) failed: %s", se->node,
+               service, gai_strerror(status));
+    return -1;
+  }
+
+  status = 0;
+  for (struct addrinfo *ai_ptr = ai_list; ai_ptr != NULL;
+       ai_ptr = ai_ptr->ai_next) {
+    conn->fd =
+        socket(ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
+    if (conn->fd < 0) {
+      status = errno;
+      continue;
+    }
+
+    stream_set_options(conn->fd, se->data.client.stream.timeout);
+    network_set_ttl(se, conn->fd, ai_ptr);
+    network_set_interface(se, conn->fd, ai_ptr);
+    network_bind_socket_to_addr(se, conn->fd, ai_ptr);
+
+    if (connect(conn->fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) == 0)
+      break;
+
+    status = errno;
+    close(conn->fd);
+    conn->fd = -1;
+  }
+
+  freeaddrinfo(ai_list);
+  if (conn->fd < 0) {
+    c_complain(LOG_ERR, complaint,
+               "network plugin: Connecting to [%s]:%s failed: %s", se->node,
+               service, STRERROR(status));
+    return -1;
+  }
+
+#if HAVE_LIBSSL
+  if ((se->tls.ctx != NULL) && (stream_tls_connect(se, conn) != 0)) {
+    char errbuf[256];
+    c_complain(LOG_ERR, complaint,
+               "network plugin: TLS handshake with [%s]:%s failed: %s",
+               se->node, service, stream_tls_error(errbuf, sizeof(errbuf)));
+    stream_conn_close(conn);
+    return -1;
+  }
+#endif
+
+  c_release(LOG_NOTICE, complaint, "network plugin: Connected to [%s]:%s.",
+            se->node, service);
+  return 0;
+} /* }}} int stream_client_connect */
+
+/* stream_client_enqueue adds a packet to the queue of a TCP socket. While the
+ * queue is full, the caller is blocked for up to "Timeout", so that a slow
+ * server slows down the write thread instead of growing the queue. */
+static int stream_client_enqueue(sockent_t *se, /* {{{ */
+                                 const char *buffer, size_t buffer_size) {
+  static c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+
+  struct stream_client *sc = &se->data.client.stream;
+
+  stream_frame_t *f = malloc(sizeof(*f) + STREAM_HEADER_SIZE + buffer_size);
+  if (f == NULL) {
+    ERROR("network plugin: malloc failed.");
+    return ENOMEM;
+  }
+  f->next = NULL;
+  f->seq = 0;
+  f->size = STREAM_HEADER_SIZE + buffer_size;
+
+  uint32_t length = htonl((uint32_t)buffer_size);
+  memcpy(f->data, &length, sizeof(length));
+  memcpy(f->data + STREAM_HEADER_SIZE, buffer, buffer_size);
+
+  pthread_mutex_lock(&sc->lock);
+
+  struct timespec deadline = CDTIME_T_TO_TIMESPEC(cdtime() + sc->timeout);
+  while ((listen_loop == 0) && (sc->queue_size > 0) &&
+         (sc->queue_size + f->size > sc->max_queue_size)) {
+    if (pthread_cond_timedwait(&sc->cond, &sc->lock, &deadline) == ETIMEDOUT)
+      break;
+  }
+
+  if ((sc->queue_size > 0) &&
+      (sc->queue_size + f->size > sc->max_queue_size)) {
+    pthread_mutex_unlock(&sc->lock);
+    c_complain(
+        LOG_WARNING, &complaint,
+        "network plugin: The queue for [%s]:%s is full. Dropping packets.",
+        se->node, (se->service != NULL) ? se->service : NET_DEFAULT_PORT);
+    sfree(f);
+    return ENOBUFS;
+  }
+
+  if (sc->tail == NULL)
+    sc->head = f;
+  else
+    sc->tail->next = f;
+  sc->tail = f;
+  sc->queue_size += f->size;
+
+  pthread_cond_broadcast(&sc->cond);
+  pthread_mutex_unlock(&sc->lock);
+
+  c_release(LOG_NOTICE, &complaint,
+            "network plugin: The queue for [%s]:%s accepts packets again.",
+            se->node, (se->service != NULL) ? se->service : NET_DEFAULT_PORT);
+  return 0;
+} /* }}} int stream_client_enqueue */
+
+/* stream_client_run sends queued frames over "conn" until the connection fails
+ * or the socket is shut down. Up to "MaxPending" frames are sent before an
+ * acknowledgement is required. Frames which have not been acknowledged are put
+ * back at the head of the queue and are sent again on the next connection. */
+static int stream_client_run(sockent_t *se, stream_conn_t *conn) /* {{{ */
+{
+  struct stream_client *sc = &se->data.client.stream;
+
+  stream_frame_t *pending_head = NULL;
+  stream_frame_t *pending_tail = NULL;
+  size_t pending_num = 0;
+  uint64_t seq = 0;
+
+  char ack[STREAM_ACK_SIZE];
+  size_t ack_fill = 0;
+  cdtime_t last_ack = 0;
+  int status = 0;
+
+  while (status == 0) {
+    stream_frame_t *batch = NULL;
+
+    pthread_mutex_lock(&sc->lock);
+    while (!sc->shutdown && (pending_num == 0) && (sc->head == NULL))
+      pthread_cond_wait(&sc->cond, &sc->lock);
+    if (sc->shutdown) {
+      pthread_mutex_unlock(&sc->lock);
+      break;
+    }
+
+    if (pending_num == 0)
+      last_ack = cdtime();
+    while ((sc->head != NULL) && (pending_num < sc->max_pending)) {
+      stream_frame_t *f = sc->head;
+      sc->head = f->next;
+      if (sc->head == NULL)
+        sc->tail = NULL;
+
+      f->next = NULL;
+      f->seq = ++seq;
+      if (pending_tail == NULL)
+        pending_head = f;
+      else
+        pending_tail->next = f;
+      pending_tail = f;
+      pending_num++;
+
+      if (batch == NULL)
+        batch = f;
+    }
+    pthread_mutex_unlock(&sc->lock);
+
+    for (stream_frame_t *f = batch; (f != NULL) && (status == 0); f = f->next) {
+      stream_put_uint64(f->data + sizeof(uint32_t), f->seq);
+      status = stream_conn_write(conn, f->data, f->size);
+    }
+    if (status != 0)
+      break;
+
+#if HAVE_LIBSSL
+    bool readable = (conn->ssl != NULL) && (SSL_pending(conn->ssl) > 0);
+#else
+    bool readable = false;
+#endif
+    if (!readable) {
+      /* Poll briefly while more frames may be sent, so that new frames are
+       * picked up while waiting for acknowledgements. */
+      struct pollfd pfd = {.fd = conn->fd, .events = POLLIN};
+      int timeout_ms = (pending_num < sc->max_pending) ? 10 : 100;
+
+      int n = poll(&pfd, 1, timeout_ms);
+      if ((n < 0) && (errno != EINTR)) {
+        status = errno;
+        break;
+      }
+      if (n <= 0) {
+        if ((cdtime() - last_ack) > sc->timeout)
+          status = ETIMEDOUT;
+        continue;
+      }
+    }
+
+    ssize_t n = stream_conn_read(conn, ack + ack_fill, sizeof(ack) - ack_fill);
+    if (n < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      status = errno;
+      break;
+    } else if (n == 0) {
+      status = ECONNRESET;
+      break;
+    }
+
+    ack_fill += (size_t)n;
+    if (ack_fill < sizeof(ack))
+      continue;
+    ack_fill = 0;
+
+    uint64_t acked = stream_get_uint64(ack);
+    if (acked > seq) {
+      status = EPROTO;
+      break;
+    }
+
+    size_t acked_size = 0;
+    while ((pending_head != NULL) && (pending_head->seq <= acked)) {
+      stream_frame_t *f = pending_head;
+      pending_head = f->next;
+      acked_size += f->size;
+      pending_num--;
+      sfree(f);
+    }
+    if (pending_head == NULL)
+      pending_tail = NULL;
+    last_ack = cdtime();
+
+    pthread_mutex_lock(&sc->lock);
+    sc->queue_size -= acked_size;
+    pthread_cond_broadcast(&sc->cond);
+    pthread_mutex_unlock(&sc->lock);
+  } /* while (status == 0) */
+
+  pthread_mutex_lock(&sc->lock);
+  if (pending_head != NULL) {
+    pending_tail->next = sc->head;
+    sc->head = pending_head;
+    if (sc->tail == NULL)
+      sc->tail = pending_tail;
+  }
+  pthread_cond_broadcast(&sc->cond);
+  pthread_mutex_unlock(&sc->lock);
+
+  return status;
+} /* }}} int stream_client_run */
+
+static void *stream_client_thread(void *arg) /* {{{ */
+{
+  sockent_t *se = arg;
+  struct stream_client *sc = &se->data.client.stream;
+  c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+  cdtime_t backoff = 0;
+
+  pthread_mutex_lock(&sc->lock);
+  while (!sc->shutdown) {
+    pthread_mutex_unlock(&sc->lock);
+
+    stream_conn_t conn;
+    int status = stream_client_connect(se, &conn, &complaint);
+    if (status == 0) {
+      backoff = 0;
+      status = stream_client_run(se, &conn);
+      stream_conn_close(&conn);
+      if (status != 0) {
+        c_complain(LOG_WARNING, &complaint,
+                   "network plugin: Connection to [%s]:%s failed: %s", se->node,
+                   (se->service != NULL) ? se->service : NET_DEFAULT_PORT,
+                   STRERROR(status));
+        backoff = TIME_T_TO_CDTIME_T(1);
+      }
+    } else {
+      /* Wait before trying again, doubling the interval up to one minute. */
+      backoff = (backoff == 0) ? TIME_T_TO_CDTIME_T(1) : 2 * backoff;
+      if (backoff > TIME_T_TO_CDTIME_T(60))
+        backoff = TIME_T_TO_CDTIME_T(60);
+    }
+
+    pthread_mutex_lock(&sc->lock);
+    struct timespec deadline = CDTIME_T_TO_TIMESPEC(cdtime() + backoff);
+    while (!sc->shutdown && (backoff > 0)) {
+      if (pthread_cond_timedwait(&sc->cond, &sc->lock, &deadline) == ETIMEDOUT)
+        break;
+    }
+  }
+  pthread_mutex_unlock(&sc->lock);
+
+  return NULL;
+} /* }}} void *stream_client_thread */
+
+static int stream_client_start(sockent_t *se) /* {{{ */
+{
+  struct stream_client *sc = &se->data.client.stream;
+
+  sc->threads = calloc(sc->connections_num, sizeof(*sc->threads));
+  if (sc->threads == NULL) {
+    ERROR("network plugin: calloc failed.");
+    return ENOMEM;
+  }
+
+  for (size_t i = 0; i < sc->connections_num; i++) {
+    int status = plugin_thread_create(&sc->threads[sc->threads_num],
+                                      stream_client_thread, se, "network tcp");
+    if (status != 0) {
+      ERROR("network plugin: pthread_create failed: %s", STRERROR(status));
+      continue;
+    }
+    sc->threads_num++;
+  }
+
+  return (sc->threads_num > 0) ? 0 : -1;
+} /* }}} int stream_client_start */
 
-        pthread_cond_signal(&receive_list_cond);
-        pthread_mutex_unlock(&receive_list_lock);
+/* stream_client_stop waits up to "Timeout" for queued frames to be
+ * acknowledged and stops the connection threads. */
+static void stream_client_stop(sockent_t *se) /* {{{ */
+{
+  struct stream_client *sc = &se->data.client.stream;
 
-        private_list_head = NULL;
-        private_list_tail = NULL;
-        private_list_length = 0;
+  pthread_mutex_lock(&sc->lock);
+  struct timespec deadline = CDTIME_T_TO_TIMESPEC(cdtime() + sc->timeout);
+  while ((sc->threads_num > 0) && (sc->queue_size > 0)) {
+    if (pthread_cond_timedwait(&sc->cond, &sc->lock, &deadline) == ETIMEDOUT)
+      break;
+  }
+  if (sc->queue_size > 0)
+    WARNING("network plugin: %" PRIsz " bytes for [%s]:%s have not been "
+            "acknowledged and are lost.",
+            sc->queue_size, se->node,
+            (se->service != NULL) ? se->service : NET_DEFAULT_PORT);
+
+  sc->shutdown = true;
+  pthread_cond_broadcast(&sc->cond);
+  pthread_mutex_unlock(&sc->lock);
+
+  for (size_t i = 0; i < sc->threads_num; i++)
+    pthread_join(sc->threads[i], NULL);
+  sc->threads_num = 0;
+} /* }}} void stream_client_stop */
+
+/* stream_server_receive reads frames from "conn" and dispatches the packets
+ * until the connection is closed. After dispatching the frames returned by one
+ * read, the last one is acknowledged. */
+static int stream_server_receive(sockent_t *se, stream_conn_t *conn, /* {{{ */
+                                 struct sockaddr_storage *peer) {
+  char *buffer = malloc(STREAM_BUFFER_SIZE);
+  if (buffer == NULL) {
+    ERROR("network plugin: malloc failed.");
+    return ENOMEM;
+  }
+
+  size_t buffer_fill = 0;
+  int status = 0;
+
+  while (listen_loop == 0) {
+    ssize_t n = stream_conn_read(conn, buffer + buffer_fill,
+                                 STREAM_BUFFER_SIZE - buffer_fill);
+    if (n < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      status = errno;
+      break;
+    } else if (n == 0) {
+      break;
+    }
+    buffer_fill += (size_t)n;
+
+    size_t offset = 0;
+    uint64_t seq = 0;
+    while ((buffer_fill - offset) >= STREAM_HEADER_SIZE) {
+      uint32_t length;
+      memcpy(&length, buffer + offset, sizeof(length));
+      length = ntohl(length);
+      if (length > STREAM_MAX_PACKET_SIZE) {
+        status = EPROTO;
+        break;
       }
+      if ((buffer_fill - offset) < (STREAM_HEADER_SIZE + length))
+        break;
 
-      status = 0;
-    } /* for (listen_sockets_pollfd) */
+      seq = stream_get_uint64(buffer + offset + sizeof(length));
+
+      pthread_mutex_lock(&parse_lock);
+      stats_octets_rx += ((uint64_t)length);
+      stats_packets_rx++;
+      parse_packet(se, buffer + offset + STREAM_HEADER_SIZE, length,
+                   /* flags = */ 0, /* username = */ NULL, peer);
+      pthread_mutex_unlock(&parse_lock);
 
+      offset += STREAM_HEADER_SIZE + length;
+    }
     if (status != 0)
       break;
+
+    memmove(buffer, buffer + offset, buffer_fill - offset);
+    buffer_fill -= offset;
+
+    if (seq != 0) {
+      char ack[STREAM_ACK_SIZE];
+      stream_put_uint64(ack, seq);
+      status = stream_conn_write(conn, ack, sizeof(ack));
+      if (status != 0)
+        break;
+    }
   } /* while (listen_loop == 0) */
 
-  /* Make sure everything is dispatched before exiting. */
-  if (private_list_head != NULL) {
-    pthread_mutex_lock(&receive_list_lock);
+  sfree(buffer);
+  return status;
+} /* }}} int stream_server_receive */
 
-    if (receive_list_head == NULL)
-      receive_list_head = private_list_head;
-    else
-      receive_list_tail->next = private_list_head;
-    receive_list_tail = private_list_tail;
-    receive_list_length += private_list_length;
+static void *stream_connection_thread(void *arg) /* {{{ */
+{
+  stream_connection_t *c = arg;
+  char peer[NI_MAXHOST] = "unknown";
+  int status = 0;
 
-    pthread_cond_signal(&receive_list_cond);
-    pthread_mutex_unlock(&receive_list_lock);
+  getnameinfo((struct sockaddr *)&c->peer, sizeof(c->peer), peer, sizeof(peer),
+              NULL, 0, NI_NUMERICHOST);
+
+#if HAVE_LIBSSL
+  if (c->se->tls.ctx != NULL) {
+    c->conn.ssl = SSL_new(c->se->tls.ctx);
+    if ((c->conn.ssl == NULL) || (SSL_set_fd(c->conn.ssl, c->conn.fd) != 1) ||
+        (SSL_accept(c->conn.ssl) != 1)) {
+      char errbuf[256];
+      NOTICE("network plugin: TLS handshake with %s failed: %s", peer,
+             stream_tls_error(errbuf, sizeof(errbuf)));
+      status = EPROTO;
+    }
   }
+#endif
 
-  return status;
-} /* }}} int network_receive */
+  if (status == 0)
+    status = stream_server_receive(c->se, &c->conn, &c->peer);
+  if ((status != 0) && (listen_loop == 0))
+    NOTICE("network plugin: Closing connection from %s: %s", peer,
+           STRERROR(status));
 
-static void *receive_thread(void __attribute__((unused)) * arg) {
-  return network_receive() ? (void *)1 : (void *)0;
-} /* void *receive_thread */
+  pthread_mutex_lock(&stream_connections_lock);
+  c->done = true;
+  pthread_mutex_unlock(&stream_connections_lock);
+
+  return NULL;
+} /* }}} void *stream_connection_thread */
+
+static void stream_connection_start(sockent_t *se, int fd, /* {{{ */
+                                    struct sockaddr_storage *peer) {
+  stream_connection_t *c = calloc(1, sizeof(*c));
+  if (c == NULL) {
+    ERROR("network plugin: calloc failed.");
+    close(fd);
+    return;
+  }
+  c->se = se;
+  c->conn.fd = fd;
+  memcpy(&c->peer, peer, sizeof(c->peer));
+
+  stream_set_options(fd, TIME_T_TO_CDTIME_T(10));
+
+  pthread_mutex_lock(&stream_connections_lock);
+  int status = plugin_thread_create(&c->thread, stream_connection_thread, c,
+                                    "network conn");
+  if (status != 0) {
+    pthread_mutex_unlock(&stream_connections_lock);
+    ERROR("network plugin: pthread_create failed: %s", STRERROR(status));
+    close(fd);
+    sfree(c);
+    return;
+  }
+  c->next = stream_connections;
+  stream_connections = c;
+  pthread_mutex_unlock(&stream_connections_lock);
+} /* }}} void stream_connection_start */
+
+/* stream_connections_reap frees the connections which have been closed. If
+ * "all" is true, all connections are closed first. */
+static void stream_connections_reap(bool all) /* {{{ */
+{
+  pthread_mutex_lock(&stream_connections_lock);
+  if (all)
+    for (stream_connection_t *c = stream_connections; c != NULL; c = c->next)
+      shutdown(c->conn.fd, SHUT_RDWR);
+
+  stream_connection_t **prev = &stream_connections;
+  while (*prev != NULL) {
+    stream_connection_t *c = *prev;
+    if (!all && !c->done) {
+      prev = &c->next;
+      continue;
+    }
+    *prev = c->next;
+
+    /* Only the stream thread and network_shutdown modify the list, so it is
+     * safe to release the lock while joining. */
+    pthread_mutex_unlock(&stream_connections_lock);
+    pthread_join(c->thread, NULL);
+    stream_conn_close(&c->conn);
+    sfree(c);
+    pthread_mutex_lock(&stream_connections_lock);
+  }
+  pthread_mutex_unlock(&stream_connections_lock);
+} /* }}} void stream_connections_reap */
+
+static void *stream_thread(void __attribute__((unused)) * arg) /* {{{ */
+{
+  size_t fds_num = 0;
+  for (sockent_t *se = stream_listen_sockets; se != NULL; se = se->next)
+    fds_num += se->data.server.fd_num;
+
+  struct pollfd fds[fds_num];
+  sockent_t *fds_se[fds_num];
+  size_t i = 0;
+  for (sockent_t *se = stream_listen_sockets; se != NULL; se = se->next) {
+    for (size_t j = 0; j < se->data.server.fd_num; j++, i++) {
+      fds[i] = (struct pollfd){.fd = se->data.server.fd[j], .events = POLLIN};
+      fds_se[i] = se;
+    }
+  }
+
+  while (listen_loop == 0) {
+    stream_connections_reap(/* all = */ false);
+
+    /* Wake up regularly to check "listen_loop". */
+    int status = poll(fds, fds_num, 1000);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("network plugin: poll(2) failed: %s", STRERRNO);
+      break;
+    }
+
+    for (i = 0; (i < fds_num) && (status > 0); i++) {
+      if ((fds[i].revents & POLLIN) == 0)
+        continue;
+      status--;
+
+      struct sockaddr_storage peer = {0};
+      socklen_t peer_len = sizeof(peer);
+      int fd = accept(fds[i].fd, (struct sockaddr *)&peer, &peer_len);
+      if (fd < 0) {
+        if ((errno != EINTR) && (errno != EAGAIN) && (errno != ECONNABORTED))
+          ERROR("network plugin: accept(2) failed: %s", STRERRNO);
+        continue;
+      }
+
+      stream_connection_start(fds_se[i], fd, &peer);
+    }
+  } /* while (listen_loop == 0) */
+
+  return NULL;
+} /* }}} void *stream_thread */
 
-static void network_init_buffer(void) {
-  memset(send_buffer, 0, network_config_packet_size);
-  send_buffer_ptr = send_buffer;
-  send_buffer_fill = 0;
-  send_buffer_last_update = 0;
+static void network_init_buffer(send_buffer_t *sb) {
+  char *buffer = sb->buffer;
+  memset(buffer, 0, network_config_packet_size);
 
-  memset(&send_buffer_vl, 0, sizeof(send_buffer_vl));
+  memset(sb, 0, sizeof(*sb));
+  sb->buffer = buffer;
+  sb->ptr = buffer;
 } /* int network_init_buffer */
 
 static void network_send_buffer_plain(sockent_t *se, /* {{{ */
                                       const char *buffer, size_t buffer_size) {
   int status;
 
+  if (se->protocol == PROTOCOL_TCP) {
+    stream_client_enqueue(se, buffer, buffer_size);
+    return;
+  }
+
   while (42) {
     status = sockent_client_connect(se);
     if (status != 0)
@@ -2566,12 +3992,17 @@ static void network_send_buffer_encrypted(sockent_t *se, /* {{{ */
 #undef BUFFER_ADD
 #endif /* HAVE_GCRYPT_H */
 
-static void network_send_buffer(char *buffer, size_t buffer_len) /* {{{ */
-{
+/* network_send_buffer sends the packet to all servers using "format", or to
+ * all servers if "format" is FORMAT_ANY. */
+static void network_send_buffer(char *buffer, size_t buffer_len, /* {{{ */
+                                int format) {
   DEBUG("network plugin: network_send_buffer: buffer_len = %" PRIsz,
         buffer_len);
 
   for (sockent_t *se = sending_sockets; se != NULL; se = se->next) {
+    if ((format != FORMAT_ANY) && (se->data.client.format != format))
+      continue;
+
     pthread_mutex_lock(&se->lock);
 #if HAVE_GCRYPT_H
     if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
@@ -2585,10 +4016,136 @@ static void network_send_buffer(char *buffer, size_t buffer_len) /* {{{ */
   } /* for (sending_sockets) */
 } /* }}} void network_send_buffer */
 
-static int add_to_buffer(char *buffer, size_t buffer_size, /* {{{ */
-                         value_list_t *vl_def, const data_set_t *ds,
-                         const value_list_t *vl) {
+static bool label_set_equal(label_set_t a, label_set_t b) /* {{{ */
+{
+  if (a.num != b.num)
+    return false;
+
+  for (size_t i = 0; i < a.num; i++)
+    if ((strcmp(a.ptr[i].name, b.ptr[i].name) != 0) ||
+        (strcmp(a.ptr[i].value, b.ptr[i].value) != 0))
+      return false;
+
+  return true;
+} /* }}} bool label_set_equal */
+
+static int add_to_buffer(send_buffer_t *sb, char *buffer, /* {{{ */
+                         size_t buffer_size, metric_t const *m) {
+  char *buffer_orig = buffer;
+  metric_family_t const *fam = m->family;
+
+  if (sb->fam != fam) {
+    if (write_part_string(&buffer, &buffer_size, TYPE_FAMILY, fam->name,
+                          strlen(fam->name)) != 0)
+      return -1;
+    if ((fam->help != NULL) &&
+        (write_part_string(&buffer, &buffer_size, TYPE_FAMILY_HELP, fam->help,
+                           strlen(fam->help)) != 0))
+      return -1;
+    if (write_part_number(&buffer, &buffer_size, TYPE_FAMILY_TYPE,
+                          (uint64_t)fam->type) != 0)
+      return -1;
+    sb->fam = fam;
+    sb->metric = NULL;
+  }
+
+  /* The family part resets the labels of the receiver. */
+  label_set_t prev_labels = {0};
+  if (sb->metric != NULL)
+    prev_labels = sb->metric->label;
+  if (!label_set_equal(prev_labels, m->label)) {
+    if (write_part_labels(&buffer, &buffer_size, m->label) != 0)
+      return -1;
+  }
+
+  if (sb->time != m->time) {
+    if (write_part_number(&buffer, &buffer_size, TYPE_TIME_HR,
+                          (uint64_t)m->time))
+      return -1;
+    sb->time = m->time;
+  }
+
+  if (sb->interval != m->interval) {
+    if (write_part_number(&buffer, &buffer_size, TYPE_INTERVAL_HR,
+                          (uint64_t)m->interval))
+      return -1;
+    sb->interval = m->interval;
+  }
+
+  if (fam->type == METRIC_TYPE_DISTRIBUTION) {
+    if (write_part_distribution(&buffer, &buffer_size,
+                                m->value.distribution) != 0)
+      return -1;
+  } else if (write_part_metric(&buffer, &buffer_size, fam->type, m->value) !=
+             0) {
+    return -1;
+  }
+
+  sb->metric = m;
+
+  return buffer - buffer_orig;
+} /* }}} int add_to_buffer */
+
+/* metric_to_value_list converts "m" to a value list for servers using the
+ * value list format. The "instance" label is used as host, the family name as
+ * plugin and the other labels, as comma separated "name=value" pairs, as type
+ * instance. Counters use the "derive" type, gauges the "gauge" type.
+ * Distributions and identifiers longer than DATA_MAX_NAME_LEN cannot be
+ * converted. */
+static int metric_to_value_list(metric_t const *m, value_list_t *vl, /* {{{ */
+                                int *ret_ds_type) {
+  metric_family_t const *fam = m->family;
+
+  switch (fam->type) {
+  case METRIC_TYPE_COUNTER:
+    *ret_ds_type = DS_TYPE_DERIVE;
+    vl->values[0].derive = (derive_t)m->value.counter;
+    sstrncpy(vl->type, "derive", sizeof(vl->type));
+    break;
+  case METRIC_TYPE_GAUGE:
+  case METRIC_TYPE_UNTYPED:
+    *ret_ds_type = DS_TYPE_GAUGE;
+    vl->values[0].gauge = m->value.gauge;
+    sstrncpy(vl->type, "gauge", sizeof(vl->type));
+    break;
+  case METRIC_TYPE_DISTRIBUTION:
+    return ENOTSUP;
+  }
+
+  if (strlen(fam->name) >= sizeof(vl->plugin))
+    return ENAMETOOLONG;
+  sstrncpy(vl->plugin, fam->name, sizeof(vl->plugin));
+  vl->plugin_instance[0] = '\0';
+
+  sstrncpy(vl->host, hostname_g, sizeof(vl->host));
+  vl->type_instance[0] = '\0';
+  size_t pos = 0;
+  for (size_t i = 0; i < m->label.num; i++) {
+    label_pair_t const *l = m->label.ptr + i;
+    if (strcmp("instance", l->name) == 0) {
+      if (strlen(l->value) >= sizeof(vl->host))
+        return ENAMETOOLONG;
+      sstrncpy(vl->host, l->value, sizeof(vl->host));
+      continue;
+    }
+
+    int len = ssnprintf(vl->type_instance + pos, sizeof(vl->type_instance) - pos,
+                        "%s%s=%s", (pos == 0) ? "" : ",", l->name, l->value);
+    if ((len < 0) || ((size_t)len >= sizeof(vl->type_instance) - pos))
+      return ENAMETOOLONG;
+    pos += (size_t)len;
+  }
+
+  vl->time = m->time;
+  vl->interval = m->interval;
+  return 0;
+} /* }}} int metric_to_value_list */
+
+static int add_to_buffer_value_list(send_buffer_t *sb, /* {{{ */
+                                    char *buffer, size_t buffer_size,
+                                    value_list_t const *vl, int ds_type) {
   char *buffer_orig = buffer;
+  value_list_t *vl_def = &sb->vl;
 
   if (strcmp(vl_def->host, vl->host) != 0) {
     if (write_part_string(&buffer, &buffer_size, TYPE_HOST, vl->host,
@@ -2631,7 +4188,7 @@ static int add_to_buffer(char *buffer, size_t buffer_size, /* {{{ */
     if (write_part_string(&buffer, &buffer_size, TYPE_TYPE, vl->type,
                           strlen(vl->type)) != 0)
       return -1;
-    sstrncpy(vl_def->type, ds->type, sizeof(vl_def->type));
+    sstrncpy(vl_def->type, vl->type, sizeof(vl_def->type));
   }
 
   if (strcmp(vl_def->type_instance, vl->type_instance) != 0) {
@@ -2642,91 +4199,131 @@ static int add_to_buffer(char *buffer, size_t buffer_size, /* {{{ */
              sizeof(vl_def->type_instance));
   }
 
-  if (write_part_values(&buffer, &buffer_size, ds, vl) != 0)
+  if (write_part_values(&buffer, &buffer_size, ds_type, vl->values[0]) != 0)
     return -1;
 
   return buffer - buffer_orig;
-} /* }}} int add_to_buffer */
+} /* }}} int add_to_buffer_value_list */
+
+static void flush_buffer(int format) {
+  send_buffer_t *sb = send_buffers + format;
 
-static void flush_buffer(void) {
-  DEBUG("network plugin: flush_buffer: send_buffer_fill = %i",
-        send_buffer_fill);
+  DEBUG("network plugin: flush_buffer: send_buffer_fill = %i", sb->fill);
 
-  network_send_buffer(send_buffer, (size_t)send_buffer_fill);
+  network_send_buffer(sb->buffer, (size_t)sb->fill, format);
 
-  stats_octets_tx += ((uint64_t)send_buffer_fill);
+  stats_octets_tx += ((uint64_t)sb->fill);
   stats_packets_tx++;
 
-  network_init_buffer();
+  network_init_buffer(sb);
 }
 
-static int network_write(const data_set_t *ds, const value_list_t *vl,
+/* network_add_metric adds "m" to the send buffer of "format", flushing the
+ * buffer if the metric does not fit. Returns an error number greater than
+ * zero if "m" cannot be sent in "format". The send buffer lock must be held. */
+static int network_add_metric(int format, metric_t const *m) /* {{{ */
+{
+  send_buffer_t *sb = send_buffers + format;
+  value_list_t vl = {.values = &(value_t){0}, .values_len = 1};
+  int ds_type = 0;
+
+  if (format == FORMAT_VALUE_LIST) {
+    int status = metric_to_value_list(m, &vl, &ds_type);
+    if (status != 0) {
+      DEBUG("network plugin: Not sending a metric of %s in the value list "
+            "format: %s",
+            m->family->name, STRERROR(status));
+      return status;
+    }
+  }
+
+  int status = -1;
+  for (int i = 0; (i < 2) && (status < 0); i++) {
+    if (i > 0) {
+      if (sb->fill == 0)
+        break;
+      flush_buffer(format);
+    }
+
+    char *buffer = sb->ptr;
+    size_t buffer_size =
+        network_config_packet_size - (sb->fill + BUFF_SIG_SIZE);
+    if (format == FORMAT_VALUE_LIST)
+      status = add_to_buffer_value_list(sb, buffer, buffer_size, &vl, ds_type);
+    else
+      status = add_to_buffer(sb, buffer, buffer_size, m);
+  }
+
+  if (status < 0) {
+    /* The parts written so far were not kept; start over with an empty
+     * state. */
+    network_init_buffer(sb);
+    ERROR("network plugin: Unable to append a metric of %s to the buffer. "
+          "The metric may be larger than `MaxPacketSize'.",
+          m->family->name);
+    return -1;
+  }
+
+  /* status == bytes added to the buffer */
+  sb->fill += status;
+  sb->ptr += status;
+  sb->last_update = cdtime();
+
+  if ((network_config_packet_size - sb->fill) < 15)
+    flush_buffer(format);
+
+  return 0;
+} /* }}} int network_add_metric */
+
+static int network_write(metric_family_t const *fam,
                          user_data_t __attribute__((unused)) * user_data) {
-  int status;
+  int status = 0;
 
   /* listen_loop is set to non-zero in the shutdown callback, which is
    * guaranteed to be called *after* all the write threads have been shut
    * down. */
   assert(listen_loop == 0);
 
-  if (!check_send_okay(vl)) {
-#if COLLECT_DEBUG
-    char name[6 * DATA_MAX_NAME_LEN];
-    FORMAT_VL(name, sizeof(name), vl);
-    name[sizeof(name) - 1] = '\0';
-    DEBUG("network plugin: network_write: "
-          "NOT sending %s.",
-          name);
-#endif
-    /* Counter is not protected by another lock and may be reached by
-     * multiple threads */
-    pthread_mutex_lock(&stats_lock);
-    stats_values_not_sent++;
-    pthread_mutex_unlock(&stats_lock);
-    return 0;
-  }
-
-  uc_meta_data_add_unsigned_int(vl, "network:time_sent", (uint64_t)vl->time);
-
   pthread_mutex_lock(&send_buffer_lock);
 
-  status = add_to_buffer(send_buffer_ptr,
-                         network_config_packet_size -
-                             (send_buffer_fill + BUFF_SIG_SIZE),
-                         &send_buffer_vl, ds, vl);
-  if (status >= 0) {
-    /* status == bytes added to the buffer */
-    send_buffer_fill += status;
-    send_buffer_ptr += status;
-    send_buffer_last_update = cdtime();
-
-    stats_values_sent++;
-  } else {
-    flush_buffer();
+  for (size_t i = 0; i < fam->metric.num; i++) {
+    metric_t const *m = fam->metric.ptr + i;
 
-    status = add_to_buffer(send_buffer_ptr,
-                           network_config_packet_size -
-                               (send_buffer_fill + BUFF_SIG_SIZE),
-                           &send_buffer_vl, ds, vl);
+    if (!check_send_okay(m)) {
+      DEBUG("network plugin: network_write: "
+            "NOT sending a metric of %s.",
+            fam->name);
+      stats_values_not_sent++;
+      continue;
+    }
 
-    if (status >= 0) {
-      send_buffer_fill += status;
-      send_buffer_ptr += status;
+    uc_meta_data_add_unsigned_int(m, "network:time_sent", (uint64_t)m->time);
 
-      stats_values_sent++;
+    bool sent = false;
+    for (int format = 0; format < FORMAT_NUM; format++) {
+      if (send_buffers[format].buffer == NULL)
+        continue;
+      int add_status = network_add_metric(format, m);
+      if (add_status < 0)
+        status = -1;
+      else if (add_status == 0)
+        sent = true;
     }
+    if (sent)
+      stats_values_sent++;
+    else
+      stats_values_not_sent++;
   }
 
-  if (status < 0) {
-    ERROR("network plugin: Unable to append to the "
-          "buffer for some weird reason");
-  } else if ((network_config_packet_size - send_buffer_fill) < 15) {
-    flush_buffer();
+  /* The family and its metrics are freed after this call. */
+  for (int format = 0; format < FORMAT_NUM; format++) {
+    send_buffers[format].fam = NULL;
+    send_buffers[format].metric = NULL;
   }
 
   pthread_mutex_unlock(&send_buffer_lock);
 
-  return (status < 0) ? -1 : 0;
+  return status;
 } /* int network_write */
 
 static int network_config_set_ttl(const oconfig_item_t *ci) /* {{{ */
@@ -2825,6 +4422,59 @@ static int network_config_set_buffer_size(const oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int network_config_set_buffer_size */
 
+static int network_config_set_protocol(const oconfig_item_t *ci, /* {{{ */
+                                       int *protocol) {
+  char buffer[8];
+
+  if (cf_util_get_string_buffer(ci, buffer, sizeof(buffer)) != 0)
+    return -1;
+
+  if (strcasecmp("UDP", buffer) == 0)
+    *protocol = PROTOCOL_UDP;
+  else if (strcasecmp("TCP", buffer) == 0)
+    *protocol = PROTOCOL_TCP;
+  else {
+    WARNING("network plugin: Unknown protocol: %s.", buffer);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int network_config_set_protocol */
+
+static int network_config_set_format(const oconfig_item_t *ci, /* {{{ */
+                                     int *format) {
+  char buffer[16];
+
+  if (cf_util_get_string_buffer(ci, buffer, sizeof(buffer)) != 0)
+    return -1;
+
+  if (strcasecmp("MetricFamily", buffer) == 0)
+    *format = FORMAT_METRIC_FAMILY;
+  else if (strcasecmp("ValueList", buffer) == 0)
+    *format = FORMAT_VALUE_LIST;
+  else {
+    WARNING("network plugin: Unknown format: %s.", buffer);
+    return -1;
+  }
+
+  return 0;
+} /* }}} int network_config_set_format */
+
+static int network_config_set_size(const oconfig_item_t *ci, /* {{{ */
+                                   size_t *ret) {
+  int tmp = 0;
+
+  if (cf_util_get_int(ci, &tmp) != 0)
+    return -1;
+  else if (tmp < 1) {
+    WARNING("network plugin: The `%s' option must be positive.", ci->key);
+    return -1;
+  }
+
+  *ret = (size_t)tmp;
+  return 0;
+} /* }}} int network_config_set_size */
+
 #if HAVE_GCRYPT_H
 static int network_config_set_security_level(oconfig_item_t *ci, /* {{{ */
                                              int *retval) {
@@ -2851,6 +4501,18 @@ static int network_config_set_security_level(oconfig_item_t *ci, /* {{{ */
 } /* }}} int network_config_set_security_level */
 #endif /* HAVE_GCRYPT_H */
 
+#if !HAVE_LIBSSL
+/* Options which must not be silently ignored: without TLS, the connections
+ * would be opened in plain text. */
+static bool network_config_is_tls_option(char const *key) /* {{{ */
+{
+  return (strcasecmp("TLS", key) == 0) || (strcasecmp("TLSCAFile", key) == 0) ||
+         (strcasecmp("TLSCertFile", key) == 0) ||
+         (strcasecmp("TLSKeyFile", key) == 0) ||
+         (strcasecmp("TLSVerifyPeer", key) == 0);
+} /* }}} bool network_config_is_tls_option */
+#endif /* !HAVE_LIBSSL */
+
 static int network_config_add_listen(const oconfig_item_t *ci) /* {{{ */
 {
   sockent_t *se;
@@ -2885,8 +4547,29 @@ static int network_config_add_listen(const oconfig_item_t *ci) /* {{{ */
       network_config_set_security_level(child, &se->data.server.security_level);
     else
 #endif /* HAVE_GCRYPT_H */
+#if HAVE_LIBSSL
+        if (strcasecmp("TLS", child->key) == 0)
+      cf_util_get_boolean(child, &se->tls.enabled);
+    else if (strcasecmp("TLSCAFile", child->key) == 0)
+      cf_util_get_string(child, &se->tls.ca_file);
+    else if (strcasecmp("TLSCertFile", child->key) == 0)
+      cf_util_get_string(child, &se->tls.cert_file);
+    else if (strcasecmp("TLSKeyFile", child->key) == 0)
+      cf_util_get_string(child, &se->tls.key_file);
+    else
+#else
+        if (network_config_is_tls_option(child->key)) {
+      ERROR("network plugin: The `%s' option requires TLS support, which is "
+            "not available in this build.",
+            child->key);
+      sockent_destroy(se);
+      return -1;
+    } else
+#endif /* HAVE_LIBSSL */
         if (strcasecmp("Interface", child->key) == 0)
       network_config_set_interface(child, &se->interface);
+    else if (strcasecmp("Protocol", child->key) == 0)
+      network_config_set_protocol(child, &se->protocol);
     else {
       WARNING("network plugin: Option `%s' is not allowed here.", child->key);
     }
@@ -2911,6 +4594,16 @@ static int network_config_add_listen(const oconfig_item_t *ci) /* {{{ */
     return -1;
   }
 
+#if HAVE_LIBSSL
+  status = sockent_init_tls(se);
+  if (status != 0) {
+    ERROR("network plugin: network_config_add_listen: sockent_init_tls() "
+          "failed.");
+    sockent_destroy(se);
+    return -1;
+  }
+#endif
+
   status = sockent_server_listen(se);
   if (status != 0) {
     ERROR("network plugin: network_config_add_listen: sockent_server_listen "
@@ -2965,12 +4658,45 @@ static int network_config_add_server(const oconfig_item_t *ci) /* {{{ */
       network_config_set_security_level(child, &se->data.client.security_level);
     else
 #endif /* HAVE_GCRYPT_H */
+#if HAVE_LIBSSL
+        if (strcasecmp("TLS", child->key) == 0)
+      cf_util_get_boolean(child, &se->tls.enabled);
+    else if (strcasecmp("TLSCAFile", child->key) == 0)
+      cf_util_get_string(child, &se->tls.ca_file);
+    else if (strcasecmp("TLSCertFile", child->key) == 0)
+      cf_util_get_string(child, &se->tls.cert_file);
+    else if (strcasecmp("TLSKeyFile", child->key) == 0)
+      cf_util_get_string(child, &se->tls.key_file);
+    else if (strcasecmp("TLSVerifyPeer", child->key) == 0)
+      cf_util_get_boolean(child, &se->tls.verify_peer);
+    else
+#else
+        if (network_config_is_tls_option(child->key)) {
+      ERROR("network plugin: The `%s' option requires TLS support, which is "
+            "not available in this build.",
+            child->key);
+      sockent_destroy(se);
+      return -1;
+    } else
+#endif /* HAVE_LIBSSL */
         if (strcasecmp("Interface", child->key) == 0)
       network_config_set_interface(child, &se->interface);
     else if (strcasecmp("BindAddress", child->key) == 0)
       network_config_set_bind_address(child, &se->data.client.bind_addr);
     else if (strcasecmp("ResolveInterval", child->key) == 0)
       cf_util_get_cdtime(child, &se->data.client.resolve_interval);
+    else if (strcasecmp("Protocol", child->key) == 0)
+      network_config_set_protocol(child, &se->protocol);
+    else if (strcasecmp("Connections", child->key) == 0)
+      network_config_set_size(child, &se->data.client.stream.connections_num);
+    else if (strcasecmp("MaxPending", child->key) == 0)
+      network_config_set_size(child, &se->data.client.stream.max_pending);
+    else if (strcasecmp("MaxQueueSize", child->key) == 0)
+      network_config_set_size(child, &se->data.client.stream.max_queue_size);
+    else if (strcasecmp("Timeout", child->key) == 0)
+      cf_util_get_cdtime(child, &se->data.client.stream.timeout);
+    else if (strcasecmp("Format", child->key) == 0)
+      network_config_set_format(child, &se->data.client.format);
     else {
       WARNING("network plugin: Option `%s' is not allowed here.", child->key);
     }
@@ -2996,8 +4722,19 @@ static int network_config_add_server(const oconfig_item_t *ci) /* {{{ */
     return -1;
   }
 
+#if HAVE_LIBSSL
+  status = sockent_init_tls(se);
+  if (status != 0) {
+    ERROR("network plugin: network_config_add_server: sockent_init_tls() "
+          "failed.");
+    sockent_destroy(se);
+    return -1;
+  }
+#endif
+
   /* No call to sockent_client_connect() here -- it is called from
-   * network_send_buffer_plain(). */
+   * network_send_buffer_plain(). TCP connections are opened by the threads
+   * started in network_init(). */
 
   status = sockent_add(se);
   if (status != 0) {
@@ -3104,7 +4841,7 @@ static int network_notification(const notification_t *n,
   if (status != 0)
     return -1;
 
-  network_send_buffer(buffer, sizeof(buffer) - buffer_free);
+  network_send_buffer(buffer, sizeof(buffer) - buffer_free, FORMAT_ANY);
 
   return 0;
 } /* int network_notification */
@@ -3131,15 +4868,28 @@ static int network_shutdown(void) {
     dispatch_thread_running = 0;
   }
 
-  sockent_destroy(listen_sockets);
+  /* Stop accepting TCP connections and close the open ones. */
+  if (stream_thread_running != 0) {
+    INFO("network plugin: Stopping stream thread.");
+    pthread_join(stream_thread_id, /* ret = */ NULL);
+    stream_thread_running = 0;
+  }
+  stream_connections_reap(/* all = */ true);
 
-  if (send_buffer_fill > 0)
-    flush_buffer();
+  sockent_destroy(listen_sockets);
+  sockent_destroy(stream_listen_sockets);
 
-  sfree(send_buffer);
+  for (int format = 0; format < FORMAT_NUM; format++) {
+    if (send_buffers[format].fill > 0)
+      flush_buffer(format);
+    sfree(send_buffers[format].buffer);
+  }
 
-  for (sockent_t *se = sending_sockets; se != NULL; se = se->next)
+  for (sockent_t *se = sending_sockets; se != NULL; se = se->next) {
+    if (se->protocol == PROTOCOL_TCP)
+      stream_client_stop(se);
     sockent_client_disconnect(se);
+  }
   sockent_destroy(sending_sockets);
 
   plugin_unregister_config("network");
@@ -3235,12 +4985,19 @@ static int network_init(void) {
 
   plugin_register_shutdown("network", network_shutdown);
 
-  send_buffer = malloc(network_config_packet_size);
-  if (send_buffer == NULL) {
-    ERROR("network plugin: malloc failed.");
-    return -1;
+  /* Metrics are only encoded in the formats used by a server. */
+  for (sockent_t *se = sending_sockets; se != NULL; se = se->next) {
+    send_buffer_t *sb = send_buffers + se->data.client.format;
+    if (sb->buffer != NULL)
+      continue;
+
+    sb->buffer = malloc(network_config_packet_size);
+    if (sb->buffer == NULL) {
+      ERROR("network plugin: malloc failed.");
+      return -1;
+    }
+    network_init_buffer(sb);
   }
-  network_init_buffer();
 
   /* setup socket(s) and so on */
   if (sending_sockets != NULL) {
@@ -3250,6 +5007,22 @@ static int network_init(void) {
                                  /* user_data = */ NULL);
   }
 
+  for (sockent_t *se = sending_sockets; se != NULL; se = se->next) {
+    if ((se->protocol == PROTOCOL_TCP) && (stream_client_start(se) != 0))
+      ERROR("network plugin: Starting the connections to [%s]:%s failed.",
+            se->node, (se->service != NULL) ? se->service : NET_DEFAULT_PORT);
+  }
+
+  if ((stream_listen_sockets != NULL) && (stream_thread_running == 0)) {
+    int status = plugin_thread_create(&stream_thread_id, stream_thread,
+                                      NULL /* no argument */, "network tcp");
+    if (status != 0) {
+      ERROR("network: pthread_create failed: %s", STRERROR(status));
+    } else {
+      stream_thread_running = 1;
+    }
+  }
+
   /* If no threads need to be started, return here. */
   if ((listen_sockets_num == 0) ||
       ((dispatch_thread_running != 0) && (receive_thread_running != 0)))
@@ -3292,15 +5065,14 @@ static int network_flush(cdtime_t timeout,
                          __attribute__((unused)) user_data_t *user_data) {
   pthread_mutex_lock(&send_buffer_lock);
 
-  if (send_buffer_fill > 0) {
-    if (timeout > 0) {
-      cdtime_t now = cdtime();
-      if ((send_buffer_last_update + timeout) > now) {
-        pthread_mutex_unlock(&send_buffer_lock);
-        return 0;
-      }
-    }
-    flush_buffer();
+  cdtime_t now = cdtime();
+  for (int format = 0; format < FORMAT_NUM; format++) {
+    send_buffer_t *sb = send_buffers + format;
+    if (sb->fill == 0)
+      continue;
+    if ((timeout > 0) && ((sb->last_update + timeout) > now))
+      continue;
+    flush_buffer(format);
   }
   pthread_mutex_unlock(&send_buffer_lock);
 
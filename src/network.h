@@ -70,6 +70,16 @@
 #define TYPE_INTERVAL 0x0007
 #define TYPE_INTERVAL_HR 0x0009
 
+/* Types to transmit metric families. A family part starts a new family and
+ * resets the labels; each metric or distribution part adds one metric using
+ * the current family, labels, time and interval. */
+#define TYPE_FAMILY 0x0010
+#define TYPE_FAMILY_HELP 0x0011
+#define TYPE_FAMILY_TYPE 0x0012
+#define TYPE_LABELS 0x0013
+#define TYPE_METRIC 0x0014
+#define TYPE_METRIC_DISTRIBUTION 0x0015
+
 /* Types to transmit notifications */
 #define TYPE_MESSAGE 0x0100
 #define TYPE_SEVERITY 0x0101
@@ -21,10 +21,46 @@
 
 #define TEST_PLUGIN_NETWORK 1
 
+#define plugin_dispatch_metric_family network_test_dispatch_metric_family
+#define plugin_dispatch_values network_test_dispatch_values
+
 #include "network.c" /* (sic) */
 
 #include "testing.h"
 
+/* Families and value lists dispatched by parse_packet. */
+static metric_family_t *dispatched_fams[8];
+static size_t dispatched_fams_num;
+static value_list_t dispatched_vls[16];
+static value_t dispatched_values[16];
+static size_t dispatched_vls_num;
+
+int network_test_dispatch_metric_family(metric_family_t const *fam) {
+  if (dispatched_fams_num >= STATIC_ARRAY_SIZE(dispatched_fams))
+    return ENOBUFS;
+  dispatched_fams[dispatched_fams_num++] = metric_family_clone(fam);
+  return 0;
+}
+
+int network_test_dispatch_values(value_list_t const *vl) {
+  if (dispatched_vls_num >= STATIC_ARRAY_SIZE(dispatched_vls))
+    return ENOBUFS;
+  value_list_t *copy = dispatched_vls + dispatched_vls_num;
+  *copy = *vl;
+  copy->meta = NULL;
+  dispatched_values[dispatched_vls_num] = vl->values[0];
+  copy->values = dispatched_values + dispatched_vls_num;
+  dispatched_vls_num++;
+  return 0;
+}
+
+static void dispatched_reset(void) {
+  for (size_t i = 0; i < dispatched_fams_num; i++)
+    metric_family_free(dispatched_fams[i]);
+  dispatched_fams_num = 0;
+  dispatched_vls_num = 0;
+}
+
 char *raw_packet_data[] = {
     "0000000e6c6f63616c686f7374000008000c1513676ac3a6e0970009000c00000002800000"
     "000002000973776170000004000973776170000005000966726565000006000f0001010000"
@@ -236,11 +272,306 @@ DEF_TEST(parse_packet) {
   }
   EXPECT_EQ_INT(139, (int)stats_values_dispatched);
 
+  dispatched_reset();
+  return 0;
+}
+
+/* make_families creates a counter, a gauge and a distribution family with
+ * three metrics each. */
+static size_t make_families(metric_family_t *fams) {
+  fams[0] = (metric_family_t){
+      .name = "test_counter_total",
+      .help = "A counter",
+      .type = METRIC_TYPE_COUNTER,
+  };
+  fams[1] = (metric_family_t){
+      .name = "test_gauge",
+      .type = METRIC_TYPE_GAUGE,
+  };
+  fams[2] = (metric_family_t){
+      .name = "test_distribution",
+      .type = METRIC_TYPE_DISTRIBUTION,
+  };
+
+  metric_t templ = {
+      .time = TIME_T_TO_CDTIME_T(1700000000),
+      .interval = TIME_T_TO_CDTIME_T(10),
+  };
+  metric_label_set(&templ, "host", "example.com");
+
+  size_t metrics_num = 0;
+  for (size_t i = 0; i < 3; i++) {
+    for (size_t j = 0; j < 3; j++) {
+      char instance[16];
+      ssnprintf(instance, sizeof(instance), "%zu", j);
+
+      value_t v = {0};
+      if (fams[i].type == METRIC_TYPE_COUNTER) {
+        v.counter = 1000 + j;
+      } else if (fams[i].type == METRIC_TYPE_GAUGE) {
+        v.gauge = 0.5 * (double)j;
+      } else {
+        v.distribution = distribution_new_linear(5, 10);
+        distribution_update(v.distribution, 3.0 * (double)j);
+      }
+      /* Takes ownership of the distribution. */
+      metric_family_append(fams + i, "instance", instance, v, &templ);
+      metrics_num++;
+    }
+  }
+
+  metric_reset(&templ);
+  return metrics_num;
+}
+
+DEF_TEST(metric_family) {
+  metric_family_t fams[3];
+  size_t metrics_num = make_families(fams);
+
+  send_buffer_t *sb = send_buffers + FORMAT_METRIC_FAMILY;
+  sb->buffer = malloc(network_config_packet_size);
+  CHECK_NOT_NULL(sb->buffer);
+  network_init_buffer(sb);
+
+  derive_t sent = stats_values_sent;
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fams); i++)
+    CHECK_ZERO(network_write(fams + i, NULL));
+  EXPECT_EQ_INT(metrics_num, (int)(stats_values_sent - sent));
+
+  size_t packet_size = (size_t)sb->fill;
+  uint8_t packet[packet_size];
+  memcpy(packet, sb->buffer, packet_size);
+
+  sockent_t se = {0};
+  derive_t dispatched = stats_values_dispatched;
+  EXPECT_EQ_INT(0, parse_packet(&se, packet, packet_size, 0, NULL, NULL));
+  EXPECT_EQ_INT(metrics_num, (int)(stats_values_dispatched - dispatched));
+
+  EXPECT_EQ_INT(STATIC_ARRAY_SIZE(fams), dispatched_fams_num);
+  for (size_t i = 0; i < dispatched_fams_num; i++) {
+    metric_family_t const *want = fams + i;
+    metric_family_t const *got = dispatched_fams[i];
+
+    EXPECT_EQ_STR(want->name, got->name);
+    EXPECT_EQ_STR(want->help, got->help);
+    EXPECT_EQ_INT(want->type, got->type);
+    EXPECT_EQ_INT(want->metric.num, got->metric.num);
+    for (size_t j = 0; j < want->metric.num; j++) {
+      metric_t const *w = want->metric.ptr + j;
+      metric_t const *g = got->metric.ptr + j;
+
+      EXPECT_EQ_INT(w->label.num, g->label.num);
+      for (size_t k = 0; k < w->label.num; k++) {
+        EXPECT_EQ_STR(w->label.ptr[k].name, g->label.ptr[k].name);
+        EXPECT_EQ_STR(w->label.ptr[k].value, g->label.ptr[k].value);
+      }
+      EXPECT_EQ_UINT64(w->time, g->time);
+      EXPECT_EQ_UINT64(w->interval, g->interval);
+
+      if (want->type == METRIC_TYPE_COUNTER) {
+        EXPECT_EQ_UINT64(w->value.counter, g->value.counter);
+      } else if (want->type == METRIC_TYPE_GAUGE) {
+        EXPECT_EQ_DOUBLE(w->value.gauge, g->value.gauge);
+      } else {
+        EXPECT_EQ_DOUBLE(distribution_total_sum(w->value.distribution),
+                         distribution_total_sum(g->value.distribution));
+        EXPECT_EQ_UINT64(
+            distribution_total_counter(w->value.distribution),
+            distribution_total_counter(g->value.distribution));
+      }
+    }
+  }
+  dispatched_reset();
+
+  /* Corrupted packets must not crash the parser. */
+  uint32_t seed = 1;
+  for (size_t i = 0; i < 10000; i++) {
+    uint8_t corrupt[packet_size];
+    memcpy(corrupt, packet, packet_size);
+    for (size_t j = 0; j < 1 + i % 4; j++) {
+      seed = seed * 1103515245 + 12345;
+      corrupt[(seed >> 8) % packet_size] ^= (uint8_t)(seed >> 24);
+    }
+    parse_packet(&se, corrupt, packet_size, 0, NULL, NULL);
+    dispatched_reset();
+  }
+
+  sfree(sb->buffer);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fams); i++)
+    metric_family_metric_reset(fams + i);
+  return 0;
+}
+
+DEF_TEST(value_list) {
+  metric_family_t fams[3];
+  make_families(fams);
+
+  send_buffer_t *sb = send_buffers + FORMAT_VALUE_LIST;
+  sb->buffer = malloc(network_config_packet_size);
+  CHECK_NOT_NULL(sb->buffer);
+  network_init_buffer(sb);
+
+  derive_t not_sent = stats_values_not_sent;
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fams); i++)
+    CHECK_ZERO(network_write(fams + i, NULL));
+  /* Distributions cannot be sent as value lists. */
+  EXPECT_EQ_INT(fams[2].metric.num, (int)(stats_values_not_sent - not_sent));
+
+  sockent_t se = {0};
+  EXPECT_EQ_INT(0, parse_packet(&se, sb->buffer, (size_t)sb->fill, 0, NULL,
+                                NULL));
+
+  EXPECT_EQ_INT(fams[0].metric.num + fams[1].metric.num, dispatched_vls_num);
+  for (size_t i = 0; i < dispatched_vls_num; i++) {
+    metric_family_t const *fam = fams + (i / 3);
+    metric_t const *m = fam->metric.ptr + (i % 3);
+    value_list_t const *vl = dispatched_vls + i;
+
+    EXPECT_EQ_STR(metric_label_get(m, "instance"), vl->host);
+    EXPECT_EQ_STR(fam->name, vl->plugin);
+    EXPECT_EQ_STR("", vl->plugin_instance);
+    EXPECT_EQ_STR("host=example.com", vl->type_instance);
+    EXPECT_EQ_UINT64(m->time, vl->time);
+    EXPECT_EQ_UINT64(m->interval, vl->interval);
+    EXPECT_EQ_INT(1, vl->values_len);
+    if (fam->type == METRIC_TYPE_COUNTER) {
+      EXPECT_EQ_STR("derive", vl->type);
+      EXPECT_EQ_UINT64(m->value.counter, (uint64_t)vl->values[0].derive);
+    } else {
+      EXPECT_EQ_STR("gauge", vl->type);
+      EXPECT_EQ_DOUBLE(m->value.gauge, vl->values[0].gauge);
+    }
+  }
+  dispatched_reset();
+
+  sfree(sb->buffer);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fams); i++)
+    metric_family_metric_reset(fams + i);
+  return 0;
+}
+
+typedef struct {
+  sockent_t *se;
+  stream_conn_t conn;
+  int status;
+} stream_test_t;
+
+static void *stream_test_client(void *arg) {
+  stream_test_t *t = arg;
+  t->status = stream_client_run(t->se, &t->conn);
+  return NULL;
+}
+
+static void *stream_test_server(void *arg) {
+  stream_test_t *t = arg;
+  t->status = stream_server_receive(t->se, &t->conn, NULL);
+  return NULL;
+}
+
+/* Waits until the queue of "se" satisfies the condition or one second has
+ * passed. */
+#define STREAM_TEST_WAIT(se, cond)                                             \
+  do {                                                                         \
+    struct stream_client *sc = &(se)->data.client.stream;                      \
+    for (int i = 0; i < 100; i++) {                                            \
+      pthread_mutex_lock(&sc->lock);                                           \
+      bool ok = (cond);                                                        \
+      pthread_mutex_unlock(&sc->lock);                                         \
+      if (ok)                                                                  \
+        break;                                                                 \
+      nanosleep(&CDTIME_T_TO_TIMESPEC(MS_TO_CDTIME_T(10)), NULL);              \
+    }                                                                          \
+  } while (0)
+
+static void stream_test_stop(stream_test_t *t, pthread_t thread) {
+  struct stream_client *sc = &t->se->data.client.stream;
+
+  pthread_mutex_lock(&sc->lock);
+  sc->shutdown = true;
+  pthread_cond_broadcast(&sc->cond);
+  pthread_mutex_unlock(&sc->lock);
+  pthread_join(thread, NULL);
+  sc->shutdown = false;
+}
+
+DEF_TEST(stream) {
+  uint8_t packet[network_config_packet_size];
+  size_t packet_size = sizeof(packet);
+  CHECK_ZERO(decode_string(raw_packet_data[0], packet, &packet_size));
+
+  sockent_t server_se = {.type = SOCKENT_TYPE_SERVER};
+  derive_t dispatched = stats_values_dispatched;
+  CHECK_ZERO(parse_packet(&server_se, packet, packet_size, 0, NULL, NULL));
+  derive_t packet_values = stats_values_dispatched - dispatched;
+
+  sockent_t *se = sockent_create(SOCKENT_TYPE_CLIENT);
+  CHECK_NOT_NULL(se);
+  se->protocol = PROTOCOL_TCP;
+  se->node = strdup("localhost");
+  struct stream_client *sc = &se->data.client.stream;
+  sc->max_pending = 2;
+
+  for (size_t i = 0; i < 5; i++)
+    EXPECT_EQ_INT(0, stream_client_enqueue(se, (char *)packet, packet_size));
+  size_t queue_size = sc->queue_size;
+  EXPECT_EQ_UINT64(5 * (STREAM_HEADER_SIZE + packet_size), queue_size);
+
+  /* Frames which are not acknowledged are put back into the queue. */
+  int fds[2];
+  CHECK_ZERO(socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  stream_test_t client = {.se = se, .conn = {.fd = fds[0]}};
+  pthread_t client_thread;
+  CHECK_ZERO(pthread_create(&client_thread, NULL, stream_test_client, &client));
+  char header[STREAM_HEADER_SIZE];
+  EXPECT_EQ_INT(sizeof(header),
+                recv(fds[1], header, sizeof(header), MSG_WAITALL));
+  uint32_t length;
+  memcpy(&length, header, sizeof(length));
+  EXPECT_EQ_INT(packet_size, ntohl(length));
+  EXPECT_EQ_UINT64(1, stream_get_uint64(header + sizeof(length)));
+  stream_test_stop(&client, client_thread);
+  EXPECT_EQ_UINT64(queue_size, sc->queue_size);
+  EXPECT_EQ_INT(1, (int)sc->head->seq);
+  EXPECT_EQ_INT(2, (int)sc->head->next->seq);
+  close(fds[0]);
+  close(fds[1]);
+
+  /* Frames are dispatched and acknowledged. */
+  CHECK_ZERO(socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  stream_test_t server = {.se = &server_se, .conn = {.fd = fds[1]}};
+  client.conn.fd = fds[0];
+  dispatched = stats_values_dispatched;
+  pthread_t server_thread;
+  CHECK_ZERO(pthread_create(&server_thread, NULL, stream_test_server, &server));
+  CHECK_ZERO(pthread_create(&client_thread, NULL, stream_test_client, &client));
+  STREAM_TEST_WAIT(se, sc->queue_size == 0);
+  EXPECT_EQ_UINT64(0, sc->queue_size);
+  EXPECT_EQ_PTR(NULL, (void *)sc->head);
+  stream_test_stop(&client, client_thread);
+  EXPECT_EQ_INT(0, client.status);
+
+  close(fds[0]);
+  pthread_join(server_thread, NULL);
+  EXPECT_EQ_INT(0, server.status);
+  EXPECT_EQ_INT(5 * packet_values, stats_values_dispatched - dispatched);
+  close(fds[1]);
+
+  /* A full queue blocks for up to "Timeout", then drops the packet. */
+  sc->max_queue_size = STREAM_HEADER_SIZE + packet_size;
+  sc->timeout = MS_TO_CDTIME_T(10);
+  EXPECT_EQ_INT(0, stream_client_enqueue(se, (char *)packet, packet_size));
+  EXPECT_EQ_INT(ENOBUFS,
+                stream_client_enqueue(se, (char *)packet, packet_size));
+
+  sockent_destroy(se);
   return 0;
 }
 
 int main() {
   RUN_TEST(parse_packet);
+  RUN_TEST(metric_family);
+  RUN_TEST(value_list);
+  RUN_TEST(stream);
 
   END_TEST;
 }
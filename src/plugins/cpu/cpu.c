@@ -32,6 +32,10 @@
 #include "plugin.h"
 #include "utils/common/common.h"
 
+#if KERNEL_LINUX
+#include "utils/sample_ring/sample_ring.h"
+#endif
+
 #ifdef HAVE_MACH_KERN_RETURN_H
 #include <mach/kern_return.h>
 #endif
@@ -203,6 +207,24 @@ typedef struct {
 
 static cpu_topology_t *cpu_topology;
 static size_t cpu_topology_num;
+
+/* High resolution mode: a dedicated thread samples the aggregated CPU usage
+ * every "HighResolutionInterval" into a ring buffer and the read callback
+ * dispatches only a summary (or a distribution) of those samples. */
+static cdtime_t hires_interval;
+static double *hires_percentile;
+static size_t hires_percentile_num;
+static bool hires_distribution;
+static distribution_t *hires_layout;
+
+static pthread_mutex_t hires_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hires_cond = PTHREAD_COND_INITIALIZER;
+static bool hires_thread_loop;
+static pthread_t hires_thread_id;
+/* hires_ring is filled by the sampling thread, hires_ring_read is swapped in
+ * by the read callback so that the summary is computed without the lock. */
+static sample_ring_t *hires_ring;
+static sample_ring_t *hires_ring_read;
 #endif
 
 /* Highest CPU number in the current iteration. Used by the dispatch logic to
@@ -217,10 +239,16 @@ static bool report_guest;
 static bool report_topology;
 static bool subtract_guest = true;
 
-static const char *config_keys[] = {"ReportByCpu",      "ReportByState",
-                                    "ReportNumCpu",     "ValuesPercentage",
-                                    "ReportGuestState", "SubtractGuestState",
-                                    "ReportTopology"};
+static const char *config_keys[] = {"ReportByCpu",
+                                    "ReportByState",
+                                    "ReportNumCpu",
+                                    "ValuesPercentage",
+                                    "ReportGuestState",
+                                    "SubtractGuestState",
+                                    "ReportTopology",
+                                    "HighResolutionInterval",
+                                    "HighResolutionPercentile",
+                                    "HighResolutionDistribution"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static int cpu_config(char const *key, char const *value)
@@ -239,6 +267,39 @@ static int cpu_config(char const *key, char const *value)
     report_topology = IS_TRUE(value);
   else if (strcasecmp(key, "SubtractGuestState") == 0)
     subtract_guest = IS_TRUE(value);
+#if defined(KERNEL_LINUX)
+  else if (strcasecmp(key, "HighResolutionInterval") == 0) {
+    double interval = atof(value);
+    if (interval < 0.0) {
+      ERROR("cpu plugin: HighResolutionInterval must not be negative.");
+      return -1;
+    }
+    hires_interval = DOUBLE_TO_CDTIME_T(interval);
+  } else if (strcasecmp(key, "HighResolutionPercentile") == 0) {
+    double percent = atof(value);
+    if ((percent <= 0.0) || (percent >= 100.0)) {
+      ERROR("cpu plugin: HighResolutionPercentile must be between 0 and 100, "
+            "exclusively.");
+      return -1;
+    }
+    double *tmp = realloc(hires_percentile,
+                          sizeof(*hires_percentile) * (hires_percentile_num + 1));
+    if (tmp == NULL) {
+      ERROR("cpu plugin: realloc failed.");
+      return -1;
+    }
+    hires_percentile = tmp;
+    hires_percentile[hires_percentile_num] = percent;
+    hires_percentile_num++;
+  } else if (strcasecmp(key, "HighResolutionDistribution") == 0)
+    hires_distribution = IS_TRUE(value);
+#else
+  else if ((strcasecmp(key, "HighResolutionInterval") == 0) ||
+           (strcasecmp(key, "HighResolutionPercentile") == 0) ||
+           (strcasecmp(key, "HighResolutionDistribution") == 0))
+    WARNING("cpu plugin: The \"%s\" option is only supported on Linux "
+            "and will be ignored.", key);
+#endif
   else
     return -1;
 
@@ -431,6 +492,195 @@ static int cpu_topology_scan(void)
   return 0;
 }
 
+/* Reads the aggregated "cpu" line of /proc/stat from the already opened
+ * file descriptor and returns the busy and total jiffies. */
+static int cpu_hires_sample(int fd, derive_t *ret_busy, derive_t *ret_total)
+{
+  char buffer[512];
+
+  ssize_t len = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  if (len <= 0)
+    return -1;
+  buffer[len] = '\0';
+
+  char *end = strchr(buffer, '\n');
+  if (end != NULL)
+    *end = '\0';
+
+  char *fields[11];
+  int numfields = strsplit(buffer, fields, STATIC_ARRAY_SIZE(fields));
+  if ((numfields < 5) || (strcmp(fields[0], "cpu") != 0))
+    return -1;
+
+  /* user, nice, system, idle, iowait, irq, softirq, steal. Guest time is
+   * already accounted in user and nice. */
+  derive_t total = 0;
+  for (int i = 1; (i < numfields) && (i <= 8); i++)
+    total += (derive_t)atoll(fields[i]);
+
+  *ret_busy = total - (derive_t)atoll(fields[4]);
+  *ret_total = total;
+  return 0;
+}
+
+static void *cpu_hires_thread(void __attribute__((unused)) *arg)
+{
+  int fd = open("/proc/stat", O_RDONLY);
+  if (fd < 0) {
+    ERROR("cpu plugin: open (/proc/stat) failed: %s", STRERRNO);
+    return (void *)-1;
+  }
+
+  derive_t last_busy = 0;
+  derive_t last_total = 0;
+  bool have_last = false;
+  cdtime_t next = cdtime();
+
+  pthread_mutex_lock(&hires_lock);
+  while (hires_thread_loop) {
+    pthread_mutex_unlock(&hires_lock);
+
+    derive_t busy;
+    derive_t total;
+    int status = cpu_hires_sample(fd, &busy, &total);
+
+    pthread_mutex_lock(&hires_lock);
+    if (!hires_thread_loop)
+      break;
+
+    if (status == 0) {
+      if (have_last && (total > last_total))
+        sample_ring_add(hires_ring, 100.0 * ((double)(busy - last_busy)) /
+                                        ((double)(total - last_total)));
+      last_busy = busy;
+      last_total = total;
+      have_last = true;
+    }
+
+    /* Wait for the next absolute deadline so that the sampling rate does not
+     * drift. If we are late, skip the missed samples. */
+    cdtime_t now = cdtime();
+    next += hires_interval;
+    if (next < now)
+      next = now + hires_interval;
+
+    struct timespec ts_wait = CDTIME_T_TO_TIMESPEC(next);
+    pthread_cond_timedwait(&hires_cond, &hires_lock, &ts_wait);
+  }
+  pthread_mutex_unlock(&hires_lock);
+
+  close(fd);
+  return (void *)0;
+}
+
+static int cpu_hires_start(void)
+{
+  if (hires_interval == 0)
+    return 0;
+
+  cdtime_t interval = plugin_get_interval();
+  if (hires_interval >= interval) {
+    WARNING("cpu plugin: HighResolutionInterval (%.3f) is not smaller than the "
+            "read interval (%.3f), disabling the high resolution mode.",
+            CDTIME_T_TO_DOUBLE(hires_interval), CDTIME_T_TO_DOUBLE(interval));
+    hires_interval = 0;
+    return 0;
+  }
+
+  /* Room for one interval worth of samples, plus some slack for jitter of
+   * the read callback. */
+  size_t capacity = (size_t)(2 * (interval / hires_interval)) + 1;
+  hires_ring = sample_ring_create(capacity);
+  hires_ring_read = sample_ring_create(capacity);
+  if ((hires_ring == NULL) || (hires_ring_read == NULL)) {
+    ERROR("cpu plugin: sample_ring_create failed.");
+    return -1;
+  }
+
+  if (hires_distribution) {
+    /* 5% wide buckets */
+    hires_layout = distribution_new_linear(20, 5.0);
+    if (hires_layout == NULL) {
+      ERROR("cpu plugin: distribution_new_linear failed.");
+      return -1;
+    }
+  }
+
+  pthread_mutex_lock(&hires_lock);
+  hires_thread_loop = true;
+  int status = plugin_thread_create(&hires_thread_id, cpu_hires_thread, NULL,
+                                    "cpu hires");
+  if (status != 0) {
+    hires_thread_loop = false;
+    pthread_mutex_unlock(&hires_lock);
+    ERROR("cpu plugin: Starting high resolution thread failed.");
+    return -1;
+  }
+  pthread_mutex_unlock(&hires_lock);
+
+  return 0;
+}
+
+static void cpu_hires_commit(void)
+{
+  if (hires_ring == NULL)
+    return;
+
+  pthread_mutex_lock(&hires_lock);
+  sample_ring_t *tmp = hires_ring;
+  hires_ring = hires_ring_read;
+  hires_ring_read = tmp;
+  pthread_mutex_unlock(&hires_lock);
+
+  if (sample_ring_num(hires_ring_read) == 0)
+    return;
+
+  metric_family_t fam = {
+      .name = "host_cpu_all_busy_hires_percent",
+      .type = hires_distribution ? METRIC_TYPE_DISTRIBUTION : METRIC_TYPE_GAUGE,
+  };
+
+  int status = sample_ring_metric_append(hires_ring_read, &fam, NULL,
+                                         hires_percentile, hires_percentile_num,
+                                         hires_layout);
+  sample_ring_reset(hires_ring_read);
+  if (status != 0) {
+    ERROR("cpu plugin: sample_ring_metric_append failed: %s", STRERROR(status));
+    metric_family_metric_reset(&fam);
+    return;
+  }
+
+  status = plugin_dispatch_metric_family(&fam);
+  if (status != 0) {
+    ERROR("cpu plugin: plugin_dispatch_metric_family failed: %s",
+          STRERROR(status));
+  }
+
+  metric_family_metric_reset(&fam);
+}
+
+static int cpu_shutdown(void)
+{
+  pthread_mutex_lock(&hires_lock);
+  bool running = hires_thread_loop;
+  hires_thread_loop = false;
+  pthread_cond_broadcast(&hires_cond);
+  pthread_mutex_unlock(&hires_lock);
+
+  if (running)
+    pthread_join(hires_thread_id, NULL);
+
+  sample_ring_destroy(hires_ring);
+  hires_ring = NULL;
+  sample_ring_destroy(hires_ring_read);
+  hires_ring_read = NULL;
+  distribution_destroy(hires_layout);
+  hires_layout = NULL;
+  sfree(hires_percentile);
+  hires_percentile_num = 0;
+  return 0;
+}
+
 #endif /* defined(KERNEL_LINUX) */
 
 static int init(void) {
@@ -528,6 +778,9 @@ static int init(void) {
 
 #elif defined(KERNEL_LINUX)
   cpu_topology_scan();
+
+  if (cpu_hires_start() != 0)
+    return -1;
 #endif /* KERNEL_LINUX */
 
   return 0;
@@ -1204,6 +1457,9 @@ static int cpu_read(void) {
 
   cpu_commit();
   cpu_reset();
+#if defined(KERNEL_LINUX)
+  cpu_hires_commit();
+#endif
   return 0;
 }
 
@@ -1211,4 +1467,7 @@ void module_register(void) {
   plugin_register_init("cpu", init);
   plugin_register_config("cpu", cpu_config, config_keys, config_keys_num);
   plugin_register_read("cpu", cpu_read);
+#if defined(KERNEL_LINUX)
+  plugin_register_shutdown("cpu", cpu_shutdown);
+#endif
 } /* void module_register */
@@ -27,6 +27,13 @@
 #include "utils/common/common.h"
 #include "utils/ignorelist/ignorelist.h"
 
+#if KERNEL_LINUX
+#include "utils/avltree/avltree.h"
+#include "utils/sample_ring/sample_ring.h"
+
+#include <sys/sysmacros.h>
+#endif
+
 #if HAVE_MACH_MACH_TYPES_H
 #include <mach/mach_types.h>
 #endif
@@ -85,6 +92,7 @@ static bool use_bsd_name;
 #elif KERNEL_LINUX
 typedef struct diskstats {
   char *name;
+  dev_t devnum;
 
   /* This overflows in roughly 1361 years */
   unsigned int poll_count;
@@ -107,10 +115,55 @@ typedef struct diskstats {
   bool has_in_progress;
   bool has_io_time;
 
+  /* Name derived from the "UdevNameAttr" udev property. Only looked up again
+   * after udev reported a change of the device. */
+  char *alt_name;
+  bool alt_name_valid;
+
   struct diskstats *next;
 } diskstats_t;
 
+/* All known disks, in a list for the removal sweep and indexed by device
+ * number for the lookup of each line of /proc/diskstats. */
 static diskstats_t *disklist;
+static c_avl_tree_t *disktree;
+
+static void disk_free(diskstats_t *ds);
+
+/* High resolution mode: a dedicated thread samples /proc/diskstats every
+ * "HighResolutionInterval" and keeps the per-sample latency and utilization
+ * of each disk in ring buffers. The read callback only dispatches a summary
+ * (or a distribution) of those samples. */
+typedef struct disk_hires_s {
+  char *name;
+  dev_t devnum;
+  unsigned int poll_count;
+
+  derive_t ops;
+  derive_t time;
+  derive_t io_time;
+  cdtime_t last;
+
+  sample_ring_t *latency;
+  sample_ring_t *utilization;
+
+  struct disk_hires_s *next;
+} disk_hires_t;
+
+static cdtime_t hires_interval;
+static double *hires_percentile;
+static size_t hires_percentile_num;
+static bool hires_distribution;
+static distribution_t *hires_latency_layout;
+static distribution_t *hires_utilization_layout;
+static size_t hires_capacity;
+
+static pthread_mutex_t hires_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hires_cond = PTHREAD_COND_INITIALIZER;
+static bool hires_thread_loop;
+static pthread_t hires_thread_id;
+static disk_hires_t *hires_list;
+static c_avl_tree_t *hires_tree;
 /* #endif KERNEL_LINUX */
 #elif KERNEL_FREEBSD
 static struct gmesh geom_tree;
@@ -151,13 +204,20 @@ static size_t ndrive = 0;
 
 #if HAVE_LIBUDEV_H
 #include <libudev.h>
+#include <poll.h>
 
 static char *conf_udev_name_attr;
 static struct udev *handle_udev;
+static struct udev_monitor *handle_udev_monitor;
 #endif
 
-static const char *config_keys[] = {"Disk", "UseBSDName", "IgnoreSelected",
-                                    "UdevNameAttr"};
+static const char *config_keys[] = {"Disk",
+                                    "UseBSDName",
+                                    "IgnoreSelected",
+                                    "UdevNameAttr",
+                                    "HighResolutionInterval",
+                                    "HighResolutionPercentile",
+                                    "HighResolutionDistribution"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static ignorelist_t *ignorelist;
@@ -194,6 +254,39 @@ static int disk_config(const char *key, const char *value)
 #else
     WARNING("disk plugin: The \"UdevNameAttr\" option is only supported "
             "if collectd is built with libudev support");
+#endif
+#if KERNEL_LINUX
+  } else if (strcasecmp("HighResolutionInterval", key) == 0) {
+    double interval = atof(value);
+    if (interval < 0.0) {
+      ERROR("disk plugin: HighResolutionInterval must not be negative.");
+      return 1;
+    }
+    hires_interval = DOUBLE_TO_CDTIME_T(interval);
+  } else if (strcasecmp("HighResolutionPercentile", key) == 0) {
+    double percent = atof(value);
+    if ((percent <= 0.0) || (percent >= 100.0)) {
+      ERROR("disk plugin: HighResolutionPercentile must be between 0 and 100, "
+            "exclusively.");
+      return 1;
+    }
+    double *tmp = realloc(hires_percentile,
+                          sizeof(*hires_percentile) * (hires_percentile_num + 1));
+    if (tmp == NULL) {
+      ERROR("disk plugin: realloc failed.");
+      return 1;
+    }
+    hires_percentile = tmp;
+    hires_percentile[hires_percentile_num] = percent;
+    hires_percentile_num++;
+  } else if (strcasecmp("HighResolutionDistribution", key) == 0) {
+    hires_distribution = IS_TRUE(value);
+#else
+  } else if ((strcasecmp("HighResolutionInterval", key) == 0) ||
+             (strcasecmp("HighResolutionPercentile", key) == 0) ||
+             (strcasecmp("HighResolutionDistribution", key) == 0)) {
+    WARNING("disk plugin: The \"%s\" option is only supported on Linux "
+            "and will be ignored.", key);
 #endif
   } else {
     return -1;
@@ -202,6 +295,370 @@ static int disk_config(const char *key, const char *value)
   return 0;
 } /* int disk_config */
 
+#if KERNEL_LINUX
+static int disk_devnum_compare(void const *a, void const *b)
+{
+  dev_t x = *((dev_t const *)a);
+  dev_t y = *((dev_t const *)b);
+
+  if (x < y)
+    return -1;
+  if (x > y)
+    return 1;
+  return 0;
+}
+
+static void disk_hires_free(disk_hires_t *dh);
+
+static disk_hires_t *disk_hires_get(dev_t devnum, char const *name)
+{
+  disk_hires_t *dh = NULL;
+  if (c_avl_get(hires_tree, &devnum, (void *)&dh) == 0) {
+    if (strcmp(name, dh->name) == 0)
+      return dh;
+
+    /* The device number has been reused by another disk. The stale entry is
+     * removed from the list by the sweep at the end of this snapshot. */
+    c_avl_remove(hires_tree, &devnum, NULL, NULL);
+    dh->poll_count = 0;
+  }
+
+  dh = calloc(1, sizeof(*dh));
+  if (dh == NULL)
+    return NULL;
+
+  dh->name = strdup(name);
+  dh->devnum = devnum;
+  dh->latency = sample_ring_create(hires_capacity);
+  dh->utilization = sample_ring_create(hires_capacity);
+  if ((dh->name == NULL) || (dh->latency == NULL) ||
+      (dh->utilization == NULL) ||
+      (c_avl_insert(hires_tree, &dh->devnum, dh) != 0)) {
+    disk_hires_free(dh);
+    return NULL;
+  }
+
+  dh->next = hires_list;
+  hires_list = dh;
+  return dh;
+}
+
+static void disk_hires_free(disk_hires_t *dh)
+{
+  sample_ring_destroy(dh->latency);
+  sample_ring_destroy(dh->utilization);
+  free(dh->name);
+  free(dh);
+}
+
+/* Parses one /proc/diskstats snapshot. Must be called with hires_lock held. */
+static void disk_hires_parse(char *buffer, cdtime_t now)
+{
+  static unsigned int poll_count;
+  poll_count++;
+
+  char *saveptr = NULL;
+  for (char *line = strtok_r(buffer, "\n", &saveptr); line != NULL;
+       line = strtok_r(NULL, "\n", &saveptr)) {
+    char *fields[32];
+    int numfields = strsplit(line, fields, STATIC_ARRAY_SIZE(fields));
+    /* partitions do not report times */
+    if (numfields < 14)
+      continue;
+
+    /* The ignorelist is applied by the read callback, which knows the udev
+     * name of the disk. */
+    dev_t devnum = makedev(strtoul(fields[0], NULL, 10),
+                           strtoul(fields[1], NULL, 10));
+    disk_hires_t *dh = disk_hires_get(devnum, fields[2]);
+    if (dh == NULL)
+      continue;
+
+    derive_t ops = atoll(fields[3]) + atoll(fields[7]);
+    derive_t time = atoll(fields[6]) + atoll(fields[10]);
+    derive_t io_time = atoll(fields[12]);
+
+    if ((dh->last != 0) && (now > dh->last)) {
+      derive_t diff_ops = ops - dh->ops;
+      derive_t diff_time = time - dh->time;
+      derive_t diff_io_time = io_time - dh->io_time;
+
+      /* times are reported in milliseconds */
+      if ((diff_ops > 0) && (diff_time >= 0))
+        sample_ring_add(dh->latency,
+                        ((double)diff_time) / (1000.0 * (double)diff_ops));
+      if (diff_io_time >= 0)
+        sample_ring_add(dh->utilization,
+                        100.0 * ((double)diff_io_time) /
+                            (1000.0 * CDTIME_T_TO_DOUBLE(now - dh->last)));
+    }
+
+    dh->ops = ops;
+    dh->time = time;
+    dh->io_time = io_time;
+    dh->last = now;
+    dh->poll_count = poll_count;
+  }
+
+  /* Remove disks that have disappeared from diskstats */
+  disk_hires_t **next = &hires_list;
+  while (*next != NULL) {
+    disk_hires_t *dh = *next;
+    if (dh->poll_count == poll_count) {
+      next = &dh->next;
+      continue;
+    }
+    *next = dh->next;
+
+    disk_hires_t *indexed = NULL;
+    if ((c_avl_get(hires_tree, &dh->devnum, (void *)&indexed) == 0) &&
+        (indexed == dh))
+      c_avl_remove(hires_tree, &dh->devnum, NULL, NULL);
+    disk_hires_free(dh);
+  }
+}
+
+static void *disk_hires_thread(void __attribute__((unused)) *arg)
+{
+  int fd = open("/proc/diskstats", O_RDONLY);
+  if (fd < 0) {
+    ERROR("disk plugin: open(\"/proc/diskstats\"): %s", STRERRNO);
+    return (void *)-1;
+  }
+
+  size_t buffer_size = 65536;
+  char *buffer = malloc(buffer_size);
+  if (buffer == NULL) {
+    ERROR("disk plugin: malloc failed.");
+    close(fd);
+    return (void *)-1;
+  }
+
+  cdtime_t next = cdtime();
+
+  pthread_mutex_lock(&hires_lock);
+  while (hires_thread_loop) {
+    pthread_mutex_unlock(&hires_lock);
+
+    ssize_t len = pread(fd, buffer, buffer_size - 1, 0);
+    /* Grow the buffer until the whole file fits, so that a snapshot is always
+     * read with a single system call. */
+    while ((len > 0) && ((size_t)len == buffer_size - 1)) {
+      char *tmp = realloc(buffer, 2 * buffer_size);
+      if (tmp == NULL)
+        break;
+      buffer = tmp;
+      buffer_size *= 2;
+      len = pread(fd, buffer, buffer_size - 1, 0);
+    }
+    cdtime_t now = cdtime();
+
+    pthread_mutex_lock(&hires_lock);
+    if (!hires_thread_loop)
+      break;
+
+    if (len > 0) {
+      buffer[len] = '\0';
+      disk_hires_parse(buffer, now);
+    }
+
+    /* Wait for the next absolute deadline so that the sampling rate does not
+     * drift. If we are late, skip the missed samples. */
+    now = cdtime();
+    next += hires_interval;
+    if (next < now)
+      next = now + hires_interval;
+
+    struct timespec ts_wait = CDTIME_T_TO_TIMESPEC(next);
+    pthread_cond_timedwait(&hires_cond, &hires_lock, &ts_wait);
+  }
+  pthread_mutex_unlock(&hires_lock);
+
+  free(buffer);
+  close(fd);
+  return (void *)0;
+}
+
+static int disk_hires_start(void)
+{
+  if (hires_interval == 0)
+    return 0;
+
+  cdtime_t interval = plugin_get_interval();
+  if (hires_interval >= interval) {
+    WARNING("disk plugin: HighResolutionInterval (%.3f) is not smaller than "
+            "the read interval (%.3f), disabling the high resolution mode.",
+            CDTIME_T_TO_DOUBLE(hires_interval), CDTIME_T_TO_DOUBLE(interval));
+    hires_interval = 0;
+    return 0;
+  }
+
+  /* Room for one interval worth of samples, plus some slack for jitter of
+   * the read callback. */
+  hires_capacity = (size_t)(2 * (interval / hires_interval)) + 1;
+
+  hires_tree = c_avl_create(disk_devnum_compare);
+  if (hires_tree == NULL) {
+    ERROR("disk plugin: c_avl_create failed.");
+    return -1;
+  }
+
+  if (hires_distribution) {
+    /* 100us .. 1.6s */
+    hires_latency_layout = distribution_new_exponential(16, 2.0, 0.0001);
+    /* 5% wide buckets */
+    hires_utilization_layout = distribution_new_linear(20, 5.0);
+    if ((hires_latency_layout == NULL) || (hires_utilization_layout == NULL)) {
+      ERROR("disk plugin: Creating the distribution layouts failed.");
+      return -1;
+    }
+  }
+
+  pthread_mutex_lock(&hires_lock);
+  hires_thread_loop = true;
+  int status = plugin_thread_create(&hires_thread_id, disk_hires_thread, NULL,
+                                    "disk hires");
+  if (status != 0) {
+    hires_thread_loop = false;
+    pthread_mutex_unlock(&hires_lock);
+    ERROR("disk plugin: Starting high resolution thread failed.");
+    return -1;
+  }
+  pthread_mutex_unlock(&hires_lock);
+
+  return 0;
+}
+
+/* Takes the samples of all disks, replacing the rings of the sampling thread
+ * by empty ones. The samples are summarized without holding hires_lock, so
+ * that the sampling thread is not delayed by the dispatch. */
+static disk_hires_t *disk_hires_snapshot(void)
+{
+  disk_hires_t *snapshot = NULL;
+
+  pthread_mutex_lock(&hires_lock);
+  for (disk_hires_t *dh = hires_list; dh != NULL; dh = dh->next) {
+    disk_hires_t *copy = calloc(1, sizeof(*copy));
+    if (copy != NULL) {
+      copy->name = strdup(dh->name);
+      copy->devnum = dh->devnum;
+      copy->latency = sample_ring_create(hires_capacity);
+      copy->utilization = sample_ring_create(hires_capacity);
+    }
+    if ((copy == NULL) || (copy->name == NULL) || (copy->latency == NULL) ||
+        (copy->utilization == NULL)) {
+      /* The samples of this disk are dropped rather than reported twice. */
+      if (copy != NULL)
+        disk_hires_free(copy);
+      sample_ring_reset(dh->latency);
+      sample_ring_reset(dh->utilization);
+      continue;
+    }
+
+    sample_ring_t *tmp = dh->latency;
+    dh->latency = copy->latency;
+    copy->latency = tmp;
+
+    tmp = dh->utilization;
+    dh->utilization = copy->utilization;
+    copy->utilization = tmp;
+
+    copy->next = snapshot;
+    snapshot = copy;
+  }
+  pthread_mutex_unlock(&hires_lock);
+
+  return snapshot;
+}
+
+static void disk_hires_commit(void)
+{
+  if (hires_interval == 0)
+    return;
+
+  metric_type_t type =
+      hires_distribution ? METRIC_TYPE_DISTRIBUTION : METRIC_TYPE_GAUGE;
+  metric_family_t fam_latency = {
+      .name = "host_disk_io_latency_hires_seconds",
+      .type = type,
+  };
+  metric_family_t fam_utilization = {
+      .name = "host_disk_utilization_hires_percent",
+      .type = type,
+  };
+
+  disk_hires_t *snapshot = disk_hires_snapshot();
+  while (snapshot != NULL) {
+    disk_hires_t *dh = snapshot;
+    snapshot = dh->next;
+
+    /* Use the same name as the regular metrics of the disk. */
+    char const *output_name = dh->name;
+    diskstats_t *ds = NULL;
+    if ((c_avl_get(disktree, &dh->devnum, (void *)&ds) == 0) &&
+        (strcmp(ds->name, dh->name) == 0) && (ds->alt_name != NULL))
+      output_name = ds->alt_name;
+
+    if (ignorelist_match(ignorelist, output_name) != 0) {
+      disk_hires_free(dh);
+      continue;
+    }
+
+    metric_t m = {0};
+    metric_label_set(&m, "device", output_name);
+
+    sample_ring_metric_append(dh->latency, &fam_latency, &m, hires_percentile,
+                              hires_percentile_num, hires_latency_layout);
+    sample_ring_metric_append(dh->utilization, &fam_utilization, &m,
+                              hires_percentile, hires_percentile_num,
+                              hires_utilization_layout);
+
+    metric_reset(&m);
+    disk_hires_free(dh);
+  }
+
+  metric_family_t *fams[] = {&fam_latency, &fam_utilization, NULL};
+  for (size_t i = 0; fams[i] != NULL; i++) {
+    if (fams[i]->metric.num == 0)
+      continue;
+
+    int status = plugin_dispatch_metric_family(fams[i]);
+    if (status != 0) {
+      ERROR("disk: plugin_dispatch_metric_family failed: %s",
+            STRERROR(status));
+    }
+    metric_family_metric_reset(fams[i]);
+  }
+}
+
+static void disk_hires_stop(void)
+{
+  pthread_mutex_lock(&hires_lock);
+  bool running = hires_thread_loop;
+  hires_thread_loop = false;
+  pthread_cond_broadcast(&hires_cond);
+  pthread_mutex_unlock(&hires_lock);
+
+  if (running)
+    pthread_join(hires_thread_id, NULL);
+
+  c_avl_destroy(hires_tree);
+  hires_tree = NULL;
+  while (hires_list != NULL) {
+    disk_hires_t *next = hires_list->next;
+    disk_hires_free(hires_list);
+    hires_list = next;
+  }
+
+  distribution_destroy(hires_latency_layout);
+  hires_latency_layout = NULL;
+  distribution_destroy(hires_utilization_layout);
+  hires_utilization_layout = NULL;
+  sfree(hires_percentile);
+  hires_percentile_num = 0;
+}
+#endif /* KERNEL_LINUX */
+
 static int disk_init(void)
 {
 #if HAVE_IOKIT_IOKITLIB_H
@@ -221,6 +678,14 @@ static int disk_init(void)
   /* #endif HAVE_IOKIT_IOKITLIB_H */
 
 #elif KERNEL_LINUX
+  if (disktree == NULL) {
+    disktree = c_avl_create(disk_devnum_compare);
+    if (disktree == NULL) {
+      ERROR("disk plugin: c_avl_create failed.");
+      return -1;
+    }
+  }
+
 #if HAVE_LIBUDEV_H
   if (conf_udev_name_attr != NULL) {
     handle_udev = udev_new();
@@ -228,8 +693,25 @@ static int disk_init(void)
       ERROR("disk plugin: udev_new() failed!");
       return -1;
     }
+
+    /* Without the monitor the udev name is looked up on every read. */
+    handle_udev_monitor = udev_monitor_new_from_netlink(handle_udev, "udev");
+    if ((handle_udev_monitor == NULL) ||
+        (udev_monitor_filter_add_match_subsystem_devtype(handle_udev_monitor,
+                                                         "block", NULL) < 0) ||
+        (udev_monitor_enable_receiving(handle_udev_monitor) < 0)) {
+      WARNING("disk plugin: Unable to monitor udev events, the \"%s\" "
+              "attribute will be looked up on every read.",
+              conf_udev_name_attr);
+      if (handle_udev_monitor != NULL)
+        udev_monitor_unref(handle_udev_monitor);
+      handle_udev_monitor = NULL;
+    }
   }
 #endif /* HAVE_LIBUDEV_H */
+
+  if (disk_hires_start() != 0)
+    return -1;
   /* #endif KERNEL_LINUX */
 
 #elif KERNEL_FREEBSD
@@ -297,15 +779,66 @@ static int disk_init(void)
 static int disk_shutdown(void)
 {
 #if KERNEL_LINUX
+  disk_hires_stop();
+
+  c_avl_destroy(disktree);
+  disktree = NULL;
+  while (disklist != NULL) {
+    diskstats_t *next = disklist->next;
+    disk_free(disklist);
+    disklist = next;
+  }
+
 #if HAVE_LIBUDEV_H
+  if (handle_udev_monitor != NULL)
+    udev_monitor_unref(handle_udev_monitor);
+  handle_udev_monitor = NULL;
   if (handle_udev != NULL)
     udev_unref(handle_udev);
+  handle_udev = NULL;
 #endif /* HAVE_LIBUDEV_H */
 #endif /* KERNEL_LINUX */
   return 0;
 }
 
 #if KERNEL_LINUX
+static void disk_free(diskstats_t *ds)
+{
+  free(ds->name);
+  free(ds->alt_name);
+  free(ds);
+}
+
+static diskstats_t *disk_get(dev_t devnum, char const *name)
+{
+  diskstats_t *ds = NULL;
+  if (c_avl_get(disktree, &devnum, (void *)&ds) == 0) {
+    if (strcmp(name, ds->name) == 0)
+      return ds;
+
+    /* The device number has been reused by another disk. The stale entry is
+     * removed from the list by the sweep at the end of disk_read. */
+    DEBUG("disk plugin: Device %u:%u renamed from %s to %s.", major(devnum),
+          minor(devnum), ds->name, name);
+    c_avl_remove(disktree, &devnum, NULL, NULL);
+  }
+
+  ds = calloc(1, sizeof(*ds));
+  if (ds == NULL)
+    return NULL;
+
+  ds->name = strdup(name);
+  ds->devnum = devnum;
+  if ((ds->name == NULL) || (c_avl_insert(disktree, &ds->devnum, ds) != 0)) {
+    disk_free(ds);
+    return NULL;
+  }
+
+  ds->next = disklist;
+  disklist = ds;
+  return ds;
+}
+
 static counter_t disk_calc_time_incr(counter_t delta_time,
                                      counter_t delta_ops)
 {
@@ -325,14 +858,14 @@ static counter_t disk_calc_time_incr(counter_t delta_time,
  * Otherwise it returns NULL.
  */
 
-static char *disk_udev_attr_name(struct udev *udev, char *disk_name,
-                                 const char *attr)
+static char *disk_udev_attr_name(struct udev *udev, dev_t devnum,
+                                 char *disk_name, const char *attr)
 {
   struct udev_device *dev;
   const char *prop;
   char *output = NULL;
 
-  dev = udev_device_new_from_subsystem_sysname(udev, "block", disk_name);
+  dev = udev_device_new_from_devnum(udev, 'b', devnum);
   if (dev != NULL) {
     prop = udev_device_get_property_value(dev, attr);
     if (prop) {
@@ -343,7 +876,35 @@ static char *disk_udev_attr_name(struct udev *udev, char *disk_name,
   }
   return output;
 }
-#endif
+
+/* Drains the pending udev events without blocking and invalidates the cached
+ * udev name of every disk that has changed. */
+static void disk_udev_monitor_read(void)
+{
+  if (handle_udev_monitor == NULL)
+    return;
+
+  struct pollfd pfd = {
+      .fd = udev_monitor_get_fd(handle_udev_monitor),
+      .events = POLLIN,
+  };
+
+  while (poll(&pfd, 1, 0) > 0) {
+    struct udev_device *dev = udev_monitor_receive_device(handle_udev_monitor);
+    if (dev == NULL)
+      break;
+
+    dev_t devnum = udev_device_get_devnum(dev);
+    diskstats_t *ds = NULL;
+    if (c_avl_get(disktree, &devnum, (void *)&ds) == 0) {
+      DEBUG("disk plugin: udev %s event for %s.",
+            udev_device_get_action(dev), ds->name);
+      ds->alt_name_valid = false;
+    }
+    udev_device_unref(dev);
+  }
+}
+#endif /* HAVE_LIBUDEV_H */
 
 #if HAVE_IOKIT_IOKITLIB_H
 static signed long long dict_get_value(CFDictionaryRef dict, const char *key)
@@ -753,13 +1314,17 @@ static int disk_read(void)
   derive_t weighted_time = 0;
   int is_disk = 0;
 
-  diskstats_t *ds, *pre_ds;
+  diskstats_t *ds;
 
   if ((fh = fopen("/proc/diskstats", "r")) == NULL) {
     ERROR("disk plugin: fopen(\"/proc/diskstats\"): %s", STRERRNO);
     return -1;
   }
 
+#if HAVE_LIBUDEV_H
+  disk_udev_monitor_read();
+#endif
+
   poll_count++;
   while (fgets(buffer, sizeof(buffer), fh) != NULL) {
     int numfields = strsplit(buffer, fields, 32);
@@ -769,26 +1334,12 @@ static int disk_read(void)
       continue;
 
     char *disk_name = fields[2];
+    dev_t devnum =
+        makedev(strtoul(fields[0], NULL, 10), strtoul(fields[1], NULL, 10));
 
-    for (ds = disklist, pre_ds = disklist; ds != NULL;
-         pre_ds = ds, ds = ds->next)
-      if (strcmp(disk_name, ds->name) == 0)
-        break;
-
-    if (ds == NULL) {
-      if ((ds = calloc(1, sizeof(*ds))) == NULL)
-        continue;
-
-      if ((ds->name = strdup(disk_name)) == NULL) {
-        free(ds);
-        continue;
-      }
-
-      if (pre_ds == NULL)
-        disklist = ds;
-      else
-        pre_ds->next = ds;
-    }
+    ds = disk_get(devnum, disk_name);
+    if (ds == NULL)
+      continue;
 
     is_disk = 0;
     if (numfields == 7) {
@@ -906,22 +1457,22 @@ static int disk_read(void)
     char *output_name = disk_name;
 
 #if HAVE_LIBUDEV_H
-    char *alt_name = NULL;
     if (conf_udev_name_attr != NULL) {
-      alt_name =
-          disk_udev_attr_name(handle_udev, disk_name, conf_udev_name_attr);
-      if (alt_name != NULL)
-        output_name = alt_name;
+      if (!ds->alt_name_valid) {
+        sfree(ds->alt_name);
+        ds->alt_name = disk_udev_attr_name(handle_udev, devnum, disk_name,
+                                           conf_udev_name_attr);
+        /* Without udev events there is no way to tell when the name
+         * changes, so it has to be looked up again on the next read. */
+        ds->alt_name_valid = (handle_udev_monitor != NULL);
+      }
+      if (ds->alt_name != NULL)
+        output_name = ds->alt_name;
     }
 #endif
 
-    if (ignorelist_match(ignorelist, output_name) != 0) {
-#if HAVE_LIBUDEV_H
-      /* release udev-based alternate name, if allocated */
-      sfree(alt_name);
-#endif
+    if (ignorelist_match(ignorelist, output_name) != 0)
       continue;
-    }
     metric_t m = {0};
     metric_label_set(&m, "device", output_name);
 
@@ -970,36 +1521,32 @@ static int disk_read(void)
     } /* if (is_disk) */
 
     metric_reset(&m);
-
-#if HAVE_LIBUDEV_H
-    /* release udev-based alternate name, if allocated */
-    sfree(alt_name);
-#endif
   } /* while (fgets (buffer, sizeof (buffer), fh) != NULL) */
 
   /* Remove disks that have disappeared from diskstats */
-  for (ds = disklist, pre_ds = disklist; ds != NULL;) {
+  diskstats_t **next = &disklist;
+  while (*next != NULL) {
+    ds = *next;
     /* Disk exists */
     if (ds->poll_count == poll_count) {
-      pre_ds = ds;
-      ds = ds->next;
+      next = &ds->next;
       continue;
     }
 
     /* Disk is missing, remove it */
-    diskstats_t *missing_ds = ds;
-    if (ds == disklist) {
-      pre_ds = disklist = ds->next;
-    } else {
-      pre_ds->next = ds->next;
-    }
-    ds = ds->next;
+    *next = ds->next;
+
+    diskstats_t *indexed = NULL;
+    if ((c_avl_get(disktree, &ds->devnum, (void *)&indexed) == 0) &&
+        (indexed == ds))
+      c_avl_remove(disktree, &ds->devnum, NULL, NULL);
 
-    DEBUG("disk plugin: Disk %s disappeared.", missing_ds->name);
-    free(missing_ds->name);
-    free(missing_ds);
+    DEBUG("disk plugin: Disk %s disappeared.", ds->name);
+    disk_free(ds);
   }
   fclose(fh);
+
+  disk_hires_commit();
   /* #endif defined(KERNEL_LINUX) */
 
 #elif HAVE_LIBKSTAT
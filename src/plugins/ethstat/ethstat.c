@@ -25,6 +25,7 @@
 #include "collectd.h"
 
 #include "plugin.h"
+#include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
 
 #if HAVE_SYS_IOCTL_H
@@ -40,26 +41,51 @@
 #include <linux/ethtool.h>
 #endif
 
-static char **interfaces;
+typedef struct {
+  char *device;
+
+  /* Number of statistics the string table below has been fetched for. The
+   * mapping is rebuilt when the driver reports a different number. */
+  size_t n_stats;
+  /* Reused for every ETHTOOL_GSTATS request. */
+  struct ethtool_stats *stats;
+  /* Index into "families" for each statistic. */
+  size_t *stat_family;
+
+  metric_family_t *families;
+  counter_t *values;
+  size_t families_num;
+} ethstat_interface_t;
+
+/* Value of "stat_family" for statistics which are not reported. */
+#define ETHSTAT_IGNORED SIZE_MAX
+
+static ethstat_interface_t *interfaces;
 static size_t interfaces_num;
 
+static bool aggregate_queues;
+
+/* Control socket for the SIOCETHTOOL requests, kept open across reads. */
+static int ethstat_fd = -1;
+
 static int ethstat_add_interface(const oconfig_item_t *ci)
 {
-  char **tmp;
-  int status;
+  char *device = NULL;
+  int status = cf_util_get_string(ci, &device);
+  if (status != 0)
+    return status;
 
-  tmp = realloc(interfaces, sizeof(*interfaces) * (interfaces_num + 1));
-  if (tmp == NULL)
+  ethstat_interface_t *tmp =
+      realloc(interfaces, sizeof(*interfaces) * (interfaces_num + 1));
+  if (tmp == NULL) {
+    free(device);
     return -1;
+  }
   interfaces = tmp;
-  interfaces[interfaces_num] = NULL;
-
-  status = cf_util_get_string(ci, interfaces + interfaces_num);
-  if (status != 0)
-    return status;
+  interfaces[interfaces_num] = (ethstat_interface_t){.device = device};
 
   interfaces_num++;
-  INFO("ethstat plugin: Registered interface %s", interfaces[interfaces_num - 1]);
+  INFO("ethstat plugin: Registered interface %s", device);
 
   return 0;
 }
@@ -71,6 +97,8 @@ static int ethstat_config(oconfig_item_t *ci)
 
     if (strcasecmp("Interface", child->key) == 0)
       ethstat_add_interface(child);
+    else if (strcasecmp("AggregateQueues", child->key) == 0)
+      cf_util_get_boolean(child, &aggregate_queues);
     else
       WARNING("ethstat plugin: The config option \"%s\" is unknown.", child->key);
   }
@@ -78,119 +106,252 @@ static int ethstat_config(oconfig_item_t *ci)
   return 0;
 }
 
-static void ethstat_submit_value(const char *device, const char *name,
-                                 counter_t value)
+/* Drivers whose "rx0_bytes" statistics are per queue. Other drivers use
+ * names like "rx64_packets" for packet size histograms. */
+static char const *const rxn_queue_drivers[] = {"mlx4_en", "mlx5_core"};
+
+/* Checks whether "name" is a per-queue statistic. If so, the name of the
+ * statistic with the queue number removed is stored in "buffer" and true is
+ * returned. Recognized are the "rx_queue_0_packets" and "queue_0_tx_cnt"
+ * (ixgbe, virtio, ena), "tx-0.packets" (i40e, ice) and, for the drivers in
+ * rxn_queue_drivers only, "rx0_bytes" (mlx4, mlx5) naming schemes, which
+ * become "rx_queue_packets", "queue_tx_cnt", "tx_queue_packets" and
+ * "rx_queue_bytes" respectively. */
+static bool ethstat_queue_name(char const *driver, char const *name,
+                               char *buffer, size_t buffer_size)
+{
+  char const *queue = strstr(name, "queue_");
+  if ((queue != NULL) && isdigit((int)queue[strlen("queue_")])) {
+    char const *end = queue + strlen("queue_");
+    while (isdigit((int)*end))
+      end++;
+    if (*end == 0) {
+      ssnprintf(buffer, buffer_size, "%.*squeue", (int)(queue - name), name);
+      return true;
+    }
+    if (*end != '_')
+      return false;
+    end++;
+
+    ssnprintf(buffer, buffer_size, "%.*squeue_%s", (int)(queue - name), name,
+              end);
+    return true;
+  }
+
+  if ((strncmp(name, "rx", 2) != 0) && (strncmp(name, "tx", 2) != 0))
+    return false;
+
+  bool rxn_queues = false;
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(rxn_queue_drivers); i++)
+    if (strcmp(driver, rxn_queue_drivers[i]) == 0)
+      rxn_queues = true;
+
+  /* "rx-0." or, for the drivers above, "rx0_". */
+  char const *num = name + 2;
+  char sep = '_';
+  if (*num == '-') {
+    num++;
+    sep = '.';
+  } else if (!rxn_queues) {
+    return false;
+  }
+  if (!isdigit((int)*num))
+    return false;
+
+  char const *end = num;
+  while (isdigit((int)*end))
+    end++;
+  if (*end != sep)
+    return false;
+  end++;
+
+  ssnprintf(buffer, buffer_size, "%.2s_queue_%s", name, end);
+  return true;
+}
+
+static void ethstat_interface_reset(ethstat_interface_t *ifc)
 {
-  char fam_name[256];
-  ssnprintf(fam_name, sizeof(fam_name), "host_ethstat_%s_total", name);
+  for (size_t i = 0; i < ifc->families_num; i++) {
+    metric_family_metric_reset(&ifc->families[i]);
+    sfree(ifc->families[i].name);
+  }
+  sfree(ifc->families);
+  sfree(ifc->values);
+  ifc->families_num = 0;
 
-  metric_family_t fam = {
-    .name = fam_name,
-    .type = METRIC_TYPE_COUNTER,
-  };
+  sfree(ifc->stats);
+  sfree(ifc->stat_family);
+  ifc->n_stats = 0;
+}
 
-  metric_family_append(&fam, "device", device, (value_t){.counter = value}, NULL);
+/* Fetches the string table of the interface and maps every statistic to a
+ * metric family. */
+static int ethstat_interface_update(ethstat_interface_t *ifc,
+                                    char const *driver, size_t n_stats,
+                                    struct ifreq *req)
+{
+  ethstat_interface_reset(ifc);
+
+  struct ethtool_gstrings *strings =
+      calloc(1, sizeof(*strings) + (n_stats * ETH_GSTRING_LEN));
+  ifc->stats = calloc(1, sizeof(*ifc->stats) + (n_stats * sizeof(uint64_t)));
+  ifc->stat_family = calloc(n_stats, sizeof(*ifc->stat_family));
+  ifc->families = calloc(n_stats, sizeof(*ifc->families));
+  ifc->values = calloc(n_stats, sizeof(*ifc->values));
+  c_avl_tree_t *names =
+      c_avl_create((int (*)(const void *, const void *))strcmp);
+  if ((strings == NULL) || (ifc->stats == NULL) ||
+      (ifc->stat_family == NULL) || (ifc->families == NULL) ||
+      (ifc->values == NULL) || (names == NULL)) {
+    ERROR("ethstat plugin: malloc failed.");
+    sfree(strings);
+    if (names != NULL)
+      c_avl_destroy(names);
+    ethstat_interface_reset(ifc);
+    return -1;
+  }
 
-  int status = plugin_dispatch_metric_family(&fam);
-  if (status != 0)
-    ERROR("ethstat plugin: plugin_dispatch_metric_family failed: %s", STRERROR(status));
+  strings->cmd = ETHTOOL_GSTRINGS;
+  strings->string_set = ETH_SS_STATS;
+  strings->len = n_stats;
+  req->ifr_data = (void *)strings;
+  if (ioctl(ethstat_fd, SIOCETHTOOL, req) < 0) {
+    ERROR("ethstat plugin: Cannot get strings from %s: %s", ifc->device,
+          STRERRNO);
+    sfree(strings);
+    c_avl_destroy(names);
+    ethstat_interface_reset(ifc);
+    return -1;
+  }
+
+  int status = 0;
+  for (size_t i = 0; i < n_stats; i++) {
+    char stat_name[ETH_GSTRING_LEN + 1];
+    sstrncpy(stat_name, (char *)&strings->data[i * ETH_GSTRING_LEN],
+             sizeof(stat_name));
+
+    /* Remove leading spaces in key name */
+    char *name = stat_name;
+    while (isspace((int)*name))
+      name++;
+
+    char queue_name[ETH_GSTRING_LEN + 16];
+    bool is_queue = aggregate_queues && ethstat_queue_name(driver, name,
+                                                           queue_name,
+                                                           sizeof(queue_name));
+    if (is_queue)
+      name = queue_name;
+
+    char fam_name[256];
+    ssnprintf(fam_name, sizeof(fam_name), "host_ethstat_%s_total", name);
+
+    /* The statistics of all queues are summed up. Other statistics the
+     * driver reports more than once are only reported the first time. */
+    size_t *index = NULL;
+    if (c_avl_get(names, fam_name, (void *)&index) == 0) {
+      if (is_queue) {
+        ifc->stat_family[i] = *index;
+      } else {
+        WARNING("ethstat plugin: %s reports the statistic \"%s\" more than "
+                "once, ignoring the duplicate.",
+                ifc->device, name);
+        ifc->stat_family[i] = ETHSTAT_IGNORED;
+      }
+      continue;
+    }
+
+    metric_family_t *fam = &ifc->families[ifc->families_num];
+    fam->name = strdup(fam_name);
+    fam->type = METRIC_TYPE_COUNTER;
+    if (fam->name == NULL) {
+      status = ENOMEM;
+      break;
+    }
+
+    ifc->stat_family[i] = ifc->families_num;
+    ifc->families_num++;
+    c_avl_insert(names, fam->name, &ifc->stat_family[i]);
+  }
+
+  sfree(strings);
+  c_avl_destroy(names);
 
-  metric_family_metric_reset(&fam);
+  if (status != 0) {
+    ERROR("ethstat plugin: strdup failed.");
+    ethstat_interface_reset(ifc);
+    return -1;
+  }
+
+  ifc->n_stats = n_stats;
+  return 0;
 }
 
-static int ethstat_read_interface(char *device)
+static int ethstat_read_interface(ethstat_interface_t *ifc)
 {
-  int fd;
-  struct ethtool_gstrings *strings;
-  struct ethtool_stats *stats;
-  size_t n_stats;
-  size_t strings_size;
-  size_t stats_size;
   int status;
 
-  fd = socket(AF_INET, SOCK_DGRAM, /* protocol = */ 0);
-  if (fd < 0) {
-    ERROR("ethstat plugin: Failed to open control socket: %s", STRERRNO);
-    return 1;
+  if (ethstat_fd < 0) {
+    ethstat_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, /* protocol = */ 0);
+    if (ethstat_fd < 0) {
+      ERROR("ethstat plugin: Failed to open control socket: %s", STRERRNO);
+      return 1;
+    }
   }
 
   struct ethtool_drvinfo drvinfo = {.cmd = ETHTOOL_GDRVINFO};
 
   struct ifreq req = {.ifr_data = (void *)&drvinfo};
 
-  sstrncpy(req.ifr_name, device, sizeof(req.ifr_name));
+  sstrncpy(req.ifr_name, ifc->device, sizeof(req.ifr_name));
 
-  status = ioctl(fd, SIOCETHTOOL, &req);
+  status = ioctl(ethstat_fd, SIOCETHTOOL, &req);
   if (status < 0) {
-    close(fd);
     ERROR("ethstat plugin: Failed to get driver information "
           "from %s: %s",
-          device, STRERRNO);
+          ifc->device, STRERRNO);
     return -1;
   }
 
-  n_stats = (size_t)drvinfo.n_stats;
+  size_t n_stats = (size_t)drvinfo.n_stats;
   if (n_stats < 1) {
-    close(fd);
-    ERROR("ethstat plugin: No stats available for %s", device);
+    ERROR("ethstat plugin: No stats available for %s", ifc->device);
     return -1;
   }
 
-  strings_size = sizeof(struct ethtool_gstrings) + (n_stats * ETH_GSTRING_LEN);
-  stats_size = sizeof(struct ethtool_stats) + (n_stats * sizeof(uint64_t));
-
-  strings = malloc(strings_size);
-  stats = malloc(stats_size);
-  if ((strings == NULL) || (stats == NULL)) {
-    close(fd);
-    sfree(strings);
-    sfree(stats);
-    ERROR("ethstat plugin: malloc failed.");
+  if ((n_stats != ifc->n_stats) &&
+      (ethstat_interface_update(ifc, drvinfo.driver, n_stats, &req) != 0))
     return -1;
-  }
 
-  strings->cmd = ETHTOOL_GSTRINGS;
-  strings->string_set = ETH_SS_STATS;
-  strings->len = n_stats;
-  req.ifr_data = (void *)strings;
-  status = ioctl(fd, SIOCETHTOOL, &req);
+  ifc->stats->cmd = ETHTOOL_GSTATS;
+  ifc->stats->n_stats = n_stats;
+  req.ifr_data = (void *)ifc->stats;
+  status = ioctl(ethstat_fd, SIOCETHTOOL, &req);
   if (status < 0) {
-    close(fd);
-    free(strings);
-    free(stats);
-    ERROR("ethstat plugin: Cannot get strings from %s: %s", device, STRERRNO);
+    ERROR("ethstat plugin: Reading statistics from %s failed: %s",
+          ifc->device, STRERRNO);
     return -1;
   }
 
-  stats->cmd = ETHTOOL_GSTATS;
-  stats->n_stats = n_stats;
-  req.ifr_data = (void *)stats;
-  status = ioctl(fd, SIOCETHTOOL, &req);
-  if (status < 0) {
-    close(fd);
-    free(strings);
-    free(stats);
-    ERROR("ethstat plugin: Reading statistics from %s failed: %s", device,
-          STRERRNO);
-    return -1;
-  }
+  memset(ifc->values, 0, ifc->families_num * sizeof(*ifc->values));
+  for (size_t i = 0; i < n_stats; i++)
+    if (ifc->stat_family[i] != ETHSTAT_IGNORED)
+      ifc->values[ifc->stat_family[i]] += (counter_t)ifc->stats->data[i];
 
-  for (size_t i = 0; i < n_stats; i++) {
-    char *stat_name;
+  for (size_t i = 0; i < ifc->families_num; i++) {
+    metric_family_t *fam = &ifc->families[i];
 
-    stat_name = (void *)&strings->data[i * ETH_GSTRING_LEN];
-    /* Remove leading spaces in key name */
-    while (isspace((int)*stat_name))
-      stat_name++;
+    DEBUG("ethstat plugin: device = \"%s\": %s = %" PRIu64, ifc->device,
+          fam->name, (uint64_t)ifc->values[i]);
+    metric_family_append(fam, "device", ifc->device,
+                         (value_t){.counter = ifc->values[i]}, NULL);
 
-    DEBUG("ethstat plugin: device = \"%s\": %s = %" PRIu64, device, stat_name,
-          (uint64_t)stats->data[i]);
-    ethstat_submit_value(device, stat_name, (counter_t)stats->data[i]);
-  }
+    status = plugin_dispatch_metric_family(fam);
+    if (status != 0)
+      ERROR("ethstat plugin: plugin_dispatch_metric_family failed: %s",
+            STRERROR(status));
 
-  close(fd);
-  sfree(strings);
-  sfree(stats);
+    metric_family_metric_reset(fam);
+  }
 
   return 0;
 }
@@ -198,20 +359,27 @@ static int ethstat_read_interface(char *device)
 static int ethstat_read(void)
 {
   for (size_t i = 0; i < interfaces_num; i++)
-    ethstat_read_interface(interfaces[i]);
+    ethstat_read_interface(&interfaces[i]);
 
   return 0;
 }
 
 static int ethstat_shutdown(void)
 {
+  if (ethstat_fd >= 0)
+    close(ethstat_fd);
+  ethstat_fd = -1;
+
   if (interfaces == NULL)
     return 0;
 
-  for (size_t i = 0; i < interfaces_num; i++)
-    sfree(interfaces[i]);
+  for (size_t i = 0; i < interfaces_num; i++) {
+    ethstat_interface_reset(&interfaces[i]);
+    sfree(interfaces[i].device);
+  }
 
   sfree(interfaces);
+  interfaces_num = 0;
   return 0;
 }
 
@@ -22,12 +22,22 @@
  *   Manuel Sanmartin
  **/
 
+/* _GNU_SOURCE is needed for setns(2) */
+#define _GNU_SOURCE
+
 #include "collectd.h"
 
 #include "plugin.h"
 #include "utils/common/common.h"
 #include "utils/ignorelist/ignorelist.h"
 
+#if KERNEL_LINUX
+#include <sched.h>
+
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
 #if HAVE_SYS_TYPES_H
 #include <sys/types.h>
 #endif
@@ -79,6 +89,8 @@ static const char *config_keys[] = {
     "Interface",
     "IgnoreSelected",
     "ReportInactive",
+    "UniqueName",
+    "NetNamespace",
 };
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
@@ -97,6 +109,29 @@ static size_t numif;
 static bool unique_name;
 #endif /* HAVE_LIBKSTAT */
 
+#if KERNEL_LINUX
+/* The statistics of all interfaces of a network namespace are dumped with a
+ * single RTM_GETLINK request. The netlink sockets are created in the target
+ * namespace when the plugin is initialized and kept open afterwards. */
+typedef struct {
+  char *name; /* NULL for the namespace of the daemon */
+  int fd;
+  uint32_t seq;
+} if_netns_t;
+
+static if_netns_t host_netns = {.fd = -1};
+static if_netns_t *netns_list;
+static size_t netns_num;
+
+static enum { SRC_DUNNO, SRC_NETLINK, SRC_PROC } linux_source = SRC_DUNNO;
+
+#define IF_NETLINK_BUFFER_SIZE 65536
+/* A dump which failed because the socket buffer overran or the interfaces
+ * changed meanwhile is requested again this many times. */
+#define IF_NETLINK_RETRIES 2
+static char *netlink_buffer;
+#endif /* KERNEL_LINUX */
+
 metric_family_t receive_bytes = {
     .name = "host_network_receive_bytes_total",
     .help = "Network device statistic receive_bytes.",
@@ -139,6 +174,11 @@ metric_family_t transmit_packets = {
     .type = METRIC_TYPE_COUNTER,
 };
 
+static metric_family_t *families[] = {
+    &receive_bytes,  &receive_drop,  &receive_errs,  &receive_packets,
+    &transmit_bytes, &transmit_drop, &transmit_errs, &transmit_packets,
+};
+
 static int interface_config(const char *key, const char *value)
 {
   if (ignorelist == NULL)
@@ -151,9 +191,28 @@ static int interface_config(const char *key, const char *value)
     if (IS_TRUE(value))
       invert = 0;
     ignorelist_set_invert(ignorelist, invert);
-  } else if (strcasecmp(key, "ReportInactive") == 0)
+  } else if (strcasecmp(key, "ReportInactive") == 0) {
     report_inactive = IS_TRUE(value);
-  else if (strcasecmp(key, "UniqueName") == 0) {
+  } else if (strcasecmp(key, "NetNamespace") == 0) {
+#if KERNEL_LINUX
+    if_netns_t *tmp =
+        realloc(netns_list, sizeof(*netns_list) * (netns_num + 1));
+    if (tmp == NULL) {
+      ERROR("interface plugin: realloc failed.");
+      return -1;
+    }
+    netns_list = tmp;
+    netns_list[netns_num] = (if_netns_t){.name = strdup(value), .fd = -1};
+    if (netns_list[netns_num].name == NULL) {
+      ERROR("interface plugin: strdup failed.");
+      return -1;
+    }
+    netns_num++;
+#else
+    WARNING("interface plugin: the \"NetNamespace\" option is only valid on "
+            "Linux.");
+#endif /* KERNEL_LINUX */
+  } else if (strcasecmp(key, "UniqueName") == 0) {
 #ifdef HAVE_LIBKSTAT
     if (IS_TRUE(value))
       unique_name = true;
@@ -196,9 +255,293 @@ static int interface_init(void)
 }
 #endif /* HAVE_LIBKSTAT */
 
-static int if_read_internal(void)
-{
 #if KERNEL_LINUX
+static int if_netlink_open(if_netns_t *ns)
+{
+  int ns_fd = -1;
+  int self_fd = -1;
+
+  if (ns->name != NULL) {
+    char path[PATH_MAX];
+    if (strchr(ns->name, '/') != NULL)
+      sstrncpy(path, ns->name, sizeof(path));
+    else
+      ssnprintf(path, sizeof(path), "/run/netns/%s", ns->name);
+
+    ns_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (ns_fd < 0) {
+      ERROR("interface plugin: open(\"%s\"): %s", path, STRERRNO);
+      return -1;
+    }
+
+    self_fd = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+    if (self_fd < 0) {
+      ERROR("interface plugin: open(\"/proc/thread-self/ns/net\"): %s",
+            STRERRNO);
+      close(ns_fd);
+      return -1;
+    }
+
+    /* A socket belongs to the namespace it has been created in, so switching
+     * back right after socket(2) is enough. */
+    if (setns(ns_fd, CLONE_NEWNET) != 0) {
+      ERROR("interface plugin: setns(\"%s\"): %s", path, STRERRNO);
+      close(self_fd);
+      close(ns_fd);
+      return -1;
+    }
+  }
+
+  ns->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  int status = (ns->fd < 0) ? errno : 0;
+
+  if (ns->name != NULL) {
+    if (setns(self_fd, CLONE_NEWNET) != 0) {
+      ERROR("interface plugin: Unable to return to the original network "
+            "namespace: %s",
+            STRERRNO);
+      status = -1;
+    }
+    close(self_fd);
+    close(ns_fd);
+  }
+
+  if (status != 0) {
+    if (status > 0)
+      ERROR("interface plugin: socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE) "
+            "failed: %s",
+            STRERROR(status));
+    if (ns->fd >= 0)
+      close(ns->fd);
+    ns->fd = -1;
+    return -1;
+  }
+
+  struct sockaddr_nl nladdr = {.nl_family = AF_NETLINK};
+  if (bind(ns->fd, (struct sockaddr *)&nladdr, sizeof(nladdr)) != 0) {
+    ERROR("interface plugin: bind(AF_NETLINK) failed: %s", STRERRNO);
+    close(ns->fd);
+    ns->fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+static void if_netlink_close(if_netns_t *ns)
+{
+  if (ns->fd >= 0)
+    close(ns->fd);
+  ns->fd = -1;
+}
+
+/* The socket of a namespace cannot be created again once the daemon has
+ * dropped its capabilities, so it is kept after errors. Replies left over from
+ * a failed dump are skipped by their sequence number. */
+static void if_netlink_reset(if_netns_t *ns)
+{
+  if (ns->name == NULL)
+    if_netlink_close(ns);
+}
+
+static void if_netlink_submit(if_netns_t *ns, char const *device,
+                              struct rtnl_link_stats64 const *stats)
+{
+  if (ignorelist_match(ignorelist, device))
+    return;
+
+  if (!report_inactive && (stats->rx_packets == 0) &&
+      (stats->tx_packets == 0))
+    return;
+
+  metric_t templ = {0};
+  if (ns->name != NULL)
+    metric_label_set(&templ, "netns", ns->name);
+
+  struct {
+    metric_family_t *fam;
+    uint64_t value;
+  } metrics[] = {
+      {&receive_bytes, stats->rx_bytes},
+      {&receive_packets, stats->rx_packets},
+      {&receive_errs, stats->rx_errors},
+      {&receive_drop, stats->rx_dropped},
+      {&transmit_bytes, stats->tx_bytes},
+      {&transmit_packets, stats->tx_packets},
+      {&transmit_errs, stats->tx_errors},
+      {&transmit_drop, stats->tx_dropped},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(metrics); i++) {
+    metric_family_append(metrics[i].fam, "device", device,
+                         (value_t){.counter = (counter_t)metrics[i].value},
+                         &templ);
+  }
+
+  metric_reset(&templ);
+}
+
+static void if_netlink_parse_link(if_netns_t *ns, struct nlmsghdr *h)
+{
+  struct ifinfomsg *ifi = NLMSG_DATA(h);
+  if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+    return;
+
+  char const *device = NULL;
+  struct rtnl_link_stats64 stats64 = {0};
+  bool have_stats = false;
+  bool have_stats64 = false;
+
+  int len = (int)(h->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi)));
+  for (struct rtattr *attr = IFLA_RTA(ifi); RTA_OK(attr, len);
+       attr = RTA_NEXT(attr, len)) {
+    switch (attr->rta_type) {
+    case IFLA_IFNAME:
+      device = RTA_DATA(attr);
+      break;
+    case IFLA_STATS64:
+      if (RTA_PAYLOAD(attr) < sizeof(stats64))
+        break;
+      /* The attribute payload is only 4 byte aligned. */
+      memcpy(&stats64, RTA_DATA(attr), sizeof(stats64));
+      have_stats = true;
+      have_stats64 = true;
+      break;
+    case IFLA_STATS:
+      /* Kernels before 2.6.35 only report 32 bit counters. */
+      if (have_stats64 ||
+          (RTA_PAYLOAD(attr) < sizeof(struct rtnl_link_stats)))
+        break;
+      struct rtnl_link_stats const *stats32 = RTA_DATA(attr);
+      stats64 = (struct rtnl_link_stats64){
+          .rx_packets = stats32->rx_packets,
+          .tx_packets = stats32->tx_packets,
+          .rx_bytes = stats32->rx_bytes,
+          .tx_bytes = stats32->tx_bytes,
+          .rx_errors = stats32->rx_errors,
+          .tx_errors = stats32->tx_errors,
+          .rx_dropped = stats32->rx_dropped,
+          .tx_dropped = stats32->tx_dropped,
+      };
+      have_stats = true;
+      break;
+    }
+  }
+
+  if ((device == NULL) || (device[0] == 0) || !have_stats)
+    return;
+
+  if_netlink_submit(ns, device, &stats64);
+}
+
+/* Returns zero on success, an errno value if the dump may be requested again
+ * and less than zero on other errors. */
+static int if_netlink_dump(if_netns_t *ns)
+{
+  if ((ns->fd < 0) && (if_netlink_open(ns) != 0))
+    return -1;
+
+  struct {
+    struct nlmsghdr nlh;
+    struct ifinfomsg ifi;
+  } req = {
+      .nlh.nlmsg_len = sizeof(req),
+      .nlh.nlmsg_type = RTM_GETLINK,
+      .nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+      .nlh.nlmsg_seq = ++ns->seq,
+      .ifi.ifi_family = AF_UNSPEC,
+  };
+
+  if (send(ns->fd, &req, sizeof(req), 0) < 0) {
+    ERROR("interface plugin: send(2) failed: %s", STRERRNO);
+    if_netlink_reset(ns);
+    return -1;
+  }
+
+  /* Set when the interfaces changed during the dump. */
+  bool interrupted = false;
+
+  while (true) {
+    ssize_t status = recv(ns->fd, netlink_buffer, IF_NETLINK_BUFFER_SIZE, 0);
+    if (status < 0) {
+      if ((errno == EINTR) || (errno == EAGAIN))
+        continue;
+      /* Replies were lost because the socket buffer was full. */
+      if (errno == ENOBUFS)
+        return ENOBUFS;
+
+      ERROR("interface plugin: recv(2) failed: %s", STRERRNO);
+      if_netlink_reset(ns);
+      return -1;
+    } else if (status == 0) {
+      ERROR("interface plugin: Unexpected zero-sized reply from netlink "
+            "socket.");
+      if_netlink_reset(ns);
+      return -1;
+    }
+
+    size_t len = (size_t)status;
+    for (struct nlmsghdr *h = (struct nlmsghdr *)netlink_buffer;
+         NLMSG_OK(h, len); h = NLMSG_NEXT(h, len)) {
+      /* Left over from an interrupted dump. */
+      if (h->nlmsg_seq != ns->seq)
+        continue;
+
+      if ((h->nlmsg_flags & NLM_F_DUMP_INTR) != 0)
+        interrupted = true;
+
+      if (h->nlmsg_type == NLMSG_DONE)
+        return interrupted ? EINTR : 0;
+
+      if (h->nlmsg_type == NLMSG_ERROR) {
+        struct nlmsgerr *msg_error = NLMSG_DATA(h);
+        if ((msg_error->error == -EINTR) || (msg_error->error == -EBUSY))
+          return -msg_error->error;
+        ERROR("interface plugin: netlink error %s",
+              STRERROR(-msg_error->error));
+        return -1;
+      }
+
+      if (h->nlmsg_type == RTM_NEWLINK)
+        if_netlink_parse_link(ns, h);
+    }
+  }
+
+  return 0;
+}
+
+/* Returns zero on success, less than zero on error. The metrics of a failed
+ * dump are removed again. */
+static int if_netlink_read(if_netns_t *ns)
+{
+  size_t metrics_num[STATIC_ARRAY_SIZE(families)];
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(families); i++)
+    metrics_num[i] = families[i]->metric.num;
+
+  for (int retry = 0; true; retry++) {
+    int status = if_netlink_dump(ns);
+    if (status == 0)
+      return 0;
+
+    for (size_t i = 0; i < STATIC_ARRAY_SIZE(families); i++) {
+      metric_list_t *list = &families[i]->metric;
+      while (list->num > metrics_num[i]) {
+        list->num--;
+        metric_reset(list->ptr + list->num);
+      }
+    }
+
+    if ((status < 0) || (retry >= IF_NETLINK_RETRIES)) {
+      if (status > 0)
+        ERROR("interface plugin: Dumping the interfaces failed: %s",
+              STRERROR(status));
+      return -1;
+    }
+  }
+}
+
+static int if_proc_read(void)
+{
   FILE *fh = fopen("/proc/net/dev", "r");
   if (fh == NULL) {
     WARNING("interface plugin: fopen(\"/proc/net/dev\"): %s", STRERRNO);
@@ -258,6 +601,67 @@ static int if_read_internal(void)
   }
 
   fclose(fh);
+
+  return 0;
+}
+
+static int interface_init(void)
+{
+  netlink_buffer = malloc(IF_NETLINK_BUFFER_SIZE);
+  if (netlink_buffer == NULL) {
+    ERROR("interface plugin: malloc failed.");
+    return -1;
+  }
+
+  /* Namespaces can only be entered with the CAP_SYS_ADMIN capability, which
+   * the daemon may drop later on, so open those sockets right away. */
+  for (size_t i = 0; i < netns_num; i++) {
+    if (if_netlink_open(&netns_list[i]) != 0)
+      WARNING("interface plugin: Unable to collect the interfaces of network "
+              "namespace \"%s\".",
+              netns_list[i].name);
+  }
+
+  return 0;
+}
+
+static int interface_shutdown(void)
+{
+  if_netlink_close(&host_netns);
+  for (size_t i = 0; i < netns_num; i++) {
+    if_netlink_close(&netns_list[i]);
+    sfree(netns_list[i].name);
+  }
+  sfree(netns_list);
+  netns_num = 0;
+  sfree(netlink_buffer);
+
+  return 0;
+}
+#endif /* KERNEL_LINUX */
+
+static int if_read_internal(void)
+{
+#if KERNEL_LINUX
+  if (linux_source == SRC_PROC)
+    return if_proc_read();
+
+  if (if_netlink_read(&host_netns) == 0) {
+    linux_source = SRC_NETLINK;
+  } else if (linux_source == SRC_DUNNO) {
+    INFO("interface plugin: Reading from netlink failed. Will read from "
+         "\"/proc/net/dev\" from now on.");
+    linux_source = SRC_PROC;
+    return if_proc_read();
+  } else {
+    return -1;
+  }
+
+  for (size_t i = 0; i < netns_num; i++) {
+    /* The socket of a namespace cannot be created again after a failure. */
+    if (netns_list[i].fd >= 0)
+      if_netlink_read(&netns_list[i]);
+  }
   /* #endif KERNEL_LINUX */
 
 #elif HAVE_GETIFADDRS
@@ -447,11 +851,6 @@ static int if_read_internal(void)
 
 static int if_read(void)
 {
-  metric_family_t *families[] = {
-      &receive_bytes,  &receive_drop,  &receive_errs,  &receive_packets,
-      &transmit_bytes, &transmit_drop, &transmit_errs, &transmit_packets,
-  };
-
   int status = if_read_internal();
 
   for (size_t i = 0; i < STATIC_ARRAY_SIZE(families); i++) {
@@ -469,8 +868,11 @@ void module_register(void)
 {
   plugin_register_config("interface", interface_config, config_keys,
                          config_keys_num);
-#if HAVE_LIBKSTAT
+#if HAVE_LIBKSTAT || KERNEL_LINUX
   plugin_register_init("interface", interface_init);
+#endif
+#if KERNEL_LINUX
+  plugin_register_shutdown("interface", interface_shutdown);
 #endif
   plugin_register_read("interface", if_read);
 }
@@ -58,6 +58,7 @@ struct instance_definition_s {
   char *metric_prefix;
   label_set_t labels;
   char *path;
+  char *state_file;
   char field_separator;
   cu_tail_t *tail;
   metric_definition_t **metric_list;
@@ -254,6 +255,15 @@ static int tcsv_read(user_data_t *ud) {
       ERROR("tail_csv plugin: cu_tail_create (\"%s\") failed.", id->path);
       return -1;
     }
+
+    if ((id->state_file != NULL) &&
+        (cu_tail_set_state_file(id->tail, id->state_file) != 0)) {
+      ERROR("tail_csv plugin: Setting the state file for \"%s\" failed.",
+            id->path);
+      cu_tail_destroy(id->tail);
+      id->tail = NULL;
+      return -1;
+    }
   }
 
   while (42) {
@@ -480,6 +490,7 @@ static void tcsv_instance_definition_destroy(void *arg) {
   sfree(id->metric_prefix);
   label_set_reset(&id->labels);
   sfree(id->path);
+  sfree(id->state_file);
   sfree(id->metric_list);
   sfree(id);
 }
@@ -567,6 +578,8 @@ static int tcsv_config_add_file(oconfig_item_t *ci) {
       status = tcsv_config_get_index(option, &id->time_from);
     else if (strcasecmp("FieldSeparator", option->key) == 0)
       status = tcsv_config_get_separator(option, &id->field_separator);
+    else if (strcasecmp("StateFile", option->key) == 0)
+      status = cf_util_get_string(option, &id->state_file);
     else {
       WARNING("tail_csv plugin: Option `%s' not allowed here.", option->key);
       status = -1;
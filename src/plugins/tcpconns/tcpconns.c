@@ -77,9 +77,13 @@
 
 #if KERNEL_LINUX
 #include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #if HAVE_LINUX_INET_DIAG_H
 #include <linux/inet_diag.h>
 #endif
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2
+#include <linux/sock_diag.h>
+#endif
 #include <arpa/inet.h>
 /* #endif KERNEL_LINUX */
 
@@ -149,7 +153,12 @@
 #endif /* KERNEL_AIX */
 
 #if KERNEL_LINUX
-#if HAVE_STRUCT_LINUX_INET_DIAG_REQ
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2
+struct nlreq {
+  struct nlmsghdr nlh;
+  struct inet_diag_req_v2 r;
+};
+#elif HAVE_STRUCT_LINUX_INET_DIAG_REQ
 struct nlreq {
   struct nlmsghdr nlh;
   struct inet_diag_req r;
@@ -263,7 +272,10 @@ static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static int port_collect_listening;
 static int port_collect_total;
+/* All entries are linked for iteration, the table maps a port number
+ * directly to its entry. */
 static port_entry_t *port_list_head;
+static port_entry_t *port_table[UINT16_MAX + 1];
 static uint32_t count_total[TCP_STATE_MAX + 1];
 
 #if KERNEL_LINUX
@@ -272,6 +284,16 @@ static uint32_t count_total[TCP_STATE_MAX + 1];
  * sequence_number is useless and we get a compilation warning.
  */
 static uint32_t sequence_number;
+
+/* The netlink socket is kept open across reads. */
+static int netlink_fd = -1;
+#define NETLINK_RCVBUF_SIZE (4 * 1024 * 1024)
+#define NETLINK_BUFFER_SIZE 65536
+static char netlink_buffer[NETLINK_BUFFER_SIZE];
+
+/* Kernel side filter for the configured ports, see conn_build_bytecode(). */
+static void *netlink_bytecode;
+static size_t netlink_bytecode_len;
 #endif
 
 static enum { SRC_DUNNO, SRC_NETLINK, SRC_PROC } linux_source = SRC_DUNNO;
@@ -335,14 +357,7 @@ static void conn_submit_all(void)
 
 static port_entry_t *conn_get_port_entry(uint16_t port, int create)
 {
-  port_entry_t *ret;
-
-  ret = port_list_head;
-  while (ret != NULL) {
-    if (ret->port == port)
-      break;
-    ret = ret->next;
-  }
+  port_entry_t *ret = port_table[port];
 
   if ((ret == NULL) && (create != 0)) {
     ret = calloc(1, sizeof(*ret));
@@ -352,6 +367,7 @@ static port_entry_t *conn_get_port_entry(uint16_t port, int create)
     ret->port = port;
     ret->next = port_list_head;
     port_list_head = ret;
+    port_table[port] = ret;
   }
 
   return ret;
@@ -381,6 +397,7 @@ static void conn_reset_port_entry(void)
       else
         prev->next = next;
 
+      port_table[pe->port] = NULL;
       sfree(pe);
       pe = next;
 
@@ -436,30 +453,125 @@ static int conn_handle_ports(uint16_t port_local, uint16_t port_remote,
 }
 
 #if KERNEL_LINUX
-/* Returns zero on success, less than zero on socket error and greater than
- * zero on other errors. */
-static int conn_read_netlink(void)
-{
 #if HAVE_STRUCT_LINUX_INET_DIAG_REQ
-  int fd;
-  struct inet_diag_msg *r;
-  char buf[8192];
-
+static int conn_netlink_open(void)
+{
   /* If this fails, it's likely a permission problem. We'll fall back to
    * reading this information from files below. */
-  fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_INET_DIAG);
-  if (fd < 0) {
+  netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_INET_DIAG);
+  if (netlink_fd < 0) {
     ERROR("tcpconns plugin: conn_read_netlink: socket(AF_NETLINK, SOCK_RAW, "
           "NETLINK_INET_DIAG) failed: %s",
           STRERRNO);
     return -1;
   }
 
+  /* With many connections the kernel produces the dump faster than it is
+   * read, so give it some room. SO_RCVBUFFORCE ignores rmem_max but needs
+   * CAP_NET_ADMIN. */
+  int rcvbuf = NETLINK_RCVBUF_SIZE;
+  if (setsockopt(netlink_fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf,
+                 sizeof(rcvbuf)) != 0)
+    setsockopt(netlink_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  return 0;
+}
+
+static void conn_netlink_close(void)
+{
+  if (netlink_fd >= 0)
+    close(netlink_fd);
+  netlink_fd = -1;
+}
+
+/* Builds an INET_DIAG bytecode program accepting sockets whose local port is
+ * one of the "LocalPort" or whose remote port is one of the "RemotePort"
+ * ports. The conditions are chained like "ss" does it: each condition jumps
+ * to the following JMP op on match, which in turn jumps to the end of the
+ * program (accept). On mismatch the JMP op is skipped and the next condition
+ * is tried; a mismatch of the last condition jumps past the end (reject). */
+static int conn_build_bytecode(void)
+{
+  size_t num = 0;
+  for (port_entry_t *pe = port_list_head; pe != NULL; pe = pe->next) {
+    if (pe->flags & PORT_COLLECT_LOCAL)
+      num++;
+    if (pe->flags & PORT_COLLECT_REMOTE)
+      num++;
+  }
+  if (num == 0)
+    return 0;
+
+  size_t cond_len =
+      sizeof(struct inet_diag_bc_op) + sizeof(struct inet_diag_hostcond);
+  size_t jmp_len = sizeof(struct inet_diag_bc_op);
+  size_t len = num * cond_len + (num - 1) * jmp_len;
+
+  char *bc = calloc(1, len);
+  if (bc == NULL) {
+    ERROR("tcpconns plugin: calloc failed.");
+    return -1;
+  }
+
+  size_t off = 0;
+  for (port_entry_t *pe = port_list_head; pe != NULL; pe = pe->next) {
+    for (int i = 0; i < 2; i++) {
+      unsigned char code;
+      if ((i == 0) && (pe->flags & PORT_COLLECT_LOCAL))
+        code = INET_DIAG_BC_S_COND;
+      else if ((i == 1) && (pe->flags & PORT_COLLECT_REMOTE))
+        code = INET_DIAG_BC_D_COND;
+      else
+        continue;
+
+      struct inet_diag_bc_op *op = (struct inet_diag_bc_op *)(bc + off);
+      *op = (struct inet_diag_bc_op){
+          .code = code,
+          .yes = cond_len,
+          .no = cond_len + jmp_len,
+      };
+      struct inet_diag_hostcond *cond =
+          (struct inet_diag_hostcond *)(bc + off + sizeof(*op));
+      *cond = (struct inet_diag_hostcond){
+          .family = AF_UNSPEC,
+          .prefix_len = 0,
+          .port = pe->port,
+      };
+      off += cond_len;
+
+      if (off < len) {
+        struct inet_diag_bc_op *jmp = (struct inet_diag_bc_op *)(bc + off);
+        *jmp = (struct inet_diag_bc_op){
+            .code = INET_DIAG_BC_JMP,
+            .yes = jmp_len,
+            .no = len - off,
+        };
+        off += jmp_len;
+      }
+    }
+  }
+
+  netlink_bytecode = bc;
+  netlink_bytecode_len = len;
+  return 0;
+}
+
+/* Returns zero on success, less than zero on socket error and greater than
+ * zero on other errors. */
+static int conn_read_netlink_family(uint8_t family)
+{
+  if ((netlink_fd < 0) && (conn_netlink_open() != 0))
+    return -1;
+
   struct sockaddr_nl nladdr = {.nl_family = AF_NETLINK};
 
   struct nlreq req = {
       .nlh.nlmsg_len = sizeof(req),
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2
+      .nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY,
+#else
       .nlh.nlmsg_type = TCPDIAG_GETSOCK,
+#endif
       /* NLM_F_ROOT: return the complete table instead of a single entry.
        * NLM_F_MATCH: return all entries matching criteria (not implemented)
        * NLM_F_REQUEST: must be set on all request messages */
@@ -469,61 +581,70 @@ static int conn_read_netlink(void)
        * reliable, we don't want to end up with a corrupt or incomplete old
        * message in case the system is/was out of memory. */
       .nlh.nlmsg_seq = ++sequence_number,
-      .r.idiag_family = AF_INET,
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2
+      .r.sdiag_family = family,
+      .r.sdiag_protocol = IPPROTO_TCP,
+#else
+      .r.idiag_family = family,
+#endif
       .r.idiag_states = 0xfff,
       .r.idiag_ext = 0};
 
-  struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+  struct rtattr rta = {
+      .rta_type = INET_DIAG_REQ_BYTECODE,
+      .rta_len = RTA_LENGTH(netlink_bytecode_len),
+  };
+
+  struct iovec iov[3] = {
+      {.iov_base = &req, .iov_len = sizeof(req)},
+      {.iov_base = &rta, .iov_len = sizeof(rta)},
+      {.iov_base = netlink_bytecode, .iov_len = netlink_bytecode_len},
+  };
+  size_t iov_num = 1;
+  if (netlink_bytecode != NULL) {
+    req.nlh.nlmsg_len += RTA_LENGTH(netlink_bytecode_len);
+    iov_num = 3;
+  }
 
   struct msghdr msg = {.msg_name = (void *)&nladdr,
                        .msg_namelen = sizeof(nladdr),
-                       .msg_iov = &iov,
-                       .msg_iovlen = 1};
+                       .msg_iov = iov,
+                       .msg_iovlen = iov_num};
 
-  if (sendmsg(fd, &msg, 0) < 0) {
+  if (sendmsg(netlink_fd, &msg, 0) < 0) {
     ERROR("tcpconns plugin: conn_read_netlink: sendmsg(2) failed: %s",
           STRERRNO);
-    close(fd);
+    conn_netlink_close();
     return -1;
   }
 
-  iov.iov_base = buf;
-  iov.iov_len = sizeof(buf);
-
   while (1) {
-    struct nlmsghdr *h;
-
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = (void *)&nladdr;
-    msg.msg_namelen = sizeof(nladdr);
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-
-    ssize_t status = recvmsg(fd, (void *)&msg, /* flags = */ 0);
+    ssize_t status =
+        recv(netlink_fd, netlink_buffer, sizeof(netlink_buffer), /* flags = */ 0);
     if (status < 0) {
       if ((errno == EINTR) || (errno == EAGAIN))
         continue;
 
-      ERROR("tcpconns plugin: conn_read_netlink: recvmsg(2) failed: %s",
+      ERROR("tcpconns plugin: conn_read_netlink: recv(2) failed: %s",
             STRERRNO);
-      close(fd);
+      conn_netlink_close();
       return -1;
     } else if (status == 0) {
-      close(fd);
       DEBUG("tcpconns plugin: conn_read_netlink: Unexpected zero-sized "
             "reply from netlink socket.");
+      conn_netlink_close();
       return 0;
     }
 
-    h = (struct nlmsghdr *)buf;
+    struct nlmsghdr *h = (struct nlmsghdr *)netlink_buffer;
     while (NLMSG_OK(h, status)) {
+      /* Left over from an earlier, interrupted dump. */
       if (h->nlmsg_seq != sequence_number) {
         h = NLMSG_NEXT(h, status);
         continue;
       }
 
       if (h->nlmsg_type == NLMSG_DONE) {
-        close(fd);
         return 0;
       } else if (h->nlmsg_type == NLMSG_ERROR) {
         struct nlmsgerr *msg_error;
@@ -531,14 +652,11 @@ static int conn_read_netlink(void)
         msg_error = NLMSG_DATA(h);
         WARNING("tcpconns plugin: conn_read_netlink: Received error %i.",
                 msg_error->error);
-
-        close(fd);
         return 1;
       }
 
-      r = NLMSG_DATA(h);
+      struct inet_diag_msg *r = NLMSG_DATA(h);
 
-      /* This code does not (need to) distinguish between IPv4 and IPv6. */
       conn_handle_ports(ntohs(r->id.idiag_sport), ntohs(r->id.idiag_dport),
                         r->idiag_state);
 
@@ -548,6 +666,29 @@ static int conn_read_netlink(void)
 
   /* Not reached because the while() loop above handles the exit condition. */
   return 0;
+}
+#endif /* HAVE_STRUCT_LINUX_INET_DIAG_REQ */
+
+/* Returns zero on success, less than zero on socket error and greater than
+ * zero on other errors. */
+static int conn_read_netlink(void)
+{
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ_V2
+  int status = conn_read_netlink_family(AF_INET);
+  if (status != 0)
+    return status;
+
+  /* The kernel may have been built without IPv6 support, so an error
+   * reply for AF_INET6 is not fatal. */
+  status = conn_read_netlink_family(AF_INET6);
+  if (status < 0)
+    return status;
+
+  return 0;
+#elif HAVE_STRUCT_LINUX_INET_DIAG_REQ
+  /* The kernel ignores the family of TCPDIAG_GETSOCK requests and always
+   * dumps both IPv4 and IPv6 sockets. */
+  return conn_read_netlink_family(AF_INET);
 #else
   return 1;
 #endif /* HAVE_STRUCT_LINUX_INET_DIAG_REQ */
@@ -678,9 +819,29 @@ static int conn_init(void)
   if (port_collect_total == 0 && port_list_head == NULL)
     port_collect_listening = 1;
 
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ
+  /* Only the configured ports are of interest, let the kernel skip all
+   * other sockets. */
+  if ((port_collect_total == 0) && (port_collect_listening == 0)) {
+    if (conn_build_bytecode() != 0)
+      return -1;
+  }
+#endif
+
   return 0;
 } /* int conn_init */
 
+static int conn_shutdown(void)
+{
+#if HAVE_STRUCT_LINUX_INET_DIAG_REQ
+  conn_netlink_close();
+  sfree(netlink_bytecode);
+  netlink_bytecode_len = 0;
+#endif
+
+  return 0;
+} /* int conn_shutdown */
+
 static int conn_read(void)
 {
   int status;
@@ -1031,6 +1192,7 @@ void module_register(void)
   plugin_register_config("tcpconns", conn_config, config_keys, config_keys_num);
 #if KERNEL_LINUX
   plugin_register_init("tcpconns", conn_init);
+  plugin_register_shutdown("tcpconns", conn_shutdown);
 #elif HAVE_SYSCTLBYNAME
   /* no initialization */
 #elif HAVE_LIBKVM_NLIST
@@ -0,0 +1,689 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "plugin.h"
+#include "utils/avltree/avltree.h"
+#include "utils/common/common.h"
+#include "utils/gorilla/gorilla.h"
+#include "utils/strbuf/strbuf.h"
+
+#include <dirent.h>
+#include <sys/mman.h>
+
+#define TSDB_CHUNK_MAGIC "TSC1"
+#define TSDB_DEFAULT_CHUNK_SIZE 16384
+#define TSDB_DEFAULT_CHUNK_DURATION TIME_T_TO_CDTIME_T_STATIC(7200)
+#define TSDB_DEFAULT_RETENTION TIME_T_TO_CDTIME_T_STATIC(7 * 86400)
+#define TSDB_DEFAULT_PRUNE_INTERVAL TIME_T_TO_CDTIME_T_STATIC(600)
+
+/* Every chunk file starts with this header, followed by the compressed
+ * samples at TSDB_DATA_OFFSET. The header holds the complete encoder state, so
+ * appending continues after a restart. Chunk files are named after the time
+ * of their first sample, in hexadecimal milliseconds, so that sorting the
+ * names sorts the chunks by time. Native byte order is used. */
+typedef struct {
+  char magic[4];
+  uint32_t size;
+  gorilla_state_t state;
+} tsdb_chunk_header_t;
+
+#define TSDB_DATA_OFFSET 64
+
+/* A series is identified by the identity of its metrics. Its chunks are
+ * stored in a directory named after the numeric id, the mapping from
+ * identities to ids is kept in the "index" file. */
+typedef struct {
+  uint64_t id;
+  char *identity;
+
+  pthread_mutex_t lock;
+  /* The chunk appended to, or NULL. */
+  uint8_t *map;
+  size_t map_size;
+  /* Whether the last chunk written before a restart was looked for. */
+  bool resumed;
+} tsdb_series_t;
+
+static char *datadir;
+static size_t chunk_size = TSDB_DEFAULT_CHUNK_SIZE;
+static cdtime_t chunk_duration = TSDB_DEFAULT_CHUNK_DURATION;
+static cdtime_t retention = TSDB_DEFAULT_RETENTION;
+static cdtime_t prune_interval = TSDB_DEFAULT_PRUNE_INTERVAL;
+
+static pthread_mutex_t series_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_avl_tree_t *series_tree;
+static uint64_t series_next_id = 1;
+static FILE *index_fh;
+
+static tsdb_chunk_header_t *chunk_header(uint8_t *map) {
+  return (tsdb_chunk_header_t *)map;
+}
+
+static void tsdb_series_path(char *buf, size_t size, uint64_t id) {
+  ssnprintf(buf, size, "%s/%" PRIu64, datadir, id);
+}
+
+static void tsdb_chunk_path(char *buf, size_t size, uint64_t id,
+                            int64_t first_time) {
+  ssnprintf(buf, size, "%s/%" PRIu64 "/%016" PRIx64, datadir, id,
+            (uint64_t)first_time);
+}
+
+static bool tsdb_is_chunk_name(char const *name) {
+  return (strlen(name) == 16) && (strspn(name, "0123456789abcdef") == 16);
+}
+
+/* Lists the chunk files of a series, ordered by time. */
+static int tsdb_chunk_filter(const struct dirent *d) {
+  return tsdb_is_chunk_name(d->d_name);
+}
+
+static int tsdb_chunk_list(tsdb_series_t *s, struct dirent ***ret_list) {
+  char path[PATH_MAX];
+  tsdb_series_path(path, sizeof(path), s->id);
+
+  int n = scandir(path, ret_list, tsdb_chunk_filter, alphasort);
+  if (n < 0) {
+    if (errno == ENOENT)
+      return 0;
+    ERROR("tsdb plugin: scandir (%s) failed: %s", path, STRERRNO);
+  }
+  return n;
+}
+
+static void tsdb_chunk_list_free(struct dirent **list, int n) {
+  for (int i = 0; i < n; i++)
+    free(list[i]);
+  free(list);
+}
+
+static int tsdb_chunk_map(char const *path, int flags, uint8_t **ret_map,
+                          size_t *ret_size) {
+  int fd = open(path, flags);
+  if (fd < 0) {
+    ERROR("tsdb plugin: open (%s) failed: %s", path, STRERRNO);
+    return errno;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int status = errno;
+    ERROR("tsdb plugin: fstat (%s) failed: %s", path, STRERRNO);
+    close(fd);
+    return status;
+  }
+
+  if ((st.st_size <= TSDB_DATA_OFFSET) || (st.st_size > UINT32_MAX)) {
+    ERROR("tsdb plugin: %s is not a chunk file.", path);
+    close(fd);
+    return EINVAL;
+  }
+
+  int prot = ((flags & O_ACCMODE) == O_RDWR) ? (PROT_READ | PROT_WRITE)
+                                             : PROT_READ;
+  void *map = mmap(NULL, (size_t)st.st_size, prot, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    ERROR("tsdb plugin: mmap (%s) failed: %s", path, STRERRNO);
+    return errno;
+  }
+
+  tsdb_chunk_header_t const *hdr = map;
+  if ((memcmp(hdr->magic, TSDB_CHUNK_MAGIC, sizeof(hdr->magic)) != 0) ||
+      (hdr->size != (uint32_t)st.st_size) ||
+      (hdr->state.bits > 8 * (hdr->size - TSDB_DATA_OFFSET))) {
+    ERROR("tsdb plugin: %s is not a valid chunk file.", path);
+    munmap(map, (size_t)st.st_size);
+    return EINVAL;
+  }
+
+  *ret_map = map;
+  *ret_size = (size_t)st.st_size;
+  return 0;
+}
+
+static void tsdb_chunk_close(tsdb_series_t *s) {
+  if (s->map == NULL)
+    return;
+
+  msync(s->map, s->map_size, MS_ASYNC);
+  munmap(s->map, s->map_size);
+  s->map = NULL;
+  s->map_size = 0;
+}
+
+/* Continues appending to the last chunk written before a restart. */
+static void tsdb_chunk_resume(tsdb_series_t *s) {
+  struct dirent **list = NULL;
+  int n = tsdb_chunk_list(s, &list);
+  if (n <= 0)
+    return;
+
+  char path[PATH_MAX];
+  ssnprintf(path, sizeof(path), "%s/%" PRIu64 "/%s", datadir, s->id,
+            list[n - 1]->d_name);
+  tsdb_chunk_list_free(list, n);
+
+  tsdb_chunk_map(path, O_RDWR, &s->map, &s->map_size);
+}
+
+static int tsdb_chunk_create(tsdb_series_t *s, int64_t first_time) {
+  char path[PATH_MAX];
+  tsdb_chunk_path(path, sizeof(path), s->id, first_time);
+
+  int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    ERROR("tsdb plugin: open (%s) failed: %s", path, STRERRNO);
+    return errno;
+  }
+
+  /* The file is zero filled, as required by the encoder. */
+  if (ftruncate(fd, (off_t)chunk_size) != 0) {
+    int status = errno;
+    ERROR("tsdb plugin: ftruncate (%s) failed: %s", path, STRERRNO);
+    close(fd);
+    unlink(path);
+    return status;
+  }
+
+  void *map =
+      mmap(NULL, chunk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    int status = errno;
+    ERROR("tsdb plugin: mmap (%s) failed: %s", path, STRERRNO);
+    unlink(path);
+    return status;
+  }
+
+  tsdb_chunk_header_t *hdr = map;
+  memcpy(hdr->magic, TSDB_CHUNK_MAGIC, sizeof(hdr->magic));
+  hdr->size = (uint32_t)chunk_size;
+
+  s->map = map;
+  s->map_size = chunk_size;
+  return 0;
+}
+
+static int tsdb_series_append(tsdb_series_t *s, int64_t time, double value) {
+  pthread_mutex_lock(&s->lock);
+
+  if ((s->map == NULL) && !s->resumed)
+    tsdb_chunk_resume(s);
+  s->resumed = true;
+
+  /* Time based rollover keeps chunks of rarely updated series from covering
+   * long periods, which would delay their removal. */
+  if ((s->map != NULL) && (chunk_header(s->map)->state.count > 0) &&
+      ((time - chunk_header(s->map)->state.first_time) >=
+       (int64_t)CDTIME_T_TO_MS(chunk_duration)))
+    tsdb_chunk_close(s);
+
+  int status = ENOSPC;
+  if (s->map != NULL)
+    status = gorilla_append(&chunk_header(s->map)->state,
+                            s->map + TSDB_DATA_OFFSET,
+                            s->map_size - TSDB_DATA_OFFSET, time, value);
+
+  if (status == ENOSPC) {
+    tsdb_chunk_close(s);
+    status = tsdb_chunk_create(s, time);
+    if (status == 0)
+      status = gorilla_append(&chunk_header(s->map)->state,
+                              s->map + TSDB_DATA_OFFSET,
+                              s->map_size - TSDB_DATA_OFFSET, time, value);
+  }
+
+  pthread_mutex_unlock(&s->lock);
+
+  if (status == EINVAL) {
+    DEBUG("tsdb plugin: Dropping out of order sample of series %" PRIu64 ".",
+          s->id);
+    return 0;
+  }
+  return status;
+}
+
+static void tsdb_series_free(tsdb_series_t *s) {
+  if (s == NULL)
+    return;
+
+  tsdb_chunk_close(s);
+  pthread_mutex_destroy(&s->lock);
+  sfree(s->identity);
+  sfree(s);
+}
+
+static tsdb_series_t *tsdb_series_alloc(uint64_t id, char const *identity) {
+  tsdb_series_t *s = calloc(1, sizeof(*s));
+  if (s == NULL)
+    return NULL;
+
+  s->id = id;
+  s->identity = strdup(identity);
+  if (s->identity == NULL) {
+    sfree(s);
+    return NULL;
+  }
+  pthread_mutex_init(&s->lock, NULL);
+
+  return s;
+}
+
+/* Returns the series with the given identity. Unknown series are created if
+ * "create" is true. */
+static tsdb_series_t *tsdb_series_get(char const *identity, bool create) {
+  tsdb_series_t *s = NULL;
+
+  pthread_mutex_lock(&series_lock);
+  /* The tree is gone after the shutdown. */
+  if (series_tree == NULL) {
+    pthread_mutex_unlock(&series_lock);
+    return NULL;
+  }
+  if ((c_avl_get(series_tree, identity, (void *)&s) == 0) || !create) {
+    pthread_mutex_unlock(&series_lock);
+    return s;
+  }
+
+  s = tsdb_series_alloc(series_next_id, identity);
+  if (s == NULL) {
+    pthread_mutex_unlock(&series_lock);
+    ERROR("tsdb plugin: Allocating a series failed.");
+    return NULL;
+  }
+
+  char path[PATH_MAX];
+  tsdb_series_path(path, sizeof(path), s->id);
+  if ((mkdir(path, 0755) != 0) && (errno != EEXIST)) {
+    pthread_mutex_unlock(&series_lock);
+    ERROR("tsdb plugin: mkdir (%s) failed: %s", path, STRERRNO);
+    tsdb_series_free(s);
+    return NULL;
+  }
+
+  if ((fprintf(index_fh, "%" PRIu64 " %s\n", s->id, s->identity) < 0) ||
+      (fflush(index_fh) != 0)) {
+    pthread_mutex_unlock(&series_lock);
+    ERROR("tsdb plugin: Writing to the index failed: %s", STRERRNO);
+    tsdb_series_free(s);
+    return NULL;
+  }
+
+  c_avl_insert(series_tree, s->identity, s);
+  series_next_id++;
+  pthread_mutex_unlock(&series_lock);
+
+  return s;
+}
+
+static int tsdb_write(metric_family_t const *fam,
+                      __attribute__((unused)) user_data_t *ud) {
+  if (fam->type == METRIC_TYPE_DISTRIBUTION)
+    return 0;
+
+  strbuf_t buf = STRBUF_CREATE;
+  int ret = 0;
+
+  for (size_t i = 0; i < fam->metric.num; i++) {
+    metric_t const *m = fam->metric.ptr + i;
+
+    strbuf_reset(&buf);
+    int status = metric_identity(&buf, m);
+    if (status != 0) {
+      ret = status;
+      continue;
+    }
+
+    tsdb_series_t *s = tsdb_series_get(buf.ptr, /* create = */ true);
+    if (s == NULL) {
+      ret = -1;
+      continue;
+    }
+
+    double value = (fam->type == METRIC_TYPE_COUNTER)
+                       ? (double)m->value.counter
+                       : m->value.gauge;
+    status = tsdb_series_append(s, (int64_t)CDTIME_T_TO_MS(m->time), value);
+    if (status != 0)
+      ret = status;
+  }
+
+  STRBUF_DESTROY(buf);
+  return ret;
+}
+
+/* Passes the samples of chunk "map" within [start, end] to "emit". Only the
+ * samples described by "state" are read, so that samples appended meanwhile
+ * are ignored. */
+static int tsdb_chunk_query(uint8_t *map, gorilla_state_t const *state,
+                            int64_t start, int64_t end,
+                            plugin_query_emit_cb emit, void *arg) {
+  if ((state->count == 0) || (state->time < start) ||
+      (state->first_time > end))
+    return 0;
+
+  gorilla_iter_t it;
+  gorilla_iter_init(&it, state, map + TSDB_DATA_OFFSET);
+
+  int64_t time;
+  double value;
+  while (gorilla_iter_next(&it, &time, &value)) {
+    if (time < start)
+      continue;
+    if (time > end)
+      break;
+
+    int status = emit(MS_TO_CDTIME_T(time), value, arg);
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+}
+
+static int tsdb_query(metric_t const *m, cdtime_t start, cdtime_t end,
+                      plugin_query_emit_cb emit, void *arg,
+                      __attribute__((unused)) user_data_t *ud) {
+  strbuf_t buf = STRBUF_CREATE;
+  int status = metric_identity(&buf, m);
+  if (status != 0) {
+    STRBUF_DESTROY(buf);
+    return status;
+  }
+
+  /* The chunk list and the state of the chunk appended to are copied while
+   * holding the locks. The chunks are read without them, so that long queries
+   * don't block writers. The series lock is held while locking the series,
+   * so that the shutdown can't free it in between. */
+  pthread_mutex_lock(&series_lock);
+  tsdb_series_t *s = NULL;
+  if (series_tree != NULL)
+    c_avl_get(series_tree, buf.ptr, (void *)&s);
+  STRBUF_DESTROY(buf);
+  if (s == NULL) {
+    pthread_mutex_unlock(&series_lock);
+    return ENOENT;
+  }
+
+  pthread_mutex_lock(&s->lock);
+  char dir[PATH_MAX];
+  tsdb_series_path(dir, sizeof(dir), s->id);
+  bool active = (s->map != NULL);
+  gorilla_state_t active_state = {0};
+  if (active)
+    active_state = chunk_header(s->map)->state;
+  struct dirent **list = NULL;
+  int n = tsdb_chunk_list(s, &list);
+  pthread_mutex_unlock(&s->lock);
+  pthread_mutex_unlock(&series_lock);
+
+  if (n < 0)
+    return -1;
+
+  int64_t start_ms = (int64_t)CDTIME_T_TO_MS(start);
+  int64_t end_ms = (int64_t)CDTIME_T_TO_MS(end);
+
+  for (int i = 0; (i < n) && (status == 0); i++) {
+    /* Chunks are sorted by their first sample. */
+    int64_t first_time = (int64_t)strtoull(list[i]->d_name, NULL, 16);
+    if (first_time > end_ms)
+      break;
+
+    char path[PATH_MAX];
+    ssnprintf(path, sizeof(path), "%s/%s", dir, list[i]->d_name);
+
+    uint8_t *map = NULL;
+    size_t map_size = 0;
+    if (tsdb_chunk_map(path, O_RDONLY, &map, &map_size) != 0)
+      continue;
+
+    gorilla_state_t state = chunk_header(map)->state;
+    if (active && (first_time == active_state.first_time))
+      state = active_state;
+    status = tsdb_chunk_query(map, &state, start_ms, end_ms, emit, arg);
+    munmap(map, map_size);
+  }
+
+  if (n > 0)
+    tsdb_chunk_list_free(list, n);
+
+  return status;
+}
+
+/* Removes the chunks of "s" which only hold samples before "cutoff". */
+static void tsdb_series_prune(tsdb_series_t *s, int64_t cutoff) {
+  pthread_mutex_lock(&s->lock);
+
+  if ((s->map != NULL) && (chunk_header(s->map)->state.time < cutoff))
+    tsdb_chunk_close(s);
+
+  struct dirent **list = NULL;
+  int n = tsdb_chunk_list(s, &list);
+  for (int i = 0; i < n; i++) {
+    char path[PATH_MAX];
+    ssnprintf(path, sizeof(path), "%s/%" PRIu64 "/%s", datadir, s->id,
+              list[i]->d_name);
+
+    /* The chunk appended to is never removed. */
+    if ((s->map != NULL) &&
+        ((int64_t)strtoull(list[i]->d_name, NULL, 16) ==
+         chunk_header(s->map)->state.first_time))
+      continue;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+      continue;
+    tsdb_chunk_header_t hdr = {{0}};
+    ssize_t len = pread(fd, &hdr, sizeof(hdr), 0);
+    close(fd);
+
+    if ((len == (ssize_t)sizeof(hdr)) && (hdr.state.time >= cutoff))
+      continue;
+
+    DEBUG("tsdb plugin: Removing %s.", path);
+    if (unlink(path) != 0)
+      WARNING("tsdb plugin: unlink (%s) failed: %s", path, STRERRNO);
+  }
+  if (n > 0)
+    tsdb_chunk_list_free(list, n);
+
+  pthread_mutex_unlock(&s->lock);
+}
+
+static int tsdb_prune(__attribute__((unused)) user_data_t *ud) {
+  int64_t cutoff = (int64_t)CDTIME_T_TO_MS(cdtime() - retention);
+
+  /* Series are never removed, so the pointers stay valid after the tree is
+   * unlocked. */
+  pthread_mutex_lock(&series_lock);
+  if (series_tree == NULL) {
+    pthread_mutex_unlock(&series_lock);
+    return 0;
+  }
+  int num = c_avl_size(series_tree);
+  tsdb_series_t **series = calloc((size_t)num + 1, sizeof(*series));
+  if (series == NULL) {
+    pthread_mutex_unlock(&series_lock);
+    return ENOMEM;
+  }
+  c_avl_iterator_t *iter = c_avl_get_iterator(series_tree);
+  char *key;
+  tsdb_series_t *s;
+  int i = 0;
+  while ((i < num) && (c_avl_iterator_next(iter, (void *)&key, (void *)&s) == 0))
+    series[i++] = s;
+  c_avl_iterator_destroy(iter);
+  pthread_mutex_unlock(&series_lock);
+
+  for (int j = 0; j < i; j++)
+    tsdb_series_prune(series[j], cutoff);
+
+  sfree(series);
+  return 0;
+}
+
+static int tsdb_flush(__attribute__((unused)) cdtime_t timeout,
+                      __attribute__((unused)) const char *identifier,
+                      __attribute__((unused)) user_data_t *ud) {
+  pthread_mutex_lock(&series_lock);
+  if (series_tree == NULL) {
+    pthread_mutex_unlock(&series_lock);
+    return 0;
+  }
+  c_avl_iterator_t *iter = c_avl_get_iterator(series_tree);
+  char *key;
+  tsdb_series_t *s;
+  while (c_avl_iterator_next(iter, (void *)&key, (void *)&s) == 0) {
+    pthread_mutex_lock(&s->lock);
+    if (s->map != NULL)
+      msync(s->map, s->map_size, MS_SYNC);
+    pthread_mutex_unlock(&s->lock);
+  }
+  c_avl_iterator_destroy(iter);
+  pthread_mutex_unlock(&series_lock);
+
+  return 0;
+}
+
+static int tsdb_index_load(char const *path) {
+  FILE *fh = fopen(path, "r");
+  if (fh == NULL) {
+    if (errno == ENOENT)
+      return 0;
+    ERROR("tsdb plugin: fopen (%s) failed: %s", path, STRERRNO);
+    return -1;
+  }
+
+  char line[4096];
+  while (fgets(line, sizeof(line), fh) != NULL) {
+    strstripnewline(line);
+
+    char *endptr = NULL;
+    uint64_t id = strtoull(line, &endptr, 10);
+    if ((endptr == line) || (*endptr != ' ') || (id == 0)) {
+      WARNING("tsdb plugin: Ignoring invalid index entry: %s", line);
+      continue;
+    }
+
+    tsdb_series_t *s = tsdb_series_alloc(id, endptr + 1);
+    if (s == NULL) {
+      fclose(fh);
+      return ENOMEM;
+    }
+    if (c_avl_insert(series_tree, s->identity, s) != 0) {
+      WARNING("tsdb plugin: Ignoring duplicate index entry: %s", line);
+      tsdb_series_free(s);
+      continue;
+    }
+
+    if (id >= series_next_id)
+      series_next_id = id + 1;
+  }
+
+  fclose(fh);
+  return 0;
+}
+
+static int tsdb_config(oconfig_item_t *ci) {
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+    int status = 0;
+
+    if (strcasecmp("DataDir", child->key) == 0) {
+      status = cf_util_get_string(child, &datadir);
+    } else if (strcasecmp("ChunkSize", child->key) == 0) {
+      int tmp = 0;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) &&
+          (tmp < TSDB_DATA_OFFSET + (GORILLA_MAX_SAMPLE_BITS + 7) / 8)) {
+        ERROR("tsdb plugin: ChunkSize %d is too small.", tmp);
+        status = EINVAL;
+      } else if (status == 0) {
+        chunk_size = (size_t)tmp;
+      }
+    } else if (strcasecmp("ChunkDuration", child->key) == 0) {
+      status = cf_util_get_cdtime(child, &chunk_duration);
+    } else if (strcasecmp("Retention", child->key) == 0) {
+      status = cf_util_get_cdtime(child, &retention);
+    } else if (strcasecmp("PruneInterval", child->key) == 0) {
+      status = cf_util_get_cdtime(child, &prune_interval);
+    } else {
+      ERROR("tsdb plugin: Invalid configuration option: %s.", child->key);
+      status = EINVAL;
+    }
+
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+}
+
+static int tsdb_init(void) {
+  if (datadir == NULL) {
+    datadir = strdup(PKGLOCALSTATEDIR "/tsdb");
+    if (datadir == NULL)
+      return ENOMEM;
+  }
+
+  char path[PATH_MAX];
+  ssnprintf(path, sizeof(path), "%s/index", datadir);
+  if (check_create_dir(path) != 0) {
+    ERROR("tsdb plugin: Creating %s failed.", datadir);
+    return -1;
+  }
+
+  series_tree = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (series_tree == NULL)
+    return ENOMEM;
+
+  int status = tsdb_index_load(path);
+  if (status != 0)
+    return status;
+
+  index_fh = fopen(path, "a");
+  if (index_fh == NULL) {
+    ERROR("tsdb plugin: fopen (%s) failed: %s", path, STRERRNO);
+    return -1;
+  }
+
+  plugin_register_write("tsdb", tsdb_write, NULL);
+  plugin_register_flush("tsdb", tsdb_flush, NULL);
+  plugin_register_query("tsdb", tsdb_query, NULL);
+  plugin_register_complex_read(NULL, "tsdb", tsdb_prune, prune_interval, NULL);
+
+  return 0;
+}
+
+static int tsdb_shutdown(void) {
+  /* Query and flush callbacks are only removed after all shutdown callbacks
+   * ran, e.g. while unixsock still handles GETRANGE and FLUSH. */
+  plugin_unregister_query("tsdb");
+  plugin_unregister_flush("tsdb");
+
+  pthread_mutex_lock(&series_lock);
+  if (series_tree != NULL) {
+    char *key;
+    tsdb_series_t *s;
+    while (c_avl_pick(series_tree, (void *)&key, (void *)&s) == 0)
+      tsdb_series_free(s);
+    c_avl_destroy(series_tree);
+    series_tree = NULL;
+  }
+
+  if (index_fh != NULL) {
+    fclose(index_fh);
+    index_fh = NULL;
+  }
+  sfree(datadir);
+  pthread_mutex_unlock(&series_lock);
+
+  return 0;
+}
+
+void module_register(void) {
+  plugin_register_complex_config("tsdb", tsdb_config);
+  plugin_register_init("tsdb", tsdb_init);
+  plugin_register_shutdown("tsdb", tsdb_shutdown);
+}
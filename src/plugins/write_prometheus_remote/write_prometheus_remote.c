@@ -0,0 +1,669 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "plugin.h"
+#include "utils/common/common.h"
+#include "utils/format_remote_write/format_remote_write.h"
+#include "utils/snappy/snappy.h"
+#include "utils/strbuf/strbuf.h"
+#include "utils_complain.h"
+
+#include <curl/curl.h>
+
+#define PRW_DEFAULT_TIMEOUT_MS 30000
+#define PRW_DEFAULT_SHARDS 4
+#define PRW_DEFAULT_MAX_SAMPLES_PER_SEND 500
+#define PRW_DEFAULT_BATCH_SEND_DEADLINE TIME_T_TO_CDTIME_T(5)
+#define PRW_DEFAULT_QUEUE_SIZE 10
+#define PRW_DEFAULT_MAX_RETRIES 5
+#define PRW_DEFAULT_MIN_BACKOFF MS_TO_CDTIME_T(30)
+#define PRW_DEFAULT_MAX_BACKOFF TIME_T_TO_CDTIME_T(5)
+
+/* prw_batch_t holds the encoded time series of one remote write request. */
+typedef struct prw_batch_s prw_batch_t;
+struct prw_batch_s {
+  strbuf_t buf;
+  size_t series;
+  prw_batch_t *next;
+};
+
+typedef struct prw_node_s prw_node_t;
+
+/* Series are distributed over shards by hashing their labels, so that all
+ * samples of a series are sent in order by the same sender thread. */
+typedef struct {
+  prw_node_t *node;
+  size_t index;
+
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  /* batch being filled by the write callback */
+  prw_batch_t *current;
+  cdtime_t current_time;
+  /* full batches waiting to be sent */
+  prw_batch_t *queue_head;
+  prw_batch_t *queue_tail;
+  size_t queue_len;
+  bool flush;
+  uint64_t dropped;
+  c_complain_t complaint;
+
+  pthread_t thread;
+  bool running;
+} prw_shard_t;
+
+struct prw_node_s {
+  char *name;
+  char *url;
+  char *user;
+  char *pass;
+  char *cacert;
+  bool verify_peer;
+  bool verify_host;
+  int timeout;
+  struct curl_slist *headers;
+
+  size_t shards_num;
+  prw_shard_t *shards;
+  size_t max_samples_per_send;
+  cdtime_t batch_send_deadline;
+  size_t queue_size;
+  int max_retries;
+  cdtime_t min_backoff;
+  cdtime_t max_backoff;
+
+  bool shutdown;
+};
+
+static prw_node_t **prw_nodes;
+static size_t prw_nodes_num;
+
+static void prw_batch_free(prw_batch_t *batch)
+{
+  if (batch == NULL)
+    return;
+
+  STRBUF_DESTROY(batch->buf);
+  free(batch);
+}
+
+/* prw_hash_string updates a FNV-1a hash with "s" and a terminating byte that
+ * cannot occur in a string. */
+static uint64_t prw_hash_string(uint64_t hash, char const *s)
+{
+  for (; *s != 0; s++)
+    hash = (hash ^ (uint8_t)*s) * 1099511628211ULL;
+  return (hash ^ 0xff) * 1099511628211ULL;
+}
+
+static uint64_t prw_series_hash(metric_family_t const *fam, metric_t const *m)
+{
+  uint64_t hash = prw_hash_string(14695981039346656037ULL, fam->name);
+  for (size_t i = 0; i < m->label.num; i++) {
+    hash = prw_hash_string(hash, m->label.ptr[i].name);
+    hash = prw_hash_string(hash, m->label.ptr[i].value);
+  }
+  return hash;
+}
+
+/* prw_shard_enqueue moves the current batch to the send queue, dropping the
+ * oldest batch if the queue is full. Must hold shard->lock when calling. */
+static void prw_shard_enqueue(prw_shard_t *shard)
+{
+  prw_batch_t *batch = shard->current;
+  if (batch == NULL)
+    return;
+  shard->current = NULL;
+
+  if (shard->queue_len >= shard->node->queue_size) {
+    prw_batch_t *old = shard->queue_head;
+    shard->queue_head = old->next;
+    if (shard->queue_head == NULL)
+      shard->queue_tail = NULL;
+    shard->queue_len--;
+    shard->dropped += old->series;
+    prw_batch_free(old);
+  }
+
+  if (shard->queue_tail == NULL)
+    shard->queue_head = batch;
+  else
+    shard->queue_tail->next = batch;
+  shard->queue_tail = batch;
+  shard->queue_len++;
+
+  pthread_cond_signal(&shard->cond);
+}
+
+static int prw_write_metric(prw_node_t *node, metric_family_t const *fam,
+                            metric_t const *m)
+{
+  prw_shard_t *shard =
+      node->shards + (prw_series_hash(fam, m) % node->shards_num);
+
+  pthread_mutex_lock(&shard->lock);
+
+  if (shard->current == NULL) {
+    shard->current = calloc(1, sizeof(*shard->current));
+    if (shard->current == NULL) {
+      pthread_mutex_unlock(&shard->lock);
+      return ENOMEM;
+    }
+    shard->current->buf = STRBUF_CREATE;
+    shard->current_time = cdtime();
+  }
+
+  size_t series = 0;
+  size_t pos = shard->current->buf.pos;
+  int status =
+      format_remote_write_metric(&shard->current->buf, fam, m, &series);
+  if (status != 0) {
+    /* Remove a partially encoded metric. */
+    shard->current->buf.pos = pos;
+    pthread_mutex_unlock(&shard->lock);
+    return status;
+  }
+  shard->current->series += series;
+
+  if (shard->current->series >= node->max_samples_per_send)
+    prw_shard_enqueue(shard);
+
+  pthread_mutex_unlock(&shard->lock);
+  return 0;
+}
+
+static int prw_write(metric_family_t const *fam, user_data_t *ud)
+{
+  if ((fam == NULL) || (ud == NULL) || (ud->data == NULL))
+    return EINVAL;
+
+  prw_node_t *node = ud->data;
+
+  int ret = 0;
+  for (size_t i = 0; i < fam->metric.num; i++) {
+    int status = prw_write_metric(node, fam, fam->metric.ptr + i);
+    if (status != 0) {
+      ERROR("write_prometheus_remote plugin: Encoding \"%s\" failed: %s",
+            fam->name, STRERROR(status));
+      if (ret == 0)
+        ret = status;
+    }
+  }
+
+  return ret;
+}
+
+static int prw_flush(cdtime_t timeout,
+                     __attribute__((unused)) const char *identifier,
+                     user_data_t *ud)
+{
+  if ((ud == NULL) || (ud->data == NULL))
+    return EINVAL;
+
+  prw_node_t *node = ud->data;
+
+  for (size_t i = 0; i < node->shards_num; i++) {
+    prw_shard_t *shard = node->shards + i;
+
+    pthread_mutex_lock(&shard->lock);
+    if ((shard->current != NULL) &&
+        ((timeout == 0) || ((shard->current_time + timeout) <= cdtime()))) {
+      shard->flush = true;
+      pthread_cond_signal(&shard->cond);
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  return 0;
+}
+
+static size_t prw_curl_write_callback(__attribute__((unused)) char *ptr,
+                                      size_t size, size_t nmemb,
+                                      __attribute__((unused)) void *userdata)
+{
+  /* The response body is not used. */
+  return size * nmemb;
+}
+
+static CURL *prw_curl_init(prw_node_t *node, char *errbuf)
+{
+  CURL *curl = curl_easy_init();
+  if (curl == NULL) {
+    ERROR("write_prometheus_remote plugin: curl_easy_init failed.");
+    return NULL;
+  }
+
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+  curl_easy_setopt(curl, CURLOPT_URL, node->url);
+  curl_easy_setopt(curl, CURLOPT_POST, 1L);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, node->headers);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, prw_curl_write_callback);
+#ifdef HAVE_CURLOPT_TIMEOUT_MS
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)node->timeout);
+#endif
+
+  if (node->user != NULL) {
+#ifdef HAVE_CURLOPT_USERNAME
+    curl_easy_setopt(curl, CURLOPT_USERNAME, node->user);
+    curl_easy_setopt(curl, CURLOPT_PASSWORD,
+                     (node->pass == NULL) ? "" : node->pass);
+#else
+    char credentials[1024];
+    ssnprintf(credentials, sizeof(credentials), "%s:%s", node->user,
+              (node->pass == NULL) ? "" : node->pass);
+    /* libcurl copies the string. */
+    curl_easy_setopt(curl, CURLOPT_USERPWD, credentials);
+#endif
+    curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+  }
+
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, (long)node->verify_peer);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, node->verify_host ? 2L : 0L);
+  if (node->cacert != NULL)
+    curl_easy_setopt(curl, CURLOPT_CAINFO, node->cacert);
+
+  return curl;
+}
+
+/* prw_shard_wait waits until "until" or until the shard is signaled. Must
+ * hold shard->lock when calling. */
+static void prw_shard_wait(prw_shard_t *shard, cdtime_t until)
+{
+  pthread_cond_timedwait(&shard->cond, &shard->lock,
+                         &CDTIME_T_TO_TIMESPEC(until));
+}
+
+/* prw_send posts one batch, retrying recoverable errors with exponential
+ * backoff. Returns true if the batch was accepted. */
+static bool prw_send(prw_shard_t *shard, CURL *curl, char const *errbuf,
+                     char const *body, size_t body_size)
+{
+  prw_node_t *node = shard->node;
+  cdtime_t backoff = node->min_backoff;
+
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)body_size);
+
+  for (int attempt = 0;; attempt++) {
+    CURLcode status = curl_easy_perform(curl);
+    long http_code = 0;
+    if (status == CURLE_OK)
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+    if ((http_code >= 200) && (http_code < 300))
+      return true;
+
+    /* Other client errors mean the request itself was rejected. */
+    bool recoverable = (status != CURLE_OK) || (http_code == 429) ||
+                       (http_code >= 500);
+    if (status != CURLE_OK)
+      ERROR("write_prometheus_remote plugin: Sending to \"%s\" failed: %s",
+            node->url, errbuf);
+    else
+      ERROR("write_prometheus_remote plugin: \"%s\" responded with HTTP "
+            "status %ld.",
+            node->url, http_code);
+
+    pthread_mutex_lock(&shard->lock);
+    bool shutdown = node->shutdown;
+    if (recoverable && !shutdown && (attempt < node->max_retries))
+      prw_shard_wait(shard, cdtime() + backoff);
+    shutdown = node->shutdown;
+    pthread_mutex_unlock(&shard->lock);
+
+    if (!recoverable || shutdown || (attempt >= node->max_retries))
+      return false;
+
+    backoff *= 2;
+    if (backoff > node->max_backoff)
+      backoff = node->max_backoff;
+  }
+}
+
+static void *prw_sender_thread(void *arg)
+{
+  prw_shard_t *shard = arg;
+  prw_node_t *node = shard->node;
+  char errbuf[CURL_ERROR_SIZE] = "";
+
+  /* The easy handle is kept for the lifetime of the thread so that the
+   * connection is reused. */
+  CURL *curl = prw_curl_init(node, errbuf);
+
+  pthread_mutex_lock(&shard->lock);
+  while (true) {
+    bool shutdown = node->shutdown;
+    cdtime_t now = cdtime();
+
+    if ((shard->current != NULL) &&
+        (shutdown || shard->flush ||
+         ((shard->current_time + node->batch_send_deadline) <= now)))
+      prw_shard_enqueue(shard);
+    shard->flush = false;
+
+    if (shard->queue_head == NULL) {
+      if (shutdown)
+        break;
+
+      cdtime_t until = now + node->batch_send_deadline;
+      if (shard->current != NULL)
+        until = shard->current_time + node->batch_send_deadline;
+      prw_shard_wait(shard, until);
+      continue;
+    }
+
+    prw_batch_t *batch = shard->queue_head;
+    shard->queue_head = batch->next;
+    if (shard->queue_head == NULL)
+      shard->queue_tail = NULL;
+    shard->queue_len--;
+
+    uint64_t dropped = shard->dropped;
+    shard->dropped = 0;
+    pthread_mutex_unlock(&shard->lock);
+
+    if (dropped > 0)
+      c_complain(LOG_WARNING, &shard->complaint,
+                 "write_prometheus_remote plugin: Queue of shard %zu of \"%s\" "
+                 "is full, dropped %" PRIu64 " series.",
+                 shard->index, node->name, dropped);
+
+    size_t body_size = 0;
+    char *body = malloc(snappy_encode_bound(batch->buf.pos));
+    int status = ENOMEM;
+    if (body != NULL)
+      status = snappy_encode(batch->buf.ptr, batch->buf.pos, body, &body_size);
+
+    if (status != 0) {
+      ERROR("write_prometheus_remote plugin: Compressing a request failed: %s",
+            STRERROR(status));
+    } else if ((curl != NULL) &&
+               prw_send(shard, curl, errbuf, body, body_size)) {
+      c_release(LOG_INFO, &shard->complaint,
+                "write_prometheus_remote plugin: Queue of shard %zu of \"%s\" "
+                "is no longer full.",
+                shard->index, node->name);
+    } else {
+      ERROR("write_prometheus_remote plugin: Dropping %zu series for \"%s\".",
+            batch->series, node->url);
+    }
+
+    free(body);
+    prw_batch_free(batch);
+
+    pthread_mutex_lock(&shard->lock);
+  }
+  pthread_mutex_unlock(&shard->lock);
+
+  if (curl != NULL)
+    curl_easy_cleanup(curl);
+  return NULL;
+}
+
+static void prw_node_free(void *arg)
+{
+  prw_node_t *node = arg;
+  if (node == NULL)
+    return;
+
+  for (size_t i = 0; i < node->shards_num; i++) {
+    prw_shard_t *shard = node->shards + i;
+    pthread_mutex_lock(&shard->lock);
+    node->shutdown = true;
+    pthread_cond_signal(&shard->cond);
+    pthread_mutex_unlock(&shard->lock);
+  }
+
+  for (size_t i = 0; i < node->shards_num; i++) {
+    prw_shard_t *shard = node->shards + i;
+
+    if (shard->running) {
+      pthread_join(shard->thread, NULL);
+      shard->running = false;
+    }
+
+    prw_batch_free(shard->current);
+    while (shard->queue_head != NULL) {
+      prw_batch_t *batch = shard->queue_head;
+      shard->queue_head = batch->next;
+      prw_batch_free(batch);
+    }
+
+    pthread_mutex_destroy(&shard->lock);
+    pthread_cond_destroy(&shard->cond);
+  }
+  sfree(node->shards);
+
+  if (node->headers != NULL)
+    curl_slist_free_all(node->headers);
+
+  sfree(node->name);
+  sfree(node->url);
+  sfree(node->user);
+  sfree(node->pass);
+  sfree(node->cacert);
+  sfree(node);
+}
+
+static int prw_config_append_header(prw_node_t *node, char const *header)
+{
+  struct curl_slist *tmp = curl_slist_append(node->headers, header);
+  if (tmp == NULL)
+    return ENOMEM;
+  node->headers = tmp;
+  return 0;
+}
+
+static int prw_config_node(oconfig_item_t *ci)
+{
+  prw_node_t *node = calloc(1, sizeof(*node));
+  if (node == NULL) {
+    ERROR("write_prometheus_remote plugin: calloc failed.");
+    return ENOMEM;
+  }
+  node->verify_peer = true;
+  node->verify_host = true;
+  node->timeout = PRW_DEFAULT_TIMEOUT_MS;
+  node->batch_send_deadline = PRW_DEFAULT_BATCH_SEND_DEADLINE;
+  node->max_retries = PRW_DEFAULT_MAX_RETRIES;
+  node->min_backoff = PRW_DEFAULT_MIN_BACKOFF;
+  node->max_backoff = PRW_DEFAULT_MAX_BACKOFF;
+
+  int shards = PRW_DEFAULT_SHARDS;
+  int max_samples_per_send = PRW_DEFAULT_MAX_SAMPLES_PER_SEND;
+  int queue_size = PRW_DEFAULT_QUEUE_SIZE;
+
+  int status = cf_util_get_string(ci, &node->name);
+  if (status != 0) {
+    prw_node_free(node);
+    return status;
+  }
+
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("URL", child->key) == 0) {
+      status = cf_util_get_string(child, &node->url);
+    } else if (strcasecmp("User", child->key) == 0) {
+      status = cf_util_get_string(child, &node->user);
+    } else if (strcasecmp("Password", child->key) == 0) {
+      status = cf_util_get_string(child, &node->pass);
+    } else if (strcasecmp("VerifyPeer", child->key) == 0) {
+      status = cf_util_get_boolean(child, &node->verify_peer);
+    } else if (strcasecmp("VerifyHost", child->key) == 0) {
+      status = cf_util_get_boolean(child, &node->verify_host);
+    } else if (strcasecmp("CACert", child->key) == 0) {
+      status = cf_util_get_string(child, &node->cacert);
+    } else if (strcasecmp("Header", child->key) == 0) {
+      char *header = NULL;
+      status = cf_util_get_string(child, &header);
+      if (status == 0)
+        status = prw_config_append_header(node, header);
+      sfree(header);
+    } else if (strcasecmp("Timeout", child->key) == 0) {
+      status = cf_util_get_int(child, &node->timeout);
+    } else if (strcasecmp("Shards", child->key) == 0) {
+      status = cf_util_get_int(child, &shards);
+    } else if (strcasecmp("MaxSamplesPerSend", child->key) == 0) {
+      status = cf_util_get_int(child, &max_samples_per_send);
+    } else if (strcasecmp("BatchSendDeadline", child->key) == 0) {
+      status = cf_util_get_cdtime(child, &node->batch_send_deadline);
+    } else if (strcasecmp("QueueSize", child->key) == 0) {
+      status = cf_util_get_int(child, &queue_size);
+    } else if (strcasecmp("MaxRetries", child->key) == 0) {
+      status = cf_util_get_int(child, &node->max_retries);
+    } else if (strcasecmp("MinBackoff", child->key) == 0) {
+      status = cf_util_get_cdtime(child, &node->min_backoff);
+    } else if (strcasecmp("MaxBackoff", child->key) == 0) {
+      status = cf_util_get_cdtime(child, &node->max_backoff);
+    } else {
+      ERROR("write_prometheus_remote plugin: Invalid configuration option: "
+            "%s.",
+            child->key);
+      status = EINVAL;
+    }
+
+    if (status != 0)
+      break;
+  }
+
+  if ((status == 0) && (node->url == NULL)) {
+    ERROR("write_prometheus_remote plugin: No URL defined for \"%s\".",
+          node->name);
+    status = EINVAL;
+  }
+  if ((status == 0) && (node->timeout < 0)) {
+    ERROR("write_prometheus_remote plugin: Timeout of \"%s\" must not be "
+          "negative.",
+          node->name);
+    status = EINVAL;
+  }
+  if ((status == 0) && ((shards < 1) || (max_samples_per_send < 1) ||
+                        (queue_size < 1) || (node->max_retries < 0) ||
+                        (node->batch_send_deadline == 0) ||
+                        (node->min_backoff == 0) ||
+                        (node->max_backoff < node->min_backoff))) {
+    ERROR("write_prometheus_remote plugin: Invalid queue configuration for "
+          "\"%s\".",
+          node->name);
+    status = EINVAL;
+  }
+  if (status == 0) {
+    status |= prw_config_append_header(node, "Content-Encoding: snappy");
+    status |= prw_config_append_header(node,
+                                       "Content-Type: application/x-protobuf");
+    status |= prw_config_append_header(
+        node, "X-Prometheus-Remote-Write-Version: 0.1.0");
+    status |= prw_config_append_header(node, "Expect:");
+  }
+  if (status != 0) {
+    prw_node_free(node);
+    return status;
+  }
+
+  node->max_samples_per_send = (size_t)max_samples_per_send;
+  node->queue_size = (size_t)queue_size;
+
+  node->shards = calloc((size_t)shards, sizeof(*node->shards));
+  prw_node_t **tmp =
+      realloc(prw_nodes, (prw_nodes_num + 1) * sizeof(*prw_nodes));
+  if (tmp != NULL)
+    prw_nodes = tmp;
+  if ((node->shards == NULL) || (tmp == NULL)) {
+    ERROR("write_prometheus_remote plugin: Allocating memory failed.");
+    prw_node_free(node);
+    return ENOMEM;
+  }
+
+  node->shards_num = (size_t)shards;
+  for (size_t i = 0; i < node->shards_num; i++) {
+    prw_shard_t *shard = node->shards + i;
+    shard->node = node;
+    shard->index = i;
+    pthread_mutex_init(&shard->lock, NULL);
+    pthread_cond_init(&shard->cond, NULL);
+    C_COMPLAIN_INIT(&shard->complaint);
+  }
+
+  char callback_name[DATA_MAX_NAME_LEN];
+  ssnprintf(callback_name, sizeof(callback_name), "write_prometheus_remote/%s",
+            node->name);
+
+  status = plugin_register_write(callback_name, prw_write,
+                                 &(user_data_t){
+                                     .data = node,
+                                     .free_func = prw_node_free,
+                                 });
+  if (status != 0) {
+    ERROR("write_prometheus_remote plugin: Registering write callback \"%s\" "
+          "failed.",
+          callback_name);
+    return status;
+  }
+  plugin_register_flush(callback_name, prw_flush,
+                        &(user_data_t){
+                            .data = node,
+                        });
+
+  prw_nodes[prw_nodes_num] = node;
+  prw_nodes_num++;
+
+  return 0;
+}
+
+static int prw_config(oconfig_item_t *ci)
+{
+  for (int i = 0; i < ci->children_num; i++) {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp("Node", child->key) == 0) {
+      prw_config_node(child);
+    } else {
+      ERROR("write_prometheus_remote plugin: Invalid configuration option: "
+            "%s.",
+            child->key);
+    }
+  }
+
+  return 0;
+}
+
+static int prw_init(void)
+{
+  /* Call this while collectd is still single-threaded to avoid
+   * initialization issues in libgcrypt. */
+  curl_global_init(CURL_GLOBAL_SSL);
+
+  int ret = 0;
+  for (size_t i = 0; i < prw_nodes_num; i++) {
+    prw_node_t *node = prw_nodes[i];
+
+    for (size_t j = 0; j < node->shards_num; j++) {
+      prw_shard_t *shard = node->shards + j;
+
+      int status = plugin_thread_create(&shard->thread, prw_sender_thread,
+                                        shard, "prw sender");
+      if (status != 0) {
+        ERROR("write_prometheus_remote plugin: Creating a sender thread "
+              "failed: %s",
+              STRERROR(status));
+        ret = status;
+        continue;
+      }
+      shard->running = true;
+    }
+  }
+
+  sfree(prw_nodes);
+  prw_nodes_num = 0;
+
+  return ret;
+}
+
+void module_register(void)
+{
+  plugin_register_complex_config("write_prometheus_remote", prw_config);
+  plugin_register_init("write_prometheus_remote", prw_init);
+}
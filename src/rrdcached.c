@@ -29,11 +29,18 @@
 #include "plugin.h"
 #include "utils/common/common.h"
 #include "utils/rrdcreate/rrdcreate.h"
+#include "utils/strbuf/strbuf.h"
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #undef HAVE_CONFIG_H
 #include <rrd.h>
 #include <rrd_client.h>
 
+#define RC_DEFAULT_PORT "42217"
+
 /*
  * Private variables
  */
@@ -51,6 +58,36 @@ static rrdcreate_config_t rrdcreate_config = {.stepsize = 0,
                                               .consolidation_functions_num = 0,
                                               .async = 0};
 
+/* Updates are queued by the write callback and sent in BATCH mode by a
+ * sender thread, which has its own connection to the daemon. The RRD client
+ * library doesn't implement BATCH, so the protocol is spoken directly. */
+static size_t batch_size = 1000;
+static cdtime_t batch_interval = TIME_T_TO_CDTIME_T_STATIC(1);
+static size_t max_queue_size = 100000;
+/* Timeout for connecting to the daemon and for each read and write on the
+ * connection of the sender thread. */
+static cdtime_t sender_timeout = TIME_T_TO_CDTIME_T_STATIC(10);
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sent_cond = PTHREAD_COND_INITIALIZER;
+static strbuf_t queue_buf = STRBUF_CREATE;
+static size_t queue_num;
+static uint64_t queue_dropped;
+/* Flushes increment flush_gen and wait for sent_gen to catch up. */
+static uint64_t flush_gen;
+static uint64_t sent_gen;
+static bool sender_shutdown;
+static bool sender_running;
+static pthread_t sender_thread;
+
+/* Round trip times of the batches sent since the last read. */
+static cdtime_t batch_rtt_sum;
+static uint64_t batch_rtt_num;
+
+static int sender_fd = -1;
+static FILE *sender_fh;
+
 /*
  * Prototypes.
  */
@@ -223,6 +260,20 @@ static int rc_config(oconfig_item_t *ci) {
         status = rc_config_add_timespan(tmp);
     } else if (strcasecmp("XFF", key) == 0)
       status = rc_config_get_xff(child, &rrdcreate_config.xff);
+    else if (strcasecmp("BatchSize", key) == 0) {
+      int tmp = 0;
+      status = rc_config_get_int_positive(child, &tmp);
+      if (status == 0)
+        batch_size = (size_t)tmp;
+    } else if (strcasecmp("BatchInterval", key) == 0)
+      status = cf_util_get_cdtime(child, &batch_interval);
+    else if (strcasecmp("MaxQueueSize", key) == 0) {
+      int tmp = 0;
+      status = rc_config_get_int_positive(child, &tmp);
+      if (status == 0)
+        max_queue_size = (size_t)tmp;
+    } else if (strcasecmp("Timeout", key) == 0)
+      status = cf_util_get_cdtime(child, &sender_timeout);
     else {
       WARNING("rrdcached plugin: Ignoring invalid option %s.", key);
       continue;
@@ -274,6 +325,25 @@ static int rc_read(void) {
     sstrncpy(vl.host, daemon_address, sizeof(vl.host));
   sstrncpy(vl.plugin, "rrdcached", sizeof(vl.plugin));
 
+  pthread_mutex_lock(&queue_lock);
+  gauge_t queue_length = (gauge_t)queue_num;
+  gauge_t rtt = (batch_rtt_num > 0) ? CDTIME_T_TO_DOUBLE(batch_rtt_sum) /
+                                          (gauge_t)batch_rtt_num
+                                    : NAN;
+  batch_rtt_sum = 0;
+  batch_rtt_num = 0;
+  pthread_mutex_unlock(&queue_lock);
+
+  vl.values[0].gauge = queue_length;
+  sstrncpy(vl.type, "queue_length", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "client", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
+  vl.values[0].gauge = rtt;
+  sstrncpy(vl.type, "response_time", sizeof(vl.type));
+  sstrncpy(vl.type_instance, "batch", sizeof(vl.type_instance));
+  plugin_dispatch_values(&vl);
+
   rrd_clear_error();
   int status = rrdc_connect(daemon_address);
   if (status != 0) {
@@ -355,10 +425,314 @@ static int rc_read(void) {
   return 0;
 } /* int rc_read */
 
+static void rc_sender_disconnect(void) {
+  if (sender_fh != NULL)
+    fclose(sender_fh); /* closes sender_fd */
+  else if (sender_fd >= 0)
+    close(sender_fd);
+  sender_fh = NULL;
+  sender_fd = -1;
+} /* void rc_sender_disconnect */
+
+/* Timeouts make sure that the sender thread, and with it flushes and the
+ * shutdown, never block forever on a hanging daemon. */
+static void rc_sender_set_timeout(int fd) {
+  struct timeval tv = CDTIME_T_TO_TIMEVAL(sender_timeout);
+
+  if ((setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) ||
+      (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0))
+    WARNING("rrdcached plugin: setsockopt (timeout): %s", STRERRNO);
+} /* void rc_sender_set_timeout */
+
+static int rc_sender_connect(void) {
+  char const *path = NULL;
+  if (strncmp("unix:", daemon_address, strlen("unix:")) == 0)
+    path = daemon_address + strlen("unix:");
+  else if (daemon_address[0] == '/')
+    path = daemon_address;
+
+  if (path != NULL) {
+    struct sockaddr_un sa = {.sun_family = AF_UNIX};
+    sstrncpy(sa.sun_path, path, sizeof(sa.sun_path));
+
+    sender_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sender_fd < 0) {
+      ERROR("rrdcached plugin: socket failed: %s", STRERRNO);
+      return -1;
+    }
+    rc_sender_set_timeout(sender_fd);
+    if (connect(sender_fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+      ERROR("rrdcached plugin: connect (%s) failed: %s", path, STRERRNO);
+      rc_sender_disconnect();
+      return -1;
+    }
+  } else {
+    /* "host", "host:port", "[v6addr]" or "[v6addr]:port" */
+    char node[NI_MAXHOST];
+    char const *service = RC_DEFAULT_PORT;
+
+    if (daemon_address[0] == '[') {
+      sstrncpy(node, daemon_address + 1, sizeof(node));
+      char *end = strchr(node, ']');
+      if (end == NULL) {
+        ERROR("rrdcached plugin: Invalid address: %s", daemon_address);
+        return -1;
+      }
+      *end = 0;
+      if ((end[1] == ':') && (end[2] != 0))
+        service = daemon_address + 1 + (end - node) + 2;
+    } else {
+      sstrncpy(node, daemon_address, sizeof(node));
+      /* More than one colon: an IPv6 address without port. */
+      char *colon = strchr(node, ':');
+      if ((colon != NULL) && (strchr(colon + 1, ':') == NULL)) {
+        *colon = 0;
+        if (colon[1] != 0)
+          service = daemon_address + (colon - node) + 1;
+      }
+    }
+
+    struct addrinfo ai_hints = {.ai_family = AF_UNSPEC,
+                                .ai_socktype = SOCK_STREAM};
+    struct addrinfo *ai_list;
+    int status = getaddrinfo(node, service, &ai_hints, &ai_list);
+    if (status != 0) {
+      ERROR("rrdcached plugin: getaddrinfo (%s, %s) failed: %s", node, service,
+            (status == EAI_SYSTEM) ? STRERRNO : gai_strerror(status));
+      return -1;
+    }
+
+    for (struct addrinfo *ai = ai_list; ai != NULL; ai = ai->ai_next) {
+      sender_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (sender_fd < 0)
+        continue;
+      rc_sender_set_timeout(sender_fd);
+      if (connect(sender_fd, ai->ai_addr, ai->ai_addrlen) == 0)
+        break;
+      close(sender_fd);
+      sender_fd = -1;
+    }
+    freeaddrinfo(ai_list);
+
+    if (sender_fd < 0) {
+      ERROR("rrdcached plugin: Failed to connect to %s.", daemon_address);
+      return -1;
+    }
+  }
+
+  sender_fh = fdopen(sender_fd, "r");
+  if (sender_fh == NULL) {
+    ERROR("rrdcached plugin: fdopen failed: %s", STRERRNO);
+    rc_sender_disconnect();
+    return -1;
+  }
+
+  return 0;
+} /* int rc_sender_connect */
+
+/* Writes all of `data' to the daemon. Unlike swrite(), a send timeout is an
+ * error rather than a reason to try again. */
+static int rc_sender_write(void const *data, size_t data_size) {
+  char const *ptr = data;
+
+  while (data_size > 0) {
+    ssize_t status = write(sender_fd, ptr, data_size);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      int err = ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? ETIMEDOUT
+                                                               : errno;
+      ERROR("rrdcached plugin: Writing to %s failed: %s", daemon_address,
+            STRERROR(err));
+      return -1;
+    }
+
+    ptr += status;
+    data_size -= (size_t)status;
+  }
+
+  return 0;
+} /* int rc_sender_write */
+
+/* Reads a response line and returns the status code at its beginning. */
+static int rc_sender_response(char *line, size_t line_size) {
+  if (fgets(line, (int)line_size, sender_fh) == NULL) {
+    ERROR("rrdcached plugin: Reading from %s failed: %s", daemon_address,
+          feof(sender_fh) ? "connection closed" : STRERRNO);
+    return -1;
+  }
+
+  char *endptr = NULL;
+  long status = strtol(line, &endptr, 10);
+  if (endptr == line) {
+    ERROR("rrdcached plugin: Invalid response: %s", line);
+    return -1;
+  }
+  return (int)status;
+} /* int rc_sender_response */
+
+/* Sends the queued "UPDATE" commands in `buf' in a single BATCH. Errors of
+ * individual updates are logged, but do not fail the batch. */
+static int rc_sender_batch(strbuf_t const *buf) {
+  char line[1024];
+
+  if ((sender_fh == NULL) && (rc_sender_connect() != 0))
+    return -1;
+
+  if (rc_sender_write("BATCH\n", strlen("BATCH\n")) != 0)
+    return -1;
+  int status = rc_sender_response(line, sizeof(line));
+  if (status != 0) {
+    if (status > 0)
+      ERROR("rrdcached plugin: BATCH failed: %s", line);
+    return -1;
+  }
+
+  if ((rc_sender_write(buf->ptr, buf->pos) != 0) ||
+      (rc_sender_write(".\n", strlen(".\n")) != 0))
+    return -1;
+
+  int errors = rc_sender_response(line, sizeof(line));
+  if (errors < 0)
+    return -1;
+
+  for (int i = 0; i < errors; i++) {
+    if (fgets(line, sizeof(line), sender_fh) == NULL)
+      return -1;
+    /* Only the first few errors are logged, e.g. when many files are
+     * missing. */
+    if (i < 5) {
+      strstripnewline(line);
+      WARNING("rrdcached plugin: Update failed: %s", line);
+    }
+  }
+  if (errors > 5)
+    WARNING("rrdcached plugin: %d updates of the batch failed.", errors);
+
+  return 0;
+} /* int rc_sender_batch */
+
+static void *rc_sender_thread(__attribute__((unused)) void *arg) {
+  strbuf_t buf = STRBUF_CREATE;
+  /* Set after a failed batch: wait for the full interval before trying
+   * again, even if the queue is full. */
+  bool failed = false;
+
+  pthread_mutex_lock(&queue_lock);
+  while (true) {
+    cdtime_t deadline = cdtime() + batch_interval;
+    struct timespec ts = CDTIME_T_TO_TIMESPEC(deadline);
+
+    while (!sender_shutdown &&
+           (failed || ((queue_num < batch_size) && (flush_gen == sent_gen))) &&
+           (cdtime() < deadline)) {
+      if (pthread_cond_timedwait(&queue_cond, &queue_lock, &ts) == ETIMEDOUT)
+        break;
+    }
+
+    uint64_t gen = flush_gen;
+    size_t num = queue_num;
+    uint64_t dropped = queue_dropped;
+
+    /* Take over the queued updates, so that writers can continue while the
+     * batch is sent. */
+    strbuf_t tmp = queue_buf;
+    queue_buf = buf;
+    buf = tmp;
+    queue_num = 0;
+    queue_dropped = 0;
+    pthread_mutex_unlock(&queue_lock);
+
+    if (dropped > 0)
+      WARNING("rrdcached plugin: The queue is full, dropped %" PRIu64
+              " updates.",
+              dropped);
+
+    bool sent = false;
+    failed = false;
+    cdtime_t rtt = 0;
+    if (num > 0) {
+      cdtime_t start = cdtime();
+      int status = rc_sender_batch(&buf);
+      if (status != 0) {
+        /* The connection may have been closed by the daemon: retry once. */
+        rc_sender_disconnect();
+        start = cdtime();
+        status = rc_sender_batch(&buf);
+      }
+      if (status != 0) {
+        ERROR("rrdcached plugin: Sending %" PRIsz " updates to %s failed.",
+              num, daemon_address);
+        rc_sender_disconnect();
+        failed = true;
+      } else {
+        sent = true;
+        rtt = cdtime() - start;
+      }
+    }
+
+    pthread_mutex_lock(&queue_lock);
+    if (sent) {
+      batch_rtt_sum += rtt;
+      batch_rtt_num++;
+    }
+
+    /* Put a failed batch back in front of the queue, so that it is sent
+     * again with the next batch, as long as the queue has room for it. During
+     * shutdown, there is no next batch. */
+    if (failed && !sender_shutdown &&
+        (queue_num + num <= max_queue_size) &&
+        (strbuf_putn(&buf, queue_buf.ptr, queue_buf.pos) == 0)) {
+      strbuf_t tmp = queue_buf;
+      queue_buf = buf;
+      buf = tmp;
+      queue_num += num;
+    } else if (failed) {
+      queue_dropped += num;
+    }
+    strbuf_reset(&buf);
+
+    sent_gen = gen;
+    pthread_cond_broadcast(&sent_cond);
+
+    if (sender_shutdown && (queue_num == 0))
+      break;
+  }
+  pthread_mutex_unlock(&queue_lock);
+
+  rc_sender_disconnect();
+  STRBUF_DESTROY(buf);
+  return NULL;
+} /* void *rc_sender_thread */
+
+/* Sends the queued updates and waits until they are acknowledged. */
+static void rc_sender_flush(void) {
+  pthread_mutex_lock(&queue_lock);
+  if (sender_running) {
+    uint64_t gen = ++flush_gen;
+    pthread_cond_signal(&queue_cond);
+    while (sender_running && (sent_gen < gen))
+      pthread_cond_wait(&sent_cond, &queue_lock);
+  }
+  pthread_mutex_unlock(&queue_lock);
+} /* void rc_sender_flush */
+
 static int rc_init(void) {
   if (config_collect_stats)
     plugin_register_read("rrdcached", rc_read);
 
+  if (daemon_address == NULL)
+    return 0;
+
+  int status = plugin_thread_create(&sender_thread, rc_sender_thread,
+                                    /* arg = */ NULL, "rrdcached send");
+  if (status != 0) {
+    ERROR("rrdcached plugin: Starting the sender thread failed: %s",
+          STRERROR(status));
+    return -1;
+  }
+  sender_running = true;
+
   return 0;
 } /* int rc_init */
 
@@ -367,7 +741,6 @@ static int rc_write(const data_set_t *ds, const value_list_t *vl,
   char filename[PATH_MAX];
   char values[512];
   int status;
-  bool retried = false;
 
   if (daemon_address == NULL) {
     ERROR("rrdcached plugin: daemon_address == NULL.");
@@ -409,40 +782,29 @@ static int rc_write(const data_set_t *ds, const value_list_t *vl,
     }
   }
 
-  rrd_clear_error();
-  status = rrdc_connect(daemon_address);
-  if (status != 0) {
-    ERROR("rrdcached plugin: Failed to connect to RRDCacheD "
-          "at %s: %s (status=%d)",
-          daemon_address, rrd_get_error(), status);
+  pthread_mutex_lock(&queue_lock);
+  if (queue_num >= max_queue_size) {
+    queue_dropped++;
+    pthread_mutex_unlock(&queue_lock);
     return -1;
   }
 
-  char *values_array[2] = {
-      [0] = values,
-      [1] = NULL,
-  };
-
-  while (42) {
-    /* The RRD client lib does not provide any means for checking a
-     * connection, hence we'll have to retry upon failed operations. */
-    rrd_clear_error();
-    status = rrdc_update(filename, /* values_num = */ 1, (void *)values_array);
-    if (status == 0)
-      break;
-
-    if (!retried) {
-      retried = true;
-      if (try_reconnect() == 0)
-        continue;
-      /* else: report the error and fail */
-    }
-
-    ERROR("rrdcached plugin: rrdc_update (%s, [%s], 1) failed: %s (status=%i)",
-          filename, values_array[0], rrd_get_error(), status);
+  /* Like the RRD client library, escape spaces and backslashes in file
+   * names. */
+  status = strbuf_print(&queue_buf, "UPDATE ");
+  status = status || strbuf_print_escaped(&queue_buf, filename, " \\", '\\');
+  status = status || strbuf_printf(&queue_buf, " %s\n", values);
+  if (status != 0) {
+    pthread_mutex_unlock(&queue_lock);
+    ERROR("rrdcached plugin: Queueing the update of %s failed.", filename);
     return -1;
   }
 
+  queue_num++;
+  if (queue_num >= batch_size)
+    pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+
   return 0;
 } /* int rc_write */
 
@@ -459,6 +821,9 @@ static int rc_flush(__attribute__((unused)) cdtime_t timeout, /* {{{ */
   else
     ssnprintf(filename, sizeof(filename), "%s.rrd", identifier);
 
+  /* Queued updates have to reach the daemon before it can flush them. */
+  rc_sender_flush();
+
   rrd_clear_error();
   int status = rrdc_connect(daemon_address);
   if (status != 0) {
@@ -495,6 +860,21 @@ static int rc_flush(__attribute__((unused)) cdtime_t timeout, /* {{{ */
 } /* }}} int rc_flush */
 
 static int rc_shutdown(void) {
+  pthread_mutex_lock(&queue_lock);
+  bool running = sender_running;
+  sender_shutdown = true;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+
+  if (running) {
+    pthread_join(sender_thread, NULL);
+    pthread_mutex_lock(&queue_lock);
+    sender_running = false;
+    pthread_cond_broadcast(&sent_cond);
+    pthread_mutex_unlock(&queue_lock);
+  }
+  STRBUF_DESTROY(queue_buf);
+
   rrdc_disconnect();
   return 0;
 } /* int rc_shutdown */
@@ -24,12 +24,18 @@
  *   Florian octo Forster <octo at collectd.org>
  */
 
+/* _GNU_SOURCE is needed for recvmmsg(2) */
+#define _GNU_SOURCE
+
 #include "collectd.h"
 
 #include "plugin.h"
+#include "distribution.h"
 #include "utils/avltree/avltree.h"
 #include "utils/common/common.h"
+#include "utils/hll/hll.h"
 #include "utils/latency/latency.h"
+#include "utils_complain.h"
 
 #include <netdb.h>
 #include <poll.h>
@@ -48,6 +54,15 @@
 #define STATSD_DEFAULT_SERVICE "8125"
 #endif
 
+/* Large enough for any UDP datagram. */
+#define STATSD_BUFFER_SIZE 65536
+/* Number of datagrams received with a single recvmmsg(2) call. */
+#define STATSD_BATCH_SIZE 16
+/* Maximum number of DogStatsD tags in a single line. */
+#define STATSD_TAGS_MAX 32
+/* Maximum size of a metrics tree key, i.e. the name and the tags. */
+#define STATSD_KEY_SIZE 1024
+
 typedef enum statsd_metric_type_e {
   STATSD_COUNTER,
   STATSD_TIMER,
@@ -55,25 +70,63 @@ typedef enum statsd_metric_type_e {
   STATSD_SET,
 } statsd_metric_type_t;
 
+/* DogStatsD tags of a single line, sorted by name. The pairs point into the
+ * receive buffer. */
+typedef struct {
+  label_pair_t ptr[STATSD_TAGS_MAX];
+  size_t num;
+} statsd_tags_t;
+
+/* A tag while parsing, with its position in the line. */
+typedef struct {
+  label_pair_t pair;
+  size_t index;
+} statsd_tag_t;
+
 struct statsd_metric_s {
   statsd_metric_type_t type;
+  /* Labels from DogStatsD tags. Metrics with labels are keyed by name and
+   * labels, and "name_len" is the length of the name part of the key. */
+  label_set_t labels;
+  size_t name_len;
   double value;
   derive_t counter;
   latency_counter_t *latency;
+  /* Used instead of "latency" if conf_timer_distribution is enabled. In
+   * metrics_tree it accumulates all timer values since the start. */
+  distribution_t *distribution;
   c_avl_tree_t *set;
+  /* Replaces "set" once the set has grown past conf_set_exact_limit. */
+  hll_t *hll;
   unsigned long updates_num;
+  /* Only used in shards: true if the gauge has been set to an absolute
+   * value, false if "value" is the sum of relative changes. */
+  bool gauge_set;
 };
 typedef struct statsd_metric_s statsd_metric_t;
 
+/* All metrics, merged from the shards on each read. */
 static c_avl_tree_t *metrics_tree;
 static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static pthread_t network_thread;
-static bool network_thread_running;
+/* Every receiver thread aggregates into its own shard, so that parsing does
+ * not contend on a global lock. The lock of a shard is only taken by its own
+ * thread (once per batch of datagrams) and by statsd_read(). */
+typedef struct {
+  c_avl_tree_t *tree;
+  pthread_mutex_t lock;
+  pthread_t thread;
+  bool thread_running;
+} statsd_shard_t;
+
+static statsd_shard_t *shards;
+static size_t shards_num;
+
 static bool network_thread_shutdown;
 
 static char *conf_node;
 static char *conf_service;
+static int conf_receive_threads = 1;
 
 static bool conf_delete_counters;
 static bool conf_delete_timers;
@@ -89,10 +142,118 @@ static bool conf_timer_upper;
 static bool conf_timer_sum;
 static bool conf_timer_count;
 
-/* Must hold metrics_lock when calling this function. */
-static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
-                                                    statsd_metric_type_t type) {
-  char key[DATA_MAX_NAME_LEN + 2];
+static bool conf_timer_distribution;
+static distribution_t *conf_timer_layout;
+
+/* Sets with more than conf_set_exact_limit members are promoted to a
+ * HyperLogLog estimator, if conf_set_precision is not zero. */
+static int conf_set_precision;
+static int conf_set_exact_limit = 1000;
+
+/* Maximum number of distinct tag sets per metric name, zero for no limit. */
+static int conf_max_tag_sets = 1000;
+/* Keys of the known tag sets of each metric, keyed by type prefix and name.
+ * The limit is checked by the receiver threads when a tag set is first seen
+ * in a shard, so that shards do not grow past it between two reads.
+ * tag_sets_lock is taken while holding a shard lock or metrics_lock, so no
+ * other lock may be taken while holding it. */
+static c_avl_tree_t *tag_sets_tree;
+static pthread_mutex_t tag_sets_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_complain_t tag_sets_complaint = C_COMPLAIN_INIT_STATIC;
+
+/* Adds the tag set of "key" to the known tag sets of its metric. "name_len" is
+ * the length of the name part of "key". Returns ENOSPC if the tag set is new
+ * and the metric has conf_max_tag_sets tag sets already. */
+static int statsd_tag_set_add(char const *key, size_t name_len) /* {{{ */
+{
+  char name[DATA_MAX_NAME_LEN + 2];
+  c_avl_tree_t *keys = NULL;
+
+  /* The name is at most DATA_MAX_NAME_LEN - 1 bytes long. */
+  sstrncpy(name, key, name_len + 3);
+
+  pthread_mutex_lock(&tag_sets_lock);
+
+  if (c_avl_get(tag_sets_tree, name, (void *)&keys) != 0) {
+    char *name_copy = strdup(name);
+    keys = c_avl_create((int (*)(const void *, const void *))strcmp);
+    if ((name_copy == NULL) || (keys == NULL) ||
+        (c_avl_insert(tag_sets_tree, name_copy, keys) != 0)) {
+      pthread_mutex_unlock(&tag_sets_lock);
+      ERROR("statsd plugin: Unable to track the tag sets of \"%s\".",
+            name + 2);
+      sfree(name_copy);
+      if (keys != NULL)
+        c_avl_destroy(keys);
+      return 0;
+    }
+  }
+
+  if (c_avl_get(keys, key, /* value = */ NULL) == 0) {
+    pthread_mutex_unlock(&tag_sets_lock);
+    return 0;
+  }
+
+  if ((conf_max_tag_sets > 0) && (c_avl_size(keys) >= conf_max_tag_sets)) {
+    pthread_mutex_unlock(&tag_sets_lock);
+    c_complain(LOG_WARNING, &tag_sets_complaint,
+               "statsd plugin: Metric \"%s\" exceeds the limit of %d "
+               "tag sets, dropping new tag sets.",
+               name + 2, conf_max_tag_sets);
+    return ENOSPC;
+  }
+
+  char *key_copy = strdup(key);
+  if ((key_copy == NULL) ||
+      (c_avl_insert(keys, key_copy, /* value = */ NULL) != 0)) {
+    ERROR("statsd plugin: Unable to track the tag sets of \"%s\".",
+          name + 2);
+    sfree(key_copy);
+  }
+
+  pthread_mutex_unlock(&tag_sets_lock);
+  return 0;
+} /* }}} int statsd_tag_set_add */
+
+/* Removes the tag set of "key" from the known tag sets of its metric. */
+static void statsd_tag_set_remove(char const *key, size_t name_len) /* {{{ */
+{
+  char name[DATA_MAX_NAME_LEN + 2];
+  c_avl_tree_t *keys = NULL;
+
+  sstrncpy(name, key, name_len + 3);
+
+  pthread_mutex_lock(&tag_sets_lock);
+
+  if (c_avl_get(tag_sets_tree, name, (void *)&keys) != 0) {
+    pthread_mutex_unlock(&tag_sets_lock);
+    return;
+  }
+
+  char *key_copy = NULL;
+  if (c_avl_remove(keys, key, (void *)&key_copy, /* value = */ NULL) == 0)
+    sfree(key_copy);
+
+  if (c_avl_size(keys) == 0) {
+    char *name_copy = NULL;
+    if (c_avl_remove(tag_sets_tree, name, (void *)&name_copy,
+                     /* value = */ NULL) == 0)
+      sfree(name_copy);
+    c_avl_destroy(keys);
+  }
+
+  pthread_mutex_unlock(&tag_sets_lock);
+} /* }}} void statsd_tag_set_remove */
+
+/* Looks up the metric, creating it if necessary. Returns ENOSPC if a new tag
+ * set has been dropped because of MaxTagSets.
+ * Must hold the lock protecting "tree" when calling this function. */
+static int statsd_metric_lookup_unsafe(c_avl_tree_t *tree, /* {{{ */
+                                       char const *name,
+                                       statsd_tags_t const *tags,
+                                       statsd_metric_type_t type,
+                                       statsd_metric_t **ret_metric) {
+  char key[STATSD_KEY_SIZE];
   char *key_copy;
   statsd_metric_t *metric;
   int status;
@@ -111,81 +272,113 @@ static statsd_metric_t *statsd_metric_lookup_unsafe(char const *name, /* {{{ */
     key[0] = 's';
     break;
   default:
-    return NULL;
+    return -1;
   }
 
   key[1] = ':';
-  sstrncpy(&key[2], name, sizeof(key) - 2);
+  sstrncpy(&key[2], name, DATA_MAX_NAME_LEN);
+
+  /* Identical tag sets produce identical keys, since the tags are sorted. */
+  label_set_t labels = {0};
+  size_t name_len = strlen(&key[2]);
+  if ((tags != NULL) && (tags->num > 0)) {
+    labels = (label_set_t){
+        .ptr = (label_pair_t *)tags->ptr,
+        .num = tags->num,
+    };
+
+    strbuf_t buf = STRBUF_CREATE_FIXED(key, sizeof(key));
+    buf.pos = 2 + name_len;
+    if ((label_set_marshal(&buf, labels) != 0) ||
+        (buf.pos >= sizeof(key) - 1)) {
+      ERROR("statsd plugin: The tags of \"%s\" are too long.", name);
+      return -1;
+    }
+  }
 
-  status = c_avl_get(metrics_tree, key, (void *)&metric);
-  if (status == 0)
-    return metric;
+  status = c_avl_get(tree, key, (void *)&metric);
+  if (status == 0) {
+    *ret_metric = metric;
+    return 0;
+  }
+
+  if (labels.num > 0) {
+    status = statsd_tag_set_add(key, name_len);
+    if (status != 0)
+      return status;
+  }
 
   key_copy = strdup(key);
   if (key_copy == NULL) {
     ERROR("statsd plugin: strdup failed.");
-    return NULL;
+    return -1;
   }
 
   metric = calloc(1, sizeof(*metric));
   if (metric == NULL) {
     ERROR("statsd plugin: calloc failed.");
     sfree(key_copy);
-    return NULL;
+    return -1;
   }
 
   metric->type = type;
   metric->latency = NULL;
   metric->set = NULL;
+  metric->name_len = name_len;
 
-  status = c_avl_insert(metrics_tree, key_copy, metric);
+  status = label_set_clone(&metric->labels, labels);
   if (status != 0) {
-    ERROR("statsd plugin: c_avl_insert failed.");
+    ERROR("statsd plugin: label_set_clone failed.");
     sfree(key_copy);
     sfree(metric);
-    return NULL;
+    return -1;
   }
 
-  return metric;
-} /* }}} statsd_metric_lookup_unsafe */
+  status = c_avl_insert(tree, key_copy, metric);
+  if (status != 0) {
+    ERROR("statsd plugin: c_avl_insert failed.");
+    sfree(key_copy);
+    label_set_reset(&metric->labels);
+    sfree(metric);
+    return -1;
+  }
 
-static int statsd_metric_set(char const *name, double value, /* {{{ */
-                             statsd_metric_type_t type) {
-  statsd_metric_t *metric;
+  *ret_metric = metric;
+  return 0;
+} /* }}} int statsd_metric_lookup_unsafe */
 
-  pthread_mutex_lock(&metrics_lock);
+/* Must hold the lock of "shard" when calling this function. */
+static int statsd_metric_set(statsd_shard_t *shard, /* {{{ */
+                             char const *name, statsd_tags_t const *tags,
+                             double value, statsd_metric_type_t type) {
+  statsd_metric_t *metric = NULL;
 
-  metric = statsd_metric_lookup_unsafe(name, type);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
-    return -1;
-  }
+  int status =
+      statsd_metric_lookup_unsafe(shard->tree, name, tags, type, &metric);
+  if (status != 0)
+    return status;
 
   metric->value = value;
+  metric->gauge_set = true;
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
-
   return 0;
 } /* }}} int statsd_metric_set */
 
-static int statsd_metric_add(char const *name, double delta, /* {{{ */
-                             statsd_metric_type_t type) {
-  statsd_metric_t *metric;
-
-  pthread_mutex_lock(&metrics_lock);
+/* Must hold the lock of "shard" when calling this function. */
+static int statsd_metric_add(statsd_shard_t *shard, /* {{{ */
+                             char const *name, statsd_tags_t const *tags,
+                             double delta, statsd_metric_type_t type) {
+  statsd_metric_t *metric = NULL;
 
-  metric = statsd_metric_lookup_unsafe(name, type);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
-    return -1;
-  }
+  int status =
+      statsd_metric_lookup_unsafe(shard->tree, name, tags, type, &metric);
+  if (status != 0)
+    return status;
 
   metric->value += delta;
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
-
   return 0;
 } /* }}} int statsd_metric_add */
 
@@ -199,6 +392,9 @@ static void statsd_metric_free(statsd_metric_t *metric) /* {{{ */
     metric->latency = NULL;
   }
 
+  distribution_destroy(metric->distribution);
+  metric->distribution = NULL;
+
   if (metric->set != NULL) {
     void *key;
     void *value;
@@ -212,6 +408,11 @@ static void statsd_metric_free(statsd_metric_t *metric) /* {{{ */
     metric->set = NULL;
   }
 
+  hll_destroy(metric->hll);
+  metric->hll = NULL;
+
+  label_set_reset(&metric->labels);
+
   sfree(metric);
 } /* }}} void statsd_metric_free */
 
@@ -226,7 +427,8 @@ static int statsd_parse_value(char const *str, value_t *ret_value) /* {{{ */
   return 0;
 } /* }}} int statsd_parse_value */
 
-static int statsd_handle_counter(char const *name, /* {{{ */
+static int statsd_handle_counter(statsd_shard_t *shard, /* {{{ */
+                                 char const *name, statsd_tags_t const *tags,
                                  char const *value_str, char const *extra) {
   value_t value;
   value_t scale;
@@ -252,11 +454,12 @@ static int statsd_handle_counter(char const *name, /* {{{ */
 
   /* Changes to the counter are added to (statsd_metric_t*)->value. ->counter is
    * only updated in statsd_metric_submit_unsafe(). */
-  return statsd_metric_add(name, (double)(value.gauge / scale.gauge),
-                           STATSD_COUNTER);
+  return statsd_metric_add(shard, name, tags,
+                           (double)(value.gauge / scale.gauge), STATSD_COUNTER);
 } /* }}} int statsd_handle_counter */
 
-static int statsd_handle_gauge(char const *name, /* {{{ */
+static int statsd_handle_gauge(statsd_shard_t *shard, /* {{{ */
+                               char const *name, statsd_tags_t const *tags,
                                char const *value_str) {
   value_t value;
   int status;
@@ -267,14 +470,17 @@ static int statsd_handle_gauge(char const *name, /* {{{ */
     return status;
 
   if ((value_str[0] == '+') || (value_str[0] == '-'))
-    return statsd_metric_add(name, (double)value.gauge, STATSD_GAUGE);
+    return statsd_metric_add(shard, name, tags, (double)value.gauge,
+                             STATSD_GAUGE);
   else
-    return statsd_metric_set(name, (double)value.gauge, STATSD_GAUGE);
+    return statsd_metric_set(shard, name, tags, (double)value.gauge,
+                             STATSD_GAUGE);
 } /* }}} int statsd_handle_gauge */
 
-static int statsd_handle_timer(char const *name, /* {{{ */
+static int statsd_handle_timer(statsd_shard_t *shard, /* {{{ */
+                               char const *name, statsd_tags_t const *tags,
                                char const *value_str, char const *extra) {
-  statsd_metric_t *metric;
+  statsd_metric_t *metric = NULL;
   value_t value_ms;
   value_t scale;
   cdtime_t value;
@@ -300,40 +506,75 @@ static int statsd_handle_timer(char const *name, /* {{{ */
 
   value = MS_TO_CDTIME_T(value_ms.gauge / scale.gauge);
 
-  pthread_mutex_lock(&metrics_lock);
+  status = statsd_metric_lookup_unsafe(shard->tree, name, tags, STATSD_TIMER,
+                                       &metric);
+  if (status != 0)
+    return status;
 
-  metric = statsd_metric_lookup_unsafe(name, STATSD_TIMER);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
-    return -1;
+  if (conf_timer_distribution) {
+    if (metric->distribution == NULL)
+      metric->distribution = distribution_clone(conf_timer_layout);
+    if (metric->distribution == NULL)
+      return -1;
+
+    distribution_update(metric->distribution, CDTIME_T_TO_DOUBLE(value));
+    metric->updates_num++;
+    return 0;
   }
 
   if (metric->latency == NULL)
     metric->latency = latency_counter_create();
-  if (metric->latency == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
+  if (metric->latency == NULL)
     return -1;
-  }
 
   latency_counter_add(metric->latency, value);
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
   return 0;
 } /* }}} int statsd_handle_timer */
 
-static int statsd_handle_set(char const *name, /* {{{ */
+/* Replaces the exact set of "metric" with a HyperLogLog estimator. */
+static int statsd_set_promote(statsd_metric_t *metric) /* {{{ */
+{
+  hll_t *hll = hll_create((unsigned int)conf_set_precision);
+  if (hll == NULL) {
+    ERROR("statsd plugin: hll_create failed.");
+    return -1;
+  }
+
+  if (metric->set != NULL) {
+    char *key;
+    void *value;
+
+    while (c_avl_pick(metric->set, (void *)&key, &value) == 0) {
+      hll_add(hll, key);
+      sfree(key);
+    }
+
+    c_avl_destroy(metric->set);
+    metric->set = NULL;
+  }
+
+  metric->hll = hll;
+  return 0;
+} /* }}} int statsd_set_promote */
+
+static int statsd_handle_set(statsd_shard_t *shard, /* {{{ */
+                             char const *name, statsd_tags_t const *tags,
                              char const *set_key_orig) {
   statsd_metric_t *metric = NULL;
   char *set_key;
   int status;
 
-  pthread_mutex_lock(&metrics_lock);
+  status = statsd_metric_lookup_unsafe(shard->tree, name, tags, STATSD_SET,
+                                       &metric);
+  if (status != 0)
+    return status;
 
-  metric = statsd_metric_lookup_unsafe(name, STATSD_SET);
-  if (metric == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
-    return -1;
+  if (metric->hll != NULL) {
+    hll_add(metric->hll, set_key_orig);
+    metric->updates_num++;
+    return 0;
   }
 
   /* Make sure metric->set exists. */
@@ -341,21 +582,18 @@ static int statsd_handle_set(char const *name, /* {{{ */
     metric->set = c_avl_create((int (*)(const void *, const void *))strcmp);
 
   if (metric->set == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
     ERROR("statsd plugin: c_avl_create failed.");
     return -1;
   }
 
   set_key = strdup(set_key_orig);
   if (set_key == NULL) {
-    pthread_mutex_unlock(&metrics_lock);
     ERROR("statsd plugin: strdup failed.");
     return -1;
   }
 
   status = c_avl_insert(metric->set, set_key, /* value = */ NULL);
   if (status < 0) {
-    pthread_mutex_unlock(&metrics_lock);
     ERROR("statsd plugin: c_avl_insert (\"%s\") failed with status %i.",
           set_key, status);
     sfree(set_key);
@@ -365,18 +603,85 @@ static int statsd_handle_set(char const *name, /* {{{ */
     sfree(set_key);
   }
 
+  if ((conf_set_precision > 0) &&
+      (c_avl_size(metric->set) > conf_set_exact_limit))
+    statsd_set_promote(metric);
+
   metric->updates_num++;
 
-  pthread_mutex_unlock(&metrics_lock);
   return 0;
 } /* }}} int statsd_handle_set */
 
-static int statsd_parse_line(char *buffer) /* {{{ */
+static int statsd_tag_compare(void const *a, void const *b) /* {{{ */
+{
+  statsd_tag_t const *x = a;
+  statsd_tag_t const *y = b;
+
+  int status = strcmp(x->pair.name, y->pair.name);
+  if (status != 0)
+    return status;
+
+  /* Keep the original order of duplicate names, the last one wins. */
+  return (x->index < y->index) ? -1 : (x->index > y->index) ? 1 : 0;
+} /* }}} int statsd_tag_compare */
+
+/* Parses the DogStatsD tag section, e.g. "env:prod,role:db", into "tags".
+ * Tag names are changed in place into valid label names. Tags without a value
+ * are ignored. */
+static int statsd_parse_tags(char *str, statsd_tags_t *tags) /* {{{ */
+{
+  statsd_tag_t parsed[STATSD_TAGS_MAX];
+  size_t parsed_num = 0;
+
+  tags->num = 0;
+
+  char *saveptr = NULL;
+  for (char *tag = strtok_r(str, ",", &saveptr); tag != NULL;
+       tag = strtok_r(NULL, ",", &saveptr)) {
+    char *value = strchr(tag, ':');
+    if ((value == NULL) || (value == tag) || (value[1] == 0))
+      continue;
+    *value = 0;
+    value++;
+
+    if (parsed_num >= STATSD_TAGS_MAX)
+      return -1;
+
+    for (char *ptr = tag; *ptr != 0; ptr++) {
+      if (strchr(VALID_LABEL_CHARS, *ptr) == NULL)
+        *ptr = '_';
+    }
+    if (isdigit((int)tag[0]))
+      tag[0] = '_';
+
+    parsed[parsed_num] = (statsd_tag_t){
+        .pair = {.name = tag, .value = value},
+        .index = parsed_num,
+    };
+    parsed_num++;
+  }
+
+  qsort(parsed, parsed_num, sizeof(parsed[0]), statsd_tag_compare);
+
+  /* Remove duplicate names, keeping the last value. */
+  for (size_t i = 0; i < parsed_num; i++) {
+    if ((i + 1 < parsed_num) &&
+        (strcmp(parsed[i].pair.name, parsed[i + 1].pair.name) == 0))
+      continue;
+    tags->ptr[tags->num] = parsed[i].pair;
+    tags->num++;
+  }
+
+  return 0;
+} /* }}} int statsd_parse_tags */
+
+static int statsd_parse_line(statsd_shard_t *shard, char *buffer) /* {{{ */
 {
   char *name = buffer;
   char *value;
   char *type;
-  char *extra;
+  char *extra = NULL;
+  statsd_tags_t tags = {.num = 0};
 
   type = strchr(name, '|');
   if (type == NULL)
@@ -390,30 +695,47 @@ static int statsd_parse_line(char *buffer) /* {{{ */
   *value = 0;
   value++;
 
-  extra = strchr(type, '|');
-  if (extra != NULL) {
-    *extra = 0;
-    extra++;
+  /* The type may be followed by a sample rate ("|@0.1") and by DogStatsD
+   * tags ("|#name:value,..."). */
+  char *section = strchr(type, '|');
+  while (section != NULL) {
+    *section = 0;
+    section++;
+
+    char *next = strchr(section, '|');
+    if (next != NULL)
+      *next = 0;
+
+    if ((section[0] == '@') && (extra == NULL))
+      extra = section;
+    else if ((section[0] == '#') && (tags.num == 0)) {
+      if (statsd_parse_tags(section + 1, &tags) != 0)
+        return -1;
+    } else
+      return -1;
+
+    section = next;
   }
 
   if (strcmp("c", type) == 0)
-    return statsd_handle_counter(name, value, extra);
+    return statsd_handle_counter(shard, name, &tags, value, extra);
   else if (strcmp("ms", type) == 0)
-    return statsd_handle_timer(name, value, extra);
+    return statsd_handle_timer(shard, name, &tags, value, extra);
 
   /* extra is only valid for counters and timers */
   if (extra != NULL)
     return -1;
 
   if (strcmp("g", type) == 0)
-    return statsd_handle_gauge(name, value);
+    return statsd_handle_gauge(shard, name, &tags, value);
   else if (strcmp("s", type) == 0)
-    return statsd_handle_set(name, value);
+    return statsd_handle_set(shard, name, &tags, value);
   else
     return -1;
 } /* }}} void statsd_parse_line */
 
-static void statsd_parse_buffer(char *buffer) /* {{{ */
+/* Must hold the lock of "shard" when calling this function. */
+static void statsd_parse_buffer(statsd_shard_t *shard, char *buffer) /* {{{ */
 {
   while (buffer != NULL) {
     char orig[64];
@@ -433,21 +755,57 @@ static void statsd_parse_buffer(char *buffer) /* {{{ */
 
     sstrncpy(orig, buffer, sizeof(orig));
 
-    status = statsd_parse_line(buffer);
-    if (status != 0)
+    status = statsd_parse_line(shard, buffer);
+    /* Lines dropped because of MaxTagSets have been complained about. */
+    if ((status != 0) && (status != ENOSPC))
       ERROR("statsd plugin: Unable to parse line: \"%s\"", orig);
 
     buffer = next;
   }
 } /* }}} void statsd_parse_buffer */
 
-static void statsd_network_read(int fd) /* {{{ */
-{
-  char buffer[4096];
+#if HAVE_RECVMMSG
+static void statsd_network_read(statsd_shard_t *shard, int fd, /* {{{ */
+                                char *buffers) {
+  struct mmsghdr msgs[STATSD_BATCH_SIZE];
+  struct iovec iovs[STATSD_BATCH_SIZE];
+
+  for (size_t i = 0; i < STATSD_BATCH_SIZE; i++) {
+    /* Leave room for the terminating null byte. */
+    iovs[i] = (struct iovec){
+        .iov_base = buffers + (i * STATSD_BUFFER_SIZE),
+        .iov_len = STATSD_BUFFER_SIZE - 1,
+    };
+    msgs[i] = (struct mmsghdr){
+        .msg_hdr.msg_iov = &iovs[i],
+        .msg_hdr.msg_iovlen = 1,
+    };
+  }
+
+  int status = recvmmsg(fd, msgs, STATSD_BATCH_SIZE, MSG_DONTWAIT, NULL);
+  if (status < 0) {
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+      return;
+
+    ERROR("statsd plugin: recvmmsg(2) failed: %s", STRERRNO);
+    return;
+  }
+
+  pthread_mutex_lock(&shard->lock);
+  for (int i = 0; i < status; i++) {
+    char *buffer = iovs[i].iov_base;
+    buffer[msgs[i].msg_len] = 0;
+    statsd_parse_buffer(shard, buffer);
+  }
+  pthread_mutex_unlock(&shard->lock);
+} /* }}} void statsd_network_read */
+#else
+static void statsd_network_read(statsd_shard_t *shard, int fd, /* {{{ */
+                                char *buffer) {
   size_t buffer_size;
   ssize_t status;
 
-  status = recv(fd, buffer, sizeof(buffer), /* flags = */ MSG_DONTWAIT);
+  status = recv(fd, buffer, STATSD_BUFFER_SIZE - 1, /* flags = */ MSG_DONTWAIT);
   if (status < 0) {
 
     if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
@@ -458,12 +816,13 @@ static void statsd_network_read(int fd) /* {{{ */
   }
 
   buffer_size = (size_t)status;
-  if (buffer_size >= sizeof(buffer))
-    buffer_size = sizeof(buffer) - 1;
   buffer[buffer_size] = 0;
 
-  statsd_parse_buffer(buffer);
+  pthread_mutex_lock(&shard->lock);
+  statsd_parse_buffer(shard, buffer);
+  pthread_mutex_unlock(&shard->lock);
 } /* }}} void statsd_network_read */
+#endif /* HAVE_RECVMMSG */
 
 static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
                                size_t *ret_fds_num) {
@@ -510,6 +869,17 @@ static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
       continue;
     }
 
+#ifdef SO_REUSEPORT
+    /* Every receiver thread binds its own socket, the kernel distributes the
+     * datagrams among them. */
+    if ((conf_receive_threads > 1) &&
+        (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1)) {
+      ERROR("statsd plugin: setsockopt (reuseport): %s", STRERRNO);
+      close(fd);
+      continue;
+    }
+#endif
+
     getnameinfo(ai_ptr->ai_addr, ai_ptr->ai_addrlen, str_node, sizeof(str_node),
                 str_service, sizeof(str_service),
                 NI_DGRAM | NI_NUMERICHOST | NI_NUMERICSERV);
@@ -555,13 +925,25 @@ static int statsd_network_init(struct pollfd **ret_fds, /* {{{ */
 
 static void *statsd_network_thread(void *args) /* {{{ */
 {
+  statsd_shard_t *shard = args;
   struct pollfd *fds = NULL;
   size_t fds_num = 0;
   int status;
 
+#if HAVE_RECVMMSG
+  char *buffers = malloc(STATSD_BATCH_SIZE * STATSD_BUFFER_SIZE);
+#else
+  char *buffers = malloc(STATSD_BUFFER_SIZE);
+#endif
+  if (buffers == NULL) {
+    ERROR("statsd plugin: malloc failed.");
+    pthread_exit((void *)0);
+  }
+
   status = statsd_network_init(&fds, &fds_num);
   if (status != 0) {
     ERROR("statsd plugin: Unable to open listening sockets.");
+    sfree(buffers);
     pthread_exit((void *)0);
   }
 
@@ -580,7 +962,7 @@ static void *statsd_network_thread(void *args) /* {{{ */
       if ((fds[i].revents & (POLLIN | POLLPRI)) == 0)
         continue;
 
-      statsd_network_read(fds[i].fd);
+      statsd_network_read(shard, fds[i].fd, buffers);
       fds[i].revents = 0;
     }
   } /* while (!network_thread_shutdown) */
@@ -589,6 +971,7 @@ static void *statsd_network_thread(void *args) /* {{{ */
   for (size_t i = 0; i < fds_num; i++)
     close(fds[i].fd);
   sfree(fds);
+  sfree(buffers);
 
   return (void *)0;
 } /* }}} void *statsd_network_thread */
@@ -623,6 +1006,52 @@ static int statsd_config_timer_percentile(oconfig_item_t *ci) /* {{{ */
   return 0;
 } /* }}} int statsd_config_timer_percentile */
 
+/* TimerBuckets "linear" <num> <size>
+ * TimerBuckets "exponential" <num> <base> <factor>
+ * TimerBuckets "custom" <boundary> [<boundary> ...] */
+static int statsd_config_timer_buckets(oconfig_item_t *ci) /* {{{ */
+{
+  if ((ci->values_num < 2) || (ci->values[0].type != OCONFIG_TYPE_STRING)) {
+    ERROR("statsd plugin: The \"%s\" option requires a layout name and its "
+          "parameters.",
+          ci->key);
+    return EINVAL;
+  }
+
+  size_t params_num = (size_t)ci->values_num - 1;
+  double params[params_num];
+  for (size_t i = 0; i < params_num; i++) {
+    if (ci->values[i + 1].type != OCONFIG_TYPE_NUMBER) {
+      ERROR("statsd plugin: The parameters of \"%s\" must be numbers.",
+            ci->key);
+      return EINVAL;
+    }
+    params[i] = ci->values[i + 1].value.number;
+  }
+
+  char const *layout = ci->values[0].value.string;
+  distribution_t *dist = NULL;
+  if ((strcasecmp("linear", layout) == 0) && (params_num == 2) &&
+      (params[0] >= 1))
+    dist = distribution_new_linear((size_t)params[0], params[1]);
+  else if ((strcasecmp("exponential", layout) == 0) && (params_num == 3) &&
+           (params[0] >= 1))
+    dist = distribution_new_exponential((size_t)params[0], params[1],
+                                        params[2]);
+  else if (strcasecmp("custom", layout) == 0)
+    dist = distribution_new_custom(params_num, params);
+
+  if (dist == NULL) {
+    ERROR("statsd plugin: Invalid bucket layout in the \"%s\" option.",
+          ci->key);
+    return EINVAL;
+  }
+
+  distribution_destroy(conf_timer_layout);
+  conf_timer_layout = dist;
+  return 0;
+} /* }}} int statsd_config_timer_buckets */
+
 static int statsd_config(oconfig_item_t *ci) /* {{{ */
 {
   for (int i = 0; i < ci->children_num; i++) {
@@ -632,6 +1061,8 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
       cf_util_get_string(child, &conf_node);
     else if (strcasecmp("Port", child->key) == 0)
       cf_util_get_service(child, &conf_service);
+    else if (strcasecmp("ReceiveThreads", child->key) == 0)
+      cf_util_get_int(child, &conf_receive_threads);
     else if (strcasecmp("DeleteCounters", child->key) == 0)
       cf_util_get_boolean(child, &conf_delete_counters);
     else if (strcasecmp("DeleteTimers", child->key) == 0)
@@ -650,6 +1081,23 @@ static int statsd_config(oconfig_item_t *ci) /* {{{ */
       cf_util_get_boolean(child, &conf_timer_sum);
     else if (strcasecmp("TimerCount", child->key) == 0)
       cf_util_get_boolean(child, &conf_timer_count);
+    else if (strcasecmp("TimerDistribution", child->key) == 0)
+      cf_util_get_boolean(child, &conf_timer_distribution);
+    else if (strcasecmp("TimerBuckets", child->key) == 0)
+      statsd_config_timer_buckets(child);
+    else if (strcasecmp("SetPrecision", child->key) == 0) {
+      if ((cf_util_get_int(child, &conf_set_precision) == 0) &&
+          (conf_set_precision != 0) &&
+          ((conf_set_precision < HLL_PRECISION_MIN) ||
+           (conf_set_precision > HLL_PRECISION_MAX))) {
+        WARNING("statsd plugin: SetPrecision must be between %d and %d.",
+                HLL_PRECISION_MIN, HLL_PRECISION_MAX);
+        conf_set_precision = 0;
+      }
+    } else if (strcasecmp("SetExactLimit", child->key) == 0)
+      cf_util_get_int(child, &conf_set_exact_limit);
+    else if (strcasecmp("MaxTagSets", child->key) == 0)
+      cf_util_get_int(child, &conf_max_tag_sets);
     else if (strcasecmp("TimerPercentile", child->key) == 0)
       statsd_config_timer_percentile(child);
     else
@@ -665,26 +1113,168 @@ static int statsd_init(void) /* {{{ */
   pthread_mutex_lock(&metrics_lock);
   if (metrics_tree == NULL)
     metrics_tree = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (tag_sets_tree == NULL)
+    tag_sets_tree = c_avl_create((int (*)(const void *, const void *))strcmp);
 
-  if (!network_thread_running) {
-    int status;
+  if (conf_timer_distribution && (conf_timer_layout == NULL)) {
+    /* 100us to about 26s */
+    conf_timer_layout = distribution_new_exponential(20, 2.0, 0.0001);
+    if (conf_timer_layout == NULL) {
+      pthread_mutex_unlock(&metrics_lock);
+      ERROR("statsd plugin: distribution_new_exponential failed.");
+      return ENOMEM;
+    }
+  }
+
+  if (shards == NULL) {
+    if (conf_receive_threads < 1)
+      conf_receive_threads = 1;
+#ifndef SO_REUSEPORT
+    if (conf_receive_threads > 1) {
+      WARNING("statsd plugin: SO_REUSEPORT is not available, using a single "
+              "receiver thread.");
+      conf_receive_threads = 1;
+    }
+#endif
+
+    shards = calloc((size_t)conf_receive_threads, sizeof(*shards));
+    if (shards == NULL) {
+      pthread_mutex_unlock(&metrics_lock);
+      ERROR("statsd plugin: calloc failed.");
+      return ENOMEM;
+    }
+    shards_num = (size_t)conf_receive_threads;
 
-    status = pthread_create(&network_thread,
-                            /* attr = */ NULL, statsd_network_thread,
-                            /* args = */ NULL);
+    for (size_t i = 0; i < shards_num; i++) {
+      shards[i].tree =
+          c_avl_create((int (*)(const void *, const void *))strcmp);
+      pthread_mutex_init(&shards[i].lock, /* attr = */ NULL);
+    }
+  }
+
+  for (size_t i = 0; i < shards_num; i++) {
+    if (shards[i].thread_running)
+      continue;
+
+    int status = plugin_thread_create(&shards[i].thread, statsd_network_thread,
+                                      &shards[i], "statsd recv");
     if (status != 0) {
       pthread_mutex_unlock(&metrics_lock);
       ERROR("statsd plugin: pthread_create failed: %s", STRERRNO);
       return status;
     }
+    shards[i].thread_running = true;
   }
-  network_thread_running = true;
 
   pthread_mutex_unlock(&metrics_lock);
 
   return 0;
 } /* }}} int statsd_init */
 
+/* Moves the metric "src", received by a shard, into metrics_tree. "key" and
+ * "src" are owned by this function afterwards.
+ * Must hold metrics_lock when calling this function. */
+static void statsd_metric_merge_unsafe(char *key, /* {{{ */
+                                       statsd_metric_t *src) {
+  statsd_metric_t *dst = NULL;
+
+  if (c_avl_get(metrics_tree, key, (void *)&dst) != 0) {
+    /* The tag set has been added by the receiver thread already, unless the
+     * metric was deleted by statsd_read() in the meantime. */
+    if ((src->labels.num > 0) &&
+        (statsd_tag_set_add(key, src->name_len) != 0)) {
+      sfree(key);
+      statsd_metric_free(src);
+      return;
+    }
+
+    src->gauge_set = false;
+    if (c_avl_insert(metrics_tree, key, src) != 0) {
+      ERROR("statsd plugin: c_avl_insert failed.");
+      sfree(key);
+      statsd_metric_free(src);
+    }
+    return;
+  }
+  sfree(key);
+
+  switch (src->type) {
+  case STATSD_COUNTER:
+    dst->value += src->value;
+    break;
+  case STATSD_GAUGE:
+    if (src->gauge_set)
+      dst->value = src->value;
+    else
+      dst->value += src->value;
+    break;
+  case STATSD_TIMER:
+    if (dst->latency == NULL) {
+      dst->latency = src->latency;
+      src->latency = NULL;
+    } else if (src->latency != NULL) {
+      latency_counter_merge(dst->latency, src->latency);
+    }
+
+    if (dst->distribution == NULL) {
+      dst->distribution = src->distribution;
+      src->distribution = NULL;
+    } else if (src->distribution != NULL) {
+      distribution_add(dst->distribution, src->distribution);
+    }
+    break;
+  case STATSD_SET:
+    if ((dst->hll == NULL) && (src->hll != NULL)) {
+      /* Add the exact members of "dst" to the estimator of "src". */
+      hll_t *hll = src->hll;
+      src->hll = NULL;
+      c_avl_tree_t *set = dst->set;
+      dst->set = src->set;
+      src->set = set;
+      dst->hll = hll;
+      if (src->set == NULL)
+        break;
+    }
+
+    if (dst->hll != NULL) {
+      if (src->hll != NULL)
+        hll_merge(dst->hll, src->hll);
+
+      char *set_key;
+      void *value;
+      while ((src->set != NULL) &&
+             (c_avl_pick(src->set, (void *)&set_key, &value) == 0)) {
+        hll_add(dst->hll, set_key);
+        sfree(set_key);
+      }
+      break;
+    }
+
+    if (dst->set == NULL) {
+      dst->set = src->set;
+      src->set = NULL;
+      break;
+    }
+    if (src->set == NULL)
+      break;
+
+    char *set_key;
+    void *value;
+    while (c_avl_pick(src->set, (void *)&set_key, &value) == 0) {
+      if (c_avl_insert(dst->set, set_key, /* value = */ NULL) != 0)
+        sfree(set_key);
+    }
+
+    if ((conf_set_precision > 0) &&
+        (c_avl_size(dst->set) > conf_set_exact_limit))
+      statsd_set_promote(dst);
+    break;
+  }
+
+  dst->updates_num += src->updates_num;
+  statsd_metric_free(src);
+} /* }}} void statsd_metric_merge_unsafe */
+
 /* Must hold metrics_lock when calling this function. */
 static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
 {
@@ -694,6 +1284,10 @@ static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
   if ((metric == NULL) || (metric->type != STATSD_SET))
     return EINVAL;
 
+  /* Start over in exact mode, the set may be small in the next interval. */
+  hll_destroy(metric->hll);
+  metric->hll = NULL;
+
   if (metric->set == NULL)
     return 0;
 
@@ -705,12 +1299,62 @@ static int statsd_metric_clear_set_unsafe(statsd_metric_t *metric) /* {{{ */
   return 0;
 } /* }}} int statsd_metric_clear_set_unsafe */
 
+/* Dispatches "vl" with the labels of "metric". Metrics without tags use the
+ * legacy path, tagged metrics are converted the same way and extended by
+ * their labels. */
+static int statsd_dispatch_values(value_list_t const *vl, /* {{{ */
+                                  statsd_metric_t const *metric) {
+  if (metric->labels.num == 0)
+    return plugin_dispatch_values(vl);
+
+  data_set_t const *ds = plugin_get_ds(vl->type);
+  if (ds == NULL)
+    return EINVAL;
+
+  metric_family_t *fam = plugin_value_list_to_metric_family(vl, ds, 0);
+  if (fam == NULL)
+    return errno;
+
+  int status = 0;
+  metric_t *m = fam->metric.ptr;
+  for (size_t i = 0; (status == 0) && (i < metric->labels.num); i++) {
+    label_pair_t const *l = metric->labels.ptr + i;
+    /* Tags must not replace the labels identifying the metric. */
+    if (metric_label_get(m, l->name) == NULL)
+      status = metric_label_set(m, l->name, l->value);
+  }
+
+  if (status == 0)
+    status = plugin_dispatch_metric_family(fam);
+
+  metric_family_free(fam);
+  return status;
+} /* }}} int statsd_dispatch_values */
+
 /* Must hold metrics_lock when calling this function. */
-static int statsd_metric_submit_unsafe(char const *name,
-                                       statsd_metric_t *metric) /* {{{ */
-{
+static int statsd_metric_submit_unsafe(char const *name, /* {{{ */
+                                       statsd_metric_t *metric,
+                                       metric_family_t *fam_timer) {
   value_list_t vl = VALUE_LIST_INIT;
 
+  if ((metric->type == STATSD_TIMER) && conf_timer_distribution) {
+    if (metric->distribution == NULL)
+      return 0;
+
+    metric_t m = {
+        .value.distribution = metric->distribution,
+    };
+    int status = label_set_clone(&m.label, metric->labels);
+    if (status == 0)
+      status = metric_label_set(&m, "timer", name);
+    /* metric_family_metric_append() stores a copy of the distribution. */
+    if (status == 0)
+      status = metric_family_metric_append(fam_timer, m);
+    m.value.distribution = NULL;
+    metric_reset(&m);
+    return status;
+  }
+
   vl.values = &(value_t){.gauge = NAN};
   vl.values_len = 1;
   sstrncpy(vl.plugin, "statsd", sizeof(vl.plugin));
@@ -739,7 +1383,7 @@ static int statsd_metric_submit_unsafe(char const *name,
         have_events
             ? CDTIME_T_TO_DOUBLE(latency_counter_get_average(metric->latency))
             : NAN;
-    plugin_dispatch_values(&vl);
+    statsd_dispatch_values(&vl, metric);
 
     if (conf_timer_lower) {
       snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-lower", name);
@@ -747,7 +1391,7 @@ static int statsd_metric_submit_unsafe(char const *name,
           have_events
               ? CDTIME_T_TO_DOUBLE(latency_counter_get_min(metric->latency))
               : NAN;
-      plugin_dispatch_values(&vl);
+      statsd_dispatch_values(&vl, metric);
     }
 
     if (conf_timer_upper) {
@@ -756,7 +1400,7 @@ static int statsd_metric_submit_unsafe(char const *name,
           have_events
               ? CDTIME_T_TO_DOUBLE(latency_counter_get_max(metric->latency))
               : NAN;
-      plugin_dispatch_values(&vl);
+      statsd_dispatch_values(&vl, metric);
     }
 
     if (conf_timer_sum) {
@@ -765,7 +1409,7 @@ static int statsd_metric_submit_unsafe(char const *name,
           have_events
               ? CDTIME_T_TO_DOUBLE(latency_counter_get_sum(metric->latency))
               : NAN;
-      plugin_dispatch_values(&vl);
+      statsd_dispatch_values(&vl, metric);
     }
 
     for (size_t i = 0; i < conf_timer_percentile_num; i++) {
@@ -775,7 +1419,7 @@ static int statsd_metric_submit_unsafe(char const *name,
           have_events ? CDTIME_T_TO_DOUBLE(latency_counter_get_percentile(
                             metric->latency, conf_timer_percentile[i]))
                       : NAN;
-      plugin_dispatch_values(&vl);
+      statsd_dispatch_values(&vl, metric);
     }
 
     /* Keep this at the end, since vl.type is set to "gauge" here. The
@@ -784,13 +1428,15 @@ static int statsd_metric_submit_unsafe(char const *name,
       sstrncpy(vl.type, "gauge", sizeof(vl.type));
       snprintf(vl.type_instance, sizeof(vl.type_instance), "%s-count", name);
       vl.values[0].gauge = latency_counter_get_num(metric->latency);
-      plugin_dispatch_values(&vl);
+      statsd_dispatch_values(&vl, metric);
     }
 
     latency_counter_reset(metric->latency);
     return 0;
   } else if (metric->type == STATSD_SET) {
-    if (metric->set == NULL)
+    if (metric->hll != NULL)
+      vl.values[0].gauge = nearbyint(hll_count(metric->hll));
+    else if (metric->set == NULL)
       vl.values[0].gauge = 0.0;
     else
       vl.values[0].gauge = (gauge_t)c_avl_size(metric->set);
@@ -804,7 +1450,7 @@ static int statsd_metric_submit_unsafe(char const *name,
     if (conf_counter_sum) {
       sstrncpy(vl.type, "count", sizeof(vl.type));
       vl.values[0].gauge = delta;
-      plugin_dispatch_values(&vl);
+      statsd_dispatch_values(&vl, metric);
 
       /* restore vl.type */
       sstrncpy(vl.type, "derive", sizeof(vl.type));
@@ -818,7 +1464,7 @@ static int statsd_metric_submit_unsafe(char const *name,
     vl.values[0].derive = metric->counter;
   }
 
-  return plugin_dispatch_values(&vl);
+  return statsd_dispatch_values(&vl, metric);
 } /* }}} int statsd_metric_submit_unsafe */
 
 static int statsd_read(void) /* {{{ */
@@ -827,6 +1473,11 @@ static int statsd_read(void) /* {{{ */
   char *name;
   statsd_metric_t *metric;
 
+  metric_family_t fam_timer = {
+      .name = "statsd_timer_seconds",
+      .type = METRIC_TYPE_DISTRIBUTION,
+  };
+
   char **to_be_deleted = NULL;
   size_t to_be_deleted_num = 0;
 
@@ -837,6 +1488,16 @@ static int statsd_read(void) /* {{{ */
     return 0;
   }
 
+  for (size_t i = 0; i < shards_num; i++) {
+    void *key;
+    void *value;
+
+    pthread_mutex_lock(&shards[i].lock);
+    while (c_avl_pick(shards[i].tree, &key, &value) == 0)
+      statsd_metric_merge_unsafe(key, value);
+    pthread_mutex_unlock(&shards[i].lock);
+  }
+
   iter = c_avl_get_iterator(metrics_tree);
   while (c_avl_iterator_next(iter, (void *)&name, (void *)&metric) == 0) {
     if ((metric->updates_num == 0) &&
@@ -850,8 +1511,17 @@ static int statsd_read(void) /* {{{ */
     }
 
     /* Names have a prefix, e.g. "c:", which determines the (statsd) type.
-     * Remove this here. */
-    statsd_metric_submit_unsafe(name + 2, metric);
+     * Remove this here, as well as the tags. */
+    if (metric->labels.num > 0) {
+      char untagged[DATA_MAX_NAME_LEN];
+      size_t len = (metric->name_len < sizeof(untagged))
+                       ? metric->name_len + 1
+                       : sizeof(untagged);
+      sstrncpy(untagged, name + 2, len);
+      statsd_metric_submit_unsafe(untagged, metric, &fam_timer);
+    } else {
+      statsd_metric_submit_unsafe(name + 2, metric, &fam_timer);
+    }
 
     /* Reset the metric. */
     metric->updates_num = 0;
@@ -871,6 +1541,9 @@ static int statsd_read(void) /* {{{ */
       continue;
     }
 
+    if (metric->labels.num > 0)
+      statsd_tag_set_remove(name, metric->name_len);
+
     sfree(name);
     statsd_metric_free(metric);
   }
@@ -879,6 +1552,14 @@ static int statsd_read(void) /* {{{ */
 
   strarray_free(to_be_deleted, to_be_deleted_num);
 
+  if (fam_timer.metric.num > 0) {
+    int status = plugin_dispatch_metric_family(&fam_timer);
+    if (status != 0)
+      ERROR("statsd plugin: plugin_dispatch_metric_family failed: %s",
+            STRERROR(status));
+  }
+  metric_family_metric_reset(&fam_timer);
+
   return 0;
 } /* }}} int statsd_read */
 
@@ -887,15 +1568,29 @@ static int statsd_shutdown(void) /* {{{ */
   void *key;
   void *value;
 
-  if (network_thread_running) {
-    network_thread_shutdown = true;
-    pthread_kill(network_thread, SIGTERM);
-    pthread_join(network_thread, /* retval = */ NULL);
+  network_thread_shutdown = true;
+  for (size_t i = 0; i < shards_num; i++) {
+    if (!shards[i].thread_running)
+      continue;
+
+    pthread_kill(shards[i].thread, SIGTERM);
+    pthread_join(shards[i].thread, /* retval = */ NULL);
+    shards[i].thread_running = false;
   }
-  network_thread_running = false;
 
   pthread_mutex_lock(&metrics_lock);
 
+  for (size_t i = 0; i < shards_num; i++) {
+    while (c_avl_pick(shards[i].tree, &key, &value) == 0) {
+      sfree(key);
+      statsd_metric_free(value);
+    }
+    c_avl_destroy(shards[i].tree);
+    pthread_mutex_destroy(&shards[i].lock);
+  }
+  sfree(shards);
+  shards_num = 0;
+
   while (c_avl_pick(metrics_tree, &key, &value) == 0) {
     sfree(key);
     statsd_metric_free(value);
@@ -903,9 +1598,27 @@ static int statsd_shutdown(void) /* {{{ */
   c_avl_destroy(metrics_tree);
   metrics_tree = NULL;
 
+  pthread_mutex_lock(&tag_sets_lock);
+  while (c_avl_pick(tag_sets_tree, &key, &value) == 0) {
+    c_avl_tree_t *keys = value;
+    void *tag_set_key;
+    void *tag_set_value;
+
+    while (c_avl_pick(keys, &tag_set_key, &tag_set_value) == 0)
+      sfree(tag_set_key);
+    c_avl_destroy(keys);
+    sfree(key);
+  }
+  c_avl_destroy(tag_sets_tree);
+  tag_sets_tree = NULL;
+  pthread_mutex_unlock(&tag_sets_lock);
+
   sfree(conf_node);
   sfree(conf_service);
 
+  distribution_destroy(conf_timer_layout);
+  conf_timer_layout = NULL;
+
   pthread_mutex_unlock(&metrics_lock);
 
   return 0;
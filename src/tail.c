@@ -211,6 +211,7 @@ static int ctail_config_add_file(oconfig_item_t *ci) {
   cdtime_t interval = 0;
   char *plugin_name = NULL;
   char *plugin_instance = NULL;
+  char *state_file = NULL;
   int num_matches = 0;
 
   if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING)) {
@@ -235,6 +236,8 @@ static int ctail_config_add_file(oconfig_item_t *ci) {
       status = cf_util_get_string(option, &plugin_instance);
     else if (strcasecmp("Interval", option->key) == 0)
       cf_util_get_cdtime(option, &interval);
+    else if (strcasecmp("StateFile", option->key) == 0)
+      status = cf_util_get_string(option, &state_file);
     else if (strcasecmp("Match", option->key) == 0) {
       status = ctail_config_add_match(tm, plugin_name, plugin_instance, option);
       if (status == 0)
@@ -255,10 +258,22 @@ static int ctail_config_add_file(oconfig_item_t *ci) {
   if (num_matches == 0) {
     ERROR("tail plugin: No (valid) matches found for file `%s'.",
           ci->values[0].value.string);
+    sfree(state_file);
     tail_match_destroy(tm);
     return -1;
   }
 
+  if (state_file != NULL) {
+    int status = tail_match_set_state_file(tm, state_file);
+    sfree(state_file);
+    if (status != 0) {
+      ERROR("tail plugin: Setting the state file for `%s' failed.",
+            ci->values[0].value.string);
+      tail_match_destroy(tm);
+      return -1;
+    }
+  }
+
   char str[255];
   snprintf(str, sizeof(str), "tail-%zu", tail_file_num++);
 
@@ -24,35 +24,59 @@
  *   Florian octo Forster <octo at collectd.org>
  **/
 
+/* _GNU_SOURCE is needed for fopencookie(3) and pipe2(2) */
+#define _GNU_SOURCE
+
 #include "collectd.h"
 
 #include "plugin.h"
 #include "utils/common/common.h"
 
+#include "utils/avltree/avltree.h"
 #include "utils/cmds/flush.h"
 #include "utils/cmds/getthreshold.h"
+#include "utils/cmds/getrange.h"
 #include "utils/cmds/getval.h"
 #include "utils/cmds/listval.h"
+#include "utils/cmds/putmetric.h"
 #include "utils/cmds/putnotif.h"
 #include "utils/cmds/putval.h"
 
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 
+#include <fcntl.h>
 #include <grp.h>
+#include <poll.h>
 
 #ifndef UNIX_PATH_MAX
 #define UNIX_PATH_MAX sizeof(((struct sockaddr_un *)0)->sun_path)
 #endif
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 #define US_DEFAULT_PATH LOCALSTATEDIR "/run/" PACKAGE_NAME "-unixsock"
 
+#define US_READ_SIZE 65536
+/* Longer lines are rejected and the connection is closed. */
+#define US_MAX_LINE_SIZE (1024 * 1024)
+/* Reading from a client is suspended while this much output is pending, and
+ * commands running in their own thread wait until the client has read it. */
+#define US_MAX_OUTPUT_SIZE (1024 * 1024)
+/* Clients which do not read their replies for this long are disconnected. */
+#ifndef US_WRITE_TIMEOUT
+#define US_WRITE_TIMEOUT TIME_T_TO_CDTIME_T(60)
+#endif
+
 /*
  * Private variables
  */
 /* valid configuration file keys */
 static const char *config_keys[] = {"SocketFile", "SocketGroup", "SocketPerms",
-                                    "DeleteSocket"};
+                                    "DeleteSocket", "WorkerThreads"};
 static int config_keys_num = STATIC_ARRAY_SIZE(config_keys);
 
 static int loop;
@@ -66,6 +90,56 @@ static bool delete_socket;
 
 static pthread_t listen_thread = (pthread_t)0;
 
+/* PUTVAL and PUTMETRIC commands received between "BATCH BEGIN" and
+ * "BATCH END", grouped by metric family. */
+typedef struct {
+  c_avl_tree_t *families;
+  size_t commands_num;
+  size_t failed_num;
+  char error[256];
+} us_batch_t;
+
+typedef struct {
+  int fd;
+  char *in;
+  size_t in_len;
+  size_t in_size;
+  bool eof;
+  us_batch_t *batch;
+
+  /* The output buffer is shared with the command thread. */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char *out;
+  size_t out_len;
+  size_t out_size;
+  bool failed;
+
+  /* Command running in its own thread. No further input is handled until it
+   * is done, so that the replies are sent in order. */
+  bool busy;
+  bool job_done;
+  pthread_t job_thread;
+  char *job_line;
+  int wake_fd;
+} us_client_t;
+
+/* Every worker thread polls a fixed set of clients. New connections are
+ * passed from the listening thread through a pipe. Command threads write to
+ * the wake pipe when they have produced output or are done. */
+typedef struct {
+  pthread_t thread;
+  bool thread_running;
+  int pipe_fd[2];
+  int wake_fd[2];
+  us_client_t **clients;
+  size_t clients_num;
+} us_worker_t;
+
+static us_worker_t *workers;
+static size_t workers_num;
+static int conf_worker_threads = 2;
+
 /*
  * Functions
  */
@@ -158,122 +232,677 @@ static int us_open_socket(void) {
   return 0;
 } /* int us_open_socket */
 
-static void *us_handle_client(void *arg) {
-  int fdin;
-  int fdout;
-  FILE *fhin, *fhout;
+static int us_buffer_reserve(char **buffer, size_t *size, /* {{{ */
+                             size_t need) {
+  if (*size >= need)
+    return 0;
 
-  fdin = *((int *)arg);
-  free(arg);
-  arg = NULL;
+  size_t new_size = (*size == 0) ? US_READ_SIZE : *size;
+  while (new_size < need)
+    new_size *= 2;
 
-  DEBUG("unixsock plugin: us_handle_client: Reading from fd #%i", fdin);
+  char *tmp = realloc(*buffer, new_size);
+  if (tmp == NULL)
+    return ENOMEM;
 
-  fdout = dup(fdin);
-  if (fdout < 0) {
-    ERROR("unixsock plugin: dup failed: %s", STRERRNO);
-    close(fdin);
-    pthread_exit((void *)1);
+  *buffer = tmp;
+  *size = new_size;
+  return 0;
+} /* }}} int us_buffer_reserve */
+
+static void us_batch_error(void *ud, cmd_status_t status, /* {{{ */
+                           const char *format, va_list ap) {
+  us_batch_t *batch = ud;
+
+  if (status == CMD_OK)
+    return;
+
+  /* Only the first error is reported to the client. */
+  if (batch->error[0] == 0)
+    vsnprintf(batch->error, sizeof(batch->error), format, ap);
+} /* }}} void us_batch_error */
+
+static us_batch_t *us_batch_create(void) /* {{{ */
+{
+  us_batch_t *batch = calloc(1, sizeof(*batch));
+  if (batch == NULL)
+    return NULL;
+
+  batch->families = c_avl_create((int (*)(const void *, const void *))strcmp);
+  if (batch->families == NULL) {
+    sfree(batch);
+    return NULL;
   }
 
-  fhin = fdopen(fdin, "r");
-  if (fhin == NULL) {
-    ERROR("unixsock plugin: fdopen failed: %s", STRERRNO);
-    close(fdin);
-    close(fdout);
-    pthread_exit((void *)1);
-    return (void *)1;
+  return batch;
+} /* }}} us_batch_t *us_batch_create */
+
+static void us_batch_destroy(us_batch_t *batch) /* {{{ */
+{
+  if (batch == NULL)
+    return;
+
+  void *key;
+  metric_family_t *fam;
+  while (c_avl_pick(batch->families, &key, (void *)&fam) == 0)
+    metric_family_free(fam);
+  c_avl_destroy(batch->families);
+
+  sfree(batch);
+} /* }}} void us_batch_destroy */
+
+/* Adds the metrics of "fam" to the family of the same name in the batch. */
+static int us_batch_append(us_batch_t *batch, /* {{{ */
+                           metric_family_t const *fam) {
+  metric_family_t *group = NULL;
+
+  if (c_avl_get(batch->families, fam->name, (void *)&group) != 0) {
+    group = metric_family_clone(fam);
+    if (group == NULL)
+      return errno;
+
+    /* The key is owned by the family. */
+    int status = c_avl_insert(batch->families, group->name, group);
+    if (status != 0) {
+      metric_family_free(group);
+      return status;
+    }
+    return 0;
   }
 
-  fhout = fdopen(fdout, "w");
-  if (fhout == NULL) {
-    ERROR("unixsock plugin: fdopen failed: %s", STRERRNO);
-    fclose(fhin); /* this closes fdin as well */
-    close(fdout);
-    pthread_exit((void *)1);
-    return (void *)1;
+  if (group->type != fam->type) {
+    snprintf(batch->error, sizeof(batch->error),
+             "Metric family \"%s\" has conflicting types.", fam->name);
+    return EINVAL;
   }
 
-  /* change output buffer to line buffered mode */
-  if (setvbuf(fhout, NULL, _IOLBF, 0) != 0) {
-    ERROR("unixsock plugin: setvbuf failed: %s", STRERRNO);
-    fclose(fhin);
-    fclose(fhout);
-    pthread_exit((void *)1);
-    return (void *)0;
+  for (size_t i = 0; i < fam->metric.num; i++) {
+    int status = metric_family_metric_append(group, fam->metric.ptr[i]);
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+} /* }}} int us_batch_append */
+
+static void us_batch_add(us_batch_t *batch, char *line) /* {{{ */
+{
+  cmd_error_handler_t err = {us_batch_error, batch};
+  cmd_t cmd = {0};
+  int status;
+
+  batch->commands_num++;
+
+  if (cmd_parse(line, &cmd, NULL, &err) != CMD_OK) {
+    batch->failed_num++;
+    return;
+  }
+
+  if (cmd.type == CMD_PUTVAL) {
+    status = 0;
+    for (size_t i = 0; (status == 0) && (i < cmd.cmd.putval.vl_num); i++) {
+      value_list_t const *vl = cmd.cmd.putval.vl + i;
+      data_set_t const *ds = plugin_get_ds(vl->type);
+      if (ds == NULL) {
+        status = EINVAL;
+        break;
+      }
+
+      for (size_t j = 0; (status == 0) && (j < ds->ds_num); j++) {
+        metric_family_t *fam = plugin_value_list_to_metric_family(vl, ds, j);
+        if (fam == NULL) {
+          status = errno;
+          break;
+        }
+        status = us_batch_append(batch, fam);
+        metric_family_free(fam);
+      }
+    }
+  } else if (cmd.type == CMD_PUTMETRIC) {
+    status = us_batch_append(batch, cmd.cmd.putmetric.family);
+  } else {
+    cmd_error(CMD_ERROR, &err, "Unexpected command in batch: `%s'.",
+              CMD_TO_STRING(cmd.type));
+    status = EINVAL;
+  }
+
+  if (status != 0) {
+    if (batch->error[0] == 0)
+      snprintf(batch->error, sizeof(batch->error), "%s", STRERROR(status));
+    batch->failed_num++;
+  }
+
+  cmd_destroy(&cmd);
+} /* }}} void us_batch_add */
+
+/* Dispatches all metrics of the batch, grouped by family, and writes a single
+ * reply for the whole batch. */
+static void us_batch_finish(us_batch_t *batch, FILE *fh) /* {{{ */
+{
+  size_t metrics_num = 0;
+  int status = 0;
+
+  void *key;
+  metric_family_t *fam;
+  while (c_avl_pick(batch->families, &key, (void *)&fam) == 0) {
+    metrics_num += fam->metric.num;
+    int tmp = plugin_dispatch_metric_family(fam);
+    if (tmp != 0)
+      status = tmp;
+    metric_family_free(fam);
+  }
+
+  if (batch->failed_num > 0)
+    fprintf(fh, "-1 %zu of %zu commands failed: %s\n", batch->failed_num,
+            batch->commands_num, batch->error);
+  else if (status != 0)
+    fprintf(fh, "-1 Dispatching %zu metrics failed: %s\n", metrics_num,
+            STRERROR(status));
+  else
+    fprintf(fh, "0 Success: %zu commands, %zu %s been dispatched.\n",
+            batch->commands_num, metrics_num,
+            (metrics_num == 1) ? "metric has" : "metrics have");
+} /* }}} void us_batch_finish */
+
+static bool us_command_is(char const *line, size_t len, /* {{{ */
+                          char const *command) {
+  return (strlen(command) == len) && (strncasecmp(line, command, len) == 0);
+} /* }}} bool us_command_is */
+
+static void us_handle_command(us_client_t *client, FILE *fh, /* {{{ */
+                              char *line) {
+  size_t len = strcspn(line, " \t");
+
+  if (us_command_is(line, len, "batch")) {
+    char *arg = line + len + strspn(line + len, " \t");
+    if ((client->batch == NULL) && (strcasecmp("begin", arg) == 0)) {
+      client->batch = us_batch_create();
+      if (client->batch == NULL)
+        fprintf(fh, "-1 Internal error\n");
+    } else if ((client->batch != NULL) && (strcasecmp("end", arg) == 0)) {
+      us_batch_finish(client->batch, fh);
+      us_batch_destroy(client->batch);
+      client->batch = NULL;
+    } else {
+      fprintf(fh, "-1 Invalid batch command: %s\n", arg);
+    }
+    return;
+  }
+
+  if (client->batch != NULL) {
+    us_batch_add(client->batch, line);
+    return;
+  }
+
+  if (us_command_is(line, len, "getval")) {
+    cmd_handle_getval(fh, line);
+  } else if (us_command_is(line, len, "getrange")) {
+    cmd_handle_getrange(fh, line);
+  } else if (us_command_is(line, len, "getthreshold")) {
+    handle_getthreshold(fh, line);
+  } else if (us_command_is(line, len, "putval")) {
+    cmd_handle_putval(fh, line);
+  } else if (us_command_is(line, len, "putmetric")) {
+    cmd_handle_putmetric(fh, line);
+  } else if (us_command_is(line, len, "listval")) {
+    cmd_handle_listval(fh, line);
+  } else if (us_command_is(line, len, "putnotif")) {
+    handle_putnotif(fh, line);
+  } else if (us_command_is(line, len, "flush")) {
+    cmd_handle_flush(fh, line);
+  } else {
+    fprintf(fh, "-1 Unknown command: %.*s\n", (int)len, line);
+  }
+} /* }}} void us_handle_command */
+
+/* Commands which may block or produce a lot of output are run in their own
+ * thread, so that they neither stall the other clients of the worker nor
+ * have to keep their whole reply in memory. */
+static bool us_command_is_job(char const *line, size_t len) /* {{{ */
+{
+  return us_command_is(line, len, "flush") ||
+         us_command_is(line, len, "getrange") ||
+         us_command_is(line, len, "getval") ||
+         us_command_is(line, len, "listval");
+} /* }}} bool us_command_is_job */
+
+static void us_worker_wake(int fd) /* {{{ */
+{
+  char c = 0;
+  /* The pipe is non-blocking: if it is full, the worker is awake anyway. */
+  if (write(fd, &c, sizeof(c)) < 0 && (errno != EAGAIN) &&
+      (errno != EWOULDBLOCK))
+    ERROR("unixsock plugin: waking the worker failed: %s", STRERRNO);
+} /* }}} void us_worker_wake */
+
+/* Marks the connection as broken. Pending and further output is dropped.
+ * The caller must hold client->lock. */
+static void us_client_fail(us_client_t *client) /* {{{ */
+{
+  client->failed = true;
+  client->out_len = 0;
+  pthread_cond_broadcast(&client->cond);
+} /* }}} void us_client_fail */
+
+/* Appends to the output buffer. The caller must hold client->lock. */
+static ssize_t us_client_append(us_client_t *client, /* {{{ */
+                                char const *buf, size_t size) {
+  if (client->failed) {
+    errno = EPIPE;
+    return -1;
+  }
+
+  if (us_buffer_reserve(&client->out, &client->out_size,
+                        client->out_len + size) != 0) {
+    ERROR("unixsock plugin: Allocating the output buffer failed.");
+    us_client_fail(client);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  memcpy(client->out + client->out_len, buf, size);
+  client->out_len += size;
+  return (ssize_t)size;
+} /* }}} ssize_t us_client_append */
+
+/* Stream of the commands handled by the worker itself. Their replies are
+ * short and reading input is suspended while the buffer is full. */
+static ssize_t us_stream_write(void *cookie, char const *buf, /* {{{ */
+                               size_t size) {
+  us_client_t *client = cookie;
+
+  pthread_mutex_lock(&client->lock);
+  ssize_t status = us_client_append(client, buf, size);
+  pthread_mutex_unlock(&client->lock);
+
+  return status;
+} /* }}} ssize_t us_stream_write */
+
+/* Stream of a command thread. Writing blocks while the output buffer is full,
+ * until the worker has sent enough of it to the client. */
+static ssize_t us_job_stream_write(void *cookie, char const *buf, /* {{{ */
+                                   size_t size) {
+  us_client_t *client = cookie;
+  struct timespec deadline = CDTIME_T_TO_TIMESPEC(cdtime() + US_WRITE_TIMEOUT);
+
+  pthread_mutex_lock(&client->lock);
+  while (!client->failed && (client->out_len >= US_MAX_OUTPUT_SIZE)) {
+    if (pthread_cond_timedwait(&client->cond, &client->lock, &deadline) ==
+        ETIMEDOUT) {
+      WARNING("unixsock plugin: Client on socket #%i does not read its "
+              "replies, closing the connection.",
+              client->fd);
+      us_client_fail(client);
+    }
+  }
+
+  /* The worker only polls for output when there is some. */
+  bool wake = (client->out_len == 0);
+  ssize_t status = us_client_append(client, buf, size);
+  pthread_mutex_unlock(&client->lock);
+
+  if (wake && (status > 0))
+    us_worker_wake(client->wake_fd);
+
+  return status;
+} /* }}} ssize_t us_job_stream_write */
+
+static void *us_job_thread(void *arg) /* {{{ */
+{
+  us_client_t *client = arg;
+
+  FILE *fh = fopencookie(client, "w",
+                         (cookie_io_functions_t){.write = us_job_stream_write});
+  if (fh != NULL) {
+    us_handle_command(client, fh, client->job_line);
+    fclose(fh);
+  } else {
+    ERROR("unixsock plugin: fopencookie failed: %s", STRERRNO);
   }
 
+  pthread_mutex_lock(&client->lock);
+  /* Without a reply the following ones would be misattributed. */
+  if (fh == NULL)
+    us_client_fail(client);
+  client->job_done = true;
+  pthread_mutex_unlock(&client->lock);
+
+  us_worker_wake(client->wake_fd);
+  return (void *)0;
+} /* }}} void *us_job_thread */
+
+static int us_job_start(us_client_t *client, char const *line) /* {{{ */
+{
+  client->job_line = strdup(line);
+  if (client->job_line == NULL)
+    return ENOMEM;
+
+  client->job_done = false;
+  int status = plugin_thread_create(&client->job_thread, us_job_thread,
+                                    client, "unixsock cmd");
+  if (status != 0) {
+    ERROR("unixsock plugin: pthread_create failed: %s", STRERRNO);
+    sfree(client->job_line);
+    return status;
+  }
+
+  client->busy = true;
+  return 0;
+} /* }}} int us_job_start */
+
+/* Handles all complete lines in the input buffer of "client", until a command
+ * is passed to its own thread. */
+static void us_client_process(us_client_t *client) /* {{{ */
+{
+  FILE *fh = fopencookie(client, "w",
+                         (cookie_io_functions_t){.write = us_stream_write});
+  if (fh == NULL) {
+    ERROR("unixsock plugin: fopencookie failed: %s", STRERRNO);
+    client->eof = true;
+    return;
+  }
+
+  client->in[client->in_len] = 0;
+
+  char *line = client->in;
   while (42) {
-    char buffer[1024];
-    char buffer_copy[1024];
-    char *fields[128];
-    int fields_num;
+    char *next = strchr(line, '\n');
+    if (next == NULL) {
+      /* Handle an unterminated last line when the client is done. */
+      if (!client->eof || (*line == 0))
+        break;
+      next = line + strlen(line);
+    } else {
+      *next = 0;
+      next++;
+    }
 
-    errno = 0;
-    if (fgets(buffer, sizeof(buffer), fhin) == NULL) {
-      if ((errno == EINTR) || (errno == EAGAIN))
-        continue;
+    size_t len = strlen(line);
+    while ((len > 0) && (line[len - 1] == '\r'))
+      line[--len] = 0;
 
-      if (errno != 0) {
-        WARNING("unixsock plugin: failed to read from socket #%i: %s",
-                fileno(fhin), STRERRNO);
+    if ((len > 0) && (client->batch == NULL) &&
+        us_command_is_job(line, strcspn(line, " \t"))) {
+      /* Replies of earlier commands go first. */
+      fflush(fh);
+      if (us_job_start(client, line) == 0) {
+        line = next;
+        break;
       }
+    }
+
+    if (len > 0)
+      us_handle_command(client, fh, line);
+
+    line = next;
+  }
+
+  /* Unless a command thread was started, only a partial line remains. */
+  size_t remaining = client->in_len - (size_t)(line - client->in);
+  if (!client->busy && (remaining > US_MAX_LINE_SIZE)) {
+    fprintf(fh, "-1 Line too long\n");
+    client->eof = true;
+    remaining = 0;
+  }
+  memmove(client->in, line, remaining);
+  client->in_len = remaining;
+
+  fclose(fh);
+} /* }}} void us_client_process */
+
+/* Joins the command thread once it is done and handles the following
+ * commands. */
+static void us_client_check_job(us_client_t *client) /* {{{ */
+{
+  if (!client->busy)
+    return;
+
+  pthread_mutex_lock(&client->lock);
+  bool done = client->job_done;
+  pthread_mutex_unlock(&client->lock);
+  if (!done)
+    return;
+
+  pthread_join(client->job_thread, NULL);
+  sfree(client->job_line);
+  client->busy = false;
+
+  pthread_mutex_lock(&client->lock);
+  bool failed = client->failed;
+  pthread_mutex_unlock(&client->lock);
+  if (!failed)
+    us_client_process(client);
+} /* }}} void us_client_check_job */
+static void us_client_read(us_client_t *client) /* {{{ */
+{
+  while (42) {
+    /* Keep room for the terminating null byte. */
+    if (us_buffer_reserve(&client->in, &client->in_size,
+                          client->in_len + US_READ_SIZE + 1) != 0) {
+      ERROR("unixsock plugin: Allocating the input buffer failed.");
+      client->eof = true;
+      return;
+    }
+
+    size_t avail = client->in_size - client->in_len - 1;
+    ssize_t status = read(client->fd, client->in + client->in_len, avail);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        break;
+
+      WARNING("unixsock plugin: failed to read from socket #%i: %s",
+              client->fd, STRERRNO);
+      client->eof = true;
+      break;
+    } else if (status == 0) {
+      client->eof = true;
       break;
     }
 
-    size_t len = strlen(buffer);
-    while ((len > 0) &&
-           ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
-      buffer[--len] = '\0';
+    client->in_len += (size_t)status;
+    if (((size_t)status < avail) || (client->in_len > US_MAX_LINE_SIZE))
+      break;
+  }
 
-    if (len == 0)
-      continue;
+  us_client_process(client);
+} /* }}} void us_client_read */
 
-    sstrncpy(buffer_copy, buffer, sizeof(buffer_copy));
+/* Sends as much of the pending output as the socket accepts. The caller must
+ * hold client->lock. */
+static int us_client_write(us_client_t *client) /* {{{ */
+{
+  size_t offset = 0;
 
-    fields_num =
-        strsplit(buffer_copy, fields, sizeof(fields) / sizeof(fields[0]));
-    if (fields_num < 1) {
-      fprintf(fhout, "-1 Internal error\n");
-      fclose(fhin);
-      fclose(fhout);
-      pthread_exit((void *)1);
-      return (void *)1;
+  while (offset < client->out_len) {
+    ssize_t status = send(client->fd, client->out + offset,
+                          client->out_len - offset, MSG_NOSIGNAL);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        break;
+
+      WARNING("unixsock plugin: failed to write to socket #%i: %s",
+              client->fd, STRERRNO);
+      return -1;
     }
+    offset += (size_t)status;
+  }
 
-    if (strcasecmp(fields[0], "getval") == 0) {
-      cmd_handle_getval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "getthreshold") == 0) {
-      handle_getthreshold(fhout, buffer);
-    } else if (strcasecmp(fields[0], "putval") == 0) {
-      cmd_handle_putval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "listval") == 0) {
-      cmd_handle_listval(fhout, buffer);
-    } else if (strcasecmp(fields[0], "putnotif") == 0) {
-      handle_putnotif(fhout, buffer);
-    } else if (strcasecmp(fields[0], "flush") == 0) {
-      cmd_handle_flush(fhout, buffer);
-    } else {
-      if (fprintf(fhout, "-1 Unknown command: %s\n", fields[0]) < 0) {
-        WARNING("unixsock plugin: failed to write to socket #%i: %s",
-                fileno(fhout), STRERRNO);
+  memmove(client->out, client->out + offset, client->out_len - offset);
+  client->out_len -= offset;
+  if (offset > 0)
+    pthread_cond_signal(&client->cond);
+  return 0;
+} /* }}} int us_client_write */
+
+static void us_client_free(us_client_t *client) /* {{{ */
+{
+  if (client == NULL)
+    return;
+
+  if (client->busy) {
+    pthread_mutex_lock(&client->lock);
+    us_client_fail(client);
+    pthread_mutex_unlock(&client->lock);
+    pthread_join(client->job_thread, NULL);
+    sfree(client->job_line);
+  }
+
+  close(client->fd);
+  us_batch_destroy(client->batch);
+  sfree(client->in);
+  sfree(client->out);
+  pthread_cond_destroy(&client->cond);
+  pthread_mutex_destroy(&client->lock);
+  sfree(client);
+} /* }}} void us_client_free */
+
+static int us_worker_add_client(us_worker_t *worker, int fd) /* {{{ */
+{
+  int flags = fcntl(fd, F_GETFL);
+  if ((flags == -1) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)) {
+    ERROR("unixsock plugin: fcntl failed: %s", STRERRNO);
+    close(fd);
+    return -1;
+  }
+
+  us_client_t **tmp = realloc(worker->clients, sizeof(*worker->clients) *
+                                                   (worker->clients_num + 1));
+  if (tmp == NULL) {
+    ERROR("unixsock plugin: realloc failed.");
+    close(fd);
+    return -1;
+  }
+  worker->clients = tmp;
+
+  us_client_t *client = calloc(1, sizeof(*client));
+  if (client == NULL) {
+    ERROR("unixsock plugin: calloc failed.");
+    close(fd);
+    return -1;
+  }
+  client->fd = fd;
+  client->wake_fd = worker->wake_fd[1];
+  pthread_mutex_init(&client->lock, NULL);
+  pthread_cond_init(&client->cond, NULL);
+
+  worker->clients[worker->clients_num] = client;
+  worker->clients_num++;
+  return 0;
+} /* }}} int us_worker_add_client */
+
+static void *us_worker_thread(void *arg) /* {{{ */
+{
+  us_worker_t *worker = arg;
+  struct pollfd *fds = NULL;
+  size_t fds_size = 0;
+
+  while (42) {
+    size_t fds_num = worker->clients_num + 2;
+    if (fds_num > fds_size) {
+      struct pollfd *tmp = realloc(fds, sizeof(*fds) * fds_num);
+      if (tmp == NULL) {
+        ERROR("unixsock plugin: realloc failed.");
         break;
       }
+      fds = tmp;
+      fds_size = fds_num;
     }
-  } /* while (fgets) */
 
-  DEBUG("unixsock plugin: us_handle_client: Exiting..");
-  fclose(fhin);
-  fclose(fhout);
+    fds[0] = (struct pollfd){.fd = worker->pipe_fd[0], .events = POLLIN};
+    fds[1] = (struct pollfd){.fd = worker->wake_fd[0], .events = POLLIN};
+    for (size_t i = 0; i < worker->clients_num; i++) {
+      us_client_t *client = worker->clients[i];
+      short events = 0;
+
+      pthread_mutex_lock(&client->lock);
+      /* Stop reading from clients which do not read their replies. */
+      if (!client->busy && !client->eof &&
+          (client->out_len < US_MAX_OUTPUT_SIZE))
+        events |= POLLIN;
+      if (client->out_len > 0)
+        events |= POLLOUT;
+      /* Broken connections are only kept until their command is done. */
+      int fd = client->failed ? -1 : client->fd;
+      pthread_mutex_unlock(&client->lock);
+
+      fds[i + 2] = (struct pollfd){.fd = fd, .events = events};
+    }
+
+    int status = poll(fds, (nfds_t)fds_num, /* timeout = */ -1);
+    if (status < 0) {
+      if (errno == EINTR)
+        continue;
+      ERROR("unixsock plugin: poll failed: %s", STRERRNO);
+      break;
+    }
+
+    /* Drain the wake pipe before looking at the clients, so that no wake up
+     * is lost. */
+    if (fds[1].revents != 0) {
+      char buf[64];
+      while (read(worker->wake_fd[0], buf, sizeof(buf)) > 0)
+        ;
+    }
+
+    /* Handle the clients before accepting new ones, so that the indexes of
+     * "fds" and "worker->clients" match. Iterate backwards, since removed
+     * clients are replaced by the last one. */
+    for (size_t i = fds_num - 2; i > 0; i--) {
+      us_client_t *client = worker->clients[i - 1];
+      short revents = fds[i + 1].revents;
+
+      us_client_check_job(client);
+
+      if (client->busy) {
+        /* The input is handled when the command is done. */
+        if ((revents & (POLLHUP | POLLERR)) != 0) {
+          pthread_mutex_lock(&client->lock);
+          us_client_fail(client);
+          pthread_mutex_unlock(&client->lock);
+        }
+      } else if ((revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+        us_client_read(client);
+      }
+
+      pthread_mutex_lock(&client->lock);
+      if ((client->out_len > 0) && (us_client_write(client) != 0))
+        us_client_fail(client);
+      bool done = client->failed || (client->eof && (client->out_len == 0));
+      pthread_mutex_unlock(&client->lock);
+
+      if (done && !client->busy) {
+        us_client_free(client);
+        worker->clients[i - 1] = worker->clients[worker->clients_num - 1];
+        worker->clients_num--;
+      }
+    }
+
+    if (fds[0].revents != 0) {
+      int fd = -1;
+      ssize_t len = read(worker->pipe_fd[0], &fd, sizeof(fd));
+      if (len == 0) /* shutdown */
+        break;
+      if (len == (ssize_t)sizeof(fd))
+        us_worker_add_client(worker, fd);
+    }
+  }
+
+  for (size_t i = 0; i < worker->clients_num; i++)
+    us_client_free(worker->clients[i]);
+  sfree(worker->clients);
+  worker->clients_num = 0;
+  sfree(fds);
 
-  pthread_exit((void *)0);
   return (void *)0;
-} /* void *us_handle_client */
+} /* }}} void *us_worker_thread */
 
 static void *us_server_thread(void __attribute__((unused)) * arg) {
   int status;
-  int *remote_fd;
-  pthread_t th;
+  size_t next_worker = 0;
 
   if (us_open_socket() != 0)
     pthread_exit((void *)1);
@@ -292,24 +921,16 @@ static void *us_server_thread(void __attribute__((unused)) * arg) {
       pthread_exit((void *)1);
     }
 
-    remote_fd = malloc(sizeof(*remote_fd));
-    if (remote_fd == NULL) {
-      WARNING("unixsock plugin: malloc failed: %s", STRERRNO);
-      close(status);
-      continue;
-    }
-    *remote_fd = status;
+    /* Hand the connection to the workers in turn. */
+    us_worker_t *worker = workers + next_worker;
+    next_worker = (next_worker + 1) % workers_num;
 
-    DEBUG("Spawning child to handle connection on fd #%i", *remote_fd);
+    DEBUG("unixsock plugin: Passing fd #%i to a worker", status);
 
-    status = plugin_thread_create(&th, us_handle_client, (void *)remote_fd,
-                                  "unixsock conn");
-    if (status == 0) {
-      pthread_detach(th);
-    } else {
-      WARNING("unixsock plugin: pthread_create failed: %s", STRERRNO);
-      close(*remote_fd);
-      free(remote_fd);
+    if (write(worker->pipe_fd[1], &status, sizeof(status)) !=
+        (ssize_t)sizeof(status)) {
+      WARNING("unixsock plugin: write to worker failed: %s", STRERRNO);
+      close(status);
       continue;
     }
   } /* while (loop) */
@@ -348,6 +969,12 @@ static int us_config(const char *key, const char *val) {
       delete_socket = true;
     else
       delete_socket = false;
+  } else if (strcasecmp(key, "WorkerThreads") == 0) {
+    conf_worker_threads = atoi(val);
+    if (conf_worker_threads < 1) {
+      WARNING("unixsock plugin: WorkerThreads must be at least 1.");
+      conf_worker_threads = 1;
+    }
   } else {
     return -1;
   }
@@ -355,6 +982,29 @@ static int us_config(const char *key, const char *val) {
   return 0;
 } /* int us_config */
 
+/* Closing the pipe makes the worker threads exit. */
+static void us_workers_stop(void) /* {{{ */
+{
+  for (size_t i = 0; i < workers_num; i++) {
+    us_worker_t *worker = workers + i;
+
+    if (worker->pipe_fd[1] >= 0)
+      close(worker->pipe_fd[1]);
+    if (worker->thread_running)
+      pthread_join(worker->thread, NULL);
+    if (worker->pipe_fd[0] >= 0)
+      close(worker->pipe_fd[0]);
+    /* The command threads, which write to the wake pipe, have been joined
+     * by the worker. */
+    if (worker->wake_fd[0] >= 0)
+      close(worker->wake_fd[0]);
+    if (worker->wake_fd[1] >= 0)
+      close(worker->wake_fd[1]);
+  }
+  sfree(workers);
+  workers_num = 0;
+} /* }}} void us_workers_stop */
+
 static int us_init(void) {
   static int have_init;
 
@@ -367,10 +1017,43 @@ static int us_init(void) {
 
   loop = 1;
 
+  workers = calloc((size_t)conf_worker_threads, sizeof(*workers));
+  if (workers == NULL) {
+    ERROR("unixsock plugin: calloc failed.");
+    return -1;
+  }
+  workers_num = (size_t)conf_worker_threads;
+  for (size_t i = 0; i < workers_num; i++) {
+    workers[i].pipe_fd[0] = workers[i].pipe_fd[1] = -1;
+    workers[i].wake_fd[0] = workers[i].wake_fd[1] = -1;
+  }
+
+  for (size_t i = 0; i < workers_num; i++) {
+    us_worker_t *worker = workers + i;
+
+    if ((pipe2(worker->pipe_fd, O_CLOEXEC) != 0) ||
+        (pipe2(worker->wake_fd, O_CLOEXEC | O_NONBLOCK) != 0)) {
+      ERROR("unixsock plugin: pipe failed: %s", STRERRNO);
+      us_workers_stop();
+      return -1;
+    }
+
+    status = plugin_thread_create(&worker->thread, us_worker_thread, worker,
+                                  "unixsock worker");
+    if (status != 0) {
+      ERROR("unixsock plugin: pthread_create failed: %s", STRERRNO);
+      us_workers_stop();
+      return -1;
+    }
+    worker->thread_running = true;
+  }
+
   status = plugin_thread_create(&listen_thread, us_server_thread, NULL,
                                 "unixsock listen");
   if (status != 0) {
     ERROR("unixsock plugin: pthread_create failed: %s", STRERRNO);
+    listen_thread = (pthread_t)0;
+    us_workers_stop();
     return -1;
   }
 
@@ -388,6 +1071,8 @@ static int us_shutdown(void) {
     listen_thread = (pthread_t)0;
   }
 
+  us_workers_stop();
+
   plugin_unregister_init("unixsock");
   plugin_unregister_shutdown("unixsock");
 
@@ -592,6 +592,28 @@ c_avl_iterator_t *c_avl_get_iterator(c_avl_tree_t *t) {
   return iter;
 } /* c_avl_iterator_t *c_avl_get_iterator */
 
+c_avl_iterator_t *c_avl_get_iterator_from(c_avl_tree_t *t, const void *key) {
+  c_avl_iterator_t *iter = c_avl_get_iterator(t);
+  if ((iter == NULL) || (key == NULL))
+    return iter;
+
+  /* Position the iterator on the largest node smaller than "key", so that the
+   * next call to c_avl_iterator_next() returns the first node greater than or
+   * equal to "key". If there is no such node, leaving "node" at NULL makes the
+   * iterator start at the smallest node. */
+  c_avl_node_t *n = t->root;
+  while (n != NULL) {
+    if (t->compare(n->key, key) < 0) {
+      iter->node = n;
+      n = n->right;
+    } else {
+      n = n->left;
+    }
+  }
+
+  return iter;
+} /* c_avl_iterator_t *c_avl_get_iterator_from */
+
 int c_avl_iterator_next(c_avl_iterator_t *iter, void **key, void **value) {
   if ((iter == NULL) || ((key == NULL) && (value == NULL))) {
     return EINVAL;
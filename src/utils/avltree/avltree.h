@@ -149,6 +149,12 @@ int c_avl_pick(c_avl_tree_t *t, void **key, void **value);
 
 c_avl_iterator_t *c_avl_get_iterator(c_avl_tree_t *t);
 
+/* c_avl_get_iterator_from returns an iterator whose first call to
+ * c_avl_iterator_next returns the smallest key greater than or equal to "key".
+ * The key does not need to be in the tree. The iterator is meant for forward
+ * iteration only. */
+c_avl_iterator_t *c_avl_get_iterator_from(c_avl_tree_t *t, const void *key);
+
 /* c_avl_iterator_next returns the next key/value in the tree. Either key or
  * value, but not both, may be NULL. Returns zero on success or EOF if there are
  * no more nodes in the tree. */
@@ -117,6 +117,32 @@ DEF_TEST(success) {
     EXPECT_EQ_INT(i, STATIC_ARRAY_SIZE(cases));
   }
 
+  /* iterate starting at a key */
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    c_avl_iterator_t *iter = c_avl_get_iterator_from(t, sorted_cases[i].key);
+    char *key;
+    CHECK_ZERO(c_avl_iterator_next(iter, (void **)&key, NULL));
+    EXPECT_EQ_STR(sorted_cases[i].key, key);
+    c_avl_iterator_destroy(iter);
+  }
+  {
+    /* "Aech6vah" is the smallest key, "zaiP5kie" the largest. */
+    c_avl_iterator_t *iter = c_avl_get_iterator_from(t, "A");
+    char *key;
+    CHECK_ZERO(c_avl_iterator_next(iter, (void **)&key, NULL));
+    EXPECT_EQ_STR(sorted_cases[0].key, key);
+    c_avl_iterator_destroy(iter);
+
+    iter = c_avl_get_iterator_from(t, "Aech6vah0");
+    CHECK_ZERO(c_avl_iterator_next(iter, (void **)&key, NULL));
+    EXPECT_EQ_STR(sorted_cases[1].key, key);
+    c_avl_iterator_destroy(iter);
+
+    iter = c_avl_get_iterator_from(t, "zz");
+    EXPECT_EQ_INT(EOF, c_avl_iterator_next(iter, (void **)&key, NULL));
+    c_avl_iterator_destroy(iter);
+  }
+
   /* iterate backward */
   {
     c_avl_iterator_t *iter = c_avl_get_iterator(t);
@@ -28,6 +28,7 @@
 
 #include "utils/cmds/cmds.h"
 #include "utils/cmds/flush.h"
+#include "utils/cmds/getrange.h"
 #include "utils/cmds/getval.h"
 #include "utils/cmds/listval.h"
 #include "utils/cmds/parse_option.h"
@@ -205,9 +206,14 @@ cmd_status_t cmd_parsev(size_t argc, char **argv, cmd_t *ret_cmd,
     ret_cmd->type = CMD_GETVAL;
     status =
         cmd_parse_getval(argc - 1, argv + 1, &ret_cmd->cmd.getval, opts, err);
+  } else if (strcasecmp("GETRANGE", command) == 0) {
+    ret_cmd->type = CMD_GETRANGE;
+    status = cmd_parse_getrange(argc - 1, argv + 1, &ret_cmd->cmd.getrange,
+                                opts, err);
   } else if (strcasecmp("LISTVAL", command) == 0) {
     ret_cmd->type = CMD_LISTVAL;
-    status = cmd_parse_listval(argc - 1, argv + 1, opts, err);
+    status = cmd_parse_listval(argc - 1, argv + 1, &ret_cmd->cmd.listval,
+                               opts, err);
   } else if (strcasecmp("PUTVAL", command) == 0) {
     ret_cmd->type = CMD_PUTVAL;
     status =
@@ -256,6 +262,10 @@ void cmd_destroy(cmd_t *cmd) {
     cmd_destroy_getval(&cmd->cmd.getval);
     break;
   case CMD_LISTVAL:
+    cmd_destroy_listval(&cmd->cmd.listval);
+    break;
+  case CMD_GETRANGE:
+    cmd_destroy_getrange(&cmd->cmd.getrange);
     break;
   case CMD_PUTVAL:
     cmd_destroy_putval(&cmd->cmd.putval);
@@ -295,6 +305,63 @@ cmd_status_t cmd_parse_option(char *field, char **ret_key, char **ret_value,
   return CMD_OK;
 } /* cmd_status_t cmd_parse_option */
 
+cmd_status_t cmd_parse_filter(size_t argc, char **argv,
+                              cmd_filter_t *ret_filter,
+                              cmd_error_handler_t *err) {
+  if (ret_filter == NULL) {
+    errno = EINVAL;
+    cmd_error(CMD_ERROR, err, "Invalid argument to cmd_parse_filter.");
+    return CMD_ERROR;
+  }
+  memset(ret_filter, 0, sizeof(*ret_filter));
+
+  for (size_t i = 0; i < argc; i++) {
+    char *opt_key = NULL;
+    char *opt_value = NULL;
+
+    cmd_status_t status = cmd_parse_option(argv[i], &opt_key, &opt_value, err);
+    if (status != CMD_OK) {
+      if (status == CMD_NO_OPTION)
+        cmd_error(CMD_PARSE_ERROR, err, "Invalid option string `%s'.", argv[i]);
+      cmd_destroy_filter(ret_filter);
+      return CMD_PARSE_ERROR;
+    }
+
+    int error = 0;
+    if (strcasecmp("prefix", opt_key) == 0) {
+      sfree(ret_filter->prefix);
+      ret_filter->prefix = strdup(opt_value);
+      if (ret_filter->prefix == NULL)
+        error = ENOMEM;
+    } else if ((strncasecmp("label:", opt_key, strlen("label:")) == 0) &&
+               (opt_key[strlen("label:")] != 0)) {
+      error = label_set_add(&ret_filter->labels, opt_key + strlen("label:"),
+                            opt_value);
+    } else {
+      cmd_error(CMD_PARSE_ERROR, err, "Cannot parse option `%s'.", opt_key);
+      cmd_destroy_filter(ret_filter);
+      return CMD_PARSE_ERROR;
+    }
+
+    if (error != 0) {
+      cmd_error(CMD_PARSE_ERROR, err, "Invalid filter option `%s': %s",
+                opt_key, STRERROR(error));
+      cmd_destroy_filter(ret_filter);
+      return CMD_PARSE_ERROR;
+    }
+  }
+
+  return CMD_OK;
+} /* cmd_status_t cmd_parse_filter */
+
+void cmd_destroy_filter(cmd_filter_t *filter) {
+  if (filter == NULL)
+    return;
+
+  sfree(filter->prefix);
+  label_set_reset(&filter->labels);
+} /* void cmd_destroy_filter */
+
 void cmd_error_fh(void *ud, cmd_status_t status, const char *format,
                   va_list ap) {
   FILE *fh = ud;
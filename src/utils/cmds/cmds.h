@@ -38,6 +38,7 @@ typedef enum {
   CMD_LISTVAL = 3,
   CMD_PUTVAL = 4,
   CMD_PUTMETRIC = 5,
+  CMD_GETRANGE = 6,
 } cmd_type_t;
 #define CMD_TO_STRING(type)                                                    \
   ((type) == CMD_FLUSH)                                                        \
@@ -48,7 +49,10 @@ typedef enum {
                   ? "LISTVAL"                                                  \
                   : ((type) == CMD_PUTVAL)                                     \
                         ? "PUTVAL"                                             \
-                        : ((type) == CMD_PUTMETRIC) ? "PUTMETRIC" : "UNKNOWN"
+                        : ((type) == CMD_PUTMETRIC)                    \
+                              ? "PUTMETRIC"                                    \
+                              : ((type) == CMD_GETRANGE) ? "GETRANGE"          \
+                                                         : "UNKNOWN"
 
 typedef struct {
   double timeout;
@@ -59,13 +63,34 @@ typedef struct {
   size_t identifiers_num;
 } cmd_flush_t;
 
+/* cmd_filter_t selects cache entries by name prefix and labels. It is used by
+ * the LISTVAL and GETVAL commands. */
 typedef struct {
-  /* The raw string provided by the user. */
+  char *prefix;
+  label_set_t labels;
+} cmd_filter_t;
+
+typedef struct {
+  /* The raw string provided by the user. NULL if "filter" is used instead. */
   char *raw_identifier;
 
   metric_t *metric;
+  cmd_filter_t filter;
 } cmd_getval_t;
 
+typedef struct {
+  cmd_filter_t filter;
+} cmd_listval_t;
+
+/* cmd_getrange_t selects the stored samples of a single series. */
+typedef struct {
+  metric_t *metric;
+  /* Plugin to query. NULL queries all plugins storing samples. */
+  char *plugin;
+  cdtime_t start;
+  cdtime_t end;
+} cmd_getrange_t;
+
 typedef struct {
   /* The raw identifier as provided by the user. */
   char *raw_identifier;
@@ -101,6 +126,8 @@ typedef struct {
   union {
     cmd_flush_t flush;
     cmd_getval_t getval;
+    cmd_listval_t listval;
+    cmd_getrange_t getrange;
     cmd_putval_t putval;
     cmd_putmetric_t putmetric;
   } cmd;
@@ -206,6 +233,31 @@ void cmd_destroy(cmd_t *cmd);
 cmd_status_t cmd_parse_option(char *field, char **ret_key, char **ret_value,
                               cmd_error_handler_t *err);
 
+/*
+ * NAME
+ *   cmd_parse_filter
+ *
+ * DESCRIPTION
+ *   Parses filter options which must be of the form:
+ *     prefix=<name prefix>
+ *     label:<label name>=<label value>
+ *
+ * PARAMETERS
+ *   `argc'       Number of fields in `argv'.
+ *   `argv'       The parsed input fields.
+ *   `ret_filter' The parsed filter will be stored at this location. It has to
+ *                be freed with cmd_destroy_filter().
+ *   `err'        An optional error handler to invoke on error.
+ *
+ * RETURN VALUE
+ *   CMD_OK on success or an error code otherwise.
+ */
+cmd_status_t cmd_parse_filter(size_t argc, char **argv,
+                              cmd_filter_t *ret_filter,
+                              cmd_error_handler_t *err);
+
+void cmd_destroy_filter(cmd_filter_t *filter);
+
 /*
  * NAME
  *   cmd_error_fh
@@ -147,6 +147,12 @@ static struct {
     },
 #endif
 
+    {
+        "GETVAL prefix=magic label:instance=\"a b\"",
+        NULL,
+        CMD_OK,
+        CMD_GETVAL,
+    },
     /* Invalid GETVAL commands. */
     {
         "GETVAL magic/MAGIC",
@@ -167,6 +173,46 @@ static struct {
         CMD_UNKNOWN,
     },
 
+    /* Valid GETRANGE commands. */
+    {
+        "GETRANGE cpu_usage",
+        NULL,
+        CMD_OK,
+        CMD_GETRANGE,
+    },
+    {
+        "GETRANGE cpu_usage label:cpu=0 start=1700000000 end=1700003600.5 "
+        "plugin=tsdb",
+        NULL,
+        CMD_OK,
+        CMD_GETRANGE,
+    },
+    /* Invalid GETRANGE commands. */
+    {
+        "GETRANGE",
+        NULL,
+        CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
+    {
+        "GETRANGE cpu_usage start=now",
+        NULL,
+        CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
+    {
+        "GETRANGE cpu_usage start=2 end=1",
+        NULL,
+        CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
+    {
+        "GETRANGE cpu_usage invalid=option",
+        NULL,
+        CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
+
     /* Valid LISTVAL commands. */
     {
         "LISTVAL",
@@ -174,6 +220,12 @@ static struct {
         CMD_OK,
         CMD_LISTVAL,
     },
+    {
+        "LISTVAL prefix=magic label:host=myhost label:instance=a",
+        NULL,
+        CMD_OK,
+        CMD_LISTVAL,
+    },
 
     /* Invalid LISTVAL commands. */
     {
@@ -182,6 +234,20 @@ static struct {
         CMD_PARSE_ERROR,
         CMD_UNKNOWN,
     },
+    {
+        /* Unknown filter option. */
+        "LISTVAL host=myhost",
+        NULL,
+        CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
+    {
+        /* Missing label name. */
+        "LISTVAL label:=myhost",
+        NULL,
+        CMD_PARSE_ERROR,
+        CMD_UNKNOWN,
+    },
 
     /* Valid PUTVAL commands. */
     {
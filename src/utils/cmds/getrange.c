@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "plugin.h"
+#include "utils/common/common.h"
+
+#include "utils/cmds/getrange.h"
+#include "utils/cmds/parse_option.h"
+
+/* Range returned if no start time is given. */
+#define GETRANGE_DEFAULT_RANGE TIME_T_TO_CDTIME_T_STATIC(3600)
+
+static int parse_epoch(char const *s, cdtime_t *ret) {
+  char *endptr = NULL;
+  errno = 0;
+  double d = strtod(s, &endptr);
+  if ((endptr == s) || (*endptr != 0) || (errno != 0) || !isfinite(d) ||
+      (d < 0))
+    return EINVAL;
+
+  *ret = DOUBLE_TO_CDTIME_T(d);
+  return 0;
+} /* int parse_epoch */
+
+cmd_status_t cmd_parse_getrange(size_t argc, char **argv,
+                                cmd_getrange_t *ret_getrange,
+                                __attribute__((unused))
+                                const cmd_options_t *opts,
+                                cmd_error_handler_t *err) {
+  if (ret_getrange == NULL) {
+    errno = EINVAL;
+    cmd_error(CMD_ERROR, err, "Invalid arguments to cmd_parse_getrange.");
+    return CMD_ERROR;
+  }
+  *ret_getrange = (cmd_getrange_t){0};
+
+  if (argc < 1) {
+    cmd_error(CMD_PARSE_ERROR, err, "Missing metric name.");
+    return CMD_PARSE_ERROR;
+  }
+
+  metric_t *m = metric_parse_identity(argv[0]);
+  if (m == NULL) {
+    cmd_error(CMD_PARSE_ERROR, err, "Invalid metric identity `%s'.", argv[0]);
+    return CMD_PARSE_ERROR;
+  }
+  ret_getrange->metric = m;
+
+  bool have_start = false;
+  bool have_end = false;
+  for (size_t i = 1; i < argc; i++) {
+    char *opt_key = NULL;
+    char *opt_value = NULL;
+
+    cmd_status_t status = cmd_parse_option(argv[i], &opt_key, &opt_value, err);
+    if (status != CMD_OK) {
+      if (status == CMD_NO_OPTION)
+        cmd_error(CMD_PARSE_ERROR, err, "Invalid option string `%s'.", argv[i]);
+      cmd_destroy_getrange(ret_getrange);
+      return CMD_PARSE_ERROR;
+    }
+
+    int error = 0;
+    if (strcasecmp("start", opt_key) == 0) {
+      error = parse_epoch(opt_value, &ret_getrange->start);
+      have_start = true;
+    } else if (strcasecmp("end", opt_key) == 0) {
+      error = parse_epoch(opt_value, &ret_getrange->end);
+      have_end = true;
+    } else if (strcasecmp("plugin", opt_key) == 0) {
+      sfree(ret_getrange->plugin);
+      ret_getrange->plugin = strdup(opt_value);
+      if (ret_getrange->plugin == NULL)
+        error = ENOMEM;
+    } else if ((strncasecmp("label:", opt_key, strlen("label:")) == 0) &&
+               (opt_key[strlen("label:")] != 0)) {
+      error = metric_label_set(m, opt_key + strlen("label:"), opt_value);
+    } else {
+      cmd_error(CMD_PARSE_ERROR, err, "Cannot parse option `%s'.", opt_key);
+      cmd_destroy_getrange(ret_getrange);
+      return CMD_PARSE_ERROR;
+    }
+
+    if (error != 0) {
+      cmd_error(CMD_PARSE_ERROR, err, "Invalid value for option `%s': %s",
+                opt_key, opt_value);
+      cmd_destroy_getrange(ret_getrange);
+      return CMD_PARSE_ERROR;
+    }
+  }
+
+  if (!have_end)
+    ret_getrange->end = cdtime();
+  if (!have_start)
+    ret_getrange->start = (ret_getrange->end > GETRANGE_DEFAULT_RANGE)
+                              ? ret_getrange->end - GETRANGE_DEFAULT_RANGE
+                              : 0;
+  if (ret_getrange->start > ret_getrange->end) {
+    cmd_error(CMD_PARSE_ERROR, err, "The start is after the end of the range.");
+    cmd_destroy_getrange(ret_getrange);
+    return CMD_PARSE_ERROR;
+  }
+
+  return CMD_OK;
+} /* cmd_status_t cmd_parse_getrange */
+
+typedef struct {
+  cdtime_t *times;
+  double *values;
+  size_t num;
+  size_t size;
+} getrange_samples_t;
+
+static int getrange_emit(cdtime_t time, double value, void *arg) {
+  getrange_samples_t *samples = arg;
+
+  if (samples->num == samples->size) {
+    size_t size = (samples->size == 0) ? 64 : 2 * samples->size;
+    cdtime_t *times = realloc(samples->times, size * sizeof(*times));
+    if (times == NULL)
+      return ENOMEM;
+    samples->times = times;
+    double *values = realloc(samples->values, size * sizeof(*values));
+    if (values == NULL)
+      return ENOMEM;
+    samples->values = values;
+    samples->size = size;
+  }
+
+  samples->times[samples->num] = time;
+  samples->values[samples->num] = value;
+  samples->num++;
+  return 0;
+} /* int getrange_emit */
+
+cmd_status_t cmd_handle_getrange(FILE *fh, char *buffer) {
+  cmd_error_handler_t err = {cmd_error_fh, fh};
+  cmd_status_t status;
+  cmd_t cmd;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return -1;
+
+  DEBUG("utils_cmd_getrange: cmd_handle_getrange (fh = %p, buffer = %s);",
+        (void *)fh, buffer);
+
+  if ((status = cmd_parse(buffer, &cmd, NULL, &err)) != CMD_OK)
+    return status;
+  if (cmd.type != CMD_GETRANGE) {
+    cmd_error(CMD_UNKNOWN_COMMAND, &err, "Unexpected command: `%s'.",
+              CMD_TO_STRING(cmd.type));
+    cmd_destroy(&cmd);
+    return CMD_UNKNOWN_COMMAND;
+  }
+
+  /* The number of samples is part of the status line, so they are collected
+   * before anything is printed. */
+  getrange_samples_t samples = {0};
+  cmd_getrange_t *r = &cmd.cmd.getrange;
+  int query_status = plugin_query(r->plugin, r->metric, r->start, r->end,
+                                  getrange_emit, &samples);
+  if (query_status != 0) {
+    if (query_status == ENOENT)
+      cmd_error(CMD_ERROR, &err, "No such series.");
+    else
+      cmd_error(CMD_ERROR, &err, "Query failed: %s", STRERROR(query_status));
+    status = CMD_ERROR;
+  } else if (fprintf(fh, "%zu Value%s found\n", samples.num,
+                     (samples.num == 1) ? "" : "s") < 0) {
+    status = CMD_ERROR;
+  } else {
+    for (size_t i = 0; i < samples.num; i++) {
+      if (fprintf(fh, "%.3f " GAUGE_FORMAT "\n",
+                  CDTIME_T_TO_DOUBLE(samples.times[i]),
+                  samples.values[i]) < 0) {
+        status = CMD_ERROR;
+        break;
+      }
+    }
+    fflush(fh);
+  }
+  if ((status == CMD_ERROR) && (query_status == 0))
+    WARNING("cmd_handle_getrange: failed to write to socket #%i: %s",
+            fileno(fh), STRERRNO);
+
+  sfree(samples.times);
+  sfree(samples.values);
+  cmd_destroy(&cmd);
+  return status;
+} /* cmd_status_t cmd_handle_getrange */
+
+void cmd_destroy_getrange(cmd_getrange_t *getrange) {
+  if (getrange == NULL)
+    return;
+
+  if (getrange->metric != NULL)
+    metric_family_free(getrange->metric->family);
+  getrange->metric = NULL;
+  sfree(getrange->plugin);
+} /* void cmd_destroy_getrange */
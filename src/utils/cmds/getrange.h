@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef UTILS_CMD_GETRANGE_H
+#define UTILS_CMD_GETRANGE_H 1
+
+#include <stdio.h>
+
+#include "utils/cmds/cmds.h"
+
+cmd_status_t cmd_parse_getrange(size_t argc, char **argv,
+                                cmd_getrange_t *ret_getrange,
+                                const cmd_options_t *opts,
+                                cmd_error_handler_t *err);
+
+cmd_status_t cmd_handle_getrange(FILE *fh, char *buffer);
+
+void cmd_destroy_getrange(cmd_getrange_t *getrange);
+
+#endif /* UTILS_CMD_GETRANGE_H */
@@ -33,6 +33,14 @@
 #include "utils/cmds/parse_option.h"
 #include "utils_cache.h"
 
+/* Number of cache entries copied per call to uc_cursor_next(). */
+#define GETVAL_CHUNK_SIZE 1024
+
+static bool is_filter_option(char const *field) {
+  return (strncasecmp("prefix=", field, strlen("prefix=")) == 0) ||
+         (strncasecmp("label:", field, strlen("label:")) == 0);
+} /* bool is_filter_option */
+
 cmd_status_t cmd_parse_getval(size_t argc, char **argv,
                               cmd_getval_t *ret_getval,
                               const cmd_options_t *opts,
@@ -43,6 +51,12 @@ cmd_status_t cmd_parse_getval(size_t argc, char **argv,
     return CMD_ERROR;
   }
 
+  /* "GETVAL prefix=... label:name=value" returns all matching values. */
+  if ((argc > 0) && is_filter_option(argv[0])) {
+    *ret_getval = (cmd_getval_t){0};
+    return cmd_parse_filter(argc, argv, &ret_getval->filter, err);
+  }
+
   if (argc != 1) {
     if (argc == 0)
       cmd_error(CMD_PARSE_ERROR, err, "Missing identifier.");
@@ -76,6 +90,62 @@ cmd_status_t cmd_parse_getval(size_t argc, char **argv,
     fflush(fh);                                                                \
   } while (0)
 
+static cmd_status_t cmd_handle_getval_filter(FILE *fh,
+                                             cmd_filter_t const *filter,
+                                             cmd_error_handler_t *err) {
+  uc_cursor_t *cursor =
+      uc_cursor_create(filter->prefix, filter->labels, GETVAL_CHUNK_SIZE);
+  if (cursor == NULL) {
+    cmd_error(CMD_ERROR, err, "uc_cursor_create failed.");
+    return CMD_ERROR;
+  }
+
+  /* Entries which the cursor may still return are not removed from the
+   * cache, so the cursor returns at least "number" entries. */
+  size_t number = 0;
+  int status = uc_cursor_count(cursor, &number);
+  if (status != 0) {
+    cmd_error(CMD_ERROR, err, "uc_cursor_count failed.");
+    uc_cursor_destroy(cursor);
+    return CMD_ERROR;
+  }
+
+  if (fprintf(fh, "%zu Value%s found\n", number, (number == 1) ? "" : "s") <
+      0) {
+    WARNING("cmd_handle_getval: failed to write to socket #%i: %s", fileno(fh),
+            STRERRNO);
+    uc_cursor_destroy(cursor);
+    return CMD_ERROR;
+  }
+
+  size_t printed = 0;
+  while (printed < number) {
+    uc_cursor_entry_t *entries = NULL;
+    size_t entries_num = 0;
+    status = uc_cursor_next(cursor, &entries, &entries_num);
+    if ((status != 0) || (entries_num == 0)) {
+      ERROR("cmd_handle_getval: uc_cursor_next failed after %zu of %zu values.",
+            printed, number);
+      break;
+    }
+
+    for (size_t i = 0; (i < entries_num) && (printed < number); i++) {
+      if (fprintf(fh, GAUGE_FORMAT " %s\n", entries[i].rate, entries[i].name) <
+          0) {
+        WARNING("cmd_handle_getval: failed to write to socket #%i: %s",
+                fileno(fh), STRERRNO);
+        uc_cursor_destroy(cursor);
+        return CMD_ERROR;
+      }
+      printed++;
+    }
+  }
+  fflush(fh);
+
+  uc_cursor_destroy(cursor);
+  return (printed == number) ? CMD_OK : CMD_ERROR;
+} /* cmd_status_t cmd_handle_getval_filter */
+
 cmd_status_t cmd_handle_getval(FILE *fh, char *buffer) {
   cmd_error_handler_t err = {cmd_error_fh, fh};
   cmd_status_t status;
@@ -96,6 +166,12 @@ cmd_status_t cmd_handle_getval(FILE *fh, char *buffer) {
     return CMD_UNKNOWN_COMMAND;
   }
 
+  if (cmd.cmd.getval.raw_identifier == NULL) {
+    status = cmd_handle_getval_filter(fh, &cmd.cmd.getval.filter, &err);
+    cmd_destroy(&cmd);
+    return status;
+  }
+
   gauge_t value;
   /* TODO(octo): raw_identifier may need to be upgraded to a metric_t style
    * identifier. */
@@ -119,5 +195,7 @@ void cmd_destroy_getval(cmd_getval_t *getval) {
     return;
 
   sfree(getval->raw_identifier);
-  metric_family_free(getval->metric->family);
+  if (getval->metric != NULL)
+    metric_family_free(getval->metric->family);
+  cmd_destroy_filter(&getval->filter);
 } /* void cmd_destroy_getval */
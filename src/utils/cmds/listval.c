@@ -33,38 +33,32 @@
 #include "utils/cmds/parse_option.h"
 #include "utils_cache.h"
 
+/* Number of cache entries copied per call to uc_cursor_next(). */
+#define LISTVAL_CHUNK_SIZE 1024
+
 cmd_status_t cmd_parse_listval(size_t argc, char **argv,
+                               cmd_listval_t *ret_listval,
                                const cmd_options_t *opts
                                __attribute__((unused)),
                                cmd_error_handler_t *err) {
-  if (argc != 0) {
-    cmd_error(CMD_PARSE_ERROR, err, "Garbage after end of command: `%s'.",
-              argv[0]);
-    return CMD_PARSE_ERROR;
+  if (ret_listval == NULL) {
+    errno = EINVAL;
+    cmd_error(CMD_ERROR, err, "Invalid arguments to cmd_parse_listval.");
+    return CMD_ERROR;
   }
 
-  return CMD_OK;
+  return cmd_parse_filter(argc, argv, &ret_listval->filter, err);
 } /* cmd_status_t cmd_parse_listval */
 
-#define free_everything_and_return(status)                                     \
-  do {                                                                         \
-    for (size_t j = 0; j < number; j++) {                                      \
-      sfree(names[j]);                                                         \
-      names[j] = NULL;                                                         \
-    }                                                                          \
-    sfree(names);                                                              \
-    sfree(times);                                                              \
-    return status;                                                             \
-  } while (0)
-
 #define print_to_socket(fh, ...)                                               \
   do {                                                                         \
     if (fprintf(fh, __VA_ARGS__) < 0) {                                        \
       WARNING("handle_listval: failed to write to socket #%i: %s", fileno(fh), \
               STRERRNO);                                                       \
-      free_everything_and_return(CMD_ERROR);                                   \
+      uc_cursor_destroy(cursor);                                               \
+      cmd_destroy(&cmd);                                                       \
+      return CMD_ERROR;                                                        \
     }                                                                          \
-    fflush(fh);                                                                \
   } while (0)
 
 cmd_status_t cmd_handle_listval(FILE *fh, char *buffer) {
@@ -72,10 +66,6 @@ cmd_status_t cmd_handle_listval(FILE *fh, char *buffer) {
   cmd_status_t status;
   cmd_t cmd;
 
-  char **names = NULL;
-  cdtime_t *times = NULL;
-  size_t number = 0;
-
   DEBUG("utils_cmd_listval: handle_listval (fh = %p, buffer = %s);", (void *)fh,
         buffer);
 
@@ -84,20 +74,65 @@ cmd_status_t cmd_handle_listval(FILE *fh, char *buffer) {
   if (cmd.type != CMD_LISTVAL) {
     cmd_error(CMD_UNKNOWN_COMMAND, &err, "Unexpected command: `%s'.",
               CMD_TO_STRING(cmd.type));
-    free_everything_and_return(CMD_UNKNOWN_COMMAND);
+    cmd_destroy(&cmd);
+    return CMD_UNKNOWN_COMMAND;
   }
 
-  status = uc_get_names(&names, &times, &number);
-  if (status != 0) {
-    DEBUG("command listval: uc_get_names failed with status %i", status);
-    cmd_error(CMD_ERROR, &err, "uc_get_names failed.");
-    free_everything_and_return(CMD_ERROR);
+  cmd_filter_t *filter = &cmd.cmd.listval.filter;
+  uc_cursor_t *cursor =
+      uc_cursor_create(filter->prefix, filter->labels, LISTVAL_CHUNK_SIZE);
+  if (cursor == NULL) {
+    cmd_error(CMD_ERROR, &err, "uc_cursor_create failed.");
+    cmd_destroy(&cmd);
+    return CMD_ERROR;
+  }
+
+  /* The number of values precedes the values. Entries which the cursor may
+   * still return are not removed from the cache, so the cursor returns at
+   * least this many entries. */
+  size_t number = 0;
+  int uc_status = uc_cursor_count(cursor, &number);
+  if (uc_status != 0) {
+    DEBUG("command listval: uc_cursor_count failed with status %i",
+          uc_status);
+    cmd_error(CMD_ERROR, &err, "uc_cursor_count failed.");
+    uc_cursor_destroy(cursor);
+    cmd_destroy(&cmd);
+    return CMD_ERROR;
   }
 
   print_to_socket(fh, "%i Value%s found\n", (int)number,
                   (number == 1) ? "" : "s");
-  for (size_t i = 0; i < number; i++)
-    print_to_socket(fh, "%.3f %s\n", CDTIME_T_TO_DOUBLE(times[i]), names[i]);
+  fflush(fh);
 
-  free_everything_and_return(CMD_OK);
+  size_t printed = 0;
+  while (printed < number) {
+    uc_cursor_entry_t *entries = NULL;
+    size_t entries_num = 0;
+    uc_status = uc_cursor_next(cursor, &entries, &entries_num);
+    if ((uc_status != 0) || (entries_num == 0)) {
+      ERROR("command listval: uc_cursor_next failed after %zu of %zu values.",
+            printed, number);
+      break;
+    }
+
+    for (size_t i = 0; (i < entries_num) && (printed < number); i++) {
+      print_to_socket(fh, "%.3f %s\n", CDTIME_T_TO_DOUBLE(entries[i].time),
+                      entries[i].name);
+      printed++;
+    }
+    /* Flush once per chunk rather than once per line. */
+    fflush(fh);
+  }
+
+  uc_cursor_destroy(cursor);
+  cmd_destroy(&cmd);
+  return (printed == number) ? CMD_OK : CMD_ERROR;
 } /* cmd_status_t cmd_handle_listval */
+
+void cmd_destroy_listval(cmd_listval_t *listval) {
+  if (listval == NULL)
+    return;
+
+  cmd_destroy_filter(&listval->filter);
+} /* void cmd_destroy_listval */
@@ -201,7 +201,7 @@ cmd_status_t cmd_handle_putmetric(FILE *fh, char *buffer) {
   int status;
   if ((status = cmd_parse(buffer, &cmd, NULL, &err)) != CMD_OK)
     return status;
-  if (cmd.type != CMD_PUTVAL) {
+  if (cmd.type != CMD_PUTMETRIC) {
     cmd_error(CMD_UNKNOWN_COMMAND, &err, "Unexpected command: `%s'.",
               CMD_TO_STRING(cmd.type));
     cmd_destroy(&cmd);
@@ -0,0 +1,775 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "utils/common/common.h"
+#include "utils/format_binary/format_binary.h"
+
+/*
+ * String table
+ */
+typedef struct {
+  char const *str;
+  size_t index;
+} strtab_slot_t;
+
+typedef struct {
+  /* Open addressing hash table, the number of slots is a power of two. */
+  strtab_slot_t *slots;
+  size_t slots_num;
+
+  char const **strs;
+  size_t strs_num;
+
+  /* Copies of strings not owned by the encoded families. */
+  char **owned;
+  size_t owned_num;
+} strtab_t;
+
+static uint64_t strtab_hash(char const *s) {
+  /* FNV-1a */
+  uint64_t h = 14695981039346656037ULL;
+  for (; *s != 0; s++) {
+    h ^= (uint8_t)*s;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static int strtab_grow(strtab_t *t) {
+  size_t num = (t->slots_num == 0) ? 64 : 2 * t->slots_num;
+
+  strtab_slot_t *slots = calloc(num, sizeof(*slots));
+  char const **strs = realloc(t->strs, (num / 2) * sizeof(*strs));
+  if ((slots == NULL) || (strs == NULL)) {
+    free(slots);
+    if (strs != NULL)
+      t->strs = strs;
+    return ENOMEM;
+  }
+
+  for (size_t i = 0; i < t->slots_num; i++) {
+    if (t->slots[i].str == NULL)
+      continue;
+
+    size_t j = strtab_hash(t->slots[i].str) & (num - 1);
+    while (slots[j].str != NULL)
+      j = (j + 1) & (num - 1);
+    slots[j] = t->slots[i];
+  }
+
+  free(t->slots);
+  t->slots = slots;
+  t->slots_num = num;
+  t->strs = strs;
+  return 0;
+}
+
+/* strtab_add returns the index of "s" in "ret_index", adding "s" to the table
+ * if necessary. "s" must stay valid until the table is destroyed. */
+static int strtab_add(strtab_t *t, char const *s, size_t *ret_index) {
+  if (2 * (t->strs_num + 1) > t->slots_num) {
+    int status = strtab_grow(t);
+    if (status != 0)
+      return status;
+  }
+
+  size_t mask = t->slots_num - 1;
+  size_t i = strtab_hash(s) & mask;
+  while (t->slots[i].str != NULL) {
+    if (strcmp(t->slots[i].str, s) == 0) {
+      if (ret_index != NULL)
+        *ret_index = t->slots[i].index;
+      return 0;
+    }
+    i = (i + 1) & mask;
+  }
+
+  t->slots[i] = (strtab_slot_t){.str = s, .index = t->strs_num};
+  t->strs[t->strs_num] = s;
+  if (ret_index != NULL)
+    *ret_index = t->strs_num;
+  t->strs_num++;
+  return 0;
+}
+
+/* strtab_add_copy is like strtab_add for strings that may be freed before the
+ * table is. */
+static int strtab_add_copy(strtab_t *t, char const *s, size_t *ret_index) {
+  size_t num = t->strs_num;
+  int status = strtab_add(t, s, ret_index);
+  if ((status != 0) || (t->strs_num == num))
+    return status;
+
+  char **owned = realloc(t->owned, (t->owned_num + 1) * sizeof(*owned));
+  char *copy = strdup(s);
+  if ((owned == NULL) || (copy == NULL)) {
+    if (owned != NULL)
+      t->owned = owned;
+    free(copy);
+    /* Remove the entry again. */
+    for (size_t i = 0; i < t->slots_num; i++)
+      if (t->slots[i].str == s)
+        t->slots[i].str = NULL;
+    t->strs_num--;
+    return ENOMEM;
+  }
+  t->owned = owned;
+  t->owned[t->owned_num] = copy;
+  t->owned_num++;
+
+  /* Point the table at the copy. */
+  for (size_t i = 0; i < t->slots_num; i++)
+    if (t->slots[i].str == s)
+      t->slots[i].str = copy;
+  t->strs[t->strs_num - 1] = copy;
+  return 0;
+}
+
+static void strtab_reset(strtab_t *t) {
+  for (size_t i = 0; i < t->owned_num; i++)
+    free(t->owned[i]);
+  free(t->owned);
+  free(t->slots);
+  free(t->strs);
+  *t = (strtab_t){0};
+}
+
+/*
+ * Encoding
+ */
+static int put_varint(strbuf_t *buf, uint64_t v) {
+  uint8_t tmp[10];
+  size_t n = 0;
+  while (v >= 0x80) {
+    tmp[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  tmp[n++] = (uint8_t)v;
+  return strbuf_putn(buf, tmp, n);
+}
+
+static int put_zigzag(strbuf_t *buf, int64_t v) {
+  return put_varint(buf, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static uint64_t double_bits(double d) {
+  uint64_t v;
+  memcpy(&v, &d, sizeof(v));
+  return v;
+}
+
+/* put_double stores the XOR of "d" and the previous value. The bytes are
+ * swapped, so that the low-order mantissa bits, which are zero for integers
+ * and short fractions, become the leading zeros of the variable length
+ * integer. */
+static int put_double(strbuf_t *buf, double d, uint64_t *prev) {
+  uint64_t v = double_bits(d);
+  int status = put_varint(buf, __builtin_bswap64(v ^ *prev));
+  *prev = v;
+  return status;
+}
+
+static int put_string_index(strbuf_t *buf, strtab_t *t, char const *s) {
+  size_t index = 0;
+  int status = strtab_add(t, s, &index);
+  if (status != 0)
+    return status;
+  return put_varint(buf, (uint64_t)index);
+}
+
+typedef struct {
+  strtab_t strtab;
+  strbuf_t *buf;
+  cdtime_t time;
+  cdtime_t interval;
+} encoder_t;
+
+/* Meta data is a list of key, type, value. Strings are stored in the string
+ * table. If "enc->buf" is NULL, the strings are only added to the table. */
+static int encode_meta(encoder_t *enc, meta_data_t *md) {
+  if (md == NULL)
+    return (enc->buf == NULL) ? 0 : put_varint(enc->buf, 0);
+
+  char **toc = NULL;
+  int toc_num = meta_data_toc(md, &toc);
+  if (toc_num < 0)
+    return EINVAL;
+
+  int status = 0;
+  if (enc->buf != NULL)
+    status = put_varint(enc->buf, (uint64_t)toc_num);
+
+  for (int i = 0; (i < toc_num) && (status == 0); i++) {
+    int type = meta_data_type(md, toc[i]);
+
+    if (enc->buf == NULL) {
+      status = strtab_add_copy(&enc->strtab, toc[i], NULL);
+      if ((status == 0) && (type == MD_TYPE_STRING)) {
+        char *v = NULL;
+        status = meta_data_get_string(md, toc[i], &v);
+        if (status == 0)
+          status = strtab_add_copy(&enc->strtab, v, NULL);
+        free(v);
+      }
+      continue;
+    }
+
+    status = put_string_index(enc->buf, &enc->strtab, toc[i]);
+    uint8_t t = (uint8_t)type;
+    status = status || strbuf_putn(enc->buf, &t, 1);
+    if (status != 0)
+      break;
+
+    switch (type) {
+    case MD_TYPE_STRING: {
+      char *v = NULL;
+      status = meta_data_get_string(md, toc[i], &v);
+      if (status == 0)
+        status = put_string_index(enc->buf, &enc->strtab, v);
+      free(v);
+      break;
+    }
+    case MD_TYPE_SIGNED_INT: {
+      int64_t v = 0;
+      status = meta_data_get_signed_int(md, toc[i], &v);
+      status = status || put_zigzag(enc->buf, v);
+      break;
+    }
+    case MD_TYPE_UNSIGNED_INT: {
+      uint64_t v = 0;
+      status = meta_data_get_unsigned_int(md, toc[i], &v);
+      status = status || put_varint(enc->buf, v);
+      break;
+    }
+    case MD_TYPE_DOUBLE: {
+      double v = 0;
+      uint64_t prev = 0;
+      status = meta_data_get_double(md, toc[i], &v);
+      status = status || put_double(enc->buf, v, &prev);
+      break;
+    }
+    case MD_TYPE_BOOLEAN: {
+      bool v = false;
+      status = meta_data_get_boolean(md, toc[i], &v);
+      uint8_t b = v ? 1 : 0;
+      status = status || strbuf_putn(enc->buf, &b, 1);
+      break;
+    }
+    default:
+      status = EINVAL;
+    }
+  }
+
+  for (int i = 0; i < toc_num; i++)
+    free(toc[i]);
+  free(toc);
+  return status ? EINVAL : 0;
+}
+
+static int encode_distribution(strbuf_t *buf, distribution_t *d) {
+  buckets_array_t buckets = get_buckets(d);
+  int status = put_varint(buf, (uint64_t)buckets.num_buckets);
+
+  uint64_t prev = 0;
+  for (size_t i = 0; (i < buckets.num_buckets) && (status == 0); i++) {
+    status = put_double(buf, buckets.buckets[i].maximum, &prev);
+    status = status || put_varint(buf, buckets.buckets[i].bucket_counter);
+  }
+  destroy_buckets_array(buckets);
+  if ((status != 0) || (buckets.num_buckets == 0))
+    return status;
+
+  prev = 0;
+  status = put_double(buf, distribution_total_sum(d), &prev);
+  prev = 0;
+  return status || put_double(buf, distribution_squares_sum(d), &prev);
+}
+
+static int encode_family(encoder_t *enc, metric_family_t const *fam) {
+  strbuf_t *buf = enc->buf;
+
+  int status = put_string_index(buf, &enc->strtab, fam->name);
+  if (fam->help == NULL) {
+    status = status || put_varint(buf, 0);
+  } else {
+    size_t index = 0;
+    status = status || strtab_add(&enc->strtab, fam->help, &index);
+    status = status || put_varint(buf, (uint64_t)index + 1);
+  }
+  status = status || put_varint(buf, (uint64_t)fam->type);
+  status = status || put_varint(buf, (uint64_t)fam->metric.num);
+
+  counter_t prev_counter = 0;
+  uint64_t prev_gauge = 0;
+  for (size_t i = 0; (i < fam->metric.num) && (status == 0); i++) {
+    metric_t const *m = fam->metric.ptr + i;
+
+    status = put_varint(buf, (uint64_t)m->label.num);
+    for (size_t j = 0; (j < m->label.num) && (status == 0); j++) {
+      status = put_string_index(buf, &enc->strtab, m->label.ptr[j].name);
+      status =
+          status || put_string_index(buf, &enc->strtab, m->label.ptr[j].value);
+    }
+
+    status = status || put_zigzag(buf, (int64_t)(m->time - enc->time));
+    status = status || put_zigzag(buf, (int64_t)(m->interval - enc->interval));
+    enc->time = m->time;
+    enc->interval = m->interval;
+
+    switch (fam->type) {
+    case METRIC_TYPE_COUNTER:
+      status = status ||
+               put_zigzag(buf, (int64_t)(m->value.counter - prev_counter));
+      prev_counter = m->value.counter;
+      break;
+    case METRIC_TYPE_GAUGE:
+    case METRIC_TYPE_UNTYPED:
+      status = status || put_double(buf, m->value.gauge, &prev_gauge);
+      break;
+    case METRIC_TYPE_DISTRIBUTION:
+      status = status || encode_distribution(buf, m->value.distribution);
+      break;
+    }
+
+    status = status || encode_meta(enc, m->meta);
+  }
+
+  return status ? ENOMEM : 0;
+}
+
+/* collect_strings adds all strings of "fam" to the string table. */
+static int collect_strings(encoder_t *enc, metric_family_t const *fam) {
+  if (fam->name == NULL)
+    return EINVAL;
+
+  int status = strtab_add(&enc->strtab, fam->name, NULL);
+  if (fam->help != NULL)
+    status = status || strtab_add(&enc->strtab, fam->help, NULL);
+
+  for (size_t i = 0; (i < fam->metric.num) && (status == 0); i++) {
+    metric_t const *m = fam->metric.ptr + i;
+    for (size_t j = 0; (j < m->label.num) && (status == 0); j++) {
+      status = strtab_add(&enc->strtab, m->label.ptr[j].name, NULL);
+      status = status || strtab_add(&enc->strtab, m->label.ptr[j].value, NULL);
+    }
+    status = status || encode_meta(enc, m->meta);
+  }
+
+  return status ? ENOMEM : 0;
+}
+
+int format_binary_encode(strbuf_t *buf, metric_family_t const *const *fams,
+                         size_t fams_num) {
+  if ((buf == NULL) || ((fams == NULL) && (fams_num != 0)))
+    return EINVAL;
+
+  encoder_t enc = {0};
+  int status = 0;
+  for (size_t i = 0; (i < fams_num) && (status == 0); i++)
+    status = collect_strings(&enc, fams[i]);
+  if (status != 0) {
+    strtab_reset(&enc.strtab);
+    return status;
+  }
+
+  strbuf_t payload = STRBUF_CREATE;
+  enc.buf = &payload;
+
+  status = put_varint(&payload, (uint64_t)enc.strtab.strs_num);
+  for (size_t i = 0; (i < enc.strtab.strs_num) && (status == 0); i++) {
+    size_t len = strlen(enc.strtab.strs[i]);
+    status = put_varint(&payload, (uint64_t)len);
+    status = status || strbuf_putn(&payload, enc.strtab.strs[i], len);
+  }
+
+  status = status || put_varint(&payload, (uint64_t)fams_num);
+  for (size_t i = 0; (i < fams_num) && (status == 0); i++)
+    status = encode_family(&enc, fams[i]);
+
+  if ((status == 0) && (payload.pos > FORMAT_BINARY_MAX_SIZE))
+    status = EINVAL;
+
+  if (status == 0) {
+    uint8_t version = FORMAT_BINARY_VERSION;
+    status = strbuf_putn(buf, &version, 1);
+    status = status || put_varint(buf, (uint64_t)payload.pos);
+    status = status || strbuf_putn(buf, payload.ptr, payload.pos);
+    if (status != 0)
+      status = ENOMEM;
+  }
+
+  STRBUF_DESTROY(payload);
+  strtab_reset(&enc.strtab);
+  return status;
+}
+
+/*
+ * Decoding
+ */
+typedef struct {
+  uint8_t const *ptr;
+  size_t len;
+
+  char **strs;
+  size_t strs_num;
+
+  cdtime_t time;
+  cdtime_t interval;
+} decoder_t;
+
+static int get_varint(decoder_t *dec, uint64_t *ret) {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (dec->len == 0)
+      return EAGAIN;
+    uint8_t b = *dec->ptr;
+    dec->ptr++;
+    dec->len--;
+
+    v |= ((uint64_t)(b & 0x7f)) << shift;
+    if ((b & 0x80) == 0) {
+      *ret = v;
+      return 0;
+    }
+  }
+  return EINVAL;
+}
+
+static int get_zigzag(decoder_t *dec, int64_t *ret) {
+  uint64_t v;
+  int status = get_varint(dec, &v);
+  if (status != 0)
+    return status;
+
+  *ret = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+  return 0;
+}
+
+static int get_u8(decoder_t *dec, uint8_t *ret) {
+  if (dec->len == 0)
+    return EINVAL;
+  *ret = *dec->ptr;
+  dec->ptr++;
+  dec->len--;
+  return 0;
+}
+
+static int get_double(decoder_t *dec, double *ret, uint64_t *prev) {
+  uint64_t v;
+  int status = get_varint(dec, &v);
+  if (status != 0)
+    return status;
+
+  *prev ^= __builtin_bswap64(v);
+  memcpy(ret, prev, sizeof(*ret));
+  return 0;
+}
+
+/* get_string returns a string of the table. The string is owned by the
+ * decoder. */
+static int get_string(decoder_t *dec, char const **ret) {
+  uint64_t index;
+  int status = get_varint(dec, &index);
+  if (status != 0)
+    return status;
+  if (index >= dec->strs_num)
+    return EINVAL;
+
+  *ret = dec->strs[index];
+  return 0;
+}
+
+/* get_count reads the number of following elements, which need at least one
+ * byte each. */
+static int get_count(decoder_t *dec, uint64_t *ret) {
+  int status = get_varint(dec, ret);
+  if (status != 0)
+    return status;
+  if (*ret > dec->len)
+    return EINVAL;
+  return 0;
+}
+
+static int decode_strings(decoder_t *dec) {
+  uint64_t num;
+  int status = get_count(dec, &num);
+  if (status != 0)
+    return status;
+
+  dec->strs = calloc(num + 1, sizeof(*dec->strs));
+  if (dec->strs == NULL)
+    return ENOMEM;
+
+  for (uint64_t i = 0; i < num; i++) {
+    uint64_t len;
+    status = get_varint(dec, &len);
+    if (status != 0)
+      return status;
+    if ((len > dec->len) || (memchr(dec->ptr, 0, (size_t)len) != NULL))
+      return EINVAL;
+
+    dec->strs[i] = strndup((char const *)dec->ptr, (size_t)len);
+    if (dec->strs[i] == NULL)
+      return ENOMEM;
+    dec->strs_num++;
+
+    dec->ptr += len;
+    dec->len -= (size_t)len;
+  }
+
+  return 0;
+}
+
+static int decode_meta(decoder_t *dec, meta_data_t **ret) {
+  uint64_t num;
+  int status = get_count(dec, &num);
+  if ((status != 0) || (num == 0))
+    return status;
+
+  meta_data_t *md = meta_data_create();
+  if (md == NULL)
+    return ENOMEM;
+
+  for (uint64_t i = 0; (i < num) && (status == 0); i++) {
+    char const *key = NULL;
+    uint8_t type = 0;
+    status = get_string(dec, &key);
+    status = status || get_u8(dec, &type);
+    if (status != 0)
+      break;
+
+    switch (type) {
+    case MD_TYPE_STRING: {
+      char const *v = NULL;
+      status = get_string(dec, &v);
+      status = status || meta_data_add_string(md, key, v);
+      break;
+    }
+    case MD_TYPE_SIGNED_INT: {
+      int64_t v = 0;
+      status = get_zigzag(dec, &v);
+      status = status || meta_data_add_signed_int(md, key, v);
+      break;
+    }
+    case MD_TYPE_UNSIGNED_INT: {
+      uint64_t v = 0;
+      status = get_varint(dec, &v);
+      status = status || meta_data_add_unsigned_int(md, key, v);
+      break;
+    }
+    case MD_TYPE_DOUBLE: {
+      double v = 0;
+      uint64_t prev = 0;
+      status = get_double(dec, &v, &prev);
+      status = status || meta_data_add_double(md, key, v);
+      break;
+    }
+    case MD_TYPE_BOOLEAN: {
+      uint8_t v = 0;
+      status = get_u8(dec, &v);
+      if ((status == 0) && (v > 1))
+        status = EINVAL;
+      status = status || meta_data_add_boolean(md, key, v == 1);
+      break;
+    }
+    default:
+      status = EINVAL;
+    }
+  }
+
+  if (status != 0) {
+    meta_data_destroy(md);
+    return EINVAL;
+  }
+
+  *ret = md;
+  return 0;
+}
+
+static int decode_distribution(decoder_t *dec, distribution_t **ret) {
+  uint64_t num;
+  int status = get_count(dec, &num);
+  if (status != 0)
+    return status;
+  if (num == 0) {
+    *ret = NULL;
+    return 0;
+  }
+
+  buckets_array_t buckets = {
+      .num_buckets = (size_t)num,
+      .buckets = calloc((size_t)num, sizeof(*buckets.buckets)),
+  };
+  if (buckets.buckets == NULL)
+    return ENOMEM;
+
+  uint64_t prev = 0;
+  for (size_t i = 0; (i < buckets.num_buckets) && (status == 0); i++) {
+    status = get_double(dec, &buckets.buckets[i].maximum, &prev);
+    status = status || get_varint(dec, &buckets.buckets[i].bucket_counter);
+  }
+
+  double sum = 0, squares_sum = 0;
+  uint64_t prev_sum = 0, prev_squares_sum = 0;
+  status = status || get_double(dec, &sum, &prev_sum);
+  status = status || get_double(dec, &squares_sum, &prev_squares_sum);
+  if (status == 0) {
+    *ret = distribution_new_buckets(buckets, sum, squares_sum);
+    if (*ret == NULL)
+      status = EINVAL;
+  }
+
+  destroy_buckets_array(buckets);
+  return status ? EINVAL : 0;
+}
+
+static metric_family_t *decode_family(decoder_t *dec) {
+  metric_family_t *fam = calloc(1, sizeof(*fam));
+  if (fam == NULL)
+    return NULL;
+
+  char const *name = NULL;
+  uint64_t help = 0;
+  uint64_t type = 0;
+  uint64_t num = 0;
+  int status = get_string(dec, &name);
+  status = status || get_varint(dec, &help);
+  status = status || get_varint(dec, &type);
+  status = status || get_count(dec, &num);
+  if ((status != 0) || (name[0] == 0) || (help > dec->strs_num) ||
+      (type > METRIC_TYPE_DISTRIBUTION)) {
+    free(fam);
+    return NULL;
+  }
+
+  fam->name = strdup(name);
+  if (help > 0)
+    fam->help = strdup(dec->strs[help - 1]);
+  fam->type = (metric_type_t)type;
+  if ((fam->name == NULL) || ((help > 0) && (fam->help == NULL))) {
+    metric_family_free(fam);
+    return NULL;
+  }
+
+  counter_t prev_counter = 0;
+  uint64_t prev_gauge = 0;
+  for (uint64_t i = 0; (i < num) && (status == 0); i++) {
+    metric_t m = {.family = fam};
+
+    uint64_t labels_num;
+    status = get_count(dec, &labels_num);
+    for (uint64_t j = 0; (j < labels_num) && (status == 0); j++) {
+      char const *lname = NULL;
+      char const *lvalue = NULL;
+      status = get_string(dec, &lname);
+      status = status || get_string(dec, &lvalue);
+      /* An empty value would remove the label. */
+      if ((status == 0) && (lvalue[0] == 0))
+        status = EINVAL;
+      status = status || metric_label_set(&m, lname, lvalue);
+    }
+
+    int64_t delta = 0;
+    status = status || get_zigzag(dec, &delta);
+    m.time = dec->time + (cdtime_t)delta;
+    status = status || get_zigzag(dec, &delta);
+    m.interval = dec->interval + (cdtime_t)delta;
+    dec->time = m.time;
+    dec->interval = m.interval;
+
+    switch (fam->type) {
+    case METRIC_TYPE_COUNTER:
+      status = status || get_zigzag(dec, &delta);
+      m.value.counter = prev_counter + (counter_t)delta;
+      prev_counter = m.value.counter;
+      break;
+    case METRIC_TYPE_GAUGE:
+    case METRIC_TYPE_UNTYPED:
+      status = status || get_double(dec, &m.value.gauge, &prev_gauge);
+      break;
+    case METRIC_TYPE_DISTRIBUTION:
+      status = status || decode_distribution(dec, &m.value.distribution);
+      break;
+    }
+
+    status = status || decode_meta(dec, &m.meta);
+    status = status || metric_family_metric_append(fam, m);
+    metric_reset(&m);
+  }
+
+  if (status != 0) {
+    metric_family_free(fam);
+    return NULL;
+  }
+  return fam;
+}
+
+void format_binary_families_free(metric_family_t **fams, size_t fams_num) {
+  if (fams == NULL)
+    return;
+
+  for (size_t i = 0; i < fams_num; i++)
+    metric_family_free(fams[i]);
+  free(fams);
+}
+
+int format_binary_decode(void const *data, size_t size,
+                         metric_family_t ***ret_fams, size_t *ret_fams_num,
+                         size_t *ret_size) {
+  if (((data == NULL) && (size != 0)) || (ret_fams == NULL) ||
+      (ret_fams_num == NULL))
+    return EINVAL;
+  if (size == 0)
+    return EAGAIN;
+
+  uint8_t const *ptr = data;
+  if (ptr[0] != FORMAT_BINARY_VERSION)
+    return ENOTSUP;
+
+  decoder_t dec = {.ptr = ptr + 1, .len = size - 1};
+  uint64_t len;
+  int status = get_varint(&dec, &len);
+  if (status != 0)
+    return status;
+  if (len > FORMAT_BINARY_MAX_SIZE)
+    return EINVAL;
+  if (len > dec.len)
+    return EAGAIN;
+
+  size_t msg_size = (size_t)(dec.ptr - ptr) + (size_t)len;
+  dec.len = (size_t)len;
+
+  metric_family_t **fams = NULL;
+  uint64_t fams_num = 0;
+  status = decode_strings(&dec);
+  status = status || get_count(&dec, &fams_num);
+  if (status == 0) {
+    fams = calloc(fams_num + 1, sizeof(*fams));
+    if (fams == NULL)
+      status = ENOMEM;
+  }
+
+  for (uint64_t i = 0; (i < fams_num) && (status == 0); i++) {
+    fams[i] = decode_family(&dec);
+    if (fams[i] == NULL)
+      status = EINVAL;
+  }
+  if ((status == 0) && (dec.len != 0))
+    status = EINVAL;
+
+  for (size_t i = 0; i < dec.strs_num; i++)
+    free(dec.strs[i]);
+  free(dec.strs);
+
+  if (status != 0) {
+    format_binary_families_free(fams, (size_t)fams_num);
+    /* Within a complete message, missing data means it is malformed. */
+    return (status == ENOMEM) ? ENOMEM : EINVAL;
+  }
+
+  *ret_fams = fams;
+  *ret_fams_num = (size_t)fams_num;
+  if (ret_size != NULL)
+    *ret_size = msg_size;
+  return 0;
+}
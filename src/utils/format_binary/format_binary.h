@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef UTILS_FORMAT_BINARY_H
+#define UTILS_FORMAT_BINARY_H 1
+
+#include "collectd.h"
+
+#include "metric.h"
+#include "utils/strbuf/strbuf.h"
+
+/* Binary encoding of metric families, used to pass them between ncollectd
+ * instances and to store them on disk without loss.
+ *
+ * A message is the format version (one byte), the length of the payload as
+ * variable length integer and the payload. The payload starts with a table of
+ * all strings used in the message: family names, help texts, label names and
+ * values and meta data. Families refer to strings by their index in the table,
+ * so that names and labels repeated between metrics are stored once.
+ *
+ * Integers are stored as variable length integers (LEB128). Times, intervals
+ * and counters are stored as the difference to the previous metric, gauges and
+ * other floating point numbers as the XOR with the previous value, so that
+ * similar metrics need few bytes. */
+
+#define FORMAT_BINARY_VERSION 1
+
+/* Messages with a longer payload are rejected. */
+#define FORMAT_BINARY_MAX_SIZE (64 * 1024 * 1024)
+
+/* format_binary_encode appends a message holding the "fams_num" families in
+ * "fams" to "buf". */
+int format_binary_encode(strbuf_t *buf, metric_family_t const *const *fams,
+                         size_t fams_num);
+
+/* format_binary_decode decodes the message at the start of "data", which holds
+ * "size" bytes. On success, the families are returned in "ret_fams", which
+ * must be freed with format_binary_families_free, and the size of the message
+ * in "ret_size", so that consecutive messages can be read from a stream.
+ *
+ * Returns EAGAIN if "data" only holds the beginning of a message, ENOTSUP if
+ * the message has an unknown version and EINVAL if it is malformed. */
+int format_binary_decode(void const *data, size_t size,
+                         metric_family_t ***ret_fams, size_t *ret_fams_num,
+                         size_t *ret_size);
+
+void format_binary_families_free(metric_family_t **fams, size_t fams_num);
+
+#endif /* UTILS_FORMAT_BINARY_H */
@@ -0,0 +1,323 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/common/common.h"
+#include "utils/format_binary/format_binary.h"
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* make_family returns a family of "type" with "num" metrics, which differ in
+ * the "instance" label. */
+static metric_family_t *make_family(char const *name, metric_type_t type,
+                                    size_t num) {
+  metric_family_t *fam = calloc(1, sizeof(*fam));
+  fam->name = strdup(name);
+  fam->type = type;
+
+  for (size_t i = 0; i < num; i++) {
+    metric_t m = {
+        .time = TIME_T_TO_CDTIME_T(1700000000) + i * DOUBLE_TO_CDTIME_T(0.001),
+        .interval = TIME_T_TO_CDTIME_T(10),
+    };
+
+    switch (type) {
+    case METRIC_TYPE_COUNTER:
+      m.value.counter = 1000000 + 37 * i;
+      break;
+    case METRIC_TYPE_GAUGE:
+    case METRIC_TYPE_UNTYPED:
+      m.value.gauge = 20.0 + (double)(i % 8) / 4.0;
+      break;
+    case METRIC_TYPE_DISTRIBUTION:
+      m.value.distribution = distribution_new_exponential(8, 2, 1);
+      for (size_t j = 0; j < i + 3; j++)
+        distribution_update(m.value.distribution, (double)(j * j) / 3.0);
+      break;
+    }
+
+    char value[32];
+    ssnprintf(value, sizeof(value), "%zu", i);
+    metric_label_set(&m, "instance", value);
+    metric_label_set(&m, "host", "example.com");
+    metric_family_metric_append(fam, m);
+    if (type == METRIC_TYPE_DISTRIBUTION)
+      distribution_destroy(m.value.distribution);
+    metric_reset(&m);
+  }
+
+  return fam;
+}
+
+static int expect_family(metric_family_t const *want,
+                         metric_family_t const *got) {
+  EXPECT_EQ_STR(want->name, got->name);
+  EXPECT_EQ_STR(want->help, got->help);
+  EXPECT_EQ_INT(want->type, got->type);
+  EXPECT_EQ_INT(want->metric.num, got->metric.num);
+
+  for (size_t i = 0; i < want->metric.num; i++) {
+    metric_t const *w = want->metric.ptr + i;
+    metric_t const *g = got->metric.ptr + i;
+
+    EXPECT_EQ_PTR((void *)got, (void *)g->family);
+    EXPECT_EQ_INT(w->label.num, g->label.num);
+    for (size_t j = 0; j < w->label.num; j++) {
+      EXPECT_EQ_STR(w->label.ptr[j].name, g->label.ptr[j].name);
+      EXPECT_EQ_STR(w->label.ptr[j].value, g->label.ptr[j].value);
+    }
+    EXPECT_EQ_UINT64(w->time, g->time);
+    EXPECT_EQ_UINT64(w->interval, g->interval);
+
+    switch (want->type) {
+    case METRIC_TYPE_COUNTER:
+      EXPECT_EQ_UINT64(w->value.counter, g->value.counter);
+      break;
+    case METRIC_TYPE_GAUGE:
+    case METRIC_TYPE_UNTYPED:
+      EXPECT_EQ_DOUBLE(w->value.gauge, g->value.gauge);
+      break;
+    case METRIC_TYPE_DISTRIBUTION: {
+      buckets_array_t wb = get_buckets(w->value.distribution);
+      buckets_array_t gb = get_buckets(g->value.distribution);
+      EXPECT_EQ_INT(wb.num_buckets, gb.num_buckets);
+      for (size_t j = 0; j < wb.num_buckets; j++) {
+        EXPECT_EQ_DOUBLE(wb.buckets[j].maximum, gb.buckets[j].maximum);
+        EXPECT_EQ_UINT64(wb.buckets[j].bucket_counter,
+                         gb.buckets[j].bucket_counter);
+      }
+      destroy_buckets_array(wb);
+      destroy_buckets_array(gb);
+      EXPECT_EQ_DOUBLE(distribution_total_sum(w->value.distribution),
+                       distribution_total_sum(g->value.distribution));
+      EXPECT_EQ_DOUBLE(distribution_squares_sum(w->value.distribution),
+                       distribution_squares_sum(g->value.distribution));
+      break;
+    }
+    }
+  }
+
+  return 0;
+}
+
+DEF_TEST(roundtrip) {
+  metric_family_t *fams[] = {
+      make_family("test_counter_total", METRIC_TYPE_COUNTER, 10),
+      make_family("test_gauge", METRIC_TYPE_GAUGE, 10),
+      make_family("test_untyped", METRIC_TYPE_UNTYPED, 1),
+      make_family("test_distribution", METRIC_TYPE_DISTRIBUTION, 4),
+      make_family("test_empty", METRIC_TYPE_GAUGE, 0),
+  };
+  fams[1]->help = strdup("A gauge with \"special\" characters\n");
+
+  /* Values which do not compress well. */
+  fams[1]->metric.ptr[0].value.gauge = NAN;
+  fams[1]->metric.ptr[1].value.gauge = -INFINITY;
+  fams[1]->metric.ptr[2].value.gauge = -0.1234567;
+  fams[0]->metric.ptr[3].value.counter = 0;
+  fams[0]->metric.ptr[4].value.counter = UINT64_MAX;
+  fams[0]->metric.ptr[5].time = 0;
+
+  meta_data_t *meta = meta_data_create();
+  meta_data_add_string(meta, "string", "value");
+  meta_data_add_signed_int(meta, "signed", -42);
+  meta_data_add_unsigned_int(meta, "unsigned", 42);
+  meta_data_add_double(meta, "double", 0.5);
+  meta_data_add_boolean(meta, "boolean", true);
+  fams[2]->metric.ptr[0].meta = meta;
+
+  strbuf_t buf = STRBUF_CREATE;
+  CHECK_ZERO(format_binary_encode(&buf, (metric_family_t const *const *)fams,
+                                  STATIC_ARRAY_SIZE(fams)));
+  EXPECT_EQ_INT(FORMAT_BINARY_VERSION, (uint8_t)buf.ptr[0]);
+
+  metric_family_t **got = NULL;
+  size_t got_num = 0;
+  size_t size = 0;
+  CHECK_ZERO(format_binary_decode(buf.ptr, buf.pos, &got, &got_num, &size));
+  EXPECT_EQ_INT(STATIC_ARRAY_SIZE(fams), got_num);
+  EXPECT_EQ_INT(buf.pos, size);
+
+  for (size_t i = 0; i < got_num; i++)
+    CHECK_ZERO(expect_family(fams[i], got[i]));
+
+  meta_data_t *got_meta = got[2]->metric.ptr[0].meta;
+  CHECK_NOT_NULL(got_meta);
+  char *s = NULL;
+  int64_t si = 0;
+  uint64_t ui = 0;
+  double d = 0;
+  bool b = false;
+  CHECK_ZERO(meta_data_get_string(got_meta, "string", &s));
+  EXPECT_EQ_STR("value", s);
+  free(s);
+  CHECK_ZERO(meta_data_get_signed_int(got_meta, "signed", &si));
+  EXPECT_EQ_INT(-42, si);
+  CHECK_ZERO(meta_data_get_unsigned_int(got_meta, "unsigned", &ui));
+  EXPECT_EQ_UINT64(42, ui);
+  CHECK_ZERO(meta_data_get_double(got_meta, "double", &d));
+  EXPECT_EQ_DOUBLE(0.5, d);
+  CHECK_ZERO(meta_data_get_boolean(got_meta, "boolean", &b));
+  OK(b);
+
+  format_binary_families_free(got, got_num);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fams); i++)
+    metric_family_free(fams[i]);
+  STRBUF_DESTROY(buf);
+  return 0;
+}
+
+DEF_TEST(stream) {
+  metric_family_t *fam = make_family("test_gauge", METRIC_TYPE_GAUGE, 3);
+  metric_family_t const *fams[] = {fam};
+
+  /* Three consecutive messages. */
+  strbuf_t buf = STRBUF_CREATE;
+  for (size_t i = 0; i < 3; i++)
+    CHECK_ZERO(format_binary_encode(&buf, fams, 1));
+
+  size_t offset = 0;
+  for (size_t i = 0; i < 3; i++) {
+    metric_family_t **got = NULL;
+    size_t got_num = 0;
+    size_t size = 0;
+    CHECK_ZERO(format_binary_decode(buf.ptr + offset, buf.pos - offset, &got,
+                                    &got_num, &size));
+    EXPECT_EQ_INT(1, got_num);
+    CHECK_ZERO(expect_family(fam, got[0]));
+    format_binary_families_free(got, got_num);
+    offset += size;
+  }
+  EXPECT_EQ_INT(buf.pos, offset);
+
+  /* Every prefix of a message is incomplete. */
+  size_t msg_size = buf.pos / 3;
+  for (size_t i = 0; i < msg_size; i++) {
+    metric_family_t **got = NULL;
+    size_t got_num = 0;
+    EXPECT_EQ_INT(EAGAIN,
+                  format_binary_decode(buf.ptr, i, &got, &got_num, NULL));
+  }
+
+  buf.ptr[0] = FORMAT_BINARY_VERSION + 1;
+  metric_family_t **got = NULL;
+  size_t got_num = 0;
+  EXPECT_EQ_INT(ENOTSUP,
+                format_binary_decode(buf.ptr, buf.pos, &got, &got_num, NULL));
+
+  STRBUF_DESTROY(buf);
+  metric_family_free(fam);
+  return 0;
+}
+
+DEF_TEST(fuzz) {
+  metric_family_t *fams[] = {
+      make_family("test_counter_total", METRIC_TYPE_COUNTER, 3),
+      make_family("test_gauge", METRIC_TYPE_GAUGE, 3),
+      make_family("test_distribution", METRIC_TYPE_DISTRIBUTION, 2),
+  };
+  meta_data_t *meta = meta_data_create();
+  meta_data_add_string(meta, "string", "value");
+  meta_data_add_boolean(meta, "boolean", true);
+  fams[1]->metric.ptr[0].meta = meta;
+
+  strbuf_t buf = STRBUF_CREATE;
+  CHECK_ZERO(format_binary_encode(&buf, (metric_family_t const *const *)fams,
+                                  STATIC_ARRAY_SIZE(fams)));
+
+  uint8_t *data = malloc(buf.pos);
+  CHECK_NOT_NULL(data);
+
+  /* Corrupted messages must be rejected or decoded to valid families, but must
+   * never crash or leak. Run with a memory checker to get the full benefit. */
+  uint32_t seed = 1;
+  size_t decoded = 0;
+  for (size_t i = 0; i < 20000; i++) {
+    memcpy(data, buf.ptr, buf.pos);
+    size_t flips = 1 + i % 4;
+    for (size_t j = 0; j < flips; j++) {
+      seed = seed * 1103515245 + 12345;
+      size_t bit = (seed >> 8) % (8 * buf.pos);
+      data[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+    }
+    seed = seed * 1103515245 + 12345;
+    size_t size = (i % 8 == 0) ? (seed >> 8) % buf.pos : buf.pos;
+
+    metric_family_t **got = NULL;
+    size_t got_num = 0;
+    if (format_binary_decode(data, size, &got, &got_num, NULL) == 0) {
+      for (size_t j = 0; j < got_num; j++)
+        OK(got[j]->name != NULL);
+      format_binary_families_free(got, got_num);
+      decoded++;
+    }
+  }
+  printf("# %zu of 20000 corrupted messages decoded\n", decoded);
+
+  free(data);
+  STRBUF_DESTROY(buf);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fams); i++)
+    metric_family_free(fams[i]);
+  return 0;
+}
+
+DEF_TEST(benchmark) {
+  /* A batch as sent by the network plugin: a few hundred metrics of families
+   * sharing label names and values. */
+  metric_family_t *fams[] = {
+      make_family("test_counter_total", METRIC_TYPE_COUNTER, 200),
+      make_family("test_gauge", METRIC_TYPE_GAUGE, 200),
+      make_family("test_distribution", METRIC_TYPE_DISTRIBUTION, 20),
+  };
+  size_t metrics_num = 0;
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fams); i++)
+    metrics_num += fams[i]->metric.num;
+
+  size_t const rounds = 200;
+  strbuf_t buf = STRBUF_CREATE;
+
+  double start = now();
+  for (size_t i = 0; i < rounds; i++) {
+    strbuf_reset(&buf);
+    CHECK_ZERO(format_binary_encode(&buf,
+                                    (metric_family_t const *const *)fams,
+                                    STATIC_ARRAY_SIZE(fams)));
+  }
+  double encode_time = now() - start;
+
+  start = now();
+  for (size_t i = 0; i < rounds; i++) {
+    metric_family_t **got = NULL;
+    size_t got_num = 0;
+    CHECK_ZERO(format_binary_decode(buf.ptr, buf.pos, &got, &got_num, NULL));
+    format_binary_families_free(got, got_num);
+  }
+  double decode_time = now() - start;
+
+  printf("# %zu metrics in %zu bytes (%.1f bytes per metric)\n", metrics_num,
+         buf.pos, (double)buf.pos / (double)metrics_num);
+  printf("# encode: %.0f metrics/s, %.1f MB/s\n",
+         (double)(rounds * metrics_num) / encode_time,
+         (double)(rounds * buf.pos) / encode_time / 1e6);
+  printf("# decode: %.0f metrics/s, %.1f MB/s\n",
+         (double)(rounds * metrics_num) / decode_time,
+         (double)(rounds * buf.pos) / decode_time / 1e6);
+
+  STRBUF_DESTROY(buf);
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fams); i++)
+    metric_family_free(fams[i]);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(roundtrip);
+  RUN_TEST(stream);
+  RUN_TEST(fuzz);
+  RUN_TEST(benchmark);
+
+  END_TEST;
+}
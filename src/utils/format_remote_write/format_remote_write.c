@@ -0,0 +1,269 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "utils/format_remote_write/format_remote_write.h"
+
+#include "distribution.h"
+#include "utils/common/common.h"
+
+#include <math.h>
+
+/* The subset of the remote write protocol used here:
+ *
+ *   message WriteRequest { repeated TimeSeries timeseries = 1; }
+ *   message TimeSeries   { repeated Label labels = 1;
+ *                          repeated Sample samples = 2; }
+ *   message Label        { string name = 1; string value = 2; }
+ *   message Sample       { double value = 1; int64 timestamp = 2; }
+ *
+ * All field numbers are below 16, so every tag fits into a single byte. */
+#define PB_WIRE_VARINT 0
+#define PB_WIRE_FIXED64 1
+#define PB_WIRE_BYTES 2
+#define PB_TAG(field, wire) ((uint8_t)(((field) << 3) | (wire)))
+
+#define RW_NAME_LABEL "__name__"
+
+typedef struct {
+  char const *name;
+  char const *value;
+  char const *value_suffix; /* appended to value, may be NULL */
+} rw_label_t;
+
+static size_t pb_varint_size(uint64_t v) {
+  size_t n = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+/* pb_bytes_size returns the size of a length-delimited field. */
+static size_t pb_bytes_size(size_t len) {
+  return 1 + pb_varint_size(len) + len;
+}
+
+static uint8_t *pb_put_varint(uint8_t *p, uint64_t v) {
+  while (v >= 0x80) {
+    *p++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+static uint8_t *pb_put_bytes(uint8_t *p, int field, char const *s,
+                             size_t len) {
+  *p++ = PB_TAG(field, PB_WIRE_BYTES);
+  p = pb_put_varint(p, len);
+  memcpy(p, s, len);
+  return p + len;
+}
+
+static uint8_t *pb_put_double(uint8_t *p, int field, double d) {
+  uint64_t v;
+  memcpy(&v, &d, sizeof(v));
+
+  *p++ = PB_TAG(field, PB_WIRE_FIXED64);
+  for (int i = 0; i < 8; i++)
+    *p++ = (uint8_t)(v >> (8 * i));
+  return p;
+}
+
+static size_t rw_label_size(rw_label_t const *l, size_t *ret_value_len) {
+  size_t value_len = strlen(l->value);
+  if (l->value_suffix != NULL)
+    value_len += strlen(l->value_suffix);
+
+  *ret_value_len = value_len;
+  return pb_bytes_size(strlen(l->name)) + pb_bytes_size(value_len);
+}
+
+/* rw_series appends one TimeSeries with a single sample. "labels" must be
+ * sorted by name. */
+static int rw_series(strbuf_t *buf, rw_label_t const *labels,
+                     size_t labels_num, double value, int64_t timestamp_ms) {
+  size_t sample_size = 1 + 8 + 1 + pb_varint_size((uint64_t)timestamp_ms);
+  size_t series_size = pb_bytes_size(sample_size);
+  for (size_t i = 0; i < labels_num; i++) {
+    size_t value_len;
+    series_size += pb_bytes_size(rw_label_size(labels + i, &value_len));
+  }
+  size_t total = pb_bytes_size(series_size);
+
+  uint8_t stack_mem[1024];
+  uint8_t *mem = stack_mem;
+  if (total > sizeof(stack_mem)) {
+    mem = malloc(total);
+    if (mem == NULL)
+      return ENOMEM;
+  }
+
+  uint8_t *p = mem;
+  *p++ = PB_TAG(1, PB_WIRE_BYTES); /* WriteRequest.timeseries */
+  p = pb_put_varint(p, series_size);
+
+  for (size_t i = 0; i < labels_num; i++) {
+    rw_label_t const *l = labels + i;
+    size_t value_len;
+    size_t label_size = rw_label_size(l, &value_len);
+
+    *p++ = PB_TAG(1, PB_WIRE_BYTES); /* TimeSeries.labels */
+    p = pb_put_varint(p, label_size);
+    p = pb_put_bytes(p, 1, l->name, strlen(l->name));
+
+    *p++ = PB_TAG(2, PB_WIRE_BYTES);
+    p = pb_put_varint(p, value_len);
+    size_t len = strlen(l->value);
+    memcpy(p, l->value, len);
+    p += len;
+    if (l->value_suffix != NULL) {
+      len = strlen(l->value_suffix);
+      memcpy(p, l->value_suffix, len);
+      p += len;
+    }
+  }
+
+  *p++ = PB_TAG(2, PB_WIRE_BYTES); /* TimeSeries.samples */
+  p = pb_put_varint(p, sample_size);
+  p = pb_put_double(p, 1, value);
+  *p++ = PB_TAG(2, PB_WIRE_VARINT);
+  p = pb_put_varint(p, (uint64_t)timestamp_ms);
+
+  assert((size_t)(p - mem) == total);
+  int status = strbuf_putn(buf, mem, total);
+
+  if (mem != stack_mem)
+    free(mem);
+  return status;
+}
+
+/* rw_labels_insert inserts "l" into the sorted array "labels". */
+static void rw_labels_insert(rw_label_t *labels, size_t *labels_num,
+                             rw_label_t l) {
+  size_t i = *labels_num;
+  while ((i > 0) && (strcmp(labels[i - 1].name, l.name) > 0)) {
+    labels[i] = labels[i - 1];
+    i--;
+  }
+  labels[i] = l;
+  (*labels_num)++;
+}
+
+/* rw_metric_series appends a series for "m", named after the family and
+ * "suffix", optionally with an additional "le" label. */
+static int rw_metric_series(strbuf_t *buf, metric_family_t const *fam,
+                            metric_t const *m, char const *suffix,
+                            char const *le, double value) {
+  rw_label_t stack_labels[16];
+  rw_label_t *labels = stack_labels;
+  size_t labels_size = m->label.num + 2;
+  if (labels_size > STATIC_ARRAY_SIZE(stack_labels)) {
+    labels = calloc(labels_size, sizeof(*labels));
+    if (labels == NULL)
+      return ENOMEM;
+  }
+
+  /* m->label is already sorted. */
+  size_t labels_num = 0;
+  for (size_t i = 0; i < m->label.num; i++) {
+    labels[labels_num++] = (rw_label_t){
+        .name = m->label.ptr[i].name,
+        .value = m->label.ptr[i].value,
+    };
+  }
+  rw_labels_insert(labels, &labels_num,
+                   (rw_label_t){
+                       .name = RW_NAME_LABEL,
+                       .value = fam->name,
+                       .value_suffix = suffix,
+                   });
+  if (le != NULL)
+    rw_labels_insert(labels, &labels_num,
+                     (rw_label_t){.name = "le", .value = le});
+
+  cdtime_t t = (m->time != 0) ? m->time : cdtime();
+  int status =
+      rw_series(buf, labels, labels_num, value, (int64_t)CDTIME_T_TO_MS(t));
+
+  if (labels != stack_labels)
+    free(labels);
+  return status;
+}
+
+static int rw_distribution(strbuf_t *buf, metric_family_t const *fam,
+                           metric_t const *m, size_t *ret_series) {
+  distribution_t *d = m->value.distribution;
+  if (d == NULL)
+    return EINVAL;
+
+  buckets_array_t buckets = get_buckets(d);
+  if ((buckets.num_buckets > 0) && (buckets.buckets == NULL))
+    return ENOMEM;
+
+  int status = 0;
+  uint64_t cumulative = 0;
+  for (size_t i = 0; (status == 0) && (i < buckets.num_buckets); i++) {
+    cumulative += buckets.buckets[i].bucket_counter;
+
+    char le[64];
+    if (isinf(buckets.buckets[i].maximum))
+      sstrncpy(le, "+Inf", sizeof(le));
+    else
+      ssnprintf(le, sizeof(le), "%.15g", buckets.buckets[i].maximum);
+
+    status = rw_metric_series(buf, fam, m, "_bucket", le, (double)cumulative);
+  }
+  destroy_buckets_array(buckets);
+
+  if (status == 0)
+    status = rw_metric_series(buf, fam, m, "_sum", NULL,
+                              distribution_total_sum(d));
+  if (status == 0)
+    status = rw_metric_series(buf, fam, m, "_count", NULL,
+                              (double)distribution_total_counter(d));
+
+  if ((status == 0) && (ret_series != NULL))
+    *ret_series = buckets.num_buckets + 2;
+  return status;
+}
+
+int format_remote_write_metric(strbuf_t *buf, metric_family_t const *fam,
+                               metric_t const *m, size_t *ret_series) {
+  if ((buf == NULL) || (fam == NULL) || (fam->name == NULL) || (m == NULL))
+    return EINVAL;
+
+  double value = NAN;
+  switch (fam->type) {
+  case METRIC_TYPE_COUNTER:
+    value = (double)m->value.counter;
+    break;
+  case METRIC_TYPE_GAUGE:
+  case METRIC_TYPE_UNTYPED:
+    value = m->value.gauge;
+    break;
+  case METRIC_TYPE_DISTRIBUTION:
+    return rw_distribution(buf, fam, m, ret_series);
+  }
+
+  int status = rw_metric_series(buf, fam, m, NULL, NULL, value);
+  if ((status == 0) && (ret_series != NULL))
+    *ret_series = 1;
+  return status;
+}
+
+int format_remote_write_metric_family(strbuf_t *buf,
+                                      metric_family_t const *fam) {
+  if ((buf == NULL) || (fam == NULL))
+    return EINVAL;
+
+  for (size_t i = 0; i < fam->metric.num; i++) {
+    int status =
+        format_remote_write_metric(buf, fam, fam->metric.ptr + i, NULL);
+    if (status != 0)
+      return status;
+  }
+
+  return 0;
+}
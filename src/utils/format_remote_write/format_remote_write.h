@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef UTILS_FORMAT_REMOTE_WRITE_H
+#define UTILS_FORMAT_REMOTE_WRITE_H 1
+
+#include "collectd.h"
+
+#include "plugin.h"
+#include "utils/strbuf/strbuf.h"
+
+/* format_remote_write_metric appends the time series of "m", a metric of
+ * "fam", to "buf". The series are encoded as "timeseries" fields of a
+ * Prometheus remote write "WriteRequest" protobuf message. Because a
+ * WriteRequest only consists of repeated fields, the output of several calls
+ * can be concatenated to form a valid message.
+ *
+ * Distribution metrics are expanded into "_bucket", "_sum" and "_count"
+ * series, like a Prometheus histogram. The number of series appended is
+ * returned in "ret_series" if it is not NULL. */
+int format_remote_write_metric(strbuf_t *buf, metric_family_t const *fam,
+                               metric_t const *m, size_t *ret_series);
+
+/* format_remote_write_metric_family appends all metrics of "fam" to "buf".
+ * See format_remote_write_metric for details. */
+int format_remote_write_metric_family(strbuf_t *buf,
+                                      metric_family_t const *fam);
+
+#endif /* UTILS_FORMAT_REMOTE_WRITE_H */
@@ -0,0 +1,121 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/format_remote_write/format_remote_write.h"
+
+static bool contains(strbuf_t const *buf, char const *s) {
+  size_t len = strlen(s);
+  for (size_t i = 0; (i + len) <= buf->pos; i++)
+    if (memcmp(buf->ptr + i, s, len) == 0)
+      return true;
+  return false;
+}
+
+DEF_TEST(gauge) {
+  metric_family_t fam = {
+      .name = "m",
+      .type = METRIC_TYPE_GAUGE,
+  };
+  metric_t m = {
+      .family = &fam,
+      .value.gauge = 1.5,
+      .time = MS_TO_CDTIME_T(1),
+  };
+  CHECK_ZERO(metric_label_set(&m, "a", "b"));
+
+  uint8_t const want[] = {
+      0x0a, 0x24,                                     /* timeseries */
+      0x0a, 0x0d,                                     /* labels */
+      0x0a, 0x08, '_', '_', 'n', 'a', 'm', 'e', '_', '_', /* name */
+      0x12, 0x01, 'm',                                /* value */
+      0x0a, 0x06,                                     /* labels */
+      0x0a, 0x01, 'a',                                /* name */
+      0x12, 0x01, 'b',                                /* value */
+      0x12, 0x0b,                                     /* samples */
+      0x09, 0, 0, 0, 0, 0, 0, 0xf8, 0x3f,             /* value */
+      0x10, 0x01,                                     /* timestamp */
+  };
+
+  strbuf_t buf = STRBUF_CREATE;
+  size_t series = 0;
+  CHECK_ZERO(format_remote_write_metric(&buf, &fam, &m, &series));
+  EXPECT_EQ_UINT64(1, series);
+  EXPECT_EQ_UINT64(sizeof(want), buf.pos);
+  EXPECT_EQ_INT(0, memcmp(want, buf.ptr, sizeof(want)));
+
+  /* WriteRequest only consists of repeated fields: output is appended. */
+  CHECK_ZERO(format_remote_write_metric(&buf, &fam, &m, NULL));
+  EXPECT_EQ_UINT64(2 * sizeof(want), buf.pos);
+  EXPECT_EQ_INT(0, memcmp(want, buf.ptr + sizeof(want), sizeof(want)));
+
+  STRBUF_DESTROY(buf);
+  metric_reset(&m);
+  return 0;
+}
+
+DEF_TEST(label_order) {
+  metric_family_t fam = {
+      .name = "m",
+      .type = METRIC_TYPE_COUNTER,
+  };
+  metric_t m = {
+      .family = &fam,
+      .value.counter = 2,
+      .time = MS_TO_CDTIME_T(1),
+  };
+  /* "Z" sorts before "__name__", "a" after it. */
+  CHECK_ZERO(metric_label_set(&m, "a", "1"));
+  CHECK_ZERO(metric_label_set(&m, "Z", "2"));
+
+  strbuf_t buf = STRBUF_CREATE;
+  CHECK_ZERO(format_remote_write_metric(&buf, &fam, &m, NULL));
+
+  uint8_t const *p = (uint8_t const *)buf.ptr;
+  /* timeseries tag and length, first label tag and length, name tag and
+   * length */
+  EXPECT_EQ_INT('Z', p[6]);
+  EXPECT_EQ_INT(0, memcmp(p + 14, "__name__", 8)); /* second label */
+
+  STRBUF_DESTROY(buf);
+  metric_reset(&m);
+  return 0;
+}
+
+DEF_TEST(distribution) {
+  metric_family_t fam = {
+      .name = "latency_seconds",
+      .type = METRIC_TYPE_DISTRIBUTION,
+  };
+  metric_t m = {
+      .family = &fam,
+      .time = MS_TO_CDTIME_T(1000),
+  };
+  CHECK_NOT_NULL(m.value.distribution = distribution_new_linear(3, 1.0));
+  CHECK_ZERO(distribution_update(m.value.distribution, 0.5));
+  CHECK_ZERO(distribution_update(m.value.distribution, 2.5));
+
+  strbuf_t buf = STRBUF_CREATE;
+  size_t series = 0;
+  CHECK_ZERO(format_remote_write_metric(&buf, &fam, &m, &series));
+  /* three buckets, _sum and _count */
+  EXPECT_EQ_UINT64(5, series);
+  OK(contains(&buf, "latency_seconds_bucket"));
+  OK(contains(&buf, "+Inf"));
+  OK(contains(&buf, "latency_seconds_sum"));
+  OK(contains(&buf, "latency_seconds_count"));
+
+  STRBUF_DESTROY(buf);
+  distribution_destroy(m.value.distribution);
+  m.value.distribution = NULL;
+  metric_reset(&m);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(gauge);
+  RUN_TEST(label_order);
+  RUN_TEST(distribution);
+
+  END_TEST;
+}
@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "utils/common/common.h"
+#include "utils/gorilla/gorilla.h"
+
+static void put_bits(uint8_t *data, uint64_t *pos, uint64_t v, int n) {
+  while (n > 0) {
+    int off = (int)(*pos % 8);
+    int take = 8 - off;
+    if (take > n)
+      take = n;
+
+    uint8_t chunk = (uint8_t)((v >> (n - take)) & ((1u << take) - 1));
+    data[*pos / 8] |= (uint8_t)(chunk << (8 - off - take));
+
+    *pos += (uint64_t)take;
+    n -= take;
+  }
+} /* void put_bits */
+
+static bool get_bits(gorilla_iter_t *it, int n, uint64_t *ret) {
+  if ((it->pos + (uint64_t)n) > it->bits)
+    return false;
+
+  uint64_t v = 0;
+  while (n > 0) {
+    int off = (int)(it->pos % 8);
+    int take = 8 - off;
+    if (take > n)
+      take = n;
+
+    uint8_t byte = it->data[it->pos / 8];
+    v = (v << take) | ((byte >> (8 - off - take)) & ((1u << take) - 1));
+
+    it->pos += (uint64_t)take;
+    n -= take;
+  }
+
+  *ret = v;
+  return true;
+} /* bool get_bits */
+
+static uint64_t double_to_bits(double d) {
+  uint64_t u;
+  memcpy(&u, &d, sizeof(u));
+  return u;
+}
+
+static double bits_to_double(uint64_t u) {
+  double d;
+  memcpy(&d, &u, sizeof(d));
+  return d;
+}
+
+/* Timestamps: delta-of-delta in buckets of 7, 9 and 12 bits, with a prefix
+ * of '10', '110' and '1110'. A zero delta-of-delta is a single '0' bit. */
+static void put_time(gorilla_state_t *s, uint8_t *data, int64_t dod) {
+  if (dod == 0) {
+    put_bits(data, &s->bits, 0, 1);
+  } else if ((dod >= -63) && (dod <= 64)) {
+    put_bits(data, &s->bits, 0x2, 2);
+    put_bits(data, &s->bits, (uint64_t)(dod + 63), 7);
+  } else if ((dod >= -255) && (dod <= 256)) {
+    put_bits(data, &s->bits, 0x6, 3);
+    put_bits(data, &s->bits, (uint64_t)(dod + 255), 9);
+  } else if ((dod >= -2047) && (dod <= 2048)) {
+    put_bits(data, &s->bits, 0xe, 4);
+    put_bits(data, &s->bits, (uint64_t)(dod + 2047), 12);
+  } else {
+    put_bits(data, &s->bits, 0xf, 4);
+    put_bits(data, &s->bits, (uint64_t)dod, 64);
+  }
+} /* void put_time */
+
+/* Values: the XOR with the previous value. A zero XOR is a single '0' bit.
+ * Otherwise, the meaningful bits are stored either within the window of the
+ * previous value ('10'), or with a new window ('11', 5 bits of leading zeros,
+ * 6 bits of length). */
+static void put_value(gorilla_state_t *s, uint8_t *data, uint64_t value) {
+  uint64_t x = value ^ s->value;
+  if (x == 0) {
+    put_bits(data, &s->bits, 0, 1);
+    return;
+  }
+
+  int leading = __builtin_clzll(x);
+  int trailing = __builtin_ctzll(x);
+  if (leading > 31)
+    leading = 31;
+  int len = 64 - leading - trailing;
+  int window = 64 - s->leading - s->trailing;
+
+  if ((leading >= s->leading) && (trailing >= s->trailing) &&
+      (window <= (11 + len))) {
+    put_bits(data, &s->bits, 0x2, 2);
+    put_bits(data, &s->bits, x >> s->trailing, window);
+    return;
+  }
+
+  put_bits(data, &s->bits, 0x3, 2);
+  put_bits(data, &s->bits, (uint64_t)leading, 5);
+  put_bits(data, &s->bits, (uint64_t)(len & 0x3f), 6); /* 64 is stored as 0 */
+  put_bits(data, &s->bits, x >> trailing, len);
+  s->leading = (uint8_t)leading;
+  s->trailing = (uint8_t)trailing;
+} /* void put_value */
+
+int gorilla_append(gorilla_state_t *s, uint8_t *data, size_t size, int64_t time,
+                   double value) {
+  if ((s == NULL) || (data == NULL))
+    return EINVAL;
+  if ((s->count > 0) && (time <= s->time))
+    return EINVAL;
+  if ((s->bits + GORILLA_MAX_SAMPLE_BITS) > 8 * (uint64_t)size)
+    return ENOSPC;
+
+  uint64_t v = double_to_bits(value);
+
+  if (s->count == 0) {
+    s->first_time = time;
+    s->delta = 0;
+    put_bits(data, &s->bits, v, 64);
+  } else {
+    int64_t delta = time - s->time;
+    put_time(s, data, delta - s->delta);
+    put_value(s, data, v);
+    s->delta = delta;
+  }
+
+  s->time = time;
+  s->value = v;
+  s->count++;
+  return 0;
+} /* int gorilla_append */
+
+void gorilla_iter_init(gorilla_iter_t *it, gorilla_state_t const *s,
+                       uint8_t const *data) {
+  *it = (gorilla_iter_t){
+      .data = data,
+      .bits = s->bits,
+      .remaining = s->count,
+      .time = s->first_time,
+  };
+} /* void gorilla_iter_init */
+
+static bool get_time(gorilla_iter_t *it, int64_t *ret_dod) {
+  /* Number of value bits for the prefixes '10', '110' and '1110'. */
+  static int const widths[] = {7, 9, 12};
+  static int64_t const offsets[] = {63, 255, 2047};
+
+  uint64_t bit;
+  for (size_t i = 0; i <= STATIC_ARRAY_SIZE(widths); i++) {
+    if (!get_bits(it, 1, &bit))
+      return false;
+    if (bit == 0) {
+      if (i == 0) {
+        *ret_dod = 0;
+        return true;
+      }
+      uint64_t v;
+      if (!get_bits(it, widths[i - 1], &v))
+        return false;
+      *ret_dod = (int64_t)v - offsets[i - 1];
+      return true;
+    }
+  }
+
+  uint64_t v;
+  if (!get_bits(it, 64, &v))
+    return false;
+  *ret_dod = (int64_t)v;
+  return true;
+} /* bool get_time */
+
+static bool get_value(gorilla_iter_t *it) {
+  uint64_t bit;
+  if (!get_bits(it, 1, &bit))
+    return false;
+  if (bit == 0)
+    return true;
+
+  if (!get_bits(it, 1, &bit))
+    return false;
+  if (bit == 1) {
+    uint64_t leading, len;
+    if (!get_bits(it, 5, &leading) || !get_bits(it, 6, &len))
+      return false;
+    if (len == 0)
+      len = 64;
+    if ((leading + len) > 64)
+      return false;
+    it->leading = (uint8_t)leading;
+    it->trailing = (uint8_t)(64 - leading - len);
+  }
+
+  int window = 64 - it->leading - it->trailing;
+  uint64_t x;
+  if (!get_bits(it, window, &x))
+    return false;
+  it->value ^= x << it->trailing;
+  return true;
+} /* bool get_value */
+
+bool gorilla_iter_next(gorilla_iter_t *it, int64_t *ret_time,
+                       double *ret_value) {
+  if (it->remaining == 0)
+    return false;
+
+  if (it->count == 0) {
+    if (!get_bits(it, 64, &it->value))
+      return false;
+  } else {
+    int64_t dod;
+    if (!get_time(it, &dod) || !get_value(it))
+      return false;
+    it->delta += dod;
+    it->time += it->delta;
+  }
+
+  it->count++;
+  it->remaining--;
+  *ret_time = it->time;
+  *ret_value = bits_to_double(it->value);
+  return true;
+} /* bool gorilla_iter_next */
@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef UTILS_GORILLA_H
+#define UTILS_GORILLA_H 1
+
+#include "collectd.h"
+
+/* Compression of (time, value) samples as described in "Gorilla: A Fast,
+ * Scalable, In-Memory Time Series Database" (Pelkonen et al., VLDB 2015).
+ * Timestamps are stored as delta-of-delta, values as the XOR with the previous
+ * value. Regularly collected series need a few bits per sample.
+ *
+ * The encoder writes into a caller provided buffer, e.g. a memory mapped file,
+ * which must be zeroed initially. All state needed to continue appending is
+ * kept in gorilla_state_t, which can be stored next to the data. */
+
+/* Upper bound of the bits needed for a single sample. */
+#define GORILLA_MAX_SAMPLE_BITS 145
+
+typedef struct {
+  uint64_t bits; /* bits used in the buffer */
+  uint32_t count;
+  uint8_t leading;
+  uint8_t trailing;
+  uint16_t pad;
+  int64_t first_time;
+  int64_t time;
+  int64_t delta;
+  uint64_t value;
+} gorilla_state_t;
+
+/* gorilla_append adds a sample to the buffer "data" of "size" bytes. "time"
+ * must be greater than the time of the previous sample, otherwise EINVAL is
+ * returned. If the buffer may be too small to hold the sample, ENOSPC is
+ * returned and the buffer is not changed. */
+int gorilla_append(gorilla_state_t *s, uint8_t *data, size_t size, int64_t time,
+                   double value);
+
+typedef struct {
+  uint8_t const *data;
+  uint64_t bits;
+  uint64_t pos;
+  uint32_t remaining;
+  uint32_t count;
+  uint8_t leading;
+  uint8_t trailing;
+  int64_t time;
+  int64_t delta;
+  uint64_t value;
+} gorilla_iter_t;
+
+/* gorilla_iter_init prepares reading the samples described by "s" from
+ * "data". */
+void gorilla_iter_init(gorilla_iter_t *it, gorilla_state_t const *s,
+                       uint8_t const *data);
+
+/* gorilla_iter_next returns the next sample. Returns false when all samples
+ * were read or the data is corrupt. */
+bool gorilla_iter_next(gorilla_iter_t *it, int64_t *ret_time,
+                       double *ret_value);
+
+#endif /* UTILS_GORILLA_H */
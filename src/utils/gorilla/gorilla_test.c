@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/gorilla/gorilla.h"
+
+#define SAMPLES_NUM 1000
+
+DEF_TEST(roundtrip) {
+  static uint8_t data[64 * 1024];
+  int64_t times[SAMPLES_NUM];
+  double values[SAMPLES_NUM];
+
+  memset(data, 0, sizeof(data));
+  gorilla_state_t s = {0};
+
+  int64_t t = 1700000000000;
+  for (size_t i = 0; i < SAMPLES_NUM; i++) {
+    /* 10 s interval with some jitter and the occasional gap. */
+    t += 10000 + (int64_t)(i % 7) - 3;
+    if (i % 100 == 99)
+      t += 3600000;
+    times[i] = t;
+
+    if (i % 3 == 0)
+      values[i] = 42.0;
+    else if (i % 3 == 1)
+      values[i] = (double)i * 1.5;
+    else
+      values[i] = -1e300 / (double)(i + 1);
+  }
+  values[10] = NAN;
+  values[11] = INFINITY;
+
+  for (size_t i = 0; i < SAMPLES_NUM; i++)
+    CHECK_ZERO(gorilla_append(&s, data, sizeof(data), times[i], values[i]));
+  EXPECT_EQ_INT(SAMPLES_NUM, s.count);
+  printf("# %d samples in %" PRIu64 " bytes\n", SAMPLES_NUM, (s.bits + 7) / 8);
+
+  /* Out of order samples are rejected. */
+  EXPECT_EQ_INT(EINVAL, gorilla_append(&s, data, sizeof(data), t, 1.0));
+
+  gorilla_iter_t it;
+  gorilla_iter_init(&it, &s, data);
+  size_t n = 0;
+  int64_t got_time;
+  double got_value;
+  while (gorilla_iter_next(&it, &got_time, &got_value)) {
+    EXPECT_EQ_UINT64((uint64_t)times[n], (uint64_t)got_time);
+    EXPECT_EQ_DOUBLE(values[n], got_value);
+    n++;
+  }
+  EXPECT_EQ_UINT64(SAMPLES_NUM, n);
+
+  return 0;
+}
+
+DEF_TEST(regular) {
+  uint8_t data[1024] = {0};
+  gorilla_state_t s = {0};
+
+  /* After the first two samples, a constant value at a constant interval
+   * needs two bits per sample. */
+  for (int64_t i = 0; i < 100; i++)
+    CHECK_ZERO(gorilla_append(&s, data, sizeof(data), 10000 * i, 1.0));
+  OK(s.bits <= 64 + 69 + 2 * 98);
+
+  return 0;
+}
+
+DEF_TEST(full) {
+  uint8_t data[64] = {0};
+  gorilla_state_t s = {0};
+
+  int status = 0;
+  int64_t i;
+  for (i = 0; status == 0; i++)
+    status = gorilla_append(&s, data, sizeof(data), i * 1000, (double)i * 0.1);
+  EXPECT_EQ_INT(ENOSPC, status);
+  EXPECT_EQ_INT(i - 1, s.count);
+  OK(s.bits <= 8 * sizeof(data));
+
+  /* Appending can be continued with a copy of the state. */
+  gorilla_state_t copy = s;
+  gorilla_iter_t it;
+  gorilla_iter_init(&it, &copy, data);
+  int64_t t;
+  double v;
+  int64_t n = 0;
+  while (gorilla_iter_next(&it, &t, &v)) {
+    EXPECT_EQ_UINT64((uint64_t)(n * 1000), (uint64_t)t);
+    EXPECT_EQ_DOUBLE((double)n * 0.1, v);
+    n++;
+  }
+  EXPECT_EQ_UINT64(s.count, (uint64_t)n);
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(roundtrip);
+  RUN_TEST(regular);
+  RUN_TEST(full);
+
+  END_TEST;
+}
@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "utils/hll/hll.h"
+
+#include <math.h>
+
+struct hll_s {
+  unsigned int precision;
+  size_t registers_num;
+  uint8_t *registers;
+};
+
+hll_t *hll_create(unsigned int precision)
+{
+  if ((precision < HLL_PRECISION_MIN) || (precision > HLL_PRECISION_MAX))
+    return NULL;
+
+  hll_t *h = calloc(1, sizeof(*h));
+  if (h == NULL)
+    return NULL;
+
+  h->precision = precision;
+  h->registers_num = ((size_t)1) << precision;
+  h->registers = calloc(h->registers_num, sizeof(*h->registers));
+  if (h->registers == NULL) {
+    free(h);
+    return NULL;
+  }
+
+  return h;
+}
+
+void hll_destroy(hll_t *h)
+{
+  if (h == NULL)
+    return;
+
+  free(h->registers);
+  free(h);
+}
+
+unsigned int hll_precision(hll_t const *h)
+{
+  if (h == NULL)
+    return 0;
+  return h->precision;
+}
+
+/* FNV-1a followed by the MurmurHash3 finalizer, which spreads the entropy of
+ * short keys over all bits. */
+uint64_t hll_hash(char const *key)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  for (unsigned char const *ptr = (unsigned char const *)key; *ptr != 0;
+       ptr++) {
+    hash ^= (uint64_t)*ptr;
+    hash *= 0x100000001b3ULL;
+  }
+
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+
+  return hash;
+}
+
+void hll_add_hash(hll_t *h, uint64_t hash)
+{
+  if (h == NULL)
+    return;
+
+  size_t index = (size_t)(hash >> (64 - h->precision));
+  /* The remaining bits, with a sentinel bit so that the rank is bounded. */
+  uint64_t bits = (hash << h->precision) | (((uint64_t)1) << (h->precision - 1));
+
+  uint8_t rank = 1;
+  while ((bits & (((uint64_t)1) << 63)) == 0) {
+    rank++;
+    bits <<= 1;
+  }
+
+  if (h->registers[index] < rank)
+    h->registers[index] = rank;
+}
+
+void hll_add(hll_t *h, char const *key)
+{
+  if ((h == NULL) || (key == NULL))
+    return;
+
+  hll_add_hash(h, hll_hash(key));
+}
+
+int hll_merge(hll_t *dst, hll_t const *src)
+{
+  if ((dst == NULL) || (src == NULL))
+    return EINVAL;
+  if (dst->precision != src->precision)
+    return EINVAL;
+
+  for (size_t i = 0; i < dst->registers_num; i++) {
+    if (dst->registers[i] < src->registers[i])
+      dst->registers[i] = src->registers[i];
+  }
+
+  return 0;
+}
+
+double hll_count(hll_t const *h)
+{
+  if (h == NULL)
+    return NAN;
+
+  double m = (double)h->registers_num;
+  double alpha;
+  switch (h->registers_num) {
+  case 16:
+    alpha = 0.673;
+    break;
+  case 32:
+    alpha = 0.697;
+    break;
+  case 64:
+    alpha = 0.709;
+    break;
+  default:
+    alpha = 0.7213 / (1.0 + 1.079 / m);
+  }
+
+  double sum = 0;
+  size_t zeros = 0;
+  for (size_t i = 0; i < h->registers_num; i++) {
+    sum += ldexp(1.0, -((int)h->registers[i]));
+    if (h->registers[i] == 0)
+      zeros++;
+  }
+
+  double estimate = alpha * m * m / sum;
+
+  /* Small range correction: linear counting is more accurate while many
+   * registers are still empty. With 64 bit hashes no large range correction
+   * is needed. */
+  if ((estimate <= 2.5 * m) && (zeros > 0))
+    estimate = m * log(m / ((double)zeros));
+
+  return estimate;
+}
+
+void hll_reset(hll_t *h)
+{
+  if (h == NULL)
+    return;
+
+  memset(h->registers, 0, h->registers_num * sizeof(*h->registers));
+}
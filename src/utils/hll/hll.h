@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef UTILS_HLL_H
+#define UTILS_HLL_H 1
+
+#include "collectd.h"
+
+#define HLL_PRECISION_MIN 4
+#define HLL_PRECISION_MAX 18
+
+/* hll_t is a HyperLogLog cardinality estimator. It uses 2^precision bytes of
+ * memory regardless of the number of distinct elements added; the standard
+ * error of the estimate is about 1.04 / sqrt(2^precision). */
+struct hll_s;
+typedef struct hll_s hll_t;
+
+/* hll_create returns NULL if "precision" is outside of
+ * [HLL_PRECISION_MIN, HLL_PRECISION_MAX]. */
+hll_t *hll_create(unsigned int precision);
+void hll_destroy(hll_t *h);
+
+unsigned int hll_precision(hll_t const *h);
+
+/* hll_hash returns the 64 bit hash used by hll_add. */
+uint64_t hll_hash(char const *key);
+
+void hll_add(hll_t *h, char const *key);
+void hll_add_hash(hll_t *h, uint64_t hash);
+
+/* hll_merge adds all elements in "src" to "dst". Both estimators must use the
+ * same precision. */
+int hll_merge(hll_t *dst, hll_t const *src);
+
+/* hll_count returns the estimated number of distinct elements. */
+double hll_count(hll_t const *h);
+void hll_reset(hll_t *h);
+
+#endif /* UTILS_HLL_H */
@@ -0,0 +1,86 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/hll/hll.h"
+
+#include <math.h>
+
+DEF_TEST(create) {
+  hll_t *h;
+
+  EXPECT_EQ_PTR(NULL, hll_create(HLL_PRECISION_MIN - 1));
+  EXPECT_EQ_PTR(NULL, hll_create(HLL_PRECISION_MAX + 1));
+
+  CHECK_NOT_NULL(h = hll_create(12));
+  EXPECT_EQ_INT(12, hll_precision(h));
+  EXPECT_EQ_DOUBLE(0, hll_count(h));
+
+  hll_destroy(h);
+  return 0;
+}
+
+DEF_TEST(count) {
+  struct {
+    unsigned int precision;
+    int num;
+  } cases[] = {
+      {14, 10}, {14, 1000}, {14, 100000}, {10, 50000}, {18, 200000},
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    hll_t *h;
+    CHECK_NOT_NULL(h = hll_create(cases[i].precision));
+
+    /* every element is added twice, duplicates must not be counted. */
+    for (int j = 0; j < 2 * cases[i].num; j++) {
+      char key[32];
+      snprintf(key, sizeof(key), "user-%d", j % cases[i].num);
+      hll_add(h, key);
+    }
+
+    double want = (double)cases[i].num;
+    /* allow for four times the standard error */
+    double error = 4.0 * 1.04 / sqrt((double)(1 << cases[i].precision));
+    double got = hll_count(h);
+    printf("precision %u: want %g, got %g\n", cases[i].precision, want, got);
+    OK(fabs(got - want) <= error * want);
+
+    hll_reset(h);
+    EXPECT_EQ_DOUBLE(0, hll_count(h));
+    hll_destroy(h);
+  }
+
+  return 0;
+}
+
+DEF_TEST(merge) {
+  hll_t *a, *b, *c;
+
+  CHECK_NOT_NULL(a = hll_create(14));
+  CHECK_NOT_NULL(b = hll_create(14));
+  CHECK_NOT_NULL(c = hll_create(12));
+
+  for (int i = 0; i < 20000; i++) {
+    char key[32];
+    snprintf(key, sizeof(key), "%d", i);
+    hll_add((i < 15000) ? a : b, key);
+  }
+
+  CHECK_ZERO(hll_merge(a, b));
+  OK(fabs(hll_count(a) - 20000.0) <= 0.04 * 20000.0);
+  EXPECT_EQ_INT(EINVAL, hll_merge(a, c));
+
+  hll_destroy(a);
+  hll_destroy(b);
+  hll_destroy(c);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(create);
+  RUN_TEST(count);
+  RUN_TEST(merge);
+
+  END_TEST;
+}
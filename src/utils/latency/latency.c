@@ -72,19 +72,8 @@ struct latency_counter_s {
  * So, if the required bin width is 300, then new bin width will be 512 as it is
  * the next nearest power of 2.
  */
-static void change_bin_width(latency_counter_t *lc, cdtime_t latency) /* {{{ */
-{
-  /* This function is called because the new value is above histogram's range.
-   * First find the required bin width:
-   *           requiredBinWidth = (value + 1) / numBins
-   * then get the next nearest power of 2
-   *           newBinWidth = 2^(ceil(log2(requiredBinWidth)))
-   */
-  double required_bin_width =
-      ((double)(latency + 1)) / ((double)HISTOGRAM_NUM_BINS);
-  double required_bin_width_logbase2 = log(required_bin_width) / log(2.0);
-  cdtime_t new_bin_width =
-      (cdtime_t)(pow(2.0, ceil(required_bin_width_logbase2)) + .5);
+static void set_bin_width(latency_counter_t *lc, /* {{{ */
+                          cdtime_t new_bin_width) {
   cdtime_t old_bin_width = lc->bin_width;
 
   lc->bin_width = new_bin_width;
@@ -106,11 +95,27 @@ static void change_bin_width(latency_counter_t *lc, cdtime_t latency) /* {{{ */
       lc->histogram[i] = 0;
     }
   }
+} /* }}} void set_bin_width */
 
+static void change_bin_width(latency_counter_t *lc, cdtime_t latency) /* {{{ */
+{
+  /* This function is called because the new value is above histogram's range.
+   * First find the required bin width:
+   *           requiredBinWidth = (value + 1) / numBins
+   * then get the next nearest power of 2
+   *           newBinWidth = 2^(ceil(log2(requiredBinWidth)))
+   */
+  double required_bin_width =
+      ((double)(latency + 1)) / ((double)HISTOGRAM_NUM_BINS);
+  double required_bin_width_logbase2 = log(required_bin_width) / log(2.0);
+  cdtime_t new_bin_width =
+      (cdtime_t)(pow(2.0, ceil(required_bin_width_logbase2)) + .5);
   DEBUG("utils_latency: change_bin_width: latency = %.3f; "
         "old_bin_width = %.3f; new_bin_width = %.3f;",
-        CDTIME_T_TO_DOUBLE(latency), CDTIME_T_TO_DOUBLE(old_bin_width),
+        CDTIME_T_TO_DOUBLE(latency), CDTIME_T_TO_DOUBLE(lc->bin_width),
         CDTIME_T_TO_DOUBLE(new_bin_width));
+
+  set_bin_width(lc, new_bin_width);
 } /* }}} void change_bin_width */
 
 latency_counter_t *latency_counter_create(void) /* {{{ */
@@ -195,6 +200,37 @@ void latency_counter_reset(latency_counter_t *lc) /* {{{ */
   lc->start_time = cdtime();
 } /* }}} void latency_counter_reset */
 
+int latency_counter_merge(latency_counter_t *dst, /* {{{ */
+                          latency_counter_t const *src) {
+  if ((dst == NULL) || (src == NULL))
+    return EINVAL;
+
+  if (src->num == 0)
+    return 0;
+
+  /* Bin widths are always a power of two, so the bins of the narrower
+   * histogram map exactly onto the bins of the wider one. */
+  if (dst->bin_width < src->bin_width)
+    set_bin_width(dst, src->bin_width);
+
+  for (size_t i = 0; i < HISTOGRAM_NUM_BINS; i++) {
+    if (src->histogram[i] == 0)
+      continue;
+    size_t bin = (size_t)((((cdtime_t)i) * src->bin_width) / dst->bin_width);
+    dst->histogram[bin] += src->histogram[i];
+  }
+
+  if ((dst->num == 0) || (dst->min > src->min))
+    dst->min = src->min;
+  if ((dst->num == 0) || (dst->max < src->max))
+    dst->max = src->max;
+
+  dst->sum += src->sum;
+  dst->num += src->num;
+
+  return 0;
+} /* }}} int latency_counter_merge */
+
 cdtime_t latency_counter_get_min(latency_counter_t *lc) /* {{{ */
 {
   if (lc == NULL)
@@ -44,6 +44,9 @@ void latency_counter_destroy(latency_counter_t *lc);
 void latency_counter_add(latency_counter_t *lc, cdtime_t latency);
 void latency_counter_reset(latency_counter_t *lc);
 
+/* latency_counter_merge adds all latencies recorded in "src" to "dst". */
+int latency_counter_merge(latency_counter_t *dst, latency_counter_t const *src);
+
 cdtime_t latency_counter_get_min(latency_counter_t *lc);
 cdtime_t latency_counter_get_max(latency_counter_t *lc);
 cdtime_t latency_counter_get_sum(latency_counter_t *lc);
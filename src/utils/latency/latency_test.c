@@ -101,6 +101,49 @@ DEF_TEST(percentile) {
   return 0;
 }
 
+DEF_TEST(merge) {
+  latency_counter_t *a;
+  latency_counter_t *b;
+  latency_counter_t *want;
+
+  CHECK_NOT_NULL(a = latency_counter_create());
+  CHECK_NOT_NULL(b = latency_counter_create());
+  CHECK_NOT_NULL(want = latency_counter_create());
+
+  /* "b" gets a larger bin width than "a" */
+  for (size_t i = 1; i <= 100; i++) {
+    cdtime_t small = TIME_T_TO_CDTIME_T(i) / 1000;
+    cdtime_t large = TIME_T_TO_CDTIME_T(i) / 10;
+
+    latency_counter_add(a, small);
+    latency_counter_add(b, large);
+    latency_counter_add(want, small);
+    latency_counter_add(want, large);
+  }
+
+  CHECK_ZERO(latency_counter_merge(a, b));
+  EXPECT_EQ_UINT64(200, latency_counter_get_num(a));
+  EXPECT_EQ_UINT64(latency_counter_get_sum(want), latency_counter_get_sum(a));
+  EXPECT_EQ_UINT64(latency_counter_get_min(want), latency_counter_get_min(a));
+  EXPECT_EQ_UINT64(latency_counter_get_max(want), latency_counter_get_max(a));
+  EXPECT_EQ_UINT64(latency_counter_get_percentile(want, 50),
+                   latency_counter_get_percentile(a, 50));
+  EXPECT_EQ_UINT64(latency_counter_get_percentile(want, 99),
+                   latency_counter_get_percentile(a, 99));
+
+  /* merging into an empty counter yields a copy */
+  latency_counter_reset(b);
+  CHECK_ZERO(latency_counter_merge(b, a));
+  EXPECT_EQ_UINT64(latency_counter_get_min(a), latency_counter_get_min(b));
+  EXPECT_EQ_UINT64(latency_counter_get_percentile(a, 90),
+                   latency_counter_get_percentile(b, 90));
+
+  latency_counter_destroy(a);
+  latency_counter_destroy(b);
+  latency_counter_destroy(want);
+  return 0;
+}
+
 DEF_TEST(get_rate) {
   /* We re-declare the struct here so we can inspect its content. */
   struct {
@@ -245,6 +288,7 @@ DEF_TEST(get_rate) {
 int main(void) {
   RUN_TEST(simple);
   RUN_TEST(percentile);
+  RUN_TEST(merge);
   RUN_TEST(get_rate);
 
   END_TEST;
@@ -40,6 +40,8 @@ struct cu_match_s {
   regex_t regex;
   regex_t excluderegex;
   int flags;
+  /* A string every line matching `regex' contains, or NULL. */
+  char *literal;
 
   int (*callback)(const char *str, char *const *matches, size_t matches_num,
                   void *user_data);
@@ -47,9 +49,217 @@ struct cu_match_s {
   void (*free)(void *user_data);
 };
 
+/* Aho-Corasick automaton over the literals of a set of matches. Only bytes
+ * occurring in a literal get a column in the transition table, all other
+ * bytes share column zero. */
+struct cu_match_set_s {
+  cu_match_t **matches;
+  size_t matches_num;
+  bool *candidate;
+
+  bool compiled;
+  uint8_t byte_class[256];
+  size_t classes_num;
+  int32_t *delta; /* states_num * classes_num */
+  size_t states_num;
+  int32_t *output;      /* first match whose literal ends in a state, or -1 */
+  int32_t *output_next; /* next match with the same literal, or -1 */
+  int32_t *dict_suffix; /* next state with an output on the failure path */
+};
+
 /*
  * Private functions
  */
+
+/* Returns a pointer to the character following the bracket expression at `p',
+ * or NULL if it isn't terminated. */
+static const char *match_skip_bracket(const char *p) {
+  p++; /* '[' */
+  if (*p == '^')
+    p++;
+  if (*p == ']')
+    p++;
+
+  while (*p != 0) {
+    if ((p[0] == '[') && ((p[1] == ':') || (p[1] == '.') || (p[1] == '='))) {
+      char end = p[1];
+      p += 2;
+      while ((p[0] != 0) && !((p[0] == end) && (p[1] == ']')))
+        p++;
+      if (p[0] == 0)
+        return NULL;
+      p += 2;
+    } else if (*p == ']') {
+      return p + 1;
+    } else {
+      p++;
+    }
+  }
+  return NULL;
+} /* const char *match_skip_bracket */
+
+/* Returns a pointer to the character following the group at `p', or NULL if
+ * it isn't terminated. */
+static const char *match_skip_group(const char *p) {
+  int depth = 0;
+
+  while (*p != 0) {
+    if (*p == '\\') {
+      if (p[1] == 0)
+        return NULL;
+      p += 2;
+    } else if (*p == '[') {
+      p = match_skip_bracket(p);
+      if (p == NULL)
+        return NULL;
+    } else if (*p == '(') {
+      depth++;
+      p++;
+    } else if (*p == ')') {
+      depth--;
+      p++;
+      if (depth == 0)
+        return p;
+    } else {
+      p++;
+    }
+  }
+  return NULL;
+} /* const char *match_skip_group */
+
+static bool match_is_quantifier(char c) {
+  return (c == '*') || (c == '+') || (c == '?') || (c == '{');
+} /* bool match_is_quantifier */
+
+/* Returns true if the quantifier at `p' allows zero repetitions. */
+static bool match_quantifier_optional(const char *p) {
+  if ((*p == '*') || (*p == '?'))
+    return true;
+  if (*p == '{')
+    return (p[1] == ',') || ((p[1] == '0') && !isdigit((unsigned char)p[2]));
+  return false;
+} /* bool match_quantifier_optional */
+
+static const char *match_skip_quantifiers(const char *p) {
+  while (match_is_quantifier(*p)) {
+    if (*p == '{') {
+      const char *end = strchr(p, '}');
+      p = (end != NULL) ? end + 1 : p + strlen(p);
+    } else {
+      p++;
+    }
+  }
+  return p;
+} /* const char *match_skip_quantifiers */
+
+/* Returns true if `regex' contains an alternation outside of groups. */
+static bool match_has_alternation(const char *regex) {
+  for (const char *p = regex; *p != 0;) {
+    if (*p == '\\') {
+      p += (p[1] != 0) ? 2 : 1;
+    } else if (*p == '[') {
+      p = match_skip_bracket(p);
+      if (p == NULL)
+        return true;
+    } else if (*p == '(') {
+      p = match_skip_group(p);
+      if (p == NULL)
+        return true;
+    } else if (*p == '|') {
+      return true;
+    } else {
+      p++;
+    }
+  }
+  return false;
+} /* bool match_has_alternation */
+
+/* match_required_literal returns the longest string that occurs in every
+ * string matched by the extended regular expression `regex', or NULL if no
+ * such string can be found. The analysis is conservative: groups, bracket
+ * expressions, escapes other than of special characters and non-ASCII bytes
+ * end a literal, and expressions with a top-level alternation have none. */
+static char *match_required_literal(const char *regex) {
+  if (match_has_alternation(regex))
+    return NULL;
+
+  size_t regex_len = strlen(regex);
+  char *run = malloc(regex_len + 1);
+  char *best = malloc(regex_len + 1);
+  if ((run == NULL) || (best == NULL)) {
+    free(run);
+    free(best);
+    return NULL;
+  }
+  size_t run_len = 0;
+  size_t best_len = 0;
+
+/* Ends the current run of literal characters, keeping it if it is the
+ * longest one so far. */
+#define END_RUN()                                                              \
+  do {                                                                         \
+    if (run_len > best_len) {                                                  \
+      memcpy(best, run, run_len);                                              \
+      best_len = run_len;                                                      \
+    }                                                                          \
+    run_len = 0;                                                               \
+  } while (0)
+
+  const char *p = regex;
+  while ((p != NULL) && (*p != 0)) {
+    char c = *p;
+    const char *next = p + 1;
+
+    if (c == '\\') {
+      if ((p[1] == 0) || (strchr(".[]()*+?{}|^$\\", p[1]) == NULL)) {
+        /* back reference, word boundary or similar */
+        END_RUN();
+        p = (p[1] != 0) ? p + 2 : p + 1;
+        continue;
+      }
+      c = p[1];
+      next = p + 2;
+    } else if (c == '[') {
+      END_RUN();
+      p = match_skip_bracket(p);
+      continue;
+    } else if (c == '(') {
+      END_RUN();
+      p = match_skip_group(p);
+      continue;
+    } else if (match_is_quantifier(c)) {
+      END_RUN();
+      p = match_skip_quantifiers(p);
+      continue;
+    } else if ((strchr(".^$)|}", c) != NULL) || ((unsigned char)c >= 0x80)) {
+      END_RUN();
+      p++;
+      continue;
+    }
+
+    if (match_is_quantifier(*next)) {
+      if (!match_quantifier_optional(next))
+        run[run_len++] = c;
+      END_RUN();
+      p = match_skip_quantifiers(next);
+      continue;
+    }
+
+    run[run_len++] = c;
+    p = next;
+  }
+  END_RUN();
+#undef END_RUN
+
+  free(run);
+  if (best_len == 0) {
+    free(best);
+    return NULL;
+  }
+  best[best_len] = 0;
+  return best;
+} /* char *match_required_literal */
+
 static char *match_substr(const char *str, int begin, int end) {
   char *ret;
   size_t ret_len;
@@ -229,6 +439,9 @@ match_create_callback(const char *regex, const char *excluderegex,
     obj->flags |= UTILS_MATCH_FLAGS_EXCLUDE_REGEX;
   }
 
+  obj->literal = match_required_literal(regex);
+  DEBUG("utils_match: match_create_callback: literal = %s", obj->literal);
+
   obj->callback = callback;
   obj->user_data = user_data;
   obj->free = free_user_data;
@@ -291,6 +504,7 @@ void match_destroy(cu_match_t *obj) {
   if ((obj->user_data != NULL) && (obj->free != NULL))
     (*obj->free)(obj->user_data);
 
+  sfree(obj->literal);
   sfree(obj);
 } /* void match_destroy */
 
@@ -355,3 +569,195 @@ void *match_get_user_data(cu_match_t *obj) {
     return NULL;
   return obj->user_data;
 } /* void *match_get_user_data */
+
+const char *match_get_literal(cu_match_t *obj) {
+  if (obj == NULL)
+    return NULL;
+  return obj->literal;
+} /* const char *match_get_literal */
+
+static void match_set_reset(cu_match_set_t *set) {
+  sfree(set->delta);
+  sfree(set->output);
+  sfree(set->output_next);
+  sfree(set->dict_suffix);
+  set->states_num = 0;
+  set->compiled = false;
+} /* void match_set_reset */
+
+static int match_set_compile(cu_match_set_t *set) {
+  match_set_reset(set);
+
+  /* Assign a column to every byte used in a literal. */
+  memset(set->byte_class, 0, sizeof(set->byte_class));
+  set->classes_num = 1;
+  size_t states_max = 1;
+  for (size_t i = 0; i < set->matches_num; i++) {
+    const char *literal = set->matches[i]->literal;
+    if (literal == NULL)
+      continue;
+    for (const char *p = literal; *p != 0; p++) {
+      uint8_t b = (uint8_t)*p;
+      if (set->byte_class[b] == 0)
+        set->byte_class[b] = (uint8_t)set->classes_num++;
+    }
+    states_max += strlen(literal);
+  }
+
+  size_t k = set->classes_num;
+  set->delta = malloc(states_max * k * sizeof(*set->delta));
+  set->output = malloc(states_max * sizeof(*set->output));
+  set->dict_suffix = malloc(states_max * sizeof(*set->dict_suffix));
+  set->output_next = malloc(set->matches_num * sizeof(*set->output_next));
+  int32_t *fail = malloc(states_max * sizeof(*fail));
+  int32_t *queue = malloc(states_max * sizeof(*queue));
+  if ((set->delta == NULL) || (set->output == NULL) ||
+      (set->dict_suffix == NULL) || (set->output_next == NULL) ||
+      (fail == NULL) || (queue == NULL)) {
+    free(fail);
+    free(queue);
+    match_set_reset(set);
+    return ENOMEM;
+  }
+
+  for (size_t i = 0; i < states_max * k; i++)
+    set->delta[i] = -1;
+  for (size_t i = 0; i < states_max; i++) {
+    set->output[i] = -1;
+    set->dict_suffix[i] = -1;
+  }
+
+  /* Build the trie. Matches with the same literal share the output state;
+   * they are chained in reverse so that the chain starts with the first. */
+  set->states_num = 1;
+  for (size_t i = set->matches_num; i-- > 0;) {
+    set->output_next[i] = -1;
+    const char *literal = set->matches[i]->literal;
+    if (literal == NULL)
+      continue;
+
+    int32_t state = 0;
+    for (const char *p = literal; *p != 0; p++) {
+      int32_t *next =
+          set->delta + (size_t)state * k + set->byte_class[(uint8_t)*p];
+      if (*next < 0)
+        *next = (int32_t)set->states_num++;
+      state = *next;
+    }
+    set->output_next[i] = set->output[state];
+    set->output[state] = (int32_t)i;
+  }
+
+  /* Compute failure links breadth first and turn the trie into a DFA. */
+  size_t head = 0;
+  size_t tail = 0;
+  for (size_t c = 0; c < k; c++) {
+    int32_t *next = set->delta + c;
+    if (*next < 0) {
+      *next = 0;
+    } else {
+      fail[*next] = 0;
+      queue[tail++] = *next;
+    }
+  }
+
+  while (head < tail) {
+    int32_t state = queue[head++];
+    int32_t f = fail[state];
+    set->dict_suffix[state] =
+        (set->output[f] >= 0) ? f : set->dict_suffix[f];
+
+    for (size_t c = 0; c < k; c++) {
+      int32_t *next = set->delta + (size_t)state * k + c;
+      int32_t fallback = set->delta[(size_t)f * k + c];
+      if (*next < 0) {
+        *next = fallback;
+      } else {
+        fail[*next] = fallback;
+        queue[tail++] = *next;
+      }
+    }
+  }
+
+  free(fail);
+  free(queue);
+  set->compiled = true;
+  return 0;
+} /* int match_set_compile */
+
+cu_match_set_t *match_set_create(void) {
+  return calloc(1, sizeof(cu_match_set_t));
+} /* cu_match_set_t *match_set_create */
+
+int match_set_add(cu_match_set_t *set, cu_match_t *match) {
+  if ((set == NULL) || (match == NULL))
+    return EINVAL;
+
+  cu_match_t **tmp =
+      realloc(set->matches, (set->matches_num + 1) * sizeof(*set->matches));
+  if (tmp == NULL)
+    return ENOMEM;
+  set->matches = tmp;
+
+  bool *candidate = realloc(set->candidate, (set->matches_num + 1) *
+                                                sizeof(*set->candidate));
+  if (candidate == NULL)
+    return ENOMEM;
+  set->candidate = candidate;
+
+  set->matches[set->matches_num] = match;
+  set->matches_num++;
+  set->compiled = false;
+  return 0;
+} /* int match_set_add */
+
+int match_set_apply(cu_match_set_t *set, const char *str) {
+  if ((set == NULL) || (str == NULL))
+    return -1;
+
+  bool prefilter = true;
+  if (!set->compiled && (match_set_compile(set) != 0)) {
+    ERROR("utils_match: match_set_apply: Compiling the prefilter failed.");
+    prefilter = false;
+  }
+
+  for (size_t i = 0; i < set->matches_num; i++)
+    set->candidate[i] = !prefilter || (set->matches[i]->literal == NULL);
+
+  if (prefilter) {
+    size_t k = set->classes_num;
+    int32_t state = 0;
+    for (const uint8_t *p = (const uint8_t *)str; *p != 0; p++) {
+      state = set->delta[(size_t)state * k + set->byte_class[*p]];
+
+      int32_t s = (set->output[state] >= 0) ? state : set->dict_suffix[state];
+      while (s >= 0) {
+        for (int32_t m = set->output[s]; m >= 0; m = set->output_next[m])
+          set->candidate[m] = true;
+        s = set->dict_suffix[s];
+      }
+    }
+  }
+
+  int status = 0;
+  for (size_t i = 0; i < set->matches_num; i++) {
+    if (!set->candidate[i])
+      continue;
+
+    int tmp = match_apply(set->matches[i], str);
+    if (status == 0)
+      status = tmp;
+  }
+
+  return status;
+} /* int match_set_apply */
+
+void match_set_destroy(cu_match_set_t *set) {
+  if (set == NULL)
+    return;
+
+  match_set_reset(set);
+  sfree(set->matches);
+  sfree(set->candidate);
+  sfree(set);
+} /* void match_set_destroy */
@@ -63,6 +63,9 @@
 struct cu_match_s;
 typedef struct cu_match_s cu_match_t;
 
+struct cu_match_set_s;
+typedef struct cu_match_set_s cu_match_set_t;
+
 struct cu_match_value_s {
   int ds_type;
   value_t value;
@@ -171,4 +174,57 @@ int match_apply(cu_match_t *obj, const char *str);
  */
 void *match_get_user_data(cu_match_t *obj);
 
+/*
+ * NAME
+ *  match_get_literal
+ *
+ * DESCRIPTION
+ *  Returns a string which occurs in every string matched by the regular
+ *  expression of `obj', or NULL if none could be derived from the expression.
+ */
+const char *match_get_literal(cu_match_t *obj);
+
+/*
+ * NAME
+ *  match_set_create
+ *
+ * DESCRIPTION
+ *  Creates an empty set of `cu_match_t' objects. Applying a set to a string is
+ *  equivalent to calling `match_apply' with each match in the order they were
+ *  added, but the string is scanned only once for the literals of all
+ *  matches (see `match_get_literal') and regular expressions are only
+ *  evaluated if their literal occurs in the string.
+ */
+cu_match_set_t *match_set_create(void);
+
+/*
+ * NAME
+ *  match_set_add
+ *
+ * DESCRIPTION
+ *  Adds `match' to the set. The set does not take ownership of the match, it
+ *  must be destroyed after the set.
+ *  Returns zero upon success, non-zero otherwise.
+ */
+int match_set_add(cu_match_set_t *set, cu_match_t *match);
+
+/*
+ * NAME
+ *  match_set_apply
+ *
+ * DESCRIPTION
+ *  Applies all matches of `set' which may match `str'. Returns zero if all
+ *  applied matches succeeded, non-zero otherwise.
+ */
+int match_set_apply(cu_match_set_t *set, const char *str);
+
+/*
+ * NAME
+ *  match_set_destroy
+ *
+ * DESCRIPTION
+ *  Destroys the set. The matches are not destroyed.
+ */
+void match_set_destroy(cu_match_set_t *set);
+
 #endif /* UTILS_MATCH_H */
@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/common/common.h"
+#include "utils/match/match.h"
+
+#include <time.h>
+
+static int count_callback(__attribute__((unused)) const char *str,
+                          __attribute__((unused)) char *const *matches,
+                          __attribute__((unused)) size_t matches_num,
+                          void *user_data) {
+  (*(uint64_t *)user_data)++;
+  return 0;
+}
+
+DEF_TEST(literal) {
+  struct {
+    char const *regex;
+    char const *want;
+  } cases[] = {
+      {"S=([1-9][0-9]*)", "S="},
+      {"\\<R=local_user\\>", "R=local_user"},
+      {"l=([0-9]*\\.[0-9]*)", "l="},
+      {"GET /index\\.html HTTP", "GET /index.html HTTP"},
+      {"^status: (ok|failed)$", "status: "},
+      {"abc*def", "def"}, /* "c" is optional */
+      {"abc+de", "abc"},  /* "c" is required */
+      {"abc{0,2}defgh", "defgh"},
+      {"ab[cd]efg", "efg"},
+      {"error|warning", NULL},
+      {"(error|warning): disk", ": disk"},
+      {"[0-9]+", NULL},
+      {".*", NULL},
+      {"\\<foo\\>", "foo"},
+  };
+
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(cases); i++) {
+    cu_match_t *m = match_create_callback(cases[i].regex, NULL,
+                                          count_callback, NULL, NULL);
+    CHECK_NOT_NULL(m);
+
+    printf("# regex %s\n", cases[i].regex);
+    EXPECT_EQ_STR(cases[i].want, match_get_literal(m));
+    match_destroy(m);
+  }
+
+  return 0;
+}
+
+#define CORPUS_LINES 50000
+#define PATTERNS_NUM 30
+
+static char *corpus[CORPUS_LINES];
+
+static void corpus_init(void) {
+  static char const *methods[] = {"GET", "POST", "PUT", "DELETE"};
+  static char const *paths[] = {"/", "/index.html", "/api/v1/users",
+                                "/api/v1/orders", "/static/app.js",
+                                "/login", "/search?q=collectd"};
+  static int const codes[] = {200, 200, 200, 301, 304, 404, 500, 503};
+  uint32_t x = 42;
+
+  for (size_t i = 0; i < CORPUS_LINES; i++) {
+    char line[512];
+    x = x * 1103515245 + 12345;
+    ssnprintf(line, sizeof(line),
+              "10.0.%u.%u - - [10/Oct/2023:13:55:%02u +0000] \"%s %s "
+              "HTTP/1.1\" %d %u \"-\" \"Mozilla/5.0\" rt=%u.%03u",
+              (x >> 8) % 256, (x >> 16) % 256, (unsigned)(i % 60),
+              methods[(x >> 3) % STATIC_ARRAY_SIZE(methods)],
+              paths[(x >> 5) % STATIC_ARRAY_SIZE(paths)],
+              codes[(x >> 11) % STATIC_ARRAY_SIZE(codes)], (x >> 13) % 100000,
+              (x >> 7) % 3, (x >> 17) % 1000);
+    corpus[i] = strdup(line);
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+DEF_TEST(set) {
+  /* Typical access log matches, most of which are rare in the corpus. */
+  char const *regexes[PATTERNS_NUM] = {
+      "\" 500 ([0-9]+)",
+      "\" 503 ([0-9]+)",
+      "\" 404 ([0-9]+)",
+      "\" 301 ",
+      "\"POST /login HTTP",
+      "\"DELETE /api/v1/users",
+      "\"PUT /api/v1/orders",
+      "/static/app\\.js HTTP/1\\.1\" 304",
+      "rt=([2-9]\\.[0-9]+)",
+      "Googlebot",
+      "bingbot",
+      "curl/([0-9.]+)",
+      "python-requests",
+      "/wp-login\\.php",
+      "/\\.env",
+      "union select",
+      "\\.\\./\\.\\./",
+      "/admin/",
+      "HTTP/2\\.0\"",
+      "HTTP/1\\.0\"",
+      "\"(GET|HEAD) /healthz",
+      "\"GET /metrics",
+      "Mozilla/4\\.0",
+      "\" 502 ",
+      "\" 429 ",
+      "\" 401 ",
+      "\" 403 ",
+      "sqlmap",
+      "nikto",
+      "[0-9]+\\.[0-9]+\\.[0-9]+\\.[0-9]+ - - ",
+  };
+
+  uint64_t want[PATTERNS_NUM] = {0};
+  uint64_t got[PATTERNS_NUM] = {0};
+  cu_match_t *matches[PATTERNS_NUM];
+  cu_match_t *set_matches[PATTERNS_NUM];
+
+  cu_match_set_t *set = match_set_create();
+  CHECK_NOT_NULL(set);
+  for (size_t i = 0; i < PATTERNS_NUM; i++) {
+    CHECK_NOT_NULL(matches[i] = match_create_callback(
+                       regexes[i], "nikto", count_callback, want + i, NULL));
+    CHECK_NOT_NULL(set_matches[i] = match_create_callback(
+                       regexes[i], "nikto", count_callback, got + i, NULL));
+    CHECK_ZERO(match_set_add(set, set_matches[i]));
+  }
+
+  corpus_init();
+
+  double t0 = now();
+  for (size_t i = 0; i < CORPUS_LINES; i++)
+    for (size_t j = 0; j < PATTERNS_NUM; j++)
+      match_apply(matches[j], corpus[i]);
+  double t1 = now();
+  for (size_t i = 0; i < CORPUS_LINES; i++)
+    match_set_apply(set, corpus[i]);
+  double t2 = now();
+
+  printf("# %d lines, %d matches: match_apply %.3fs, match_set_apply %.3fs\n",
+         CORPUS_LINES, PATTERNS_NUM, t1 - t0, t2 - t1);
+
+  for (size_t i = 0; i < PATTERNS_NUM; i++) {
+    printf("# regex %s\n", regexes[i]);
+    EXPECT_EQ_UINT64(want[i], got[i]);
+  }
+  OK(want[0] > 0);
+  EXPECT_EQ_UINT64(CORPUS_LINES, want[PATTERNS_NUM - 1]);
+
+  match_set_destroy(set);
+  for (size_t i = 0; i < PATTERNS_NUM; i++) {
+    match_destroy(matches[i]);
+    match_destroy(set_matches[i]);
+  }
+  for (size_t i = 0; i < CORPUS_LINES; i++)
+    sfree(corpus[i]);
+
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(literal);
+  RUN_TEST(set);
+
+  END_TEST;
+}
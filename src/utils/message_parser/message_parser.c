@@ -45,11 +45,66 @@ typedef struct checked_match_s {
   int msg_pattern_idx;
 } checked_match_t;
 
+/* A pattern matching a line, found by a worker thread. */
+typedef struct parser_event_s {
+  int msg_pattern_idx;
+  char *submatch;
+} parser_event_t;
+
+typedef struct parser_worker_s parser_worker_t;
+
+typedef struct parser_worker_pattern_s {
+  parser_worker_t *worker;
+  int msg_pattern_idx;
+} parser_worker_pattern_t;
+
+/* Each worker has its own compiled regular expressions, because regexec()
+ * serializes concurrent calls on the same regex_t. */
+struct parser_worker_s {
+  parser_job_data_t *parser_job;
+  pthread_t thread;
+  cu_match_t **matches;
+  cu_match_set_t *set;
+  parser_worker_pattern_t *patterns;
+  /* Lines [line_begin, line_end) of the batch are assigned to this worker.
+   * events_end[i] is the end of the events of line (line_begin + i). */
+  size_t line_begin;
+  size_t line_end;
+  parser_event_t *events;
+  size_t events_num;
+  size_t events_max;
+  size_t *events_end;
+};
+
+/* Lines are collected into batches, which are split into one slice per
+ * worker. Found matches are then fed to the message assembly in line order,
+ * so the result is the same as with sequential parsing. */
+typedef struct parser_pool_s {
+  parser_worker_t *workers;
+  size_t workers_num;
+  size_t batch_lines;
+
+  char *batch;
+  size_t batch_len;
+  size_t batch_size;
+  size_t *line_offsets;
+  size_t lines_num;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  uint64_t generation;
+  size_t pending;
+  bool shutdown;
+} parser_pool_t;
+
 struct parser_job_data_s {
   const char *filename;
   unsigned int start_idx;
   unsigned int stop_idx;
   cu_tail_match_t *tm;
+  checked_match_t **checked_matches;
+  parser_pool_t *pool;
   message_t *messages_storage;
   size_t messages_max_len;
   int message_idx;
@@ -239,6 +294,12 @@ parser_job_data_t *message_parser_init(const char *filename,
   memcpy(parser_job->message_patterns, message_patterns,
          sizeof(*parser_job->message_patterns) * message_patterns_len);
   parser_job->message_patterns_len = message_patterns_len;
+  parser_job->checked_matches =
+      calloc(message_patterns_len, sizeof(*parser_job->checked_matches));
+  if (parser_job->checked_matches == NULL) {
+    ERROR(UTIL_NAME ": Error allocating checked_matches");
+    goto free_msg_storage;
+  }
   /* Init tail match */
   parser_job->tm = tail_match_create(parser_job->filename);
   if (parser_job->tm == NULL) {
@@ -257,6 +318,7 @@ parser_job_data_t *message_parser_init(const char *filename,
     current_match->parser_job = parser_job;
     current_match->msg_pattern = message_patterns[i];
     current_match->msg_pattern_idx = i;
+    parser_job->checked_matches[i] = current_match;
     /* Create callback */
     cu_match_t *m = match_create_callback(
         message_patterns[i].regex, message_patterns[i].excluderegex,
@@ -276,6 +338,7 @@ parser_job_data_t *message_parser_init(const char *filename,
 free_tail_match:
   tail_match_destroy(parser_job->tm);
 free_msg_storage:
+  sfree(parser_job->checked_matches);
   sfree(parser_job->messages_storage);
 free_msg_patterns:
   sfree(parser_job->message_patterns);
@@ -285,6 +348,287 @@ free_parser_job:
   return NULL;
 }
 
+int message_parser_set_state_file(parser_job_data_t *parser_job,
+                                  const char *state_file) {
+  if (parser_job == NULL) {
+    ERROR(UTIL_NAME ": Invalid parser_job pointer");
+    return -1;
+  }
+  return tail_match_set_state_file(parser_job->tm, state_file);
+}
+
+static int parser_worker_callback(__attribute__((unused)) const char *row,
+                                  char *const *matches, size_t matches_num,
+                                  void *user_data) {
+  parser_worker_pattern_t *wp = user_data;
+  parser_worker_t *worker = wp->worker;
+  message_pattern_t *pattern =
+      worker->parser_job->message_patterns + wp->msg_pattern_idx;
+
+  if (worker->events_num == worker->events_max) {
+    size_t max = (worker->events_max == 0) ? 64 : 2 * worker->events_max;
+    parser_event_t *tmp = realloc(worker->events, max * sizeof(*tmp));
+    if (tmp == NULL) {
+      ERROR(UTIL_NAME ": Error allocating parser events");
+      return -1;
+    }
+    worker->events = tmp;
+    worker->events_max = max;
+  }
+
+  char *submatch = NULL;
+  if ((pattern->submatch_idx >= 0) &&
+      (pattern->submatch_idx < (int)matches_num)) {
+    submatch = strdup(matches[pattern->submatch_idx]);
+    if (submatch == NULL)
+      return -1;
+  }
+
+  worker->events[worker->events_num++] = (parser_event_t){
+      .msg_pattern_idx = wp->msg_pattern_idx,
+      .submatch = submatch,
+  };
+  return 0;
+}
+
+static void parser_worker_match(parser_worker_t *worker) {
+  parser_pool_t *pool = worker->parser_job->pool;
+
+  worker->events_num = 0;
+  for (size_t i = worker->line_begin; i < worker->line_end; i++) {
+    match_set_apply(worker->set, pool->batch + pool->line_offsets[i]);
+    worker->events_end[i - worker->line_begin] = worker->events_num;
+  }
+}
+
+static void *parser_worker_thread(void *arg) {
+  parser_worker_t *worker = arg;
+  parser_pool_t *pool = worker->parser_job->pool;
+  uint64_t generation = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (!pool->shutdown && (pool->generation == generation))
+      pthread_cond_wait(&pool->work_cond, &pool->lock);
+    if (pool->shutdown)
+      break;
+    generation = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    parser_worker_match(worker);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending--;
+    if (pool->pending == 0)
+      pthread_cond_signal(&pool->done_cond);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+/* Feeds a pattern match found by a worker to the message assembly. */
+static void parser_event_replay(parser_job_data_t *parser_job,
+                                parser_event_t *event) {
+  checked_match_t *cm = parser_job->checked_matches[event->msg_pattern_idx];
+  int submatch_idx = cm->msg_pattern.submatch_idx;
+
+  /* Only the submatch used by the pattern is kept by the workers. A missing
+   * submatch is reported by message_assembler(). */
+  char *matches[32] = {0};
+  size_t matches_num = 0;
+  if ((submatch_idx >= 0) && (event->submatch != NULL)) {
+    matches[submatch_idx] = event->submatch;
+    matches_num = (size_t)submatch_idx + 1;
+  }
+
+  message_assembler(NULL, matches, matches_num, cm);
+}
+
+static int parser_pool_process(parser_job_data_t *parser_job) {
+  parser_pool_t *pool = parser_job->pool;
+  if (pool->lines_num == 0)
+    return 0;
+
+  /* Assign contiguous slices of the batch to the workers. */
+  size_t per_worker = pool->lines_num / pool->workers_num;
+  size_t remainder = pool->lines_num % pool->workers_num;
+  size_t line = 0;
+  for (size_t i = 0; i < pool->workers_num; i++) {
+    parser_worker_t *worker = pool->workers + i;
+    worker->line_begin = line;
+    line += per_worker + ((i < remainder) ? 1 : 0);
+    worker->line_end = line;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->pending = pool->workers_num;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->work_cond);
+  while (pool->pending > 0)
+    pthread_cond_wait(&pool->done_cond, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+
+  /* Merge the results in line order. */
+  for (size_t i = 0; i < pool->workers_num; i++) {
+    parser_worker_t *worker = pool->workers + i;
+    for (size_t j = 0; j < worker->events_num; j++) {
+      parser_event_replay(parser_job, worker->events + j);
+      sfree(worker->events[j].submatch);
+    }
+    worker->events_num = 0;
+  }
+
+  pool->batch_len = 0;
+  pool->lines_num = 0;
+  return 0;
+}
+
+static int parser_pool_add_line(void *data, char *buf,
+                                __attribute__((unused)) int buflen) {
+  parser_job_data_t *parser_job = data;
+  parser_pool_t *pool = parser_job->pool;
+
+  size_t len = strlen(buf) + 1;
+  if (pool->batch_len + len > pool->batch_size) {
+    size_t size = 2 * (pool->batch_len + len);
+    char *tmp = realloc(pool->batch, size);
+    if (tmp == NULL) {
+      ERROR(UTIL_NAME ": Error allocating line batch");
+      return -1;
+    }
+    pool->batch = tmp;
+    pool->batch_size = size;
+  }
+
+  memcpy(pool->batch + pool->batch_len, buf, len);
+  pool->line_offsets[pool->lines_num++] = pool->batch_len;
+  pool->batch_len += len;
+
+  if (pool->lines_num == pool->batch_lines)
+    return parser_pool_process(parser_job);
+  return 0;
+}
+
+static void parser_pool_destroy(parser_pool_t *pool) {
+  if (pool == NULL)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 0; i < pool->workers_num; i++) {
+    parser_worker_t *worker = pool->workers + i;
+
+    if (worker->thread != (pthread_t)0)
+      pthread_join(worker->thread, NULL);
+
+    match_set_destroy(worker->set);
+    if (worker->matches != NULL) {
+      size_t patterns_len = worker->parser_job->message_patterns_len;
+      for (size_t j = 0; j < patterns_len; j++)
+        match_destroy(worker->matches[j]);
+    }
+    for (size_t j = 0; j < worker->events_num; j++)
+      sfree(worker->events[j].submatch);
+    sfree(worker->matches);
+    sfree(worker->patterns);
+    sfree(worker->events);
+    sfree(worker->events_end);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_cond_destroy(&pool->done_cond);
+  sfree(pool->workers);
+  sfree(pool->batch);
+  sfree(pool->line_offsets);
+  sfree(pool);
+}
+
+static int parser_worker_init(parser_job_data_t *parser_job,
+                              parser_worker_t *worker, size_t batch_lines) {
+  size_t patterns_len = parser_job->message_patterns_len;
+
+  worker->parser_job = parser_job;
+  worker->set = match_set_create();
+  worker->matches = calloc(patterns_len, sizeof(*worker->matches));
+  worker->patterns = calloc(patterns_len, sizeof(*worker->patterns));
+  worker->events_end = calloc(batch_lines, sizeof(*worker->events_end));
+  if ((worker->set == NULL) || (worker->matches == NULL) ||
+      (worker->patterns == NULL) || (worker->events_end == NULL))
+    return ENOMEM;
+
+  for (size_t i = 0; i < patterns_len; i++) {
+    message_pattern_t *pattern = parser_job->message_patterns + i;
+
+    worker->patterns[i] = (parser_worker_pattern_t){
+        .worker = worker,
+        .msg_pattern_idx = (int)i,
+    };
+    worker->matches[i] = match_create_callback(
+        pattern->regex, pattern->excluderegex, parser_worker_callback,
+        worker->patterns + i, NULL);
+    if (worker->matches[i] == NULL)
+      return EINVAL;
+    if (match_set_add(worker->set, worker->matches[i]) != 0)
+      return ENOMEM;
+  }
+
+  return 0;
+}
+
+int message_parser_set_workers(parser_job_data_t *parser_job,
+                               size_t workers_num, size_t batch_lines) {
+  if ((parser_job == NULL) || (batch_lines == 0)) {
+    ERROR(UTIL_NAME ": Invalid arguments");
+    return -1;
+  }
+
+  parser_pool_destroy(parser_job->pool);
+  parser_job->pool = NULL;
+  if (workers_num == 0)
+    return 0;
+
+  parser_pool_t *pool = calloc(1, sizeof(*pool));
+  if (pool == NULL) {
+    ERROR(UTIL_NAME ": Error allocating worker pool");
+    return -1;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  pool->batch_lines = batch_lines;
+  pool->line_offsets = calloc(batch_lines, sizeof(*pool->line_offsets));
+  pool->workers = calloc(workers_num, sizeof(*pool->workers));
+  if ((pool->line_offsets == NULL) || (pool->workers == NULL)) {
+    ERROR(UTIL_NAME ": Error allocating worker pool");
+    parser_pool_destroy(pool);
+    return -1;
+  }
+  parser_job->pool = pool;
+
+  for (size_t i = 0; i < workers_num; i++) {
+    parser_worker_t *worker = pool->workers + i;
+    pool->workers_num++;
+
+    int status = parser_worker_init(parser_job, worker, batch_lines);
+    if (status == 0)
+      status = plugin_thread_create(&worker->thread, parser_worker_thread,
+                                    worker, "logparser");
+    if (status != 0) {
+      ERROR(UTIL_NAME ": Starting parser worker failed: %s", STRERROR(status));
+      parser_job->pool = NULL;
+      parser_pool_destroy(pool);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 int message_parser_read(parser_job_data_t *parser_job,
                         message_t **messages_storage, bool force_rewind) {
   if (parser_job == NULL) {
@@ -319,7 +663,15 @@ int message_parser_read(parser_job_data_t *parser_job,
     parser_job->message_idx = -1;
   }
 
-  int status = tail_match_read(parser_job->tm, force_rewind);
+  int status;
+  if (parser_job->pool != NULL) {
+    status = tail_match_read_lines(parser_job->tm, parser_pool_add_line,
+                                   parser_job, force_rewind);
+    if (status == 0)
+      status = parser_pool_process(parser_job);
+  } else {
+    status = tail_match_read(parser_job->tm, force_rewind);
+  }
   if (status != 0) {
     ERROR(UTIL_NAME ": Error while parser read. Status: %d", status);
     return -1;
@@ -339,9 +691,11 @@ void message_parser_cleanup(parser_job_data_t *parser_job) {
     ERROR(UTIL_NAME ": Invalid parser_job pointer");
     return;
   }
+  parser_pool_destroy(parser_job->pool);
   sfree(parser_job->messages_storage);
-  sfree(parser_job->message_patterns);
   if (parser_job->tm)
     tail_match_destroy(parser_job->tm);
+  sfree(parser_job->checked_matches);
+  sfree(parser_job->message_patterns);
   sfree(parser_job);
 }
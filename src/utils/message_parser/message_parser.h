@@ -114,6 +114,38 @@ parser_job_data_t *message_parser_init(const char *filename,
                                        message_pattern_t message_patterns[],
                                        size_t message_patterns_len);
 
+/*
+ * NAME
+ *   message_parser_set_state_file
+ *
+ * DESCRIPTION
+ *   Persists the position in the parsed file to `state_file', so that parsing
+ *   resumes where it left off after a restart. Must be called before the first
+ *   call to 'message_parser_read'.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise.
+ */
+int message_parser_set_state_file(parser_job_data_t *parser_job,
+                                  const char *state_file);
+
+/*
+ * NAME
+ *   message_parser_set_workers
+ *
+ * DESCRIPTION
+ *   Matches the patterns in `workers_num' threads. New lines are read in
+ *   batches of up to `batch_lines' lines, which are split between the
+ *   workers. Messages are assembled from the results in the order of the
+ *   lines, so multi-line messages are handled as in sequential parsing.
+ *   A `workers_num' of zero parses sequentially, which is the default.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise.
+ */
+int message_parser_set_workers(parser_job_data_t *parser_job,
+                               size_t workers_num, size_t batch_lines);
+
 /*
  * NAME
  *   message_parser_read
@@ -27,6 +27,17 @@
 
 #include "collectd.h"
 #include "testing.h"
+#include "utils/strbuf/strbuf.h"
+
+#include <pthread.h>
+
+/* The plugin mock does not start threads, but the parser workers need them. */
+static int test_thread_create(pthread_t *thread, void *(*start)(void *),
+                              void *arg,
+                              __attribute__((unused)) char const *name) {
+  return pthread_create(thread, NULL, start, arg);
+}
+#define plugin_thread_create test_thread_create
 
 #include "utils/message_parser/message_parser.c"
 
@@ -426,7 +437,119 @@ DEF_TEST(msg_parser_read_2) {
   return 0;
 }
 
+static char test_dir[] = "/tmp/collectd_message_parser_test_XXXXXX";
+static char test_file[PATH_MAX];
+
+/* Multi-line messages, including one which is interrupted by a new start
+ * pattern and one with several patterns matching the same line. */
+static char const *test_log_1 = "BEGIN id=1\n"
+                                "noise\n"
+                                "value=a\n"
+                                "END\n"
+                                "value=stray\n"
+                                "BEGIN id=2\n"
+                                "value=b\n"
+                                "BEGIN id=3\n"
+                                "value=c\n"
+                                "value=d\n"
+                                "END\n"
+                                "BEGIN id=4 value=e\n"
+                                "noise\n";
+/* Completes the message started at the end of test_log_1. */
+static char const *test_log_2 = "value=f\n"
+                                "END\n"
+                                "BEGIN id=5\n"
+                                "value=g END\n"
+                                "BEGIN id=6\n";
+
+static int append_log(char const *s) {
+  FILE *fh = fopen(test_file, "a");
+  if (fh == NULL)
+    return errno;
+  fputs(s, fh);
+  fclose(fh);
+  return 0;
+}
+
+/* Appends the completed messages to "buf", one line per message. */
+static void print_messages(strbuf_t *buf, message_t const *messages, int num) {
+  for (int i = 0; i < num; i++) {
+    if (!messages[i].completed)
+      continue;
+    for (size_t j = 0; j < STATIC_ARRAY_SIZE(messages[i].message_items); j++) {
+      message_item_t const *item = messages[i].message_items + j;
+      if (item->name[0] == 0)
+        break;
+      strbuf_printf(buf, "%s%s=%s", (j == 0) ? "" : " ", item->name,
+                    item->value);
+    }
+    strbuf_print(buf, "\n");
+  }
+}
+
+/* Parses the test log with "workers_num" workers, reading the second part of
+ * the log after the first one has been parsed. */
+static int parse_log(strbuf_t *buf, size_t workers_num, size_t batch_lines) {
+  message_pattern_t patterns[] = {
+      {.name = "id", .regex = "BEGIN id=([0-9]+)", .submatch_idx = 1,
+       .is_mandatory = true},
+      {.name = "value", .regex = "value=([a-z]+)", .submatch_idx = 1},
+      {.name = "end", .regex = "END", .submatch_idx = -1,
+       .is_mandatory = true},
+  };
+
+  unlink(test_file);
+  CHECK_ZERO(append_log(test_log_1));
+
+  parser_job_data_t *job = message_parser_init(test_file, 0, 2, patterns,
+                                               STATIC_ARRAY_SIZE(patterns));
+  CHECK_NOT_NULL(job);
+  CHECK_ZERO(message_parser_set_workers(job, workers_num, batch_lines));
+
+  message_t *messages = NULL;
+  int num = message_parser_read(job, &messages, /* force_rewind = */ true);
+  OK(num >= 0);
+  print_messages(buf, messages, num);
+
+  CHECK_ZERO(append_log(test_log_2));
+  num = message_parser_read(job, &messages, /* force_rewind = */ false);
+  OK(num >= 0);
+  print_messages(buf, messages, num);
+
+  message_parser_cleanup(job);
+  unlink(test_file);
+  return 0;
+}
+
+DEF_TEST(msg_parser_read_parallel) {
+  strbuf_t want = STRBUF_CREATE;
+  CHECK_ZERO(parse_log(&want, /* workers_num = */ 0, /* batch_lines = */ 1));
+  EXPECT_EQ_STR("id=1 value=a\n"
+                "id=3 value=c value=d\n"
+                "id=4 value=e value=f\n"
+                "id=5 value=g\n",
+                want.ptr);
+
+  /* Small batches, so that messages span batches and workers. */
+  size_t const batch_lines[] = {1, 3, 4, 64};
+  for (size_t workers_num = 1; workers_num <= 3; workers_num++) {
+    for (size_t i = 0; i < STATIC_ARRAY_SIZE(batch_lines); i++) {
+      strbuf_t got = STRBUF_CREATE;
+      CHECK_ZERO(parse_log(&got, workers_num, batch_lines[i]));
+      EXPECT_EQ_STR(want.ptr, got.ptr);
+      STRBUF_DESTROY(got);
+    }
+  }
+
+  STRBUF_DESTROY(want);
+  return 0;
+}
+
 int main(void) {
+  if (mkdtemp(test_dir) == NULL)
+    return 1;
+  ssnprintf(test_file, sizeof(test_file), "%s/log", test_dir);
+
   /* message_item_assembly */
   RUN_TEST(msg_item_assembly);
   /* start_message_item_assembly */
@@ -448,6 +571,8 @@ int main(void) {
   /* message_parser_read */
   RUN_TEST(msg_parser_read_1);
   RUN_TEST(msg_parser_read_2);
+  RUN_TEST(msg_parser_read_parallel);
 
+  rmdir(test_dir);
   END_TEST;
 }
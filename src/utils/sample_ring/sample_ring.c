@@ -0,0 +1,226 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "utils/sample_ring/sample_ring.h"
+
+#include <math.h>
+
+struct sample_ring_s {
+  size_t capacity;
+  size_t head; /* index of the oldest sample */
+  size_t num;
+  double *values;
+
+  /* Sorted copy of "values", rebuilt lazily for percentile lookups. */
+  double *sorted;
+  bool sorted_valid;
+};
+
+sample_ring_t *sample_ring_create(size_t capacity)
+{
+  if (capacity == 0)
+    return NULL;
+
+  sample_ring_t *r = calloc(1, sizeof(*r));
+  if (r == NULL)
+    return NULL;
+
+  r->values = calloc(capacity, sizeof(*r->values));
+  r->sorted = calloc(capacity, sizeof(*r->sorted));
+  if ((r->values == NULL) || (r->sorted == NULL)) {
+    sample_ring_destroy(r);
+    return NULL;
+  }
+  r->capacity = capacity;
+
+  return r;
+}
+
+void sample_ring_destroy(sample_ring_t *r)
+{
+  if (r == NULL)
+    return;
+
+  free(r->values);
+  free(r->sorted);
+  free(r);
+}
+
+void sample_ring_add(sample_ring_t *r, double value)
+{
+  if ((r == NULL) || isnan(value))
+    return;
+
+  if (r->num < r->capacity) {
+    r->values[(r->head + r->num) % r->capacity] = value;
+    r->num++;
+  } else {
+    r->values[r->head] = value;
+    r->head = (r->head + 1) % r->capacity;
+  }
+  r->sorted_valid = false;
+}
+
+void sample_ring_reset(sample_ring_t *r)
+{
+  if (r == NULL)
+    return;
+
+  r->head = 0;
+  r->num = 0;
+  r->sorted_valid = false;
+}
+
+size_t sample_ring_num(sample_ring_t const *r)
+{
+  if (r == NULL)
+    return 0;
+  return r->num;
+}
+
+double sample_ring_get(sample_ring_t const *r, size_t i)
+{
+  if ((r == NULL) || (i >= r->num))
+    return NAN;
+  return r->values[(r->head + i) % r->capacity];
+}
+
+double sample_ring_min(sample_ring_t const *r)
+{
+  if ((r == NULL) || (r->num == 0))
+    return NAN;
+
+  double min = r->values[r->head];
+  for (size_t i = 1; i < r->num; i++) {
+    double v = r->values[(r->head + i) % r->capacity];
+    if (v < min)
+      min = v;
+  }
+  return min;
+}
+
+double sample_ring_max(sample_ring_t const *r)
+{
+  if ((r == NULL) || (r->num == 0))
+    return NAN;
+
+  double max = r->values[r->head];
+  for (size_t i = 1; i < r->num; i++) {
+    double v = r->values[(r->head + i) % r->capacity];
+    if (v > max)
+      max = v;
+  }
+  return max;
+}
+
+double sample_ring_average(sample_ring_t const *r)
+{
+  if ((r == NULL) || (r->num == 0))
+    return NAN;
+
+  double sum = 0;
+  for (size_t i = 0; i < r->num; i++)
+    sum += r->values[(r->head + i) % r->capacity];
+  return sum / ((double)r->num);
+}
+
+static int sample_ring_compare(void const *a, void const *b)
+{
+  double x = *((double const *)a);
+  double y = *((double const *)b);
+
+  if (x < y)
+    return -1;
+  if (x > y)
+    return 1;
+  return 0;
+}
+
+double sample_ring_percentile(sample_ring_t *r, double percent)
+{
+  if ((r == NULL) || (r->num == 0))
+    return NAN;
+  if ((percent < 0.0) || (percent > 100.0))
+    return NAN;
+
+  if (!r->sorted_valid) {
+    for (size_t i = 0; i < r->num; i++)
+      r->sorted[i] = r->values[(r->head + i) % r->capacity];
+    qsort(r->sorted, r->num, sizeof(*r->sorted), sample_ring_compare);
+    r->sorted_valid = true;
+  }
+
+  /* nearest-rank method */
+  size_t rank = (size_t)ceil((percent / 100.0) * ((double)r->num));
+  if (rank == 0)
+    rank = 1;
+  return r->sorted[rank - 1];
+}
+
+static int sample_ring_append_stat(metric_family_t *fam, metric_t *m,
+                                   char const *stat, double value)
+{
+  int status = metric_label_set(m, "stat", stat);
+  if (status != 0)
+    return status;
+
+  m->value.gauge = value;
+  return metric_family_metric_append(fam, *m);
+}
+
+int sample_ring_metric_append(sample_ring_t *r, metric_family_t *fam,
+                              metric_t const *templ, double const *percentile,
+                              size_t percentile_num, distribution_t *layout)
+{
+  if ((r == NULL) || (fam == NULL))
+    return EINVAL;
+  if (r->num == 0)
+    return 0;
+
+  metric_t m = {0};
+  if (templ != NULL) {
+    int status = label_set_clone(&m.label, templ->label);
+    if (status != 0)
+      return status;
+    m.time = templ->time;
+    m.interval = templ->interval;
+  }
+
+  int status = 0;
+  if (fam->type == METRIC_TYPE_DISTRIBUTION) {
+    if (layout == NULL) {
+      metric_reset(&m);
+      return EINVAL;
+    }
+
+    distribution_t *dist = distribution_clone(layout);
+    if (dist == NULL) {
+      metric_reset(&m);
+      return ENOMEM;
+    }
+    distribution_reset(dist);
+    for (size_t i = 0; i < r->num; i++)
+      distribution_update(dist, r->values[(r->head + i) % r->capacity]);
+
+    m.value.distribution = dist;
+    /* metric_family_metric_append() stores a copy of the distribution. */
+    status = metric_family_metric_append(fam, m);
+    distribution_destroy(dist);
+    m.value.distribution = NULL;
+  } else {
+    status = sample_ring_append_stat(fam, &m, "min", sample_ring_min(r));
+    if (status == 0)
+      status = sample_ring_append_stat(fam, &m, "max", sample_ring_max(r));
+    if (status == 0)
+      status = sample_ring_append_stat(fam, &m, "avg", sample_ring_average(r));
+    for (size_t i = 0; (status == 0) && (i < percentile_num); i++) {
+      char stat[16];
+      snprintf(stat, sizeof(stat), "p%g", percentile[i]);
+      status = sample_ring_append_stat(fam, &m, stat,
+                                       sample_ring_percentile(r, percentile[i]));
+    }
+  }
+
+  metric_reset(&m);
+  return status;
+}
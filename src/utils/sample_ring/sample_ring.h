@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef UTILS_SAMPLE_RING_H
+#define UTILS_SAMPLE_RING_H 1
+
+#include "collectd.h"
+
+#include "distribution.h"
+#include "metric.h"
+
+/* sample_ring_t is a fixed capacity ring buffer of gauge samples. When the
+ * ring is full the oldest sample is overwritten. It is meant for plugins that
+ * sample faster than their read interval and only dispatch an aggregate. */
+struct sample_ring_s;
+typedef struct sample_ring_s sample_ring_t;
+
+sample_ring_t *sample_ring_create(size_t capacity);
+void sample_ring_destroy(sample_ring_t *r);
+
+/* sample_ring_add appends a sample. NaN values are ignored. */
+void sample_ring_add(sample_ring_t *r, double value);
+void sample_ring_reset(sample_ring_t *r);
+
+size_t sample_ring_num(sample_ring_t const *r);
+/* sample_ring_get returns the i-th sample, oldest first. */
+double sample_ring_get(sample_ring_t const *r, size_t i);
+
+double sample_ring_min(sample_ring_t const *r);
+double sample_ring_max(sample_ring_t const *r);
+double sample_ring_average(sample_ring_t const *r);
+/* sample_ring_percentile returns the nearest-rank percentile of the samples
+ * in the ring, or NaN if the ring is empty. */
+double sample_ring_percentile(sample_ring_t *r, double percent);
+
+/* sample_ring_metric_append appends the samples in "r" to "fam", using
+ * "templ" for the labels of the new metrics. For METRIC_TYPE_DISTRIBUTION
+ * families all samples are added to a copy of "layout" which is appended as a
+ * single metric. Otherwise one metric is appended for each of the min, max,
+ * avg and percentile statistics, distinguished by the "stat" label. */
+int sample_ring_metric_append(sample_ring_t *r, metric_family_t *fam,
+                              metric_t const *templ, double const *percentile,
+                              size_t percentile_num, distribution_t *layout);
+
+#endif /* UTILS_SAMPLE_RING_H */
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/sample_ring/sample_ring.h"
+
+DEF_TEST(simple) {
+  sample_ring_t *r;
+
+  CHECK_NOT_NULL(r = sample_ring_create(10));
+  EXPECT_EQ_UINT64(0, sample_ring_num(r));
+  EXPECT_EQ_DOUBLE(NAN, sample_ring_min(r));
+  EXPECT_EQ_DOUBLE(NAN, sample_ring_percentile(r, 50));
+
+  double values[] = {5, 3, 9, 1, 7};
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    sample_ring_add(r, values[i]);
+  sample_ring_add(r, NAN);
+
+  EXPECT_EQ_UINT64(5, sample_ring_num(r));
+  EXPECT_EQ_DOUBLE(1, sample_ring_min(r));
+  EXPECT_EQ_DOUBLE(9, sample_ring_max(r));
+  EXPECT_EQ_DOUBLE(5, sample_ring_average(r));
+  EXPECT_EQ_DOUBLE(5, sample_ring_percentile(r, 50));
+  EXPECT_EQ_DOUBLE(9, sample_ring_percentile(r, 100));
+  EXPECT_EQ_DOUBLE(1, sample_ring_percentile(r, 0));
+  /* percentiles must not disturb the ring order */
+  EXPECT_EQ_DOUBLE(5, sample_ring_get(r, 0));
+  EXPECT_EQ_DOUBLE(7, sample_ring_get(r, 4));
+
+  sample_ring_reset(r);
+  EXPECT_EQ_UINT64(0, sample_ring_num(r));
+
+  sample_ring_destroy(r);
+  return 0;
+}
+
+DEF_TEST(wrap_around) {
+  sample_ring_t *r;
+
+  CHECK_NOT_NULL(r = sample_ring_create(4));
+  for (int i = 1; i <= 10; i++)
+    sample_ring_add(r, (double)i);
+
+  EXPECT_EQ_UINT64(4, sample_ring_num(r));
+  EXPECT_EQ_DOUBLE(7, sample_ring_get(r, 0));
+  EXPECT_EQ_DOUBLE(10, sample_ring_get(r, 3));
+  EXPECT_EQ_DOUBLE(7, sample_ring_min(r));
+  EXPECT_EQ_DOUBLE(10, sample_ring_max(r));
+  EXPECT_EQ_DOUBLE(8.5, sample_ring_average(r));
+  EXPECT_EQ_DOUBLE(8, sample_ring_percentile(r, 50));
+
+  sample_ring_add(r, 1);
+  EXPECT_EQ_DOUBLE(1, sample_ring_percentile(r, 25));
+
+  sample_ring_destroy(r);
+  return 0;
+}
+
+DEF_TEST(metric_append) {
+  sample_ring_t *r;
+
+  CHECK_NOT_NULL(r = sample_ring_create(8));
+  for (int i = 1; i <= 4; i++)
+    sample_ring_add(r, (double)i);
+
+  metric_family_t fam = {
+      .name = "test_hires",
+      .type = METRIC_TYPE_GAUGE,
+  };
+  metric_t templ = {0};
+  CHECK_ZERO(metric_label_set(&templ, "device", "sda"));
+
+  double percentile[] = {50, 99.5};
+  CHECK_ZERO(sample_ring_metric_append(r, &fam, &templ, percentile, 2, NULL));
+  EXPECT_EQ_UINT64(5, fam.metric.num);
+  EXPECT_EQ_STR("sda", metric_label_get(&fam.metric.ptr[0], "device"));
+  EXPECT_EQ_STR("min", metric_label_get(&fam.metric.ptr[0], "stat"));
+  EXPECT_EQ_DOUBLE(1, fam.metric.ptr[0].value.gauge);
+  EXPECT_EQ_STR("avg", metric_label_get(&fam.metric.ptr[2], "stat"));
+  EXPECT_EQ_DOUBLE(2.5, fam.metric.ptr[2].value.gauge);
+  EXPECT_EQ_STR("p99.5", metric_label_get(&fam.metric.ptr[4], "stat"));
+  EXPECT_EQ_DOUBLE(4, fam.metric.ptr[4].value.gauge);
+  metric_family_metric_reset(&fam);
+
+  distribution_t *layout;
+  CHECK_NOT_NULL(layout = distribution_new_linear(4, 1.0));
+  fam.type = METRIC_TYPE_DISTRIBUTION;
+  CHECK_ZERO(sample_ring_metric_append(r, &fam, &templ, NULL, 0, layout));
+  EXPECT_EQ_UINT64(1, fam.metric.num);
+  EXPECT_EQ_UINT64(4,
+                   distribution_total_counter(fam.metric.ptr[0].value.distribution));
+  /* the layout itself is left untouched */
+  EXPECT_EQ_UINT64(0, distribution_total_counter(layout));
+  metric_family_metric_reset(&fam);
+
+  distribution_destroy(layout);
+  metric_reset(&templ);
+  sample_ring_destroy(r);
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(simple);
+  RUN_TEST(wrap_around);
+  RUN_TEST(metric_append);
+
+  END_TEST;
+}
@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "utils/snappy/snappy.h"
+
+/* Input is compressed in independent blocks so that offsets always fit into
+ * the two byte copy elements and the hash table can use 16 bit positions. */
+#define SNAPPY_BLOCK_SIZE 65536
+#define SNAPPY_HASH_BITS 14
+
+#define SNAPPY_TAG_LITERAL 0x00
+#define SNAPPY_TAG_COPY_1 0x01
+#define SNAPPY_TAG_COPY_2 0x02
+#define SNAPPY_TAG_COPY_4 0x03
+
+size_t snappy_encode_bound(size_t src_len) {
+  return 32 + src_len + src_len / 6;
+}
+
+static uint32_t snappy_load32(uint8_t const *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static uint32_t snappy_hash(uint32_t v) {
+  return (v * 0x1e35a7bd) >> (32 - SNAPPY_HASH_BITS);
+}
+
+static uint8_t *snappy_put_varint(uint8_t *dst, uint64_t v) {
+  while (v >= 0x80) {
+    *dst++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *dst++ = (uint8_t)v;
+  return dst;
+}
+
+static uint8_t *snappy_emit_literal(uint8_t *dst, uint8_t const *src,
+                                    size_t len) {
+  size_t n = len - 1;
+
+  if (n < 60) {
+    *dst++ = SNAPPY_TAG_LITERAL | (uint8_t)(n << 2);
+  } else {
+    /* Tags 60 to 63 are followed by the length in 1 to 4 bytes. */
+    int bytes = 0;
+    for (size_t tmp = n; tmp > 0; tmp >>= 8)
+      bytes++;
+    *dst++ = SNAPPY_TAG_LITERAL | (uint8_t)((59 + bytes) << 2);
+    for (int i = 0; i < bytes; i++)
+      *dst++ = (uint8_t)(n >> (8 * i));
+  }
+
+  memcpy(dst, src, len);
+  return dst + len;
+}
+
+/* snappy_emit_copy emits a back reference. "len" must be at least 4. */
+static uint8_t *snappy_emit_copy(uint8_t *dst, size_t offset, size_t len) {
+  /* Copies with a two byte offset hold at most 64 bytes. Split long matches
+   * so that the remainder is at least 4 bytes. */
+  while (len >= 68) {
+    *dst++ = SNAPPY_TAG_COPY_2 | (63 << 2);
+    *dst++ = (uint8_t)offset;
+    *dst++ = (uint8_t)(offset >> 8);
+    len -= 64;
+  }
+  if (len > 64) {
+    *dst++ = SNAPPY_TAG_COPY_2 | (59 << 2);
+    *dst++ = (uint8_t)offset;
+    *dst++ = (uint8_t)(offset >> 8);
+    len -= 60;
+  }
+
+  if ((len < 12) && (offset < 2048)) {
+    *dst++ = SNAPPY_TAG_COPY_1 | (uint8_t)((len - 4) << 2) |
+             (uint8_t)((offset >> 8) << 5);
+    *dst++ = (uint8_t)offset;
+  } else {
+    *dst++ = SNAPPY_TAG_COPY_2 | (uint8_t)((len - 1) << 2);
+    *dst++ = (uint8_t)offset;
+    *dst++ = (uint8_t)(offset >> 8);
+  }
+  return dst;
+}
+
+static uint8_t *snappy_encode_block(uint8_t *dst, uint8_t const *src,
+                                    size_t src_len, uint16_t *table) {
+  memset(table, 0, sizeof(*table) << SNAPPY_HASH_BITS);
+
+  size_t literal = 0;
+  size_t i = 0;
+  while ((i + 4) <= src_len) {
+    uint32_t v = snappy_load32(src + i);
+    uint32_t h = snappy_hash(v);
+    size_t candidate = table[h];
+    table[h] = (uint16_t)i;
+
+    if ((candidate >= i) || (snappy_load32(src + candidate) != v)) {
+      i++;
+      continue;
+    }
+
+    size_t len = 4;
+    while (((i + len) < src_len) && (src[candidate + len] == src[i + len]))
+      len++;
+
+    if (literal < i)
+      dst = snappy_emit_literal(dst, src + literal, i - literal);
+    dst = snappy_emit_copy(dst, i - candidate, len);
+
+    i += len;
+    literal = i;
+  }
+
+  if (literal < src_len)
+    dst = snappy_emit_literal(dst, src + literal, src_len - literal);
+  return dst;
+}
+
+int snappy_encode(void const *src, size_t src_len, void *dst,
+                  size_t *ret_dst_len) {
+  if (((src == NULL) && (src_len != 0)) || (dst == NULL) ||
+      (ret_dst_len == NULL) || (src_len > UINT32_MAX))
+    return EINVAL;
+
+  uint16_t *table = calloc(1 << SNAPPY_HASH_BITS, sizeof(*table));
+  if (table == NULL)
+    return ENOMEM;
+
+  uint8_t const *in = src;
+  uint8_t *out = snappy_put_varint(dst, (uint64_t)src_len);
+
+  for (size_t offset = 0; offset < src_len; offset += SNAPPY_BLOCK_SIZE) {
+    size_t len = src_len - offset;
+    if (len > SNAPPY_BLOCK_SIZE)
+      len = SNAPPY_BLOCK_SIZE;
+    out = snappy_encode_block(out, in + offset, len, table);
+  }
+
+  free(table);
+  *ret_dst_len = (size_t)(out - (uint8_t *)dst);
+  return 0;
+}
+
+static int snappy_get_varint(uint8_t const **p, uint8_t const *end,
+                             uint64_t *ret) {
+  uint64_t v = 0;
+
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (*p >= end)
+      return EINVAL;
+    uint8_t c = *(*p)++;
+    v |= ((uint64_t)(c & 0x7f)) << shift;
+    if ((c & 0x80) == 0) {
+      *ret = v;
+      return 0;
+    }
+  }
+
+  return EINVAL;
+}
+
+int snappy_decoded_length(void const *src, size_t src_len, size_t *ret_len) {
+  if ((src == NULL) || (ret_len == NULL))
+    return EINVAL;
+
+  uint8_t const *p = src;
+  uint64_t len = 0;
+  int status = snappy_get_varint(&p, p + src_len, &len);
+  if (status != 0)
+    return status;
+
+  *ret_len = (size_t)len;
+  return 0;
+}
+
+int snappy_decode(void const *src, size_t src_len, void *dst, size_t dst_size,
+                  size_t *ret_dst_len) {
+  if ((src == NULL) || ((dst == NULL) && (dst_size != 0)) ||
+      (ret_dst_len == NULL))
+    return EINVAL;
+
+  uint8_t const *p = src;
+  uint8_t const *end = p + src_len;
+  uint8_t *out = dst;
+
+  uint64_t total = 0;
+  int status = snappy_get_varint(&p, end, &total);
+  if (status != 0)
+    return status;
+  if (total > dst_size)
+    return ENOSPC;
+
+  size_t pos = 0;
+  while (p < end) {
+    uint8_t tag = *p++;
+    size_t len = 0;
+    size_t offset = 0;
+
+    switch (tag & 0x03) {
+    case SNAPPY_TAG_LITERAL:
+      len = tag >> 2;
+      if (len >= 60) {
+        size_t bytes = len - 59;
+        if ((size_t)(end - p) < bytes)
+          return EINVAL;
+        len = 0;
+        for (size_t i = 0; i < bytes; i++)
+          len |= ((size_t)p[i]) << (8 * i);
+        p += bytes;
+      }
+      len++;
+
+      if (((size_t)(end - p) < len) || ((total - pos) < len))
+        return EINVAL;
+      memcpy(out + pos, p, len);
+      p += len;
+      pos += len;
+      continue;
+
+    case SNAPPY_TAG_COPY_1:
+      if (p >= end)
+        return EINVAL;
+      len = 4 + ((tag >> 2) & 0x07);
+      offset = (((size_t)(tag >> 5)) << 8) | *p++;
+      break;
+
+    case SNAPPY_TAG_COPY_2:
+      if ((end - p) < 2)
+        return EINVAL;
+      len = 1 + (tag >> 2);
+      offset = ((size_t)p[0]) | (((size_t)p[1]) << 8);
+      p += 2;
+      break;
+
+    case SNAPPY_TAG_COPY_4:
+      if ((end - p) < 4)
+        return EINVAL;
+      len = 1 + (tag >> 2);
+      offset = ((size_t)p[0]) | (((size_t)p[1]) << 8) |
+               (((size_t)p[2]) << 16) | (((size_t)p[3]) << 24);
+      p += 4;
+      break;
+    }
+
+    if ((offset == 0) || (offset > pos) || ((total - pos) < len))
+      return EINVAL;
+
+    /* Source and destination may overlap: copy byte by byte. */
+    for (size_t i = 0; i < len; i++)
+      out[pos + i] = out[pos - offset + i];
+    pos += len;
+  }
+
+  if (pos != total)
+    return EINVAL;
+
+  *ret_dst_len = pos;
+  return 0;
+}
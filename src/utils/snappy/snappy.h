@@ -0,0 +1,32 @@
+// SPDX-License-Identifier: GPL-2.0
+#ifndef UTILS_SNAPPY_H
+#define UTILS_SNAPPY_H 1
+
+#include "collectd.h"
+
+/* Encoder and decoder for the Snappy block format, as used for example by the
+ * Prometheus remote write protocol. The framing (stream) format is not
+ * supported. */
+
+/* snappy_encode_bound returns the maximum size of "src_len" bytes after
+ * encoding. */
+size_t snappy_encode_bound(size_t src_len);
+
+/* snappy_encode compresses "src_len" bytes from "src" into "dst", which must
+ * be able to hold at least snappy_encode_bound(src_len) bytes. The size of the
+ * compressed data is returned in "ret_dst_len". */
+int snappy_encode(void const *src, size_t src_len, void *dst,
+                  size_t *ret_dst_len);
+
+/* snappy_decoded_length returns the uncompressed size stored in the header of
+ * the compressed data in "src". */
+int snappy_decoded_length(void const *src, size_t src_len, size_t *ret_len);
+
+/* snappy_decode uncompresses "src_len" bytes from "src" into "dst", which has
+ * room for "dst_size" bytes. The size of the uncompressed data is returned in
+ * "ret_dst_len". Returns EINVAL if the data is corrupt and ENOSPC if "dst" is
+ * too small. */
+int snappy_decode(void const *src, size_t src_len, void *dst, size_t dst_size,
+                  size_t *ret_dst_len);
+
+#endif /* UTILS_SNAPPY_H */
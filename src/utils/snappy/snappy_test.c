@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/snappy/snappy.h"
+
+static int round_trip(uint8_t const *data, size_t data_len,
+                      size_t *ret_compressed_len) {
+  uint8_t *compressed = malloc(snappy_encode_bound(data_len));
+  uint8_t *decompressed = malloc(data_len + 1);
+  CHECK_NOT_NULL(compressed);
+  CHECK_NOT_NULL(decompressed);
+
+  size_t compressed_len = 0;
+  CHECK_ZERO(snappy_encode(data, data_len, compressed, &compressed_len));
+  OK(compressed_len <= snappy_encode_bound(data_len));
+
+  size_t len = 0;
+  CHECK_ZERO(snappy_decoded_length(compressed, compressed_len, &len));
+  EXPECT_EQ_UINT64(data_len, len);
+
+  CHECK_ZERO(snappy_decode(compressed, compressed_len, decompressed,
+                           data_len + 1, &len));
+  EXPECT_EQ_UINT64(data_len, len);
+  EXPECT_EQ_INT(0, memcmp(data, decompressed, data_len));
+
+  *ret_compressed_len = compressed_len;
+  free(compressed);
+  free(decompressed);
+  return 0;
+}
+
+DEF_TEST(round_trip) {
+  size_t data_len = 200000;
+  uint8_t *data = malloc(data_len);
+  CHECK_NOT_NULL(data);
+  size_t compressed_len;
+
+  CHECK_ZERO(round_trip(data, 0, &compressed_len));
+  EXPECT_EQ_UINT64(1, compressed_len);
+
+  memcpy(data, "x", 1);
+  CHECK_ZERO(round_trip(data, 1, &compressed_len));
+
+  /* repetitive data, spanning several blocks */
+  for (size_t i = 0; i < data_len; i++)
+    data[i] = "metric_name{label=\"value\"} 42\n"[i % 30];
+  CHECK_ZERO(round_trip(data, data_len, &compressed_len));
+  OK(compressed_len < (data_len / 10));
+
+  /* incompressible data */
+  uint32_t x = 1;
+  for (size_t i = 0; i < data_len; i++) {
+    x = x * 1103515245 + 12345;
+    data[i] = (uint8_t)(x >> 16);
+  }
+  CHECK_ZERO(round_trip(data, data_len, &compressed_len));
+  CHECK_ZERO(round_trip(data, 70, &compressed_len));
+
+  free(data);
+  return 0;
+}
+
+DEF_TEST(decode) {
+  /* length 10, literal "ab", copy of 8 bytes at offset 2 */
+  uint8_t const in[] = {0x0a, 0x04, 'a', 'b', 0x11, 0x02};
+  char out[16] = {0};
+  size_t len = 0;
+
+  CHECK_ZERO(snappy_decode(in, sizeof(in), out, sizeof(out), &len));
+  EXPECT_EQ_UINT64(10, len);
+  EXPECT_EQ_STR("ababababab", out);
+
+  EXPECT_EQ_INT(ENOSPC, snappy_decode(in, sizeof(in), out, 4, &len));
+
+  /* offset beyond the start of the output */
+  uint8_t const bad_offset[] = {0x0a, 0x04, 'a', 'b', 0x11, 0x03};
+  EXPECT_EQ_INT(EINVAL, snappy_decode(bad_offset, sizeof(bad_offset), out,
+                                      sizeof(out), &len));
+
+  /* truncated input */
+  EXPECT_EQ_INT(EINVAL, snappy_decode(in, sizeof(in) - 1, out, sizeof(out),
+                                      &len));
+  return 0;
+}
+
+int main(void) {
+  RUN_TEST(round_trip);
+  RUN_TEST(decode);
+
+  END_TEST;
+}
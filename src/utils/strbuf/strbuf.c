@@ -200,6 +200,28 @@ int strbuf_printf(strbuf_t *buf, char const *format, ...) {
   return 0;
 }
 
+int strbuf_putn(strbuf_t *buf, void const *data, size_t n) {
+  if ((buf == NULL) || ((data == NULL) && (n != 0)))
+    return EINVAL;
+  if (n == 0) {
+    return 0;
+  }
+
+  int status = strbuf_resize(buf, n);
+  if (status != 0)
+    return status;
+
+  /* Binary data is useless when truncated: fail instead. */
+  if (strbuf_avail(buf) < n)
+    return ENOSPC;
+
+  memmove(buf->ptr + buf->pos, data, n);
+  buf->pos += n;
+  buf->ptr[buf->pos] = 0;
+
+  return 0;
+}
+
 #if !HAVE_STRNLEN
 static size_t strnlen(const char *s, size_t maxlen) {
   for (size_t i = 0; i < maxlen; i++) {
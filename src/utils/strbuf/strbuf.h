@@ -97,6 +97,12 @@ int strbuf_printf(strbuf_t *buf, char const *format, ...);
  * is returned. */
 int strbuf_printn(strbuf_t *buf, char const *s, size_t n);
 
+/* strbuf_putn adds exactly n bytes from "data" to the buffer, including any
+ * null bytes, which makes it suitable for binary data. If the size of the
+ * buffer is static and the data does not fit, nothing is added and ENOSPC is
+ * returned. */
+int strbuf_putn(strbuf_t *buf, void const *data, size_t n);
+
 /* strbuf_print_escaped adds an escaped copy of "s" to the buffer. Each
  * character in "need_escape" is prefixed by "escape_char". If "escape_char" is
  * '\' (backslash), newline (\n), cartridge return (\r) and tab (\t) are
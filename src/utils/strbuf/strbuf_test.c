@@ -177,6 +177,27 @@ DEF_TEST(print_escaped) {
   return 0;
 }
 
+DEF_TEST(putn) {
+  strbuf_t buf = STRBUF_CREATE;
+
+  CHECK_ZERO(strbuf_putn(&buf, "a\0b", 3));
+  CHECK_ZERO(strbuf_putn(&buf, "\0c", 2));
+  EXPECT_EQ_UINT64(5, buf.pos);
+  EXPECT_EQ_INT(0, memcmp(buf.ptr, "a\0b\0c", 5));
+  EXPECT_EQ_INT(0, buf.ptr[buf.pos]);
+  STRBUF_DESTROY(buf);
+
+  char mem[4] = {0};
+  buf = STRBUF_CREATE_STATIC(mem);
+  CHECK_ZERO(strbuf_putn(&buf, "\0\0", 2));
+  EXPECT_EQ_INT(ENOSPC, strbuf_putn(&buf, "xy", 2));
+  EXPECT_EQ_UINT64(2, buf.pos);
+  CHECK_ZERO(strbuf_putn(&buf, "z", 1));
+  EXPECT_EQ_UINT64(3, buf.pos);
+
+  return 0;
+}
+
 int main(int argc, char **argv) /* {{{ */
 {
   RUN_TEST(dynamic_heap);
@@ -185,6 +206,7 @@ int main(int argc, char **argv) /* {{{ */
   RUN_TEST(fixed_stack);
   RUN_TEST(static_stack);
   RUN_TEST(print_escaped);
+  RUN_TEST(putn);
 
   END_TEST;
 } /* }}} int main */
@@ -35,12 +35,226 @@
 #include "utils/common/common.h"
 #include "utils/tail/tail.h"
 
+#ifdef HAVE_SYS_INOTIFY_H
+#include <libgen.h>
+#include <sys/inotify.h>
+#endif
+
+/* Data is read from the file in blocks of this size and split into lines in
+ * memory. */
+#define TAIL_BLOCK_SIZE 65536
+
 struct cu_tail_s {
   char *file;
-  FILE *fh;
+  int fd;
   struct stat stat;
+
+  /* Data read from the file, not yet returned to the caller, is stored in
+   * buffer[buffer_pos..buffer_len). `offset' is the file offset of
+   * buffer[buffer_len]. */
+  char *buffer;
+  size_t buffer_size;
+  size_t buffer_pos;
+  size_t buffer_len;
+  off_t offset;
+
+  /* Set when the end of the file has been reached. While set, and while no
+   * inotify events arrived, nothing is read from the file. */
+  bool at_eof;
+  /* Set after a rotation while the buffer still holds the incomplete last
+   * line of the previous file. */
+  bool flush_partial;
+
+  char *state_file;
+  bool state_valid;
+  ino_t state_ino;
+  off_t state_offset;
+
+#ifdef HAVE_SYS_INOTIFY_H
+  int inotify_fd;
+  int watch_file;
+  int watch_dir;
+  char *basename;
+#endif
 };
 
+/* The offset of the first byte not yet returned to the caller. */
+static off_t cu_tail_position(cu_tail_t *obj) {
+  return obj->offset - (off_t)(obj->buffer_len - obj->buffer_pos);
+} /* off_t cu_tail_position */
+
+static int cu_tail_state_load(cu_tail_t *obj) {
+  FILE *fh = fopen(obj->state_file, "r");
+  if (fh == NULL) {
+    if (errno != ENOENT)
+      P_WARNING("utils_tail: fopen (%s) failed: %s", obj->state_file,
+                STRERRNO);
+    return -1;
+  }
+
+  uintmax_t ino = 0;
+  intmax_t offset = 0;
+  int status = fscanf(fh, "%ju %jd", &ino, &offset);
+  fclose(fh);
+
+  if ((status != 2) || (offset < 0)) {
+    P_WARNING("utils_tail: Ignoring invalid state file `%s'.",
+              obj->state_file);
+    return -1;
+  }
+
+  obj->state_ino = (ino_t)ino;
+  obj->state_offset = (off_t)offset;
+  obj->state_valid = true;
+  return 0;
+} /* int cu_tail_state_load */
+
+/* Writes the current position to the state file, unless it didn't change
+ * since the last call. The file is replaced atomically so that a crash never
+ * leaves a partially written state behind. */
+static int cu_tail_state_save(cu_tail_t *obj) {
+  if ((obj->state_file == NULL) || (obj->fd < 0) || obj->flush_partial)
+    return 0;
+
+  off_t position = cu_tail_position(obj);
+  if (obj->state_valid && (obj->state_ino == obj->stat.st_ino) &&
+      (obj->state_offset == position))
+    return 0;
+
+  char tmp[PATH_MAX];
+  ssnprintf(tmp, sizeof(tmp), "%s.tmp", obj->state_file);
+
+  FILE *fh = fopen(tmp, "w");
+  if (fh == NULL) {
+    P_ERROR("utils_tail: fopen (%s) failed: %s", tmp, STRERRNO);
+    return -1;
+  }
+
+  fprintf(fh, "%ju %jd\n", (uintmax_t)obj->stat.st_ino, (intmax_t)position);
+  if (fclose(fh) != 0) {
+    P_ERROR("utils_tail: Writing `%s' failed: %s", tmp, STRERRNO);
+    unlink(tmp);
+    return -1;
+  }
+
+  if (rename(tmp, obj->state_file) != 0) {
+    P_ERROR("utils_tail: rename (%s, %s) failed: %s", tmp, obj->state_file,
+            STRERRNO);
+    unlink(tmp);
+    return -1;
+  }
+
+  obj->state_ino = obj->stat.st_ino;
+  obj->state_offset = position;
+  obj->state_valid = true;
+  return 0;
+} /* int cu_tail_state_save */
+
+#ifdef HAVE_SYS_INOTIFY_H
+static void cu_tail_inotify_init(cu_tail_t *obj) {
+  obj->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (obj->inotify_fd < 0) {
+    P_INFO("utils_tail: inotify_init1 failed, polling `%s': %s", obj->file,
+           STRERRNO);
+    return;
+  }
+
+  char *dir = strdup(obj->file);
+  char *base = strdup(obj->file);
+  if ((dir == NULL) || (base == NULL)) {
+    free(dir);
+    free(base);
+    close(obj->inotify_fd);
+    obj->inotify_fd = -1;
+    return;
+  }
+
+  /* Watch the directory to learn about files being created or moved to the
+   * watched name, e.g. after a log rotation. */
+  obj->watch_dir = inotify_add_watch(obj->inotify_fd, dirname(dir),
+                                     IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM |
+                                         IN_DELETE | IN_ONLYDIR);
+  obj->basename = strdup(basename(base));
+  free(dir);
+  free(base);
+
+  if ((obj->watch_dir < 0) || (obj->basename == NULL)) {
+    P_INFO("utils_tail: Watching the directory of `%s' failed, polling "
+           "instead.",
+           obj->file);
+    close(obj->inotify_fd);
+    obj->inotify_fd = -1;
+  }
+} /* void cu_tail_inotify_init */
+
+/* Watches the currently opened file for modifications. */
+static void cu_tail_inotify_watch_file(cu_tail_t *obj) {
+  if (obj->inotify_fd < 0)
+    return;
+
+  if (obj->watch_file >= 0)
+    inotify_rm_watch(obj->inotify_fd, obj->watch_file);
+
+  /* The new watch is added by name and may end up on a different file than
+   * the one just opened if the file was rotated in between. This is harmless:
+   * the directory watch reports the rotation and the file is stat'ed again. */
+  obj->watch_file = inotify_add_watch(obj->inotify_fd, obj->file,
+                                      IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF |
+                                          IN_DELETE_SELF);
+  if (obj->watch_file < 0) {
+    P_INFO("utils_tail: inotify_add_watch (%s) failed, polling instead: %s",
+           obj->file, STRERRNO);
+    close(obj->inotify_fd);
+    obj->inotify_fd = -1;
+  }
+} /* void cu_tail_inotify_watch_file */
+
+/* Reads all pending events and returns true if any of them concerns the
+ * tailed file. */
+static bool cu_tail_inotify_changed(cu_tail_t *obj) {
+  bool changed = false;
+  char events[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (42) {
+    ssize_t len = read(obj->inotify_fd, events, sizeof(events));
+    if (len <= 0) {
+      if ((len < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+        /* Fall back to polling. */
+        close(obj->inotify_fd);
+        obj->inotify_fd = -1;
+        return true;
+      }
+      break;
+    }
+
+    for (char *ptr = events; ptr < events + len;) {
+      struct inotify_event *event = (struct inotify_event *)ptr;
+      ptr += sizeof(*event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW)
+        changed = true;
+      else if (event->wd != obj->watch_dir)
+        changed = true;
+      else if ((event->len > 0) && (strcmp(event->name, obj->basename) == 0))
+        changed = true;
+    }
+  }
+
+  return changed;
+} /* bool cu_tail_inotify_changed */
+#endif /* HAVE_SYS_INOTIFY_H */
+
+static void cu_tail_close(cu_tail_t *obj) {
+  if (obj->fd >= 0)
+    close(obj->fd);
+  obj->fd = -1;
+  obj->buffer_pos = 0;
+  obj->buffer_len = 0;
+  obj->at_eof = false;
+  obj->flush_partial = false;
+} /* void cu_tail_close */
+
 static int cu_tail_reopen(cu_tail_t *obj, bool force_rewind) {
   int seek_end = 0;
   struct stat stat_buf = {0};
@@ -52,17 +266,21 @@ static int cu_tail_reopen(cu_tail_t *obj, bool force_rewind) {
   }
 
   /* The file is already open.. */
-  if ((obj->fh != NULL) && (stat_buf.st_ino == obj->stat.st_ino)) {
+  if ((obj->fd >= 0) && (stat_buf.st_ino == obj->stat.st_ino)) {
     /* Seek to the beginning if file was truncated */
-    if (stat_buf.st_size < obj->stat.st_size) {
+    if (stat_buf.st_size < obj->offset) {
       P_INFO("utils_tail: File `%s' was truncated.", obj->file);
-      status = fseek(obj->fh, 0, SEEK_SET);
-      if (status != 0) {
-        P_ERROR("utils_tail: fseek (%s) failed: %s", obj->file, STRERRNO);
-        fclose(obj->fh);
-        obj->fh = NULL;
+      if (lseek(obj->fd, 0, SEEK_SET) != 0) {
+        P_ERROR("utils_tail: lseek (%s) failed: %s", obj->file, STRERRNO);
+        cu_tail_close(obj);
         return -1;
       }
+      obj->buffer_pos = 0;
+      obj->buffer_len = 0;
+      obj->offset = 0;
+      obj->flush_partial = false;
+      memcpy(&obj->stat, &stat_buf, sizeof(struct stat));
+      return 0;
     }
     memcpy(&obj->stat, &stat_buf, sizeof(struct stat));
     return 1;
@@ -74,26 +292,42 @@ static int cu_tail_reopen(cu_tail_t *obj, bool force_rewind) {
   if ((obj->stat.st_ino == 0) || (obj->stat.st_ino == stat_buf.st_ino))
     seek_end = !force_rewind;
 
-  FILE *fh = fopen(obj->file, "r");
-  if (fh == NULL) {
-    P_ERROR("utils_tail: fopen (%s) failed: %s", obj->file, STRERRNO);
+  int fd = open(obj->file, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    P_ERROR("utils_tail: open (%s) failed: %s", obj->file, STRERRNO);
     return -1;
   }
 
-  if (seek_end != 0) {
-    status = fseek(fh, 0, SEEK_END);
-    if (status != 0) {
-      P_ERROR("utils_tail: fseek (%s) failed: %s", obj->file, STRERRNO);
-      fclose(fh);
-      return -1;
-    }
+  /* Resume from the state file if it refers to this file. Otherwise the file
+   * has been rotated or truncated while not running, and all of it is new. */
+  off_t offset = 0;
+  if ((obj->stat.st_ino == 0) && obj->state_valid) {
+    if ((obj->state_ino == stat_buf.st_ino) &&
+        (obj->state_offset <= stat_buf.st_size))
+      offset = lseek(fd, obj->state_offset, SEEK_SET);
+  } else if (seek_end != 0) {
+    offset = lseek(fd, 0, SEEK_END);
+  }
+  if (offset < 0) {
+    P_ERROR("utils_tail: lseek (%s) failed: %s", obj->file, STRERRNO);
+    close(fd);
+    return -1;
   }
 
-  if (obj->fh != NULL)
-    fclose(obj->fh);
-  obj->fh = fh;
+  /* Keep the incomplete last line of a rotated file in the buffer, it is
+   * returned before reading from the new file. */
+  if (obj->fd >= 0)
+    close(obj->fd);
+  obj->fd = fd;
+  obj->offset = offset;
+  obj->at_eof = false;
+  obj->flush_partial = (obj->buffer_len > obj->buffer_pos);
   memcpy(&obj->stat, &stat_buf, sizeof(struct stat));
 
+#ifdef HAVE_SYS_INOTIFY_H
+  cu_tail_inotify_watch_file(obj);
+#endif
+
   return 0;
 } /* int cu_tail_reopen */
 
@@ -110,80 +344,169 @@ cu_tail_t *cu_tail_create(const char *file) {
     return NULL;
   }
 
-  obj->fh = NULL;
+  obj->fd = -1;
+
+#ifdef HAVE_SYS_INOTIFY_H
+  obj->watch_file = -1;
+  obj->watch_dir = -1;
+  cu_tail_inotify_init(obj);
+#endif
 
   return obj;
 } /* cu_tail_t *cu_tail_create */
 
+int cu_tail_set_state_file(cu_tail_t *obj, const char *state_file) {
+  if ((obj == NULL) || (state_file == NULL))
+    return EINVAL;
+
+  char *tmp = strdup(state_file);
+  if (tmp == NULL)
+    return ENOMEM;
+
+  free(obj->state_file);
+  obj->state_file = tmp;
+  obj->state_valid = false;
+
+  cu_tail_state_load(obj);
+  return 0;
+} /* int cu_tail_set_state_file */
+
 int cu_tail_destroy(cu_tail_t *obj) {
-  if (obj->fh != NULL)
-    fclose(obj->fh);
+  cu_tail_state_save(obj);
+  cu_tail_close(obj);
+
+#ifdef HAVE_SYS_INOTIFY_H
+  if (obj->inotify_fd >= 0)
+    close(obj->inotify_fd);
+  free(obj->basename);
+#endif
+
+  free(obj->state_file);
+  free(obj->buffer);
   free(obj->file);
   free(obj);
 
   return 0;
 } /* int cu_tail_destroy */
 
+/* Returns the next line, or the next `buflen - 1' bytes of a longer line, from
+ * the buffer. Returns false if the buffer doesn't hold a complete line. */
+static bool cu_tail_buffer_line(cu_tail_t *obj, char *buf, int buflen,
+                                bool partial) {
+  char *begin = obj->buffer + obj->buffer_pos;
+  size_t avail = obj->buffer_len - obj->buffer_pos;
+  size_t max = (size_t)buflen - 1;
+
+  if (avail == 0)
+    return false;
+
+  size_t len;
+  char *eol = memchr(begin, '\n', (avail < max) ? avail : max);
+  if (eol != NULL)
+    len = (size_t)(eol - begin) + 1;
+  else if ((avail >= max) || partial)
+    len = (avail < max) ? avail : max;
+  else
+    return false;
+
+  memcpy(buf, begin, len);
+  buf[len] = 0;
+  obj->buffer_pos += len;
+  return true;
+} /* bool cu_tail_buffer_line */
+
+/* Reads the next block from the file into the buffer. Returns the number of
+ * bytes read, zero on EOF and -1 on error. */
+static ssize_t cu_tail_fill(cu_tail_t *obj) {
+  if (obj->buffer_pos > 0) {
+    memmove(obj->buffer, obj->buffer + obj->buffer_pos,
+            obj->buffer_len - obj->buffer_pos);
+    obj->buffer_len -= obj->buffer_pos;
+    obj->buffer_pos = 0;
+  }
+
+  if ((obj->buffer_size - obj->buffer_len) < TAIL_BLOCK_SIZE) {
+    size_t size = obj->buffer_len + TAIL_BLOCK_SIZE;
+    char *tmp = realloc(obj->buffer, size);
+    if (tmp == NULL) {
+      P_ERROR("utils_tail: realloc failed.");
+      return -1;
+    }
+    obj->buffer = tmp;
+    obj->buffer_size = size;
+  }
+
+  ssize_t len;
+  do {
+    len = read(obj->fd, obj->buffer + obj->buffer_len,
+               obj->buffer_size - obj->buffer_len);
+  } while ((len < 0) && (errno == EINTR));
+
+  if (len > 0) {
+    obj->buffer_len += (size_t)len;
+    obj->offset += len;
+  }
+  return len;
+} /* ssize_t cu_tail_fill */
+
 int cu_tail_readline(cu_tail_t *obj, char *buf, int buflen, bool force_rewind) {
   int status;
 
-  if (buflen < 1) {
+  if (buflen < 2) {
     ERROR("utils_tail: cu_tail_readline: buflen too small: %i bytes.", buflen);
     return -1;
   }
 
-  if (obj->fh == NULL) {
+  if (obj->fd < 0) {
     status = cu_tail_reopen(obj, force_rewind);
     if (status < 0)
       return status;
   }
-  assert(obj->fh != NULL);
+  assert(obj->fd >= 0);
 
-  /* Try to read from the filehandle. If that succeeds, everything appears to
-   * be fine and we can return. */
-  clearerr(obj->fh);
-  if (fgets(buf, buflen, obj->fh) != NULL) {
-    buf[buflen - 1] = '\0';
-    return 0;
-  }
+  while (42) {
+    if (cu_tail_buffer_line(obj, buf, buflen, obj->flush_partial))
+      return 0;
+    obj->flush_partial = false;
+
+    /* Nothing happened to the file since EOF was reached: avoid the read()
+     * and stat() calls. */
+#ifdef HAVE_SYS_INOTIFY_H
+    if (obj->at_eof && (obj->inotify_fd >= 0) &&
+        !cu_tail_inotify_changed(obj)) {
+      buf[0] = 0;
+      return 0;
+    }
+#endif
+    obj->at_eof = false;
 
-  /* Check if we encountered an error */
-  if (ferror(obj->fh) != 0) {
-    /* Jupp, error. Force `cu_tail_reopen' to reopen the file.. */
-    fclose(obj->fh);
-    obj->fh = NULL;
-  }
-  /* else: eof -> check if the file was moved away and reopen the new file if
-   * so.. */
+    ssize_t len = cu_tail_fill(obj);
+    if (len > 0)
+      continue;
 
-  status = cu_tail_reopen(obj, force_rewind);
-  /* error -> return with error */
-  if (status < 0)
-    return status;
-  /* file end reached and file not reopened -> nothing more to read */
-  else if (status > 0) {
-    buf[0] = 0;
-    return 0;
-  }
+    if (len < 0) {
+      WARNING("utils_tail: read (%s) returned an error: %s", obj->file,
+              STRERRNO);
+      cu_tail_close(obj);
+      return -1;
+    }
 
-  /* If we get here: file was re-opened and there may be more to read.. Let's
-   * try again. */
-  if (fgets(buf, buflen, obj->fh) != NULL) {
-    buf[buflen - 1] = '\0';
-    return 0;
-  }
+    /* EOF -> check if the file was moved away and reopen the new file if
+     * so.. */
+    status = cu_tail_reopen(obj, force_rewind);
+    /* error -> return with error */
+    if (status < 0)
+      return status;
+    /* file end reached and file not reopened -> nothing more to read */
+    if (status > 0) {
+      obj->at_eof = true;
+      cu_tail_state_save(obj);
+      buf[0] = 0;
+      return 0;
+    }
 
-  if (ferror(obj->fh) != 0) {
-    WARNING("utils_tail: fgets (%s) returned an error: %s", obj->file,
-            STRERRNO);
-    fclose(obj->fh);
-    obj->fh = NULL;
-    return -1;
+    /* If we get here: file was re-opened and there may be more to read.. */
   }
-
-  /* EOf, well, apparently the new file is empty.. */
-  buf[0] = 0;
-  return 0;
 } /* int cu_tail_readline */
 
 int cu_tail_read(cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
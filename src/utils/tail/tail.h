@@ -49,6 +49,22 @@ typedef int tailfunc_t(void *data, char *buf, int buflen);
  */
 cu_tail_t *cu_tail_create(const char *file);
 
+/*
+ * cu_tail_set_state_file
+ *
+ * Makes the tail object remember its position in `state_file'. The inode and
+ * offset of the last line returned are written to the file whenever the end
+ * of the tailed file is reached and when the object is destroyed. When the
+ * file is opened for the first time and the inode matches the saved one,
+ * reading resumes at the saved offset instead of the end of the file. If the
+ * inode differs, or the file is shorter than the saved offset, the file has
+ * been rotated or truncated in the meantime and is read from the beginning.
+ *
+ * Must be called before the first read. Returns 0 when successful and non-zero
+ * otherwise.
+ */
+int cu_tail_set_state_file(cu_tail_t *obj, const char *state_file);
+
 /*
  * cu_tail_destroy
  *
@@ -69,7 +85,12 @@ int cu_tail_destroy(cu_tail_t *obj);
  *
  * You can check if the EOF condition is reached by looking at the buffer: If
  * the length of the string stored in the buffer is zero, EOF occurred.
- * Otherwise at least the newline character will be in the buffer.
+ * Otherwise at least the newline character will be in the buffer, unless the
+ * line is longer than `buflen - 1' characters. An incomplete line at the end
+ * of the file is only returned once it is completed or the file is rotated.
+ *
+ * The file is read in large blocks. Where inotify is available, the file is
+ * not accessed at all after EOF until the kernel reports a change to it.
  *
  * Returns 0 when successful and non-zero otherwise.
  */
@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "collectd.h"
+
+#include "testing.h"
+#include "utils/common/common.h"
+#include "utils/tail/tail.h"
+
+static char test_dir[] = "/tmp/collectd_tail_test_XXXXXX";
+static char test_file[PATH_MAX];
+static char state_file[PATH_MAX];
+
+static int append(char const *file, char const *s) {
+  FILE *fh = fopen(file, "a");
+  if (fh == NULL)
+    return errno;
+  fputs(s, fh);
+  fclose(fh);
+  return 0;
+}
+
+static int readline(cu_tail_t *tail, char *buf, int buflen) {
+  return cu_tail_readline(tail, buf, buflen, /* force_rewind = */ false);
+}
+
+DEF_TEST(lines) {
+  char buf[16];
+
+  unlink(test_file);
+  CHECK_ZERO(append(test_file, "old\n"));
+
+  cu_tail_t *tail = cu_tail_create(test_file);
+  CHECK_NOT_NULL(tail);
+
+  /* The first read seeks to the end of the file. */
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("", buf);
+
+  CHECK_ZERO(append(test_file, "one\ntwo\nthr"));
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("one\n", buf);
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("two\n", buf);
+  /* Incomplete lines are held back. */
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("", buf);
+
+  CHECK_ZERO(append(test_file, "ee\n0123456789abcdefghij\n"));
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("three\n", buf);
+  /* Long lines are returned in pieces of buflen - 1 bytes. */
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("0123456789abcde", buf);
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("fghij\n", buf);
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("", buf);
+
+  CHECK_ZERO(cu_tail_destroy(tail));
+  return 0;
+}
+
+DEF_TEST(rotate) {
+  char buf[64];
+  char rotated[PATH_MAX];
+  ssnprintf(rotated, sizeof(rotated), "%s.1", test_file);
+
+  unlink(test_file);
+  CHECK_ZERO(append(test_file, ""));
+
+  cu_tail_t *tail = cu_tail_create(test_file);
+  CHECK_NOT_NULL(tail);
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("", buf);
+
+  CHECK_ZERO(append(test_file, "before\nlast"));
+  CHECK_ZERO(rename(test_file, rotated));
+  CHECK_ZERO(append(test_file, "after\n"));
+
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("before\n", buf);
+  /* The incomplete last line of the rotated file is not lost. */
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("last", buf);
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("after\n", buf);
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("", buf);
+
+  /* Truncation restarts at the beginning of the file. */
+  CHECK_ZERO(truncate(test_file, 0));
+  CHECK_ZERO(append(test_file, "new\n"));
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("new\n", buf);
+
+  CHECK_ZERO(cu_tail_destroy(tail));
+  unlink(rotated);
+  return 0;
+}
+
+DEF_TEST(state_file) {
+  char buf[64];
+
+  unlink(test_file);
+  unlink(state_file);
+  CHECK_ZERO(append(test_file, "skipped\n"));
+
+  cu_tail_t *tail = cu_tail_create(test_file);
+  CHECK_NOT_NULL(tail);
+  CHECK_ZERO(cu_tail_set_state_file(tail, state_file));
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("", buf);
+
+  CHECK_ZERO(append(test_file, "one\ntw"));
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("one\n", buf);
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("", buf);
+  CHECK_ZERO(cu_tail_destroy(tail));
+
+  /* Lines written while not running are read after a restart, and the
+   * incomplete line is read again from its beginning. */
+  CHECK_ZERO(append(test_file, "o\nthree\n"));
+
+  tail = cu_tail_create(test_file);
+  CHECK_NOT_NULL(tail);
+  CHECK_ZERO(cu_tail_set_state_file(tail, state_file));
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("two\n", buf);
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("three\n", buf);
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("", buf);
+  CHECK_ZERO(cu_tail_destroy(tail));
+
+  /* A file rotated while not running is read from its beginning. */
+  char replacement[PATH_MAX];
+  ssnprintf(replacement, sizeof(replacement), "%s.new", test_file);
+  CHECK_ZERO(append(replacement, "replaced\n"));
+  CHECK_ZERO(rename(replacement, test_file));
+
+  tail = cu_tail_create(test_file);
+  CHECK_NOT_NULL(tail);
+  CHECK_ZERO(cu_tail_set_state_file(tail, state_file));
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("replaced\n", buf);
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("", buf);
+  CHECK_ZERO(cu_tail_destroy(tail));
+
+  /* So is a file truncated while not running. */
+  CHECK_ZERO(truncate(test_file, 0));
+  CHECK_ZERO(append(test_file, "new\n"));
+
+  tail = cu_tail_create(test_file);
+  CHECK_NOT_NULL(tail);
+  CHECK_ZERO(cu_tail_set_state_file(tail, state_file));
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("new\n", buf);
+  CHECK_ZERO(readline(tail, buf, sizeof(buf)));
+  EXPECT_EQ_STR("", buf);
+  CHECK_ZERO(cu_tail_destroy(tail));
+
+  unlink(test_file);
+  unlink(state_file);
+  return 0;
+}
+
+int main(void) {
+  if (mkdtemp(test_dir) == NULL)
+    return 1;
+  ssnprintf(test_file, sizeof(test_file), "%s/file", test_dir);
+  ssnprintf(state_file, sizeof(state_file), "%s/state", test_dir);
+
+  RUN_TEST(lines);
+  RUN_TEST(rotate);
+  RUN_TEST(state_file);
+
+  rmdir(test_dir);
+  END_TEST;
+}
@@ -59,6 +59,8 @@ struct cu_tail_match_s {
   cu_tail_t *tail;
   cu_tail_match_match_t *matches;
   size_t matches_num;
+  /* All matches, applied to each line with a single literal prefilter pass. */
+  cu_match_set_t *set;
 };
 
 /*
@@ -171,8 +173,7 @@ static int tail_callback(void *data, char *buf,
                          int __attribute__((unused)) buflen) {
   cu_tail_match_t *obj = (cu_tail_match_t *)data;
 
-  for (size_t i = 0; i < obj->matches_num; i++)
-    match_apply(obj->matches[i].match, buf);
+  match_set_apply(obj->set, buf);
 
   return 0;
 } /* int tail_callback */
@@ -199,9 +200,20 @@ cu_tail_match_t *tail_match_create(const char *filename) {
     return NULL;
   }
 
+  obj->set = match_set_create();
+  if (obj->set == NULL) {
+    cu_tail_destroy(obj->tail);
+    sfree(obj);
+    return NULL;
+  }
+
   return obj;
 } /* cu_tail_match_t *tail_match_create */
 
+int tail_match_set_state_file(cu_tail_match_t *obj, const char *state_file) {
+  return cu_tail_set_state_file(obj->tail, state_file);
+} /* int tail_match_set_state_file */
+
 void tail_match_destroy(cu_tail_match_t *obj) {
   if (obj == NULL)
     return;
@@ -211,6 +223,10 @@ void tail_match_destroy(cu_tail_match_t *obj) {
     obj->tail = NULL;
   }
 
+  /* The set references the matches, destroy it first. */
+  match_set_destroy(obj->set);
+  obj->set = NULL;
+
   for (size_t i = 0; i < obj->matches_num; i++) {
     cu_tail_match_match_t *match = obj->matches + i;
     if (match->match != NULL) {
@@ -239,6 +255,11 @@ int tail_match_add_match(cu_tail_match_t *obj, cu_match_t *match,
   if (temp == NULL)
     return -1;
 
+  if (match_set_add(obj->set, match) != 0) {
+    obj->matches = temp;
+    return -1;
+  }
+
   obj->matches = temp;
   obj->matches_num++;
 
@@ -328,3 +349,17 @@ int tail_match_read(cu_tail_match_t *obj, bool force_rewind) {
 
   return 0;
 } /* int tail_match_read */
+
+int tail_match_read_lines(cu_tail_match_t *obj, tailfunc_t *callback,
+                          void *data, bool force_rewind) {
+  char buffer[4096];
+
+  int status = cu_tail_read(obj->tail, buffer, sizeof(buffer), callback, data,
+                            force_rewind);
+  if (status != 0) {
+    ERROR("tail_match: cu_tail_read failed.");
+    return status;
+  }
+
+  return 0;
+} /* int tail_match_read_lines */
@@ -38,6 +38,7 @@
 
 #include "utils/latency/latency_config.h"
 #include "utils/match/match.h"
+#include "utils/tail/tail.h"
 
 struct cu_tail_match_s;
 typedef struct cu_tail_match_s cu_tail_match_t;
@@ -57,6 +58,19 @@ typedef struct cu_tail_match_s cu_tail_match_t;
  */
 cu_tail_match_t *tail_match_create(const char *filename);
 
+/*
+ * NAME
+ *   tail_match_set_state_file
+ *
+ * DESCRIPTION
+ *   Persists the read position to `state_file' so that reading resumes where
+ *   it left off after a restart. See `cu_tail_set_state_file'.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise.
+ */
+int tail_match_set_state_file(cu_tail_match_t *obj, const char *state_file);
+
 /*
  * NAME
  *   tail_match_destroy
@@ -137,4 +151,19 @@ int tail_match_add_match_simple(cu_tail_match_t *obj, const char *regex,
  */
 int tail_match_read(cu_tail_match_t *obj, bool force_rewind);
 
+/*
+ * NAME
+ *   tail_match_read_lines
+ *
+ * DESCRIPTION
+ *   Reads new lines from the logfile like `tail_match_read', but passes each
+ *   line to `callback' instead of applying the added matches. This allows
+ *   callers to match lines themselves, e.g. in batches.
+ *
+ * RETURN VALUE
+ *   Zero on success, nonzero on failure.
+ */
+int tail_match_read_lines(cu_tail_match_t *obj, tailfunc_t *callback,
+                          void *data, bool force_rewind);
+
 #endif /* UTILS_TAIL_MATCH_H */
@@ -40,6 +40,11 @@
  *     Prefix "collectd"
  *     UseTags true
  *     ReverseHost false
+ *     Asynchronous true
+ *     QueueSize 4194304
+ *     SpoolFile "/var/spool/collectd/graphite.spool"
+ *     SpoolMaxSize 268435456
+ *     ReportStats true
  *   </Carbon>
  * </Plugin>
  */
@@ -53,6 +58,7 @@
 #include "utils/strbuf/strbuf.h"
 #include "utils_complain.h"
 
+#include <fcntl.h>
 #include <netdb.h>
 
 #ifndef WG_DEFAULT_NODE
@@ -84,9 +90,44 @@
 #define WG_MIN_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T(1)
 #endif
 
+#ifndef WG_MAX_RECONNECT_INTERVAL
+#define WG_MAX_RECONNECT_INTERVAL TIME_T_TO_CDTIME_T(60)
+#endif
+
+#ifndef WG_DEFAULT_QUEUE_SIZE
+#define WG_DEFAULT_QUEUE_SIZE (4 * 1024 * 1024)
+#endif
+
+#ifndef WG_DEFAULT_SPOOL_MAX_SIZE
+#define WG_DEFAULT_SPOOL_MAX_SIZE (256 * 1024 * 1024)
+#endif
+
+/* Connecting and sending fail after this time, so that a carbon server which
+ * stops reading blocks neither the writers nor the shutdown forever. */
+#ifndef WG_SEND_TIMEOUT
+#define WG_SEND_TIMEOUT TIME_T_TO_CDTIME_T(10)
+#endif
+
+/* The read position in the spool file is kept in a file with this suffix, so
+ * that lines sent before a restart are not sent again. */
+#define WG_SPOOL_OFFSET_SUFFIX ".offset"
+
+/* Maximum time the sender thread waits for a full send buffer before sending
+ * what has been queued so far. */
+#ifndef WG_ASYNC_SEND_DELAY
+#define WG_ASYNC_SEND_DELAY TIME_T_TO_CDTIME_T(1)
+#endif
+
 /*
  * Private variables
  */
+struct wg_callback;
+
+/* Nodes using asynchronous mode. Their sender threads are started in
+ * wg_init(), after the daemon has forked. */
+static struct wg_callback **async_callbacks;
+static size_t async_callbacks_num;
+
 struct wg_callback {
   int sock_fd;
 
@@ -115,6 +156,35 @@ struct wg_callback {
   cdtime_t last_reconnect_time;
   cdtime_t reconnect_interval;
   bool reconnect_interval_reached;
+
+  /* Asynchronous mode: writers append rendered lines to "queue", a ring
+   * buffer, and the sender thread owns the socket. When the ring is full, lines
+   * are appended to the spool file instead until the spool has been drained.
+   * All fields are protected by send_lock. */
+  bool async;
+  char *queue;
+  size_t queue_size;
+  size_t queue_head;
+  size_t queue_fill;
+
+  /* The spool file holds "spool_read" bytes already sent, followed by
+   * "spool_fill" bytes still to send. */
+  char *spool_file;
+  int spool_fd;
+  uint64_t spool_max_size;
+  uint64_t spool_read;
+  uint64_t spool_fill;
+
+  pthread_t sender_thread;
+  bool sender_running;
+  bool sender_shutdown;
+  bool flush_requested;
+  pthread_cond_t queue_cond;
+  c_complain_t queue_complaint;
+
+  bool report_stats;
+  uint64_t stats_sent;
+  uint64_t stats_dropped;
 };
 
 /* wg_force_reconnect_check closes cb->sock_fd when it was open for longer
@@ -150,26 +220,48 @@ static void wg_reset_buffer(struct wg_callback *cb) {
   cb->send_buf_init_time = cdtime();
 }
 
+/* wg_send writes all of "data" to "fd". Unlike swrite(), it gives up when the
+ * send timeout expires and returns ETIMEDOUT. Returns zero or an errno
+ * value. */
+static int wg_send(int fd, char const *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? ETIMEDOUT : errno;
+    }
+
+    data += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
 static int wg_send_buffer(struct wg_callback *cb) {
-  ssize_t status;
+  size_t len = strlen(cb->send_buf);
 
-  if (cb->sock_fd < 0)
+  if (cb->sock_fd < 0) {
+    cb->stats_dropped += len;
     return -1;
+  }
 
-  status = swrite(cb->sock_fd, cb->send_buf, strlen(cb->send_buf));
+  int status = wg_send(cb->sock_fd, cb->send_buf, len);
   if (status != 0) {
     if (cb->log_send_errors) {
-      ERROR("write_graphite plugin: send to %s:%s (%s) failed with status %zi "
-            "(%s)",
-            cb->node, cb->service, cb->protocol, status, STRERRNO);
+      ERROR("write_graphite plugin: send to %s:%s (%s) failed: %s", cb->node,
+            cb->service, cb->protocol, STRERROR(status));
     }
 
     close(cb->sock_fd);
     cb->sock_fd = -1;
+    cb->stats_dropped += len;
 
     return -1;
   }
 
+  cb->stats_sent += len;
   return 0;
 }
 
@@ -245,6 +337,12 @@ static int wg_callback_init(struct wg_callback *cb) {
 
     set_sock_opts(cb->sock_fd);
 
+    struct timeval tv = CDTIME_T_TO_TIMEVAL(WG_SEND_TIMEOUT);
+    if (setsockopt(cb->sock_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) !=
+        0)
+      WARNING("write_graphite plugin: setsockopt (SO_SNDTIMEO) failed: %s",
+              STRERRNO);
+
     status = connect(cb->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
     if (status != 0) {
       snprintf(connerr, sizeof(connerr), "failed to connect to remote host: %s",
@@ -282,6 +380,455 @@ static int wg_callback_init(struct wg_callback *cb) {
   return 0;
 }
 
+/*
+ * Asynchronous sending
+ */
+/* wg_spool_write appends "len" bytes to the spool file. The size of the file,
+ * including the lines already sent, is limited to cb->spool_max_size. Must
+ * hold cb->send_lock when calling. */
+static int wg_spool_write(struct wg_callback *cb, char const *data,
+                          size_t len) {
+  if ((cb->spool_fd < 0) ||
+      (cb->spool_read + cb->spool_fill + len > cb->spool_max_size))
+    return ENOSPC;
+
+  if (swrite(cb->spool_fd, data, len) != 0) {
+    int status = errno;
+    c_complain(LOG_ERR, &cb->queue_complaint,
+               "write_graphite plugin: Writing to spool file \"%s\" failed: %s",
+               cb->spool_file, STRERROR(status));
+    return status;
+  }
+
+  cb->spool_fill += len;
+  return 0;
+}
+
+/* wg_spool_offset_save writes "offset", the read position in the spool file,
+ * to the offset file. */
+static void wg_spool_offset_save(struct wg_callback *cb, uint64_t offset) {
+  char path[PATH_MAX];
+  ssnprintf(path, sizeof(path), "%s" WG_SPOOL_OFFSET_SUFFIX, cb->spool_file);
+
+  FILE *fh = fopen(path, "w");
+  if (fh == NULL) {
+    ERROR("write_graphite plugin: Opening \"%s\" failed: %s", path,
+          STRERRNO);
+    return;
+  }
+  fprintf(fh, "%" PRIu64 "\n", offset);
+  if (fclose(fh) != 0)
+    ERROR("write_graphite plugin: Writing \"%s\" failed: %s", path, STRERRNO);
+}
+
+/* wg_spool_offset_load returns the read position saved by
+ * wg_spool_offset_save, or zero. */
+static uint64_t wg_spool_offset_load(struct wg_callback *cb) {
+  char path[PATH_MAX];
+  ssnprintf(path, sizeof(path), "%s" WG_SPOOL_OFFSET_SUFFIX, cb->spool_file);
+
+  FILE *fh = fopen(path, "r");
+  if (fh == NULL)
+    return 0;
+
+  uint64_t offset = 0;
+  if (fscanf(fh, "%" SCNu64, &offset) != 1)
+    offset = 0;
+  fclose(fh);
+  return offset;
+}
+
+/* wg_spool_copy appends the bytes from "start" to "end" of the spool file to
+ * "fd". */
+static int wg_spool_copy(struct wg_callback *cb, int fd, uint64_t start,
+                         uint64_t end) {
+  char buffer[65536];
+
+  while (start < end) {
+    size_t len = sizeof(buffer);
+    if ((uint64_t)len > end - start)
+      len = (size_t)(end - start);
+
+    ssize_t n = pread(cb->spool_fd, buffer, len, (off_t)start);
+    if (n <= 0)
+      return (n < 0) ? errno : EIO;
+    if (swrite(fd, buffer, (size_t)n) != 0)
+      return errno;
+    start += (uint64_t)n;
+  }
+
+  return 0;
+}
+
+/* wg_spool_compact replaces the spool file with a copy holding only the lines
+ * not sent yet, once a quarter of the maximum size has been sent, so that the
+ * file does not grow while the spool never drains completely. Most of the
+ * copy is made without holding the lock; the writers only append to the file.
+ * Must hold cb->send_lock when calling and must only be called by the sender
+ * thread. */
+static void wg_spool_compact(struct wg_callback *cb) {
+  if ((cb->spool_fill == 0) || (cb->spool_read < cb->spool_max_size / 4))
+    return;
+
+  char path[PATH_MAX];
+  ssnprintf(path, sizeof(path), "%s.tmp", cb->spool_file);
+
+  uint64_t start = cb->spool_read;
+  uint64_t end = cb->spool_read + cb->spool_fill;
+  pthread_mutex_unlock(&cb->send_lock);
+
+  int status = 0;
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+  if (fd < 0)
+    status = errno;
+  else
+    status = wg_spool_copy(cb, fd, start, end);
+
+  pthread_mutex_lock(&cb->send_lock);
+
+  /* Lines appended while the lock was released. */
+  if (status == 0)
+    status = wg_spool_copy(cb, fd, end, cb->spool_read + cb->spool_fill);
+
+  /* Save the new offset first: if the daemon crashes before the rename, the
+   * old file is sent again from the start rather than lines being skipped. */
+  if (status == 0) {
+    wg_spool_offset_save(cb, 0);
+    if (rename(path, cb->spool_file) != 0)
+      status = errno;
+  }
+
+  if (status != 0) {
+    WARNING("write_graphite plugin: Compacting spool file \"%s\" failed: %s",
+            cb->spool_file, STRERROR(status));
+    wg_spool_offset_save(cb, cb->spool_read);
+    if (fd >= 0) {
+      close(fd);
+      unlink(path);
+    }
+    return;
+  }
+
+  close(cb->spool_fd);
+  cb->spool_fd = fd;
+  cb->spool_read = 0;
+}
+
+/* wg_queue_save moves the contents of the ring buffer to the spool file so
+ * they survive a restart. Lines end up after any lines already spooled, i.e.
+ * possibly out of order, which carbon does not mind. Must hold cb->send_lock
+ * when calling. */
+static void wg_queue_save(struct wg_callback *cb) {
+  if ((cb->queue_fill == 0) || (cb->spool_fd < 0))
+    return;
+
+  size_t first = cb->queue_size - cb->queue_head;
+  if (first > cb->queue_fill)
+    first = cb->queue_fill;
+
+  if ((wg_spool_write(cb, cb->queue + cb->queue_head, first) != 0) ||
+      (wg_spool_write(cb, cb->queue, cb->queue_fill - first) != 0)) {
+    WARNING("write_graphite plugin: Discarding %" PRIsz " queued bytes for "
+            "%s:%s.",
+            cb->queue_fill, cb->node, cb->service);
+    cb->stats_dropped += cb->queue_fill;
+  }
+  cb->queue_head = 0;
+  cb->queue_fill = 0;
+}
+
+/* wg_queue_message appends a rendered line to the queue of an asynchronous
+ * node without ever touching the network. */
+static int wg_queue_message(char const *message, size_t message_len,
+                            struct wg_callback *cb) {
+  int status = 0;
+
+  pthread_mutex_lock(&cb->send_lock);
+
+  /* Once lines go to the spool, keep spooling until the sender drained it to
+   * preserve the order of lines. */
+  if ((cb->spool_fill == 0) &&
+      (message_len <= cb->queue_size - cb->queue_fill)) {
+    size_t tail = (cb->queue_head + cb->queue_fill) % cb->queue_size;
+    size_t first = cb->queue_size - tail;
+    if (first > message_len)
+      first = message_len;
+
+    memcpy(cb->queue + tail, message, first);
+    memcpy(cb->queue, message + first, message_len - first);
+    cb->queue_fill += message_len;
+  } else if (wg_spool_write(cb, message, message_len) != 0) {
+    cb->stats_dropped += message_len;
+    c_complain(LOG_WARNING, &cb->queue_complaint,
+               "write_graphite plugin: Queue for %s:%s is full, dropping "
+               "lines.",
+               cb->node, cb->service);
+    status = ENOBUFS;
+  }
+
+  if (cb->queue_fill + cb->spool_fill >= WG_SEND_BUF_SIZE)
+    pthread_cond_signal(&cb->queue_cond);
+
+  pthread_mutex_unlock(&cb->send_lock);
+  return status;
+}
+
+/* wg_sender_wait waits until the queue is signaled, "timeout" expires or the
+ * thread is asked to shut down. Must hold cb->send_lock when calling. */
+static void wg_sender_wait(struct wg_callback *cb, cdtime_t timeout) {
+  if (cb->sender_shutdown)
+    return;
+
+  pthread_cond_timedwait(&cb->queue_cond, &cb->send_lock,
+                         &CDTIME_T_TO_TIMESPEC(cdtime() + timeout));
+}
+
+/* wg_send_chunk sends the oldest lines, at most one send buffer's worth, to
+ * carbon. Lines are cut at newlines so that each UDP datagram contains whole
+ * lines. Must hold cb->send_lock when calling; the lock is released while
+ * sending. */
+static int wg_send_chunk(struct wg_callback *cb) {
+  char buffer[WG_SEND_BUF_SIZE];
+  bool from_spool = (cb->queue_fill == 0);
+  size_t len = 0;
+
+  if (!from_spool) {
+    len = cb->queue_fill;
+    if (len > sizeof(buffer))
+      len = sizeof(buffer);
+
+    size_t first = cb->queue_size - cb->queue_head;
+    if (first > len)
+      first = len;
+    memcpy(buffer, cb->queue + cb->queue_head, first);
+    memcpy(buffer + first, cb->queue, len - first);
+  } else {
+    len = sizeof(buffer);
+    if ((uint64_t)len > cb->spool_fill)
+      len = (size_t)cb->spool_fill;
+  }
+  uint64_t spool_read = cb->spool_read;
+
+  wg_force_reconnect_check(cb);
+  int sock_fd = cb->sock_fd;
+  pthread_mutex_unlock(&cb->send_lock);
+
+  /* Only the sender thread removes data from the queue and the spool, so the
+   * data at their head does not change while the lock is released. */
+  int status = 0;
+  if (from_spool) {
+    ssize_t n = pread(cb->spool_fd, buffer, len, (off_t)spool_read);
+    if (n <= 0) {
+      ERROR("write_graphite plugin: Reading spool file \"%s\" failed: %s",
+            cb->spool_file, (n < 0) ? STRERRNO : "unexpected end of file");
+      status = EIO;
+    } else {
+      len = (size_t)n;
+    }
+  }
+
+  if (status == 0) {
+    for (size_t i = len; i > 0; i--) {
+      if (buffer[i - 1] == '\n') {
+        len = i;
+        break;
+      }
+    }
+
+    if (sock_fd < 0) {
+      status = ENOTCONN;
+    } else {
+      status = wg_send(sock_fd, buffer, len);
+      if ((status != 0) && cb->log_send_errors)
+        ERROR("write_graphite plugin: send to %s:%s (%s) failed: %s", cb->node,
+              cb->service, cb->protocol, STRERROR(status));
+    }
+  }
+
+  pthread_mutex_lock(&cb->send_lock);
+
+  if (status == EIO) {
+    /* The spool file is unusable, start over. */
+    cb->stats_dropped += cb->spool_fill;
+    len = (size_t)cb->spool_fill;
+  } else if (status != 0) {
+    if (cb->sock_fd >= 0) {
+      close(cb->sock_fd);
+      cb->sock_fd = -1;
+    }
+    return status;
+  } else {
+    cb->stats_sent += len;
+  }
+
+  if (!from_spool) {
+    cb->queue_head = (cb->queue_head + len) % cb->queue_size;
+    cb->queue_fill -= len;
+  } else {
+    cb->spool_read += len;
+    cb->spool_fill -= len;
+    if (cb->spool_fill == 0) {
+      wg_spool_offset_save(cb, 0);
+      if (ftruncate(cb->spool_fd, 0) != 0)
+        WARNING("write_graphite plugin: Truncating spool file \"%s\" failed: "
+                "%s",
+                cb->spool_file, STRERRNO);
+      cb->spool_read = 0;
+    }
+    wg_spool_compact(cb);
+  }
+
+  return 0;
+}
+
+static void *wg_sender_thread(void *arg) {
+  struct wg_callback *cb = arg;
+  cdtime_t reconnect_delay = WG_MIN_RECONNECT_INTERVAL;
+  cdtime_t next_connect_time = 0;
+
+  pthread_mutex_lock(&cb->send_lock);
+  while (!cb->sender_shutdown) {
+    size_t pending = cb->queue_fill + (size_t)cb->spool_fill;
+    if (pending == 0) {
+      wg_sender_wait(cb, WG_ASYNC_SEND_DELAY);
+      continue;
+    }
+
+    /* Wait for a full send buffer, a flush or the send delay to pass. */
+    if ((pending < WG_SEND_BUF_SIZE) && !cb->flush_requested)
+      wg_sender_wait(cb, WG_ASYNC_SEND_DELAY);
+    cb->flush_requested = false;
+
+    if (cb->sock_fd < 0) {
+      /* Back off exponentially while carbon is unreachable. */
+      cdtime_t now = cdtime();
+      if (now < next_connect_time) {
+        wg_sender_wait(cb, next_connect_time - now);
+        continue;
+      }
+
+      pthread_mutex_unlock(&cb->send_lock);
+      int status = wg_callback_init(cb);
+      pthread_mutex_lock(&cb->send_lock);
+
+      if (status != 0) {
+        next_connect_time = cdtime() + reconnect_delay;
+        reconnect_delay *= 2;
+        if (reconnect_delay > WG_MAX_RECONNECT_INTERVAL)
+          reconnect_delay = WG_MAX_RECONNECT_INTERVAL;
+        continue;
+      }
+      reconnect_delay = WG_MIN_RECONNECT_INTERVAL;
+    }
+
+    while (!cb->sender_shutdown && (cb->queue_fill + cb->spool_fill > 0)) {
+      if (wg_send_chunk(cb) != 0)
+        break;
+    }
+  }
+
+  /* Try to send what is left once, without waiting for a reconnect. */
+  while ((cb->sock_fd >= 0) && (cb->queue_fill + cb->spool_fill > 0)) {
+    if (wg_send_chunk(cb) != 0)
+      break;
+  }
+  pthread_mutex_unlock(&cb->send_lock);
+
+  return NULL;
+}
+
+static int wg_async_init(struct wg_callback *cb) {
+  if (cb->spool_file != NULL) {
+    cb->spool_fd = open(cb->spool_file, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (cb->spool_fd < 0) {
+      ERROR("write_graphite plugin: Opening spool file \"%s\" failed: %s",
+            cb->spool_file, STRERRNO);
+      return errno;
+    }
+
+    /* Lines spooled before a restart are sent before any new ones, starting
+     * at the saved read position. */
+    struct stat statbuf = {0};
+    if (fstat(cb->spool_fd, &statbuf) == 0) {
+      uint64_t size = (uint64_t)statbuf.st_size;
+      uint64_t offset = wg_spool_offset_load(cb);
+      if (offset > size)
+        offset = 0;
+      cb->spool_read = offset;
+      cb->spool_fill = size - offset;
+    }
+  }
+
+  int status = plugin_thread_create(&cb->sender_thread, wg_sender_thread, cb,
+                                    "writegraphite");
+  if (status != 0) {
+    ERROR("write_graphite plugin: Creating the sender thread failed: %s",
+          STRERROR(status));
+    return status;
+  }
+  cb->sender_running = true;
+
+  return 0;
+}
+
+static int wg_stats_read(user_data_t *user_data) {
+  struct wg_callback *cb = user_data->data;
+
+  pthread_mutex_lock(&cb->send_lock);
+  uint64_t queued = cb->queue_fill;
+  uint64_t spooled = cb->spool_fill;
+  uint64_t sent = cb->stats_sent;
+  uint64_t dropped = cb->stats_dropped;
+  pthread_mutex_unlock(&cb->send_lock);
+
+  char node[DATA_MAX_NAME_LEN];
+  if (cb->name != NULL)
+    sstrncpy(node, cb->name, sizeof(node));
+  else
+    snprintf(node, sizeof(node), "%s:%s", cb->node, cb->service);
+
+  metric_family_t fam_queued = {
+      .name = "write_graphite_queued_bytes",
+      .help = "Number of bytes waiting to be sent to carbon",
+      .type = METRIC_TYPE_GAUGE,
+  };
+  metric_family_t fam_sent = {
+      .name = "write_graphite_sent_bytes_total",
+      .help = "Number of bytes sent to carbon",
+      .type = METRIC_TYPE_COUNTER,
+  };
+  metric_family_t fam_dropped = {
+      .name = "write_graphite_dropped_bytes_total",
+      .help = "Number of bytes dropped because they could not be queued or "
+              "sent",
+      .type = METRIC_TYPE_COUNTER,
+  };
+
+  metric_t templ = {0};
+  metric_label_set(&templ, "node", node);
+
+  metric_family_append(&fam_queued, "queue", "memory",
+                       (value_t){.gauge = (gauge_t)queued}, &templ);
+  metric_family_append(&fam_queued, "queue", "spool",
+                       (value_t){.gauge = (gauge_t)spooled}, &templ);
+  metric_family_append(&fam_sent, NULL, NULL, (value_t){.counter = sent},
+                       &templ);
+  metric_family_append(&fam_dropped, NULL, NULL, (value_t){.counter = dropped},
+                       &templ);
+
+  metric_family_t *fams[] = {&fam_queued, &fam_sent, &fam_dropped};
+  for (size_t i = 0; i < STATIC_ARRAY_SIZE(fams); i++) {
+    int status = plugin_dispatch_metric_family(fams[i]);
+    if (status != 0)
+      ERROR("write_graphite plugin: plugin_dispatch_metric_family failed: %s",
+            STRERROR(status));
+    metric_family_metric_reset(fams[i]);
+  }
+
+  metric_reset(&templ);
+  return 0;
+}
+
 static void wg_callback_free(void *data) {
   struct wg_callback *cb;
 
@@ -290,9 +837,25 @@ static void wg_callback_free(void *data) {
 
   cb = data;
 
+  if (cb->sender_running) {
+    pthread_mutex_lock(&cb->send_lock);
+    cb->sender_shutdown = true;
+    pthread_cond_broadcast(&cb->queue_cond);
+    pthread_mutex_unlock(&cb->send_lock);
+
+    pthread_join(cb->sender_thread, NULL);
+    cb->sender_running = false;
+  }
+
   pthread_mutex_lock(&cb->send_lock);
 
-  wg_flush_nolock(/* timeout = */ 0, cb);
+  if (!cb->async)
+    wg_flush_nolock(/* timeout = */ 0, cb);
+  else
+    wg_queue_save(cb);
+
+  if (cb->spool_fd >= 0)
+    wg_spool_offset_save(cb, cb->spool_read);
 
   if (cb->sock_fd >= 0) {
     close(cb->sock_fd);
@@ -305,9 +868,16 @@ static void wg_callback_free(void *data) {
   sfree(cb->service);
   sfree(cb->prefix);
   sfree(cb->postfix);
+  sfree(cb->queue);
+  sfree(cb->spool_file);
+  if (cb->spool_fd >= 0) {
+    close(cb->spool_fd);
+    cb->spool_fd = -1;
+  }
 
   pthread_mutex_unlock(&cb->send_lock);
   pthread_mutex_destroy(&cb->send_lock);
+  pthread_cond_destroy(&cb->queue_cond);
 
   sfree(cb);
 }
@@ -325,6 +895,14 @@ static int wg_flush(cdtime_t timeout,
 
   pthread_mutex_lock(&cb->send_lock);
 
+  if (cb->async) {
+    /* The sender thread sends everything it has on the next wake-up. */
+    cb->flush_requested = true;
+    pthread_cond_signal(&cb->queue_cond);
+    pthread_mutex_unlock(&cb->send_lock);
+    return 0;
+  }
+
   if (cb->sock_fd < 0) {
     status = wg_callback_init(cb);
     if (status != 0) {
@@ -388,7 +966,7 @@ static int wg_send_message(char const *message, struct wg_callback *cb) {
   return 0;
 }
 
-static int wg_write_messages(metric_single_t const *m, struct wg_callback *cb) {
+static int wg_write_messages(metric_t const *m, struct wg_callback *cb) {
   strbuf_t buf = STRBUF_CREATE;
 
   int status = format_graphite(&buf, m, cb->prefix, cb->postfix,
@@ -399,17 +977,27 @@ static int wg_write_messages(metric_single_t const *m, struct wg_callback *cb) {
   }
 
   /* Send the message to graphite */
-  status = wg_send_message(buf.ptr, cb);
+  if (cb->async)
+    status = wg_queue_message(buf.ptr, buf.pos, cb);
+  else
+    status = wg_send_message(buf.ptr, cb);
   STRBUF_DESTROY(buf);
   return status;
 } /* int wg_write_messages */
 
-static int wg_write(metric_single_t const *m, user_data_t *user_data) {
-  if ((m == NULL) || (user_data == NULL)) {
+static int wg_write(metric_family_t const *fam, user_data_t *user_data) {
+  if ((fam == NULL) || (user_data == NULL)) {
     return EINVAL;
   }
 
-  return wg_write_messages(m, user_data->data);
+  int ret = 0;
+  for (size_t i = 0; i < fam->metric.num; i++) {
+    int status = wg_write_messages(fam->metric.ptr + i, user_data->data);
+    if (ret == 0)
+      ret = status;
+  }
+
+  return ret;
 }
 
 static int config_set_char(char *dest, oconfig_item_t *ci) {
@@ -460,6 +1048,9 @@ static int wg_config_node(oconfig_item_t *ci) {
   cb->postfix = NULL;
   cb->escape_char = WG_DEFAULT_ESCAPE;
   cb->format_flags = GRAPHITE_STORE_RATES;
+  cb->queue_size = WG_DEFAULT_QUEUE_SIZE;
+  cb->spool_fd = -1;
+  cb->spool_max_size = WG_DEFAULT_SPOOL_MAX_SIZE;
 
   /* FIXME: Legacy configuration syntax. */
   if (strcasecmp("Carbon", ci->key) != 0) {
@@ -471,7 +1062,9 @@ static int wg_config_node(oconfig_item_t *ci) {
   }
 
   pthread_mutex_init(&cb->send_lock, /* attr = */ NULL);
+  pthread_cond_init(&cb->queue_cond, /* attr = */ NULL);
   C_COMPLAIN_INIT(&cb->init_complaint);
+  C_COMPLAIN_INIT(&cb->queue_complaint);
 
   for (int i = 0; i < ci->children_num; i++) {
     oconfig_item_t *child = ci->children + i;
@@ -512,6 +1105,29 @@ static int wg_config_node(oconfig_item_t *ci) {
       cf_util_get_flag(child, &cb->format_flags, GRAPHITE_REVERSE_HOST);
     else if (strcasecmp("EscapeCharacter", child->key) == 0)
       config_set_char(&cb->escape_char, child);
+    else if (strcasecmp("Asynchronous", child->key) == 0)
+      status = cf_util_get_boolean(child, &cb->async);
+    else if (strcasecmp("QueueSize", child->key) == 0) {
+      int tmp = 0;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < WG_SEND_BUF_SIZE)) {
+        ERROR("write_graphite plugin: \"QueueSize\" must be at least %d.",
+              WG_SEND_BUF_SIZE);
+        status = -1;
+      }
+      cb->queue_size = (size_t)tmp;
+    } else if (strcasecmp("SpoolFile", child->key) == 0)
+      status = cf_util_get_string(child, &cb->spool_file);
+    else if (strcasecmp("SpoolMaxSize", child->key) == 0) {
+      double tmp = 0;
+      status = cf_util_get_double(child, &tmp);
+      if ((status == 0) && (tmp < 0)) {
+        ERROR("write_graphite plugin: \"SpoolMaxSize\" must not be negative.");
+        status = -1;
+      }
+      cb->spool_max_size = (uint64_t)tmp;
+    } else if (strcasecmp("ReportStats", child->key) == 0)
+      status = cf_util_get_boolean(child, &cb->report_stats);
     else {
       ERROR("write_graphite plugin: Invalid configuration "
             "option: %s.",
@@ -523,6 +1139,23 @@ static int wg_config_node(oconfig_item_t *ci) {
       break;
   }
 
+  if ((status == 0) && cb->async) {
+    cb->queue = malloc(cb->queue_size);
+    struct wg_callback **tmp =
+        realloc(async_callbacks,
+                (async_callbacks_num + 1) * sizeof(*async_callbacks));
+    if (tmp != NULL)
+      async_callbacks = tmp;
+
+    if ((cb->queue == NULL) || (tmp == NULL)) {
+      ERROR("write_graphite plugin: Allocating the queue failed.");
+      status = ENOMEM;
+    } else {
+      async_callbacks[async_callbacks_num] = cb;
+      async_callbacks_num++;
+    }
+  }
+
   if (status != 0) {
     wg_callback_free(cb);
     return status;
@@ -544,6 +1177,11 @@ static int wg_config_node(oconfig_item_t *ci) {
 
   plugin_register_flush(callback_name, wg_flush, &(user_data_t){.data = cb});
 
+  if (cb->report_stats)
+    plugin_register_complex_read("write_graphite", callback_name, wg_stats_read,
+                                 /* interval = */ 0,
+                                 &(user_data_t){.data = cb});
+
   return 0;
 }
 
@@ -566,6 +1204,22 @@ static int wg_config(oconfig_item_t *ci) {
   return 0;
 }
 
+static int wg_init(void) {
+  int ret = 0;
+
+  for (size_t i = 0; i < async_callbacks_num; i++) {
+    int status = wg_async_init(async_callbacks[i]);
+    if (status != 0)
+      ret = status;
+  }
+
+  sfree(async_callbacks);
+  async_callbacks_num = 0;
+
+  return ret;
+}
+
 void module_register(void) {
   plugin_register_complex_config("write_graphite", wg_config);
+  plugin_register_init("write_graphite", wg_init);
 }
@@ -34,6 +34,10 @@
 
 #include <curl/curl.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #ifndef WRITE_HTTP_DEFAULT_PREFIX
 #define WRITE_HTTP_DEFAULT_PREFIX "collectd"
 #endif
@@ -42,9 +46,43 @@
 #define WRITE_HTTP_RESPONSE_BUFFER_SIZE 1024
 #endif
 
+#define WH_DEFAULT_BUFFER_SIZE 4096
+#define WH_DEFAULT_MAX_IN_FLIGHT 4
+#define WH_DEFAULT_QUEUE_SIZE (8 * 1024 * 1024)
+#define WH_DEFAULT_MAX_RETRIES 3
+#define WH_DEFAULT_RETRY_INTERVAL TIME_T_TO_CDTIME_T(1)
+#define WH_MAX_RETRY_INTERVAL TIME_T_TO_CDTIME_T(60)
+/* Time the sender thread is given to deliver queued requests on shutdown. */
+#define WH_SHUTDOWN_TIMEOUT TIME_T_TO_CDTIME_T(10)
+
 /*
  * Private variables
  */
+
+/* wh_request_t is a request body waiting to be sent by the sender thread. */
+typedef struct wh_request_s wh_request_t;
+struct wh_request_s {
+  char *body;
+  size_t body_size;
+  int attempts;
+  cdtime_t not_before;
+  wh_request_t *next;
+};
+
+/* wh_handle_t is a curl easy handle with its own error and response
+ * buffers. */
+typedef struct {
+  CURL *curl;
+  char errbuf[CURL_ERROR_SIZE];
+  char response_buffer[WRITE_HTTP_RESPONSE_BUFFER_SIZE];
+  size_t response_buffer_pos;
+
+  /* request assigned to this handle and whether the handle has been added to
+   * the multi handle, asynchronous mode only */
+  wh_request_t *req;
+  bool busy;
+} wh_handle_t;
+
 struct wh_callback_s {
   char *name;
 
@@ -73,45 +111,70 @@ struct wh_callback_s {
   bool send_metrics;
   bool send_notifications;
 
+  bool compress;
+
+  /* handle used for synchronous posts, protected by curl_lock */
   pthread_mutex_t curl_lock;
-  CURL *curl;
+  wh_handle_t handle;
   curl_stats_t *curl_stats;
   struct curl_slist *headers;
-  char curl_errbuf[CURL_ERROR_SIZE];
 
+  /* Metrics are formatted into send_buffer. When it is flushed or grows
+   * beyond send_buffer_size it is swapped for an empty buffer, so that
+   * formatting can continue while the data is being posted. */
   pthread_mutex_t send_buffer_lock;
   strbuf_t send_buffer;
+  size_t send_buffer_size;
   cdtime_t send_buffer_init_time;
 
-  char response_buffer[WRITE_HTTP_RESPONSE_BUFFER_SIZE];
-  unsigned int response_buffer_pos;
-
   int data_ttl;
   char *metrics_prefix;
+
+  /* In asynchronous mode, request bodies are queued and posted by a sender
+   * thread with up to max_in_flight concurrent requests. */
+  bool async;
+  int max_in_flight;
+  size_t queue_size;
+  int max_retries;
+  cdtime_t retry_interval;
+
+  pthread_mutex_t queue_lock;
+  pthread_cond_t queue_cond;
+  wh_request_t *queue_head;
+  wh_request_t *queue_tail;
+  size_t queue_bytes;
+  pthread_t sender_thread;
+  bool sender_running;
+  bool sender_shutdown;
 };
 typedef struct wh_callback_s wh_callback_t;
 
+static wh_callback_t **async_callbacks;
+static size_t async_callbacks_num;
+
 /* libcurl may call this multiple times depending on how big the server's
  * http response is
  */
 static size_t wh_curl_write_callback(char *ptr, size_t size, size_t nmemb,
                                      void *userdata) {
 
-  wh_callback_t *cb = (wh_callback_t *)userdata;
-  unsigned int len = 0;
+  wh_handle_t *h = userdata;
+  size_t len = 0;
 
-  if ((cb->response_buffer_pos + nmemb) > sizeof(cb->response_buffer))
-    len = sizeof(cb->response_buffer) - cb->response_buffer_pos;
+  /* Leave room for the terminating null byte. */
+  if ((h->response_buffer_pos + nmemb) >= sizeof(h->response_buffer))
+    len = sizeof(h->response_buffer) - h->response_buffer_pos - 1;
   else
     len = nmemb;
 
   DEBUG(
-      "write_http plugin: curl callback nmemb=%zu buffer_pos=%u write_len=%u ",
-      nmemb, cb->response_buffer_pos, len);
+      "write_http plugin: curl callback nmemb=%" PRIsz " buffer_pos=%" PRIsz
+      " write_len=%" PRIsz " ",
+      nmemb, h->response_buffer_pos, len);
 
-  memcpy(cb->response_buffer + cb->response_buffer_pos, ptr, len);
-  cb->response_buffer_pos += len;
-  cb->response_buffer[sizeof(cb->response_buffer) - 1] = '\0';
+  memcpy(h->response_buffer + h->response_buffer_pos, ptr, len);
+  h->response_buffer_pos += len;
+  h->response_buffer[h->response_buffer_pos] = '\0';
 
   /* Always return nmemb even if we write less so libcurl won't throw an error
    */
@@ -119,137 +182,299 @@ static size_t wh_curl_write_callback(char *ptr, size_t size, size_t nmemb,
 
 } /* wh_curl_write_callback */
 
-static void wh_log_http_error(wh_callback_t *cb) {
-  if (!cb->log_http_error) {
-    return;
+/* wh_headers_init appends the default headers to the user supplied ones. */
+static int wh_headers_init(wh_callback_t *cb) {
+  struct curl_slist *headers = cb->headers;
+
+  headers = curl_slist_append(headers, "Accept:  */*");
+  if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB)
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+  else
+    headers = curl_slist_append(headers, "Content-Type: text/plain");
+  if (cb->compress)
+    headers = curl_slist_append(headers, "Content-Encoding: gzip");
+  headers = curl_slist_append(headers, "Expect:");
+  if (headers == NULL) {
+    ERROR("write_http plugin: curl_slist_append failed.");
+    return ENOMEM;
   }
 
-  long http_code = 0;
-  curl_easy_getinfo(cb->curl, CURLINFO_RESPONSE_CODE, &http_code);
+  cb->headers = headers;
+  return 0;
+} /* int wh_headers_init */
 
-  if (http_code != 200) {
-    INFO("write_http plugin: HTTP Error code: %lu", http_code);
+static int wh_handle_init(wh_callback_t *cb, wh_handle_t *h) {
+  if (h->curl != NULL) {
+    return 0;
   }
-}
 
-/* must hold cb->curl_lock when calling */
-static int wh_post(wh_callback_t *cb, char const *data) {
-  pthread_mutex_lock(&cb->curl_lock);
+  h->curl = curl_easy_init();
+  if (h->curl == NULL) {
+    ERROR("curl plugin: curl_easy_init failed.");
+    return -1;
+  }
+
+  if (cb->low_speed_limit > 0 && cb->low_speed_time > 0) {
+    curl_easy_setopt(h->curl, CURLOPT_LOW_SPEED_LIMIT,
+                     (long)(cb->low_speed_limit * cb->low_speed_time));
+    curl_easy_setopt(h->curl, CURLOPT_LOW_SPEED_TIME,
+                     (long)cb->low_speed_time);
+  }
+
+#ifdef HAVE_CURLOPT_TIMEOUT_MS
+  if (cb->timeout > 0)
+    curl_easy_setopt(h->curl, CURLOPT_TIMEOUT_MS, (long)cb->timeout);
+#endif
+
+  curl_easy_setopt(h->curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(h->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+  curl_easy_setopt(h->curl, CURLOPT_URL, cb->location);
+  curl_easy_setopt(h->curl, CURLOPT_POST, 1L);
+  curl_easy_setopt(h->curl, CURLOPT_WRITEFUNCTION, &wh_curl_write_callback);
+  curl_easy_setopt(h->curl, CURLOPT_WRITEDATA, (void *)h);
+  curl_easy_setopt(h->curl, CURLOPT_PRIVATE, (void *)h);
+  curl_easy_setopt(h->curl, CURLOPT_HTTPHEADER, cb->headers);
+
+  curl_easy_setopt(h->curl, CURLOPT_ERRORBUFFER, h->errbuf);
+  curl_easy_setopt(h->curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(h->curl, CURLOPT_MAXREDIRS, 50L);
+
+  if (cb->user != NULL) {
+#ifdef HAVE_CURLOPT_USERNAME
+    curl_easy_setopt(h->curl, CURLOPT_USERNAME, cb->user);
+    curl_easy_setopt(h->curl, CURLOPT_PASSWORD,
+                     (cb->pass == NULL) ? "" : cb->pass);
+#else
+    if (cb->credentials == NULL) {
+      size_t credentials_size;
+
+      credentials_size = strlen(cb->user) + 2;
+      if (cb->pass != NULL)
+        credentials_size += strlen(cb->pass);
+
+      cb->credentials = malloc(credentials_size);
+      if (cb->credentials == NULL) {
+        ERROR("curl plugin: malloc failed.");
+        return -1;
+      }
+
+      snprintf(cb->credentials, credentials_size, "%s:%s", cb->user,
+               (cb->pass == NULL) ? "" : cb->pass);
+    }
+    curl_easy_setopt(h->curl, CURLOPT_USERPWD, cb->credentials);
+#endif
+    curl_easy_setopt(h->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
+  }
+
+  curl_easy_setopt(h->curl, CURLOPT_SSL_VERIFYPEER, (long)cb->verify_peer);
+  curl_easy_setopt(h->curl, CURLOPT_SSL_VERIFYHOST, cb->verify_host ? 2L : 0L);
+  curl_easy_setopt(h->curl, CURLOPT_SSLVERSION, cb->sslversion);
+  if (cb->cacert != NULL)
+    curl_easy_setopt(h->curl, CURLOPT_CAINFO, cb->cacert);
+  if (cb->capath != NULL)
+    curl_easy_setopt(h->curl, CURLOPT_CAPATH, cb->capath);
+
+  if (cb->clientkey != NULL && cb->clientcert != NULL) {
+    curl_easy_setopt(h->curl, CURLOPT_SSLKEY, cb->clientkey);
+    curl_easy_setopt(h->curl, CURLOPT_SSLCERT, cb->clientcert);
+
+    if (cb->clientkeypass != NULL)
+      curl_easy_setopt(h->curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+  }
+
+  return 0;
+} /* int wh_handle_init */
 
-  curl_easy_setopt(cb->curl, CURLOPT_URL, cb->location);
-  curl_easy_setopt(cb->curl, CURLOPT_POSTFIELDS, data);
-  curl_easy_setopt(cb->curl, CURLOPT_WRITEFUNCTION, &wh_curl_write_callback);
-  curl_easy_setopt(cb->curl, CURLOPT_WRITEDATA, (void *)cb);
-  int status = curl_easy_perform(cb->curl);
+static void wh_handle_prepare(wh_handle_t *h, char const *data,
+                              size_t data_size) {
+  h->response_buffer_pos = 0;
+  h->response_buffer[0] = '\0';
+  h->errbuf[0] = '\0';
 
-  wh_log_http_error(cb);
+  curl_easy_setopt(h->curl, CURLOPT_POSTFIELDS, data);
+  curl_easy_setopt(h->curl, CURLOPT_POSTFIELDSIZE, (long)data_size);
+}
+
+/* wh_handle_done logs the outcome of a POST performed by "func" and
+ * dispatches the curl statistics. The HTTP response code is returned in
+ * "ret_http_code". */
+static void wh_handle_done(wh_callback_t *cb, wh_handle_t *h, char const *func,
+                           CURLcode status, long *ret_http_code) {
+  long http_code = 0;
+  curl_easy_getinfo(h->curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+  if (cb->log_http_error && (http_code != 200)) {
+    INFO("write_http plugin: HTTP Error code: %lu", http_code);
+  }
 
   if (cb->curl_stats != NULL) {
-    int rc = curl_stats_dispatch(cb->curl_stats, cb->curl, NULL, "write_http",
-                                 cb->name);
+    metric_t tmpl = {0};
+    metric_label_set(&tmpl, "instance", cb->name);
+    int rc = curl_stats_dispatch(cb->curl_stats, h->curl, &tmpl);
+    metric_reset(&tmpl);
     if (rc != 0) {
       ERROR("write_http plugin: curl_stats_dispatch failed with status %d", rc);
     }
   }
 
   if (status != CURLE_OK) {
-    ERROR("write_http plugin: curl_easy_perform failed with status %d: %s",
-          status, cb->curl_errbuf);
-    if (strlen(cb->response_buffer) > 0) {
-      ERROR("write_http plugin: curl_response=%s", cb->response_buffer);
+    ERROR("write_http plugin: %s failed with status %d: %s", func, status,
+          h->errbuf);
+    if (strlen(h->response_buffer) > 0) {
+      ERROR("write_http plugin: curl_response=%s", h->response_buffer);
     }
   } else {
-    DEBUG("write_http plugin: curl_response=%s", cb->response_buffer);
+    DEBUG("write_http plugin: curl_response=%s", h->response_buffer);
+  }
+
+  if (ret_http_code != NULL)
+    *ret_http_code = http_code;
+} /* wh_handle_done */
+
+static int wh_post(wh_callback_t *cb, char const *data, size_t data_size) {
+  pthread_mutex_lock(&cb->curl_lock);
+
+  if (wh_handle_init(cb, &cb->handle) != 0) {
+    ERROR("write_http plugin: wh_handle_init failed.");
+    pthread_mutex_unlock(&cb->curl_lock);
+    return -1;
   }
 
+  wh_handle_prepare(&cb->handle, data, data_size);
+  int status = curl_easy_perform(cb->handle.curl);
+  wh_handle_done(cb, &cb->handle, "curl_easy_perform", status, NULL);
+
   pthread_mutex_unlock(&cb->curl_lock);
   return status;
 } /* wh_post */
 
-static int wh_callback_init(wh_callback_t *cb) {
-  if (cb->curl != NULL) {
-    return 0;
-  }
+#ifdef HAVE_ZLIB
+static int wh_gzip(char const *data, size_t data_size, char **ret_body,
+                   size_t *ret_body_size) {
+  z_stream stream = {0};
 
-  cb->curl = curl_easy_init();
-  if (cb->curl == NULL) {
-    ERROR("curl plugin: curl_easy_init failed.");
+  /* 16 + MAX_WBITS selects the gzip wrapper instead of zlib's. */
+  int status = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                            16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+  if (status != Z_OK) {
+    ERROR("write_http plugin: deflateInit2 failed with status %d.", status);
     return -1;
   }
 
-  if (cb->low_speed_limit > 0 && cb->low_speed_time > 0) {
-    curl_easy_setopt(cb->curl, CURLOPT_LOW_SPEED_LIMIT,
-                     (long)(cb->low_speed_limit * cb->low_speed_time));
-    curl_easy_setopt(cb->curl, CURLOPT_LOW_SPEED_TIME,
-                     (long)cb->low_speed_time);
+  size_t body_size = deflateBound(&stream, (uLong)data_size);
+  char *body = malloc(body_size);
+  if (body == NULL) {
+    deflateEnd(&stream);
+    return ENOMEM;
   }
 
-#ifdef HAVE_CURLOPT_TIMEOUT_MS
-  if (cb->timeout > 0)
-    curl_easy_setopt(cb->curl, CURLOPT_TIMEOUT_MS, (long)cb->timeout);
-#endif
+  stream.next_in = (Bytef *)data;
+  stream.avail_in = (uInt)data_size;
+  stream.next_out = (Bytef *)body;
+  stream.avail_out = (uInt)body_size;
 
-  curl_easy_setopt(cb->curl, CURLOPT_NOSIGNAL, 1L);
-  curl_easy_setopt(cb->curl, CURLOPT_USERAGENT, COLLECTD_USERAGENT);
+  status = deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+  if (status != Z_STREAM_END) {
+    ERROR("write_http plugin: deflate failed with status %d.", status);
+    free(body);
+    return -1;
+  }
 
-  cb->headers = curl_slist_append(cb->headers, "Accept:  */*");
-  if (cb->format == WH_FORMAT_JSON || cb->format == WH_FORMAT_KAIROSDB)
-    cb->headers =
-        curl_slist_append(cb->headers, "Content-Type: application/json");
-  else
-    cb->headers = curl_slist_append(cb->headers, "Content-Type: text/plain");
-  cb->headers = curl_slist_append(cb->headers, "Expect:");
-  curl_easy_setopt(cb->curl, CURLOPT_HTTPHEADER, cb->headers);
+  *ret_body = body;
+  *ret_body_size = (size_t)stream.total_out;
+  return 0;
+} /* int wh_gzip */
+#endif
 
-  curl_easy_setopt(cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
-  curl_easy_setopt(cb->curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(cb->curl, CURLOPT_MAXREDIRS, 50L);
+static void wh_request_free(wh_request_t *req) {
+  if (req == NULL)
+    return;
 
-  if (cb->user != NULL) {
-#ifdef HAVE_CURLOPT_USERNAME
-    curl_easy_setopt(cb->curl, CURLOPT_USERNAME, cb->user);
-    curl_easy_setopt(cb->curl, CURLOPT_PASSWORD,
-                     (cb->pass == NULL) ? "" : cb->pass);
-#else
-    size_t credentials_size;
+  free(req->body);
+  free(req);
+}
 
-    credentials_size = strlen(cb->user) + 2;
-    if (cb->pass != NULL)
-      credentials_size += strlen(cb->pass);
+/* wh_queue_request appends "req" to the queue, dropping the oldest pending
+ * requests if the queue would exceed its size limit. */
+static void wh_queue_request(wh_callback_t *cb, wh_request_t *req) {
+  size_t dropped = 0;
+
+  pthread_mutex_lock(&cb->queue_lock);
+
+  while ((cb->queue_head != NULL) &&
+         ((cb->queue_bytes + req->body_size) > cb->queue_size)) {
+    wh_request_t *old = cb->queue_head;
+    cb->queue_head = old->next;
+    if (cb->queue_head == NULL)
+      cb->queue_tail = NULL;
+    cb->queue_bytes -= old->body_size;
+    wh_request_free(old);
+    dropped++;
+  }
 
-    cb->credentials = malloc(credentials_size);
-    if (cb->credentials == NULL) {
-      ERROR("curl plugin: malloc failed.");
-      return -1;
-    }
+  if (cb->queue_tail == NULL)
+    cb->queue_head = req;
+  else
+    cb->queue_tail->next = req;
+  cb->queue_tail = req;
+  cb->queue_bytes += req->body_size;
 
-    snprintf(cb->credentials, credentials_size, "%s:%s", cb->user,
-             (cb->pass == NULL) ? "" : cb->pass);
-    curl_easy_setopt(cb->curl, CURLOPT_USERPWD, cb->credentials);
-#endif
-    curl_easy_setopt(cb->curl, CURLOPT_HTTPAUTH, CURLAUTH_ANY);
-  }
+  pthread_cond_signal(&cb->queue_cond);
+  pthread_mutex_unlock(&cb->queue_lock);
 
-  curl_easy_setopt(cb->curl, CURLOPT_SSL_VERIFYPEER, (long)cb->verify_peer);
-  curl_easy_setopt(cb->curl, CURLOPT_SSL_VERIFYHOST, cb->verify_host ? 2L : 0L);
-  curl_easy_setopt(cb->curl, CURLOPT_SSLVERSION, cb->sslversion);
-  if (cb->cacert != NULL)
-    curl_easy_setopt(cb->curl, CURLOPT_CAINFO, cb->cacert);
-  if (cb->capath != NULL)
-    curl_easy_setopt(cb->curl, CURLOPT_CAPATH, cb->capath);
+  if (dropped > 0)
+    WARNING("write_http plugin: Queue of \"%s\" is full, dropped %" PRIsz
+            " request(s).",
+            cb->name, dropped);
+}
 
-  if (cb->clientkey != NULL && cb->clientcert != NULL) {
-    curl_easy_setopt(cb->curl, CURLOPT_SSLKEY, cb->clientkey);
-    curl_easy_setopt(cb->curl, CURLOPT_SSLCERT, cb->clientcert);
+/* wh_send posts "body", compressing it first if configured. In asynchronous
+ * mode the body is queued for the sender thread. Takes ownership of
+ * "body". */
+static int wh_send(wh_callback_t *cb, char *body, size_t body_size) {
+#ifdef HAVE_ZLIB
+  if (cb->compress) {
+    char *compressed = NULL;
+    size_t compressed_size = 0;
+    int status = wh_gzip(body, body_size, &compressed, &compressed_size);
+    free(body);
+    if (status != 0)
+      return status;
+    body = compressed;
+    body_size = compressed_size;
+  }
+#endif
 
-    if (cb->clientkeypass != NULL)
-      curl_easy_setopt(cb->curl, CURLOPT_SSLKEYPASSWD, cb->clientkeypass);
+  if (!cb->async) {
+    int status = wh_post(cb, body, body_size);
+    free(body);
+    return status;
   }
 
-  strbuf_reset(&cb->send_buffer);
+  wh_request_t *req = calloc(1, sizeof(*req));
+  if (req == NULL) {
+    ERROR("write_http plugin: calloc failed.");
+    free(body);
+    return ENOMEM;
+  }
+  req->body = body;
+  req->body_size = body_size;
 
+  wh_queue_request(cb, req);
   return 0;
-} /* int wh_callback_init */
+} /* int wh_send */
+
+/* wh_send_buffer_take swaps the send buffer for an empty one and returns its
+ * content. Must hold cb->send_buffer_lock when calling. */
+static char *wh_send_buffer_take(wh_callback_t *cb, size_t *ret_size) {
+  char *data = cb->send_buffer.ptr;
+  *ret_size = cb->send_buffer.pos;
+
+  cb->send_buffer = STRBUF_CREATE;
+  cb->send_buffer_init_time = cdtime();
+  return data;
+}
 
 static int wh_flush(cdtime_t timeout,
                     const char *identifier __attribute__((unused)),
@@ -261,12 +486,6 @@ static int wh_flush(cdtime_t timeout,
 
   pthread_mutex_lock(&cb->send_buffer_lock);
 
-  if (wh_callback_init(cb) != 0) {
-    ERROR("write_http plugin: wh_callback_init failed.");
-    pthread_mutex_unlock(&cb->send_buffer_lock);
-    return -1;
-  }
-
   /* timeout == 0  => flush unconditionally */
   if (timeout > 0) {
     if ((cb->send_buffer_init_time + timeout) > cdtime()) {
@@ -281,20 +500,214 @@ static int wh_flush(cdtime_t timeout,
     return 0;
   }
 
-  char *json = strdup(cb->send_buffer.ptr);
-  strbuf_reset(&cb->send_buffer);
-  cb->send_buffer_init_time = cdtime();
+  size_t data_size = 0;
+  char *data = wh_send_buffer_take(cb, &data_size);
   pthread_mutex_unlock(&cb->send_buffer_lock);
 
-  if (json == NULL) {
-    return ENOMEM;
+  return wh_send(cb, data, data_size);
+} /* int wh_flush */
+
+/* wh_queue_pop removes the first request from the queue if it may be sent
+ * at "now". Must hold cb->queue_lock when calling. */
+static wh_request_t *wh_queue_pop(wh_callback_t *cb, cdtime_t now) {
+  wh_request_t *req = cb->queue_head;
+  if ((req == NULL) || (req->not_before > now))
+    return NULL;
+
+  cb->queue_head = req->next;
+  if (cb->queue_head == NULL)
+    cb->queue_tail = NULL;
+  cb->queue_bytes -= req->body_size;
+  req->next = NULL;
+  return req;
+}
+
+/* wh_request_retry puts a failed request back at the front of the queue,
+ * doubling the delay with each attempt. */
+static void wh_request_retry(wh_callback_t *cb, wh_request_t *req) {
+  req->attempts++;
+  if (req->attempts > cb->max_retries) {
+    ERROR("write_http plugin: Dropping request to \"%s\" after %d attempt(s).",
+          cb->location, req->attempts);
+    wh_request_free(req);
+    return;
+  }
+
+  cdtime_t delay = cb->retry_interval;
+  for (int i = 1; (i < req->attempts) && (delay < WH_MAX_RETRY_INTERVAL); i++)
+    delay *= 2;
+  if (delay > WH_MAX_RETRY_INTERVAL)
+    delay = WH_MAX_RETRY_INTERVAL;
+  req->not_before = cdtime() + delay;
+
+  pthread_mutex_lock(&cb->queue_lock);
+  req->next = cb->queue_head;
+  cb->queue_head = req;
+  if (cb->queue_tail == NULL)
+    cb->queue_tail = req;
+  cb->queue_bytes += req->body_size;
+  pthread_mutex_unlock(&cb->queue_lock);
+}
+
+static bool wh_should_retry(CURLcode status, long http_code) {
+  if (status != CURLE_OK)
+    return true;
+  /* Request Timeout, Too Many Requests and server errors are transient. */
+  return (http_code == 408) || (http_code == 429) || (http_code >= 500);
+}
+
+static void *wh_sender_thread(void *arg) {
+  wh_callback_t *cb = arg;
+
+  CURLM *multi = curl_multi_init();
+  wh_handle_t *handles = calloc(cb->max_in_flight, sizeof(*handles));
+  if ((multi == NULL) || (handles == NULL)) {
+    ERROR("write_http plugin: Initializing the sender thread of \"%s\" "
+          "failed.",
+          cb->name);
+    if (multi != NULL)
+      curl_multi_cleanup(multi);
+    free(handles);
+    return NULL;
   }
+#ifdef CURLPIPE_MULTIPLEX
+  /* Send concurrent requests over a single HTTP/2 connection if possible. */
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 
-  int status = wh_post(cb, json);
-  free(json);
+  int in_flight = 0;
+  cdtime_t deadline = 0;
+
+  while (true) {
+    pthread_mutex_lock(&cb->queue_lock);
+
+    cdtime_t now = cdtime();
+    if (cb->sender_shutdown) {
+      if (deadline == 0)
+        deadline = now + WH_SHUTDOWN_TIMEOUT;
+      /* Stop when nothing is left to send before the deadline. A queued
+       * request which may not be retried until after the deadline is dropped
+       * by wh_callback_free() rather than waited for. */
+      bool idle = (in_flight == 0) && ((cb->queue_head == NULL) ||
+                                       (cb->queue_head->not_before > deadline));
+      if (idle || (now >= deadline)) {
+        pthread_mutex_unlock(&cb->queue_lock);
+        break;
+      }
+    }
 
-  return status;
-} /* int wh_flush */
+    /* Sleep until a request is queued or the first one may be retried. */
+    if ((in_flight == 0) && !cb->sender_shutdown &&
+        ((cb->queue_head == NULL) || (cb->queue_head->not_before > now))) {
+      cdtime_t until = now + WH_MAX_RETRY_INTERVAL;
+      if (cb->queue_head != NULL)
+        until = cb->queue_head->not_before;
+      pthread_cond_timedwait(&cb->queue_cond, &cb->queue_lock,
+                             &CDTIME_T_TO_TIMESPEC(until));
+      now = cdtime();
+    }
+
+    /* Start as many queued requests as there are idle handles. On shutdown,
+     * pending retries are attempted right away. */
+    cdtime_t ready = cb->sender_shutdown ? deadline : now;
+    for (int i = 0; (i < cb->max_in_flight) && (cb->queue_head != NULL); i++) {
+      wh_handle_t *h = handles + i;
+      if (h->req != NULL)
+        continue;
+
+      h->req = wh_queue_pop(cb, ready);
+      if (h->req == NULL)
+        break;
+    }
+    pthread_mutex_unlock(&cb->queue_lock);
+
+    for (int i = 0; i < cb->max_in_flight; i++) {
+      wh_handle_t *h = handles + i;
+      if ((h->req == NULL) || h->busy)
+        continue;
+
+      /* Easy handles are reused so that connections are kept alive. */
+      if (wh_handle_init(cb, h) != 0) {
+        wh_request_retry(cb, h->req);
+        h->req = NULL;
+        continue;
+      }
+
+      wh_handle_prepare(h, h->req->body, h->req->body_size);
+      curl_multi_add_handle(multi, h->curl);
+      h->busy = true;
+      in_flight++;
+    }
+
+    if (in_flight == 0)
+      continue;
+
+    int running = 0;
+    curl_multi_perform(multi, &running);
+
+    CURLMsg *msg;
+    int msgs_left = 0;
+    while ((msg = curl_multi_info_read(multi, &msgs_left)) != NULL) {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+
+      CURLcode result = msg->data.result;
+      wh_handle_t *h = NULL;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&h);
+      curl_multi_remove_handle(multi, h->curl);
+      h->busy = false;
+      in_flight--;
+
+      wh_request_t *req = h->req;
+      h->req = NULL;
+
+      long http_code = 0;
+      wh_handle_done(cb, h, "curl_multi_perform", result, &http_code);
+      if (wh_should_retry(result, http_code))
+        wh_request_retry(cb, req);
+      else
+        wh_request_free(req);
+    }
+
+    if (running > 0)
+      curl_multi_wait(multi, NULL, 0, /* timeout_ms = */ 100, NULL);
+  }
+
+  size_t lost = 0;
+  for (int i = 0; i < cb->max_in_flight; i++) {
+    wh_handle_t *h = handles + i;
+    if (h->busy)
+      curl_multi_remove_handle(multi, h->curl);
+    if (h->req != NULL) {
+      wh_request_free(h->req);
+      lost++;
+    }
+    if (h->curl != NULL)
+      curl_easy_cleanup(h->curl);
+  }
+  curl_multi_cleanup(multi);
+  free(handles);
+
+  if (lost > 0)
+    ERROR("write_http plugin: %" PRIsz " request(s) to \"%s\" were still in "
+          "flight on shutdown.",
+          lost, cb->location);
+
+  return NULL;
+} /* void *wh_sender_thread */
+
+static int wh_async_init(wh_callback_t *cb) {
+  int status = plugin_thread_create(&cb->sender_thread, wh_sender_thread, cb,
+                                    "writehttp");
+  if (status != 0) {
+    ERROR("write_http plugin: Creating the sender thread failed: %s",
+          STRERROR(status));
+    return status;
+  }
+  cb->sender_running = true;
+
+  return 0;
+} /* int wh_async_init */
 
 static void wh_callback_free(void *data) {
   if (data == NULL)
@@ -304,9 +717,32 @@ static void wh_callback_free(void *data) {
 
   wh_flush(/* timeout = */ 0, NULL, &(user_data_t){.data = cb});
 
-  if (cb->curl != NULL) {
-    curl_easy_cleanup(cb->curl);
-    cb->curl = NULL;
+  if (cb->sender_running) {
+    pthread_mutex_lock(&cb->queue_lock);
+    cb->sender_shutdown = true;
+    pthread_cond_broadcast(&cb->queue_cond);
+    pthread_mutex_unlock(&cb->queue_lock);
+
+    pthread_join(cb->sender_thread, NULL);
+    cb->sender_running = false;
+  }
+
+  size_t lost = 0;
+  while (cb->queue_head != NULL) {
+    wh_request_t *req = cb->queue_head;
+    cb->queue_head = req->next;
+    wh_request_free(req);
+    lost++;
+  }
+  cb->queue_tail = NULL;
+  if (lost > 0)
+    ERROR("write_http plugin: Dropping %" PRIsz " queued request(s) to \"%s\" "
+          "on shutdown.",
+          lost, cb->location);
+
+  if (cb->handle.curl != NULL) {
+    curl_easy_cleanup(cb->handle.curl);
+    cb->handle.curl = NULL;
   }
 
   curl_stats_destroy(cb->curl_stats);
@@ -331,6 +767,11 @@ static void wh_callback_free(void *data) {
   sfree(cb->clientkeypass);
   sfree(cb->metrics_prefix);
 
+  pthread_mutex_destroy(&cb->curl_lock);
+  pthread_mutex_destroy(&cb->send_buffer_lock);
+  pthread_mutex_destroy(&cb->queue_lock);
+  pthread_cond_destroy(&cb->queue_cond);
+
   sfree(cb);
 } /* void wh_callback_free */
 
@@ -414,7 +855,19 @@ static int wh_write(metric_family_t const *fam, user_data_t *user_data) {
     status = wh_write_command(fam, cb);
     break;
   }
-  return status;
+
+  pthread_mutex_lock(&cb->send_buffer_lock);
+  if (cb->send_buffer.pos < cb->send_buffer_size) {
+    pthread_mutex_unlock(&cb->send_buffer_lock);
+    return status;
+  }
+
+  size_t data_size = 0;
+  char *data = wh_send_buffer_take(cb, &data_size);
+  pthread_mutex_unlock(&cb->send_buffer_lock);
+
+  int send_status = wh_send(cb, data, data_size);
+  return (status != 0) ? status : send_status;
 } /* int wh_write */
 
 static int wh_notify(notification_t const *n, user_data_t *ud) {
@@ -434,17 +887,13 @@ static int wh_notify(notification_t const *n, user_data_t *ud) {
     return status;
   }
 
-  pthread_mutex_lock(&cb->send_buffer_lock);
-  if (wh_callback_init(cb) != 0) {
-    ERROR("write_http plugin: wh_callback_init failed.");
-    pthread_mutex_unlock(&cb->send_buffer_lock);
-    return -1;
+  char *body = strdup(alert);
+  if (body == NULL) {
+    ERROR("write_http plugin: strdup failed.");
+    return ENOMEM;
   }
 
-  status = wh_post(cb, alert);
-  pthread_mutex_unlock(&cb->send_buffer_lock);
-
-  return status;
+  return wh_send(cb, body, strlen(body));
 } /* int wh_notify */
 
 static int config_set_format(wh_callback_t *cb, oconfig_item_t *ci) {
@@ -472,6 +921,35 @@ static int config_set_format(wh_callback_t *cb, oconfig_item_t *ci) {
   return 0;
 } /* int config_set_format */
 
+static int config_set_compression(wh_callback_t *cb, oconfig_item_t *ci) {
+  char *string;
+
+  if ((ci->values_num != 1) || (ci->values[0].type != OCONFIG_TYPE_STRING)) {
+    WARNING("write_http plugin: The `%s' config option "
+            "needs exactly one string argument.",
+            ci->key);
+    return -1;
+  }
+
+  string = ci->values[0].value.string;
+  if (strcasecmp("None", string) == 0)
+    cb->compress = false;
+  else if (strcasecmp("Gzip", string) == 0) {
+#ifdef HAVE_ZLIB
+    cb->compress = true;
+#else
+    ERROR("write_http plugin: Gzip compression is not supported because "
+          "collectd was built without zlib.");
+    return -1;
+#endif
+  } else {
+    ERROR("write_http plugin: Invalid compression: %s", string);
+    return -1;
+  }
+
+  return 0;
+} /* int config_set_compression */
+
 static int wh_config_append_string(const char *name, struct curl_slist **dest,
                                    oconfig_item_t *ci) {
   struct curl_slist *temp = NULL;
@@ -491,7 +969,8 @@ static int wh_config_append_string(const char *name, struct curl_slist **dest,
 
 static int wh_config_node(oconfig_item_t *ci) {
   wh_callback_t *cb;
-  int buffer_size = 0;
+  int buffer_size = WH_DEFAULT_BUFFER_SIZE;
+  int queue_size = WH_DEFAULT_QUEUE_SIZE;
   char callback_name[DATA_MAX_NAME_LEN];
   int status = 0;
 
@@ -513,6 +992,9 @@ static int wh_config_node(oconfig_item_t *ci) {
   cb->data_ttl = 0;
   cb->metrics_prefix = strdup(WRITE_HTTP_DEFAULT_PREFIX);
   cb->curl_stats = NULL;
+  cb->max_in_flight = WH_DEFAULT_MAX_IN_FLIGHT;
+  cb->max_retries = WH_DEFAULT_MAX_RETRIES;
+  cb->retry_interval = WH_DEFAULT_RETRY_INTERVAL;
 
   if (cb->metrics_prefix == NULL) {
     ERROR("write_http plugin: strdup failed.");
@@ -522,6 +1004,8 @@ static int wh_config_node(oconfig_item_t *ci) {
 
   pthread_mutex_init(&cb->curl_lock, /* attr = */ NULL);
   pthread_mutex_init(&cb->send_buffer_lock, /* attr = */ NULL);
+  pthread_mutex_init(&cb->queue_lock, /* attr = */ NULL);
+  pthread_cond_init(&cb->queue_cond, /* attr = */ NULL);
 
   cf_util_get_string(ci, &cb->name);
 
@@ -610,6 +1094,18 @@ static int wh_config_node(oconfig_item_t *ci) {
       status = cf_util_get_int(child, &cb->data_ttl);
     else if (strcasecmp("Prefix", child->key) == 0)
       status = cf_util_get_string(child, &cb->metrics_prefix);
+    else if (strcasecmp("Compression", child->key) == 0)
+      status = config_set_compression(cb, child);
+    else if (strcasecmp("Asynchronous", child->key) == 0)
+      status = cf_util_get_boolean(child, &cb->async);
+    else if (strcasecmp("MaxInFlight", child->key) == 0)
+      status = cf_util_get_int(child, &cb->max_in_flight);
+    else if (strcasecmp("QueueSize", child->key) == 0)
+      status = cf_util_get_int(child, &queue_size);
+    else if (strcasecmp("MaxRetries", child->key) == 0)
+      status = cf_util_get_int(child, &cb->max_retries);
+    else if (strcasecmp("RetryInterval", child->key) == 0)
+      status = cf_util_get_cdtime(child, &cb->retry_interval);
     else {
       ERROR("write_http plugin: Invalid configuration "
             "option: %s.",
@@ -640,6 +1136,40 @@ static int wh_config_node(oconfig_item_t *ci) {
     return -1;
   }
 
+  if (buffer_size < 1024) {
+    ERROR("write_http plugin: BufferSize of \"%s\" must be at least 1024.",
+          cb->name);
+    wh_callback_free(cb);
+    return -1;
+  }
+  cb->send_buffer_size = (size_t)buffer_size;
+
+  if (cb->async) {
+    if ((cb->max_in_flight < 1) || (queue_size < 1) ||
+        (cb->max_retries < 0)) {
+      ERROR("write_http plugin: MaxInFlight and QueueSize of \"%s\" must be "
+            "positive and MaxRetries must not be negative.",
+            cb->name);
+      wh_callback_free(cb);
+      return -1;
+    }
+    cb->queue_size = (size_t)queue_size;
+
+    wh_callback_t **tmp = realloc(
+        async_callbacks, (async_callbacks_num + 1) * sizeof(*async_callbacks));
+    if (tmp == NULL) {
+      ERROR("write_http plugin: realloc failed.");
+      wh_callback_free(cb);
+      return -1;
+    }
+    async_callbacks = tmp;
+  }
+
+  if (wh_headers_init(cb) != 0) {
+    wh_callback_free(cb);
+    return -1;
+  }
+
   if (strlen(cb->metrics_prefix) == 0)
     sfree(cb->metrics_prefix);
 
@@ -674,6 +1204,11 @@ static int wh_config_node(oconfig_item_t *ci) {
     user_data.free_func = NULL;
   }
 
+  if (cb->async) {
+    async_callbacks[async_callbacks_num] = cb;
+    async_callbacks_num++;
+  }
+
   return 0;
 } /* int wh_config_node */
 
@@ -695,7 +1230,18 @@ static int wh_init(void) {
   /* Call this while collectd is still single-threaded to avoid
    * initialization issues in libgcrypt. */
   curl_global_init(CURL_GLOBAL_SSL);
-  return 0;
+
+  int ret = 0;
+  for (size_t i = 0; i < async_callbacks_num; i++) {
+    int status = wh_async_init(async_callbacks[i]);
+    if (status != 0)
+      ret = status;
+  }
+
+  sfree(async_callbacks);
+  async_callbacks_num = 0;
+
+  return ret;
 } /* int wh_init */
 
 void module_register(void) {
@@ -27,10 +27,11 @@
 #include "collectd.h"
 
 #include "plugin.h"
-#include "utils/cmds/putval.h"
+#include "utils/cmds/putmetric.h"
 #include "utils/common/common.h"
 #include "utils/format_graphite/format_graphite.h"
 #include "utils/format_json/format_json.h"
+#include "utils/strbuf/strbuf.h"
 #include "utils_random.h"
 
 #include <errno.h>
@@ -53,11 +54,20 @@ struct kafka_topic_context {
   char *postfix;
   char escape_char;
   char *topic_name;
+
+  /* Messages are accumulated in "batch" until it reaches "batch_max_size"
+   * bytes or its oldest entry is older than "batch_linger". A batch_max_size
+   * of zero disables batching. */
+  size_t batch_max_size;
+  cdtime_t batch_linger;
+  strbuf_t batch;
+  cdtime_t batch_time;
+
   pthread_mutex_t lock;
 };
 
 static int kafka_handle(struct kafka_topic_context *);
-static int kafka_write(metric_single_t const *, user_data_t *);
+static int kafka_write(metric_family_t const *, user_data_t *);
 static int32_t kafka_partition(const rd_kafka_topic_t *, const void *, size_t,
                                int32_t, void *, void *);
 
@@ -170,71 +180,221 @@ static int kafka_handle(struct kafka_topic_context *ctx) /* {{{ */
 
 } /* }}} int kafka_handle */
 
-static int kafka_write(/* {{{ */
-                       metric_single_t const *m, user_data_t *ud) {
-  int status = 0;
-  void *key;
-  size_t keylen = 0;
-  char buffer[8192];
-  size_t bfree = sizeof(buffer);
-  size_t bfill = 0;
-  size_t blen = 0;
-  struct kafka_topic_context *ctx = ud->data;
+/* kafka_produce hands the payload in "buf" over to librdkafka, which frees it
+ * once the message has been delivered. "buf" is reset to an empty buffer. */
+static int kafka_produce(struct kafka_topic_context *ctx, strbuf_t *buf) {
+  if (buf->pos == 0) {
+    free(buf->ptr);
+    *buf = STRBUF_CREATE;
+    return 0;
+  }
 
-  if ((m == NULL) || (metric_p->ds == NULL) || (m->identity == NULL) ||
-      (ctx == NULL))
-    return EINVAL;
+  char *key =
+      (ctx->key != NULL) ? ctx->key : kafka_random_key(KAFKA_RANDOM_KEY_BUFFER);
 
-  pthread_mutex_lock(&ctx->lock);
-  status = kafka_handle(ctx);
-  pthread_mutex_unlock(&ctx->lock);
-  if (status != 0)
-    return status;
+  int status = rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA,
+                                RD_KAFKA_MSG_F_FREE, buf->ptr, buf->pos, key,
+                                strlen(key), NULL);
+  if (status != 0) {
+    ERROR("write_kafka plugin: rd_kafka_produce failed: %s",
+          rd_kafka_err2str(kafka_error()));
+    /* On failure the payload has not been taken over. */
+    free(buf->ptr);
+    *buf = STRBUF_CREATE;
+    return -1;
+  }
+
+  *buf = STRBUF_CREATE;
+  return 0;
+}
 
-  bzero(buffer, sizeof(buffer));
+/* kafka_format appends "fam" to "buf", using the topic's format. */
+static int kafka_format(struct kafka_topic_context *ctx, strbuf_t *buf,
+                        metric_family_t const *fam) {
+  int status = 0;
 
   switch (ctx->format) {
   case KAFKA_FORMAT_COMMAND:
-    status = cmd_create_putval(buffer, sizeof(buffer), m);
-    if (status != 0) {
-      ERROR("write_kafka plugin: cmd_create_putval failed with status %i.",
+    for (size_t i = 0; (status == 0) && (i < fam->metric.num); i++)
+      status = cmd_format_putmetric(buf, fam->metric.ptr + i);
+    if (status != 0)
+      ERROR("write_kafka plugin: cmd_format_putmetric failed with status %i.",
             status);
-      return status;
-    }
-    blen = strlen(buffer);
-    break;
+    return status;
   case KAFKA_FORMAT_JSON:
-    format_json_initialize(buffer, &bfill, &bfree);
-    format_json_metric(buffer, &bfill, &bfree, m, ctx->store_rates);
-    format_json_finalize(buffer, &bfill, &bfree);
-    blen = strlen(buffer);
-    break;
+    status = format_json_metric_family(buf, fam, ctx->store_rates);
+    if (status != 0)
+      ERROR("write_kafka plugin: format_json_metric_family failed with status "
+            "%i.",
+            status);
+    return status;
   case KAFKA_FORMAT_GRAPHITE:
-    status =
-        format_graphite(buffer, sizeof(buffer), m, ctx->prefix, ctx->postfix,
-                        ctx->escape_char, ctx->graphite_flags);
-    if (status != 0) {
+    for (size_t i = 0; (status == 0) && (i < fam->metric.num); i++)
+      status = format_graphite(buf, fam->metric.ptr + i, ctx->prefix,
+                               ctx->postfix, ctx->escape_char,
+                               ctx->graphite_flags);
+    if (status != 0)
       ERROR("write_kafka plugin: format_graphite failed with status %i.",
             status);
+    return status;
+  }
+
+  ERROR("write_kafka plugin: invalid format %i.", ctx->format);
+  return -1;
+}
+
+/* kafka_write_unbatched sends one message per metric, or one per metric family
+ * for the JSON format. */
+static int kafka_write_unbatched(struct kafka_topic_context *ctx,
+                                 metric_family_t const *fam) {
+  if (ctx->format == KAFKA_FORMAT_JSON) {
+    strbuf_t buf = STRBUF_CREATE;
+    int status = kafka_format(ctx, &buf, fam);
+    if (status != 0) {
+      STRBUF_DESTROY(buf);
       return status;
     }
-    blen = strlen(buffer);
-    break;
-  default:
-    ERROR("write_kafka plugin: invalid format %i.", ctx->format);
-    return -1;
+    return kafka_produce(ctx, &buf);
   }
 
-  key =
-      (ctx->key != NULL) ? ctx->key : kafka_random_key(KAFKA_RANDOM_KEY_BUFFER);
-  keylen = strlen(key);
+  int ret = 0;
+  for (size_t i = 0; i < fam->metric.num; i++) {
+    metric_family_t single = *fam;
+    single.metric = (metric_list_t){
+        .ptr = fam->metric.ptr + i,
+        .num = 1,
+    };
+
+    strbuf_t buf = STRBUF_CREATE;
+    int status = kafka_format(ctx, &buf, &single);
+    if (status == 0)
+      status = kafka_produce(ctx, &buf);
+    else
+      STRBUF_DESTROY(buf);
+
+    if (ret == 0)
+      ret = status;
+  }
+  return ret;
+}
 
-  rd_kafka_produce(ctx->topic, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_COPY,
-                   buffer, blen, key, keylen, NULL);
+/* kafka_batch_take moves the pending batch out of the context. The caller
+ * must hold ctx->lock. */
+static strbuf_t kafka_batch_take(struct kafka_topic_context *ctx) {
+  strbuf_t batch = ctx->batch;
+  ctx->batch = STRBUF_CREATE;
+  ctx->batch_time = 0;
+  return batch;
+}
 
-  return status;
+/* kafka_batch_append appends the rendered family in "msg" to the pending
+ * batch. JSON arrays are merged so that a batch is a single valid document.
+ * The caller must hold ctx->lock. */
+static int kafka_batch_append(struct kafka_topic_context *ctx,
+                              strbuf_t const *msg) {
+  if (ctx->batch.pos == 0) {
+    ctx->batch_time = cdtime();
+    return strbuf_printn(&ctx->batch, msg->ptr, msg->pos);
+  }
+
+  if (ctx->format == KAFKA_FORMAT_JSON) {
+    /* "[a]" + "[b]" -> "[a,b]" */
+    ctx->batch.ptr[ctx->batch.pos - 1] = ',';
+    return strbuf_printn(&ctx->batch, msg->ptr + 1, msg->pos - 1);
+  }
+
+  return strbuf_printn(&ctx->batch, msg->ptr, msg->pos);
+}
+
+static int kafka_write_batched(struct kafka_topic_context *ctx,
+                               metric_family_t const *fam) {
+  strbuf_t msg = STRBUF_CREATE;
+  int status = kafka_format(ctx, &msg, fam);
+  if (status != 0) {
+    STRBUF_DESTROY(msg);
+    return status;
+  }
+
+  strbuf_t full = STRBUF_CREATE;
+  strbuf_t ready = STRBUF_CREATE;
+
+  pthread_mutex_lock(&ctx->lock);
+  /* Send the pending batch first if this message would push it over the
+   * limit. A single message larger than the limit becomes its own batch. */
+  if ((ctx->batch.pos > 0) &&
+      ((ctx->batch.pos + msg.pos) > ctx->batch_max_size))
+    full = kafka_batch_take(ctx);
+
+  status = kafka_batch_append(ctx, &msg);
+
+  if ((ctx->batch.pos >= ctx->batch_max_size) ||
+      ((ctx->batch_linger > 0) &&
+       ((cdtime() - ctx->batch_time) >= ctx->batch_linger)))
+    ready = kafka_batch_take(ctx);
+  pthread_mutex_unlock(&ctx->lock);
+
+  STRBUF_DESTROY(msg);
+
+  int ret = kafka_produce(ctx, &full);
+  int ready_status = kafka_produce(ctx, &ready);
+  if (ret == 0)
+    ret = ready_status;
+  if (status != 0) {
+    ERROR("write_kafka plugin: appending to the batch failed with status %i.",
+          status);
+    return status;
+  }
+  return ret;
+}
+
+static int kafka_write(/* {{{ */
+                       metric_family_t const *fam, user_data_t *ud) {
+  struct kafka_topic_context *ctx = ud->data;
+
+  if ((fam == NULL) || (ctx == NULL))
+    return EINVAL;
+
+  if (fam->metric.num == 0)
+    return 0;
+
+  pthread_mutex_lock(&ctx->lock);
+  int status = kafka_handle(ctx);
+  pthread_mutex_unlock(&ctx->lock);
+  if (status != 0)
+    return status;
+
+  if (ctx->batch_max_size == 0)
+    return kafka_write_unbatched(ctx, fam);
+  return kafka_write_batched(ctx, fam);
 } /* }}} int kafka_write */
 
+static int kafka_flush(cdtime_t timeout, /* {{{ */
+                       __attribute__((unused)) const char *identifier,
+                       user_data_t *ud) {
+  struct kafka_topic_context *ctx = ud->data;
+
+  if (ctx == NULL)
+    return EINVAL;
+
+  strbuf_t batch = STRBUF_CREATE;
+
+  pthread_mutex_lock(&ctx->lock);
+  if ((ctx->batch.pos > 0) && (ctx->topic != NULL)) {
+    if ((timeout == 0) || ((cdtime() - ctx->batch_time) >= timeout))
+      batch = kafka_batch_take(ctx);
+  }
+  pthread_mutex_unlock(&ctx->lock);
+
+  int status = kafka_produce(ctx, &batch);
+
+#if RD_KAFKA_VERSION >= 0x000902ff
+  if ((status == 0) && (timeout == 0) && (ctx->kafka != NULL))
+    rd_kafka_flush(ctx->kafka, /* timeout_ms = */ 1000);
+#endif
+
+  return status;
+} /* }}} int kafka_flush */
+
 static void kafka_topic_context_free(void *p) /* {{{ */
 {
   struct kafka_topic_context *ctx = p;
@@ -242,6 +402,17 @@ static void kafka_topic_context_free(void *p) /* {{{ */
   if (ctx == NULL)
     return;
 
+  if ((ctx->batch.pos > 0) && (ctx->topic != NULL))
+    kafka_produce(ctx, &ctx->batch);
+  STRBUF_DESTROY(ctx->batch);
+
+  if (ctx->kafka != NULL) {
+#if RD_KAFKA_VERSION >= 0x000902ff
+    /* Give outstanding messages a chance to be delivered. */
+    rd_kafka_flush(ctx->kafka, /* timeout_ms = */ 5000);
+#endif
+  }
+
   if (ctx->topic_name != NULL)
     sfree(ctx->topic_name);
   if (ctx->topic != NULL)
@@ -367,6 +538,20 @@ static void kafka_config_topic(rd_kafka_conf_t *conf,
 
       sfree(key);
 
+    } else if (strcasecmp("BatchMaxSize", child->key) == 0) {
+      int tmp = 0;
+      status = cf_util_get_int(child, &tmp);
+      if ((status == 0) && (tmp < 0)) {
+        WARNING("write_kafka plugin: The \"BatchMaxSize\" option must not be "
+                "negative.");
+        status = EINVAL;
+      }
+      if (status == 0)
+        tctx->batch_max_size = (size_t)tmp;
+
+    } else if (strcasecmp("BatchLinger", child->key) == 0) {
+      status = cf_util_get_cdtime(child, &tctx->batch_linger);
+
     } else if (strcasecmp("StoreRates", child->key) == 0) {
       status = cf_util_get_boolean(child, &tctx->store_rates);
       (void)cf_util_get_flag(child, &tctx->graphite_flags,
@@ -428,6 +613,10 @@ static void kafka_config_topic(rd_kafka_conf_t *conf,
 
   pthread_mutex_init(&tctx->lock, /* attr = */ NULL);
 
+  if (tctx->batch_max_size > 0)
+    plugin_register_flush(callback_name, kafka_flush,
+                          &(user_data_t){.data = tctx});
+
   return;
 errout:
   if (tctx->topic_name != NULL)